@@ -0,0 +1,244 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2005 OpenVPN Solutions LLC <info@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef WIN32
+#include "config-win32.h"
+#else
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#if P2MP_SERVER
+
+#include "multi.h"
+#include "arp.h"
+
+#include "memdbg.h"
+
+struct arp_proxy *
+arp_proxy_init (void)
+{
+  struct arp_proxy *ap;
+  ALLOC_OBJ_CLEAR (ap, struct arp_proxy);
+  ap->hash = hash_init (256,
+			mroute_addr_hash_function,
+			mroute_addr_compare_function);
+  ap->next_expire = now + ARP_PROXY_EXPIRE_INTERVAL;
+  return ap;
+}
+
+void
+arp_proxy_free (struct arp_proxy *ap)
+{
+  if (ap)
+    {
+      struct hash_iterator hi;
+      struct hash_element *he;
+
+      hash_iterator_init (ap->hash, &hi, true);
+      while ((he = hash_iterator_next (&hi)))
+	{
+	  struct arp_binding *b = (struct arp_binding *) he->value;
+	  hash_iterator_delete_element (&hi);
+	  free (b);
+	}
+      hash_iterator_free (&hi);
+      hash_free (ap->hash);
+      free (ap);
+    }
+}
+
+static void
+arp_addr (struct mroute_addr *a, const uint8_t *ip)
+{
+  mroute_addr_init (a);
+  a->type = MR_ADDR_IPV4;
+  a->len = 4;
+  memcpy (a->addr, ip, 4);
+}
+
+/*
+ * Return the ARP part of an IPv4 over ethernet
+ * ARP frame, or NULL if buf is something else.
+ */
+static const struct openvpn_arp *
+arp_header (const struct buffer *buf)
+{
+  const struct openvpn_ethhdr *eth = (const struct openvpn_ethhdr *) BPTR (buf);
+  const struct openvpn_arp *arp;
+
+  if (BLEN (buf) < (int) ARP_FRAME_SIZE || eth->proto != htons (OPENVPN_ETH_P_ARP))
+    return NULL;
+  arp = (const struct openvpn_arp *) (BPTR (buf) + sizeof (struct openvpn_ethhdr));
+  if (arp->htype != htons (OPENVPN_ARP_HTYPE_ETHER)
+      || arp->ptype != htons (OPENVPN_ETH_P_IPV4)
+      || arp->hlen != OPENVPN_ETH_ALEN
+      || arp->plen != 4)
+    return NULL;
+  return arp;
+}
+
+/*
+ * Only unicast addresses may be bound.
+ */
+static bool
+arp_addr_learnable (const uint8_t *ip)
+{
+  return ip[0] != 0 && ip[0] < 224;
+}
+
+void
+arp_proxy_learn (struct arp_proxy *ap, struct multi_instance *mi, const struct buffer *buf)
+{
+  const struct openvpn_ethhdr *eth = (const struct openvpn_ethhdr *) BPTR (buf);
+  const struct openvpn_arp *arp = arp_header (buf);
+
+  if (arp
+      && (arp->op == htons (OPENVPN_ARP_REQUEST) || arp->op == htons (OPENVPN_ARP_REPLY))
+      && !memcmp (arp->sha, eth->source, OPENVPN_ETH_ALEN)
+      && arp_addr_learnable (arp->spa))
+    {
+      struct mroute_addr key;
+      struct arp_binding *b;
+
+      arp_addr (&key, arp->spa);
+      b = (struct arp_binding *) hash_lookup (ap->hash, &key);
+      if (!b)
+	{
+	  ALLOC_OBJ_CLEAR (b, struct arp_binding);
+	  b->addr = key;
+	  hash_add (ap->hash, &b->addr, b, false);
+	}
+      else if (b->mi != mi || memcmp (b->mac, arp->sha, OPENVPN_ETH_ALEN))
+	{
+	  struct gc_arena gc = gc_new ();
+	  msg (D_MULTI_LOW, "ARP: %s moved to %s",
+	       mroute_addr_print (&key, &gc),
+	       multi_instance_string (mi, false, &gc));
+	  gc_free (&gc);
+	}
+      memcpy (b->mac, arp->sha, OPENVPN_ETH_ALEN);
+      b->mi = mi;
+      b->last_seen = now;
+    }
+}
+
+const struct arp_binding *
+arp_proxy_lookup (struct arp_proxy *ap, const struct buffer *buf)
+{
+  const struct openvpn_ethhdr *eth = (const struct openvpn_ethhdr *) BPTR (buf);
+  const struct openvpn_arp *arp = arp_header (buf);
+
+  if (arp
+      && arp->op == htons (OPENVPN_ARP_REQUEST)
+      && (eth->dest[0] & 1)
+      /* leave address probes and gratuitous ARP alone */
+      && arp_addr_learnable (arp->spa)
+      && memcmp (arp->spa, arp->tpa, 4))
+    {
+      struct mroute_addr key;
+      const struct arp_binding *b;
+
+      arp_addr (&key, arp->tpa);
+      b = (const struct arp_binding *) hash_lookup (ap->hash, &key);
+      if (b && now - b->last_seen <= ARP_PROXY_TIMEOUT)
+	return b;
+      ++ap->flooded;
+    }
+  return NULL;
+}
+
+void
+arp_proxy_build_reply (const struct buffer *request,
+		       const struct arp_binding *b,
+		       struct buffer *reply)
+{
+  const struct openvpn_arp *req = (const struct openvpn_arp *)
+    (BPTR (request) + sizeof (struct openvpn_ethhdr));
+  struct openvpn_ethhdr *eth;
+  struct openvpn_arp *arp;
+
+  eth = (struct openvpn_ethhdr *) buf_write_alloc (reply, sizeof (struct openvpn_ethhdr));
+  arp = (struct openvpn_arp *) buf_write_alloc (reply, sizeof (struct openvpn_arp));
+  ASSERT (eth && arp);
+
+  memcpy (eth->dest, req->sha, OPENVPN_ETH_ALEN);
+  memcpy (eth->source, b->mac, OPENVPN_ETH_ALEN);
+  eth->proto = htons (OPENVPN_ETH_P_ARP);
+
+  arp->htype = htons (OPENVPN_ARP_HTYPE_ETHER);
+  arp->ptype = htons (OPENVPN_ETH_P_IPV4);
+  arp->hlen = OPENVPN_ETH_ALEN;
+  arp->plen = 4;
+  arp->op = htons (OPENVPN_ARP_REPLY);
+  memcpy (arp->sha, b->mac, OPENVPN_ETH_ALEN);
+  memcpy (arp->spa, req->tpa, 4);
+  memcpy (arp->tha, req->sha, OPENVPN_ETH_ALEN);
+  memcpy (arp->tpa, req->spa, 4);
+}
+
+void
+arp_proxy_forget (struct arp_proxy *ap, const struct multi_instance *mi)
+{
+  struct hash_iterator hi;
+  struct hash_element *he;
+
+  hash_iterator_init (ap->hash, &hi, true);
+  while ((he = hash_iterator_next (&hi)))
+    {
+      struct arp_binding *b = (struct arp_binding *) he->value;
+      if (b->mi == mi)
+	{
+	  hash_iterator_delete_element (&hi);
+	  free (b);
+	}
+    }
+  hash_iterator_free (&hi);
+}
+
+void
+arp_proxy_expire_dowork (struct arp_proxy *ap)
+{
+  struct hash_iterator hi;
+  struct hash_element *he;
+
+  ap->next_expire = now + ARP_PROXY_EXPIRE_INTERVAL;
+
+  hash_iterator_init (ap->hash, &hi, true);
+  while ((he = hash_iterator_next (&hi)))
+    {
+      struct arp_binding *b = (struct arp_binding *) he->value;
+      if (now - b->last_seen > ARP_PROXY_TIMEOUT)
+	{
+	  hash_iterator_delete_element (&hi);
+	  free (b);
+	}
+    }
+  hash_iterator_free (&hi);
+}
+
+#else
+static void dummy(void) {}
+#endif
@@ -0,0 +1,116 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2005 OpenVPN Solutions LLC <info@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef ARP_H
+#define ARP_H
+
+/*
+ * ARP proxy for tap server mode (--proxy-arp).
+ *
+ * IPv4 -> MAC bindings are learned from the ARP requests
+ * and replies which clients send.  A broadcast ARP request,
+ * from a client or from the tap interface, for an address
+ * bound to a connected client is then answered on that
+ * client's behalf instead of being flooded to every client.
+ */
+
+#if P2MP_SERVER
+
+#include "basic.h"
+#include "common.h"
+#include "buffer.h"
+#include "otime.h"
+#include "list.h"
+#include "mroute.h"
+#include "proto.h"
+
+/* don't answer from a binding which hasn't been refreshed for this long */
+#define ARP_PROXY_TIMEOUT 300
+
+/* how often to purge stale bindings */
+#define ARP_PROXY_EXPIRE_INTERVAL 60
+
+/* size of an ethernet ARP frame */
+#define ARP_FRAME_SIZE (sizeof (struct openvpn_ethhdr) + sizeof (struct openvpn_arp))
+
+struct multi_instance;
+
+struct arp_binding
+{
+  struct mroute_addr addr;    /* hash key, IPv4 address */
+  uint8_t mac[OPENVPN_ETH_ALEN];
+  struct multi_instance *mi;
+  time_t last_seen;
+};
+
+struct arp_proxy
+{
+  struct hash *hash;
+  time_t next_expire;
+
+  /* statistics */
+  counter_type answered;      /* requests answered, i.e. broadcasts suppressed */
+  counter_type flooded;       /* requests for unknown addresses */
+};
+
+struct arp_proxy *arp_proxy_init (void);
+void arp_proxy_free (struct arp_proxy *ap);
+
+/*
+ * Learn the sender binding of an ARP packet sent by mi.
+ * The caller has already verified that the packet's
+ * source MAC belongs to mi.
+ */
+void arp_proxy_learn (struct arp_proxy *ap, struct multi_instance *mi, const struct buffer *buf);
+
+/*
+ * If buf is a broadcast ARP request which may be answered
+ * by proxy, return the binding for the requested address.
+ */
+const struct arp_binding *arp_proxy_lookup (struct arp_proxy *ap, const struct buffer *buf);
+
+/*
+ * Write into reply an ARP reply to request, answered with
+ * the address in b.
+ */
+void arp_proxy_build_reply (const struct buffer *request,
+			    const struct arp_binding *b,
+			    struct buffer *reply);
+
+/*
+ * Remove all bindings of mi, called when instance is closed.
+ */
+void arp_proxy_forget (struct arp_proxy *ap, const struct multi_instance *mi);
+
+void arp_proxy_expire_dowork (struct arp_proxy *ap);
+
+static inline void
+arp_proxy_expire (struct arp_proxy *ap)
+{
+  if (now >= ap->next_expire)
+    arp_proxy_expire_dowork (ap);
+}
+
+#endif
+#endif
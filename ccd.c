@@ -0,0 +1,421 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2005 OpenVPN Solutions LLC <info@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef WIN32
+#include "config-win32.h"
+#else
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#if P2MP_SERVER
+
+#include "ccd.h"
+#include "misc.h"
+#include "otime.h"
+#include "fdmisc.h"
+
+#include "memdbg.h"
+
+/* ccd files are small, but put a bound on what we will cache */
+#define CCD_MAX_LINES 1024
+
+static uint32_t
+ccd_hash_function (const void *key, uint32_t iv)
+{
+  const char *str = (const char *) key;
+  return hash_func ((const uint8_t *) str, strlen (str), iv);
+}
+
+static bool
+ccd_compare_function (const void *key1, const void *key2)
+{
+  return !strcmp ((const char *) key1, (const char *) key2);
+}
+
+/*
+ * LRU list
+ */
+
+static void
+ccd_lru_unlink (struct ccd_cache *cc, struct ccd_entry *e)
+{
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    cc->head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    cc->tail = e->prev;
+  e->prev = e->next = NULL;
+}
+
+static void
+ccd_lru_push (struct ccd_cache *cc, struct ccd_entry *e)
+{
+  e->prev = NULL;
+  e->next = cc->head;
+  if (cc->head)
+    cc->head->prev = e;
+  else
+    cc->tail = e;
+  cc->head = e;
+}
+
+static void
+ccd_entry_free (struct ccd_entry *e)
+{
+  gc_free (&e->gc);
+  free (e);
+}
+
+static void
+ccd_cache_remove (struct ccd_cache *cc, struct ccd_entry *e)
+{
+  hash_remove (cc->hash, e->name);
+  ccd_lru_unlink (cc, e);
+  ccd_entry_free (e);
+}
+
+/*
+ * Read and tokenize a ccd file.  A file which cannot be
+ * opened is cached as not existing.
+ */
+static struct ccd_entry *
+ccd_entry_load (const char *name, const char *path, const int msglevel)
+{
+  struct ccd_entry *e;
+  struct stat st;
+  FILE *fp;
+
+  ALLOC_OBJ_CLEAR (e, struct ccd_entry);
+  e->gc = gc_new ();
+  e->name = string_alloc (name, &e->gc);
+  e->loaded = e->last_check = now;
+
+  if (stat (path, &st) == 0 && (fp = fopen (path, "r")) != NULL)
+    {
+      char line[OPTION_LINE_SIZE];
+      int n = 0;
+      int max;
+
+      e->exists = true;
+      e->mtime = st.st_mtime;
+      e->size = st.st_size;
+      e->ino = st.st_ino;
+
+      while (fgets (line, sizeof (line), fp) && n < CCD_MAX_LINES)
+	++n;
+      rewind (fp);
+
+      /* the file may have grown since it was counted */
+      max = n;
+      ALLOC_ARRAY_CLEAR_GC (e->lines, struct option_line, max, &e->gc);
+      n = 0;
+      while (n < max && fgets (line, sizeof (line), fp))
+	{
+	  struct option_line *ol = &e->lines[e->n_lines];
+	  ++n;
+	  if (parse_line (line, ol->p, SIZE (ol->p), path, n, msglevel, &e->gc))
+	    {
+	      if (strlen (ol->p[0]) >= 3 && !strncmp (ol->p[0], "--", 2))
+		ol->p[0] += 2;
+	      ol->line_num = n;
+	      ++e->n_lines;
+	    }
+	}
+      if (n >= CCD_MAX_LINES && fgets (line, sizeof (line), fp))
+	msg (M_WARN, "WARNING: only the first %d lines of %s were cached", CCD_MAX_LINES, path);
+      fclose (fp);
+    }
+
+  dmsg (D_TEST_FILE, "CCD CACHE LOAD '%s' exists=%d lines=%d", path, e->exists, e->n_lines);
+
+  return e;
+}
+
+/*
+ * Is a cached entry still current?
+ */
+static bool
+ccd_entry_current (struct ccd_cache *cc, struct ccd_entry *e, const char *path)
+{
+  struct stat st;
+  bool exists;
+
+  /* inotify tells us about changes, unless a refresh interval asks us to double check */
+  if (cc->inotify_fd >= 0 && !cc->refresh)
+    return true;
+  if (cc->refresh && now < e->last_check + cc->refresh)
+    return true;
+
+  e->last_check = now;
+  exists = (stat (path, &st) == 0);
+  if (exists != e->exists)
+    return false;
+  if (exists && (st.st_mtime != e->mtime || st.st_size != e->size || st.st_ino != e->ino))
+    return false;
+  return true;
+}
+
+/*
+ * Apply pending inotify events
+ */
+static void
+ccd_cache_notify (struct ccd_cache *cc)
+{
+#if INOTIFY
+  if (cc->inotify_fd >= 0)
+    {
+      char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+      ssize_t len;
+
+      while ((len = read (cc->inotify_fd, buf, sizeof (buf))) > 0)
+	{
+	  const char *p = buf;
+	  while (p < buf + len)
+	    {
+	      const struct inotify_event *ev = (const struct inotify_event *) p;
+	      if (ev->mask & (IN_Q_OVERFLOW|IN_IGNORED|IN_DELETE_SELF|IN_MOVE_SELF))
+		{
+		  /* lost track of what changed */
+		  cc->invalidations += ccd_cache_flush (cc, NULL);
+		  if (!(ev->mask & IN_Q_OVERFLOW))
+		    {
+		      msg (M_WARN, "WARNING: --client-config-dir %s was moved or deleted, --ccd-cache will check file modification times instead", cc->dir);
+		      close (cc->inotify_fd);
+		      cc->inotify_fd = -1;
+		      return;
+		    }
+		}
+	      else if (ev->len)
+		{
+		  struct ccd_entry *e = (struct ccd_entry *) hash_lookup (cc->hash, ev->name);
+		  if (e)
+		    {
+		      ccd_cache_remove (cc, e);
+		      ++cc->invalidations;
+		    }
+		}
+	      p += sizeof (struct inotify_event) + ev->len;
+	    }
+	}
+    }
+#endif
+}
+
+struct ccd_cache *
+ccd_cache_new (const char *dir, const int max_entries, const int refresh)
+{
+  struct ccd_cache *cc;
+
+  ALLOC_OBJ_CLEAR (cc, struct ccd_cache);
+  cc->dir = dir;
+  cc->max_entries = max_entries;
+  cc->refresh = refresh;
+  cc->hash = hash_init (max_entries, ccd_hash_function, ccd_compare_function);
+  cc->inotify_fd = -1;
+
+#if INOTIFY
+  cc->inotify_fd = inotify_init ();
+  if (cc->inotify_fd >= 0)
+    {
+      if (inotify_add_watch (cc->inotify_fd, dir,
+			     IN_CREATE|IN_DELETE|IN_CLOSE_WRITE|IN_MOVED_FROM|IN_MOVED_TO
+			     |IN_ATTRIB|IN_DELETE_SELF|IN_MOVE_SELF) >= 0)
+	{
+	  set_nonblock (cc->inotify_fd);
+	  set_cloexec (cc->inotify_fd);
+	}
+      else
+	{
+	  msg (M_WARN | M_ERRNO, "WARNING: cannot watch --client-config-dir %s for changes", dir);
+	  close (cc->inotify_fd);
+	  cc->inotify_fd = -1;
+	}
+    }
+#endif
+
+  msg (M_INFO, "CCD cache: max entries=%d refresh=%d notify=%s",
+       max_entries, refresh, cc->inotify_fd >= 0 ? "inotify" : "mtime");
+
+  return cc;
+}
+
+void
+ccd_cache_free (struct ccd_cache *cc)
+{
+  if (cc)
+    {
+      ccd_cache_flush (cc, NULL);
+      hash_free (cc->hash);
+#if INOTIFY
+      if (cc->inotify_fd >= 0)
+	close (cc->inotify_fd);
+#endif
+      free (cc);
+    }
+}
+
+/*
+ * Return the entry for a ccd file, loading it
+ * if it is absent or out of date.
+ */
+static struct ccd_entry *
+ccd_cache_get (struct ccd_cache *cc, const char *name, const int msglevel)
+{
+  struct gc_arena gc = gc_new ();
+  const char *path = gen_path (cc->dir, name, &gc);
+  struct ccd_entry *e = (struct ccd_entry *) hash_lookup (cc->hash, name);
+
+  if (e && !ccd_entry_current (cc, e, path))
+    {
+      ccd_cache_remove (cc, e);
+      ++cc->reloads;
+      e = NULL;
+    }
+
+  if (e)
+    {
+      ++cc->hits;
+      ++e->hits;
+      ccd_lru_unlink (cc, e);
+      ccd_lru_push (cc, e);
+    }
+  else
+    {
+      ++cc->misses;
+      e = ccd_entry_load (name, path, msglevel);
+      hash_add (cc->hash, e->name, e, false);
+      ccd_lru_push (cc, e);
+      while (hash_n_elements (cc->hash) > cc->max_entries && cc->tail != e)
+	{
+	  ccd_cache_remove (cc, cc->tail);
+	  ++cc->evictions;
+	}
+    }
+
+  gc_free (&gc);
+  return e;
+}
+
+void
+ccd_cache_import (struct ccd_cache *cc,
+		  struct options *o,
+		  const char *common_name,
+		  int msglevel,
+		  unsigned int permission_mask,
+		  unsigned int *option_types_found,
+		  struct env_set *es)
+{
+  struct gc_arena gc = gc_new ();
+  const char *name = gen_path (NULL, common_name, &gc); /* sanitized file name */
+  struct ccd_entry *e = NULL;
+
+  ccd_cache_notify (cc);
+
+  /* try common-name file */
+  if (name)
+    e = ccd_cache_get (cc, name, msglevel);
+
+  /* try default file */
+  if (!e || !e->exists)
+    e = ccd_cache_get (cc, CCD_DEFAULT, msglevel);
+
+  if (e->exists)
+    options_server_import_lines (o,
+				 gen_path (cc->dir, e->name, &gc),
+				 e->lines,
+				 e->n_lines,
+				 msglevel,
+				 permission_mask,
+				 option_types_found,
+				 es);
+  gc_free (&gc);
+}
+
+int
+ccd_cache_flush (struct ccd_cache *cc, const char *common_name)
+{
+  int n = 0;
+
+  if (common_name)
+    {
+      struct gc_arena gc = gc_new ();
+      const char *name = gen_path (NULL, common_name, &gc);
+      struct ccd_entry *e = name ? (struct ccd_entry *) hash_lookup (cc->hash, name) : NULL;
+      if (e)
+	{
+	  ccd_cache_remove (cc, e);
+	  ++n;
+	}
+      gc_free (&gc);
+    }
+  else
+    {
+      while (cc->head)
+	{
+	  ccd_cache_remove (cc, cc->head);
+	  ++n;
+	}
+    }
+  return n;
+}
+
+void
+ccd_cache_print (const struct ccd_cache *cc, const bool list, const int msglevel)
+{
+  if (list)
+    {
+      const struct ccd_entry *e;
+      for (e = cc->head; e; e = e->next)
+	msg (msglevel, "%s,%d,%d,%u,%d",
+	     e->name,
+	     e->exists,
+	     e->n_lines,
+	     e->hits,
+	     (int) (now - e->loaded));
+      msg (msglevel, "END");
+    }
+  else
+    {
+      msg (msglevel, "SUCCESS: entries=%d/%d hits=" counter_format " misses=" counter_format
+	   " reloads=" counter_format " invalidations=" counter_format " evictions=" counter_format
+	   " notify=%s",
+	   hash_n_elements (cc->hash),
+	   cc->max_entries,
+	   cc->hits,
+	   cc->misses,
+	   cc->reloads,
+	   cc->invalidations,
+	   cc->evictions,
+	   cc->inotify_fd >= 0 ? "inotify" : "mtime");
+    }
+}
+
+#else
+static void dummy(void) {}
+#endif /* P2MP_SERVER */
@@ -0,0 +1,118 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2005 OpenVPN Solutions LLC <info@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef CCD_H
+#define CCD_H
+
+/*
+ * In-memory cache of parsed --client-config-dir files,
+ * so that a reconnecting client does not cause its
+ * ccd file to be re-read from disk.
+ *
+ * Entries are keyed by file name within the ccd directory
+ * (the sanitized common name, or CCD_DEFAULT), and also
+ * remember files which do not exist.  An entry is
+ * re-validated against the file's mtime/size/inode when it
+ * is more than --ccd-cache t seconds old, and where inotify
+ * is available, changes to the directory invalidate entries
+ * immediately.
+ */
+
+#if P2MP_SERVER
+
+#include "basic.h"
+#include "common.h"
+#include "buffer.h"
+#include "list.h"
+#include "options.h"
+
+struct ccd_entry
+{
+  char *name;                 /* hash key, also file name in ccd dir */
+  bool exists;
+
+  /* for validation */
+  time_t mtime;
+  off_t size;
+  ino_t ino;
+  time_t loaded;
+  time_t last_check;
+
+  /* parsed lines, allocated from gc */
+  struct option_line *lines;
+  int n_lines;
+
+  unsigned int hits;
+  struct gc_arena gc;
+
+  /* LRU list, most recently used first */
+  struct ccd_entry *prev;
+  struct ccd_entry *next;
+};
+
+struct ccd_cache
+{
+  const char *dir;
+  int max_entries;
+  int refresh;
+
+  struct hash *hash;
+  struct ccd_entry *head;
+  struct ccd_entry *tail;
+
+  int inotify_fd;
+
+  /* statistics */
+  counter_type hits;
+  counter_type misses;
+  counter_type reloads;
+  counter_type invalidations;
+  counter_type evictions;
+};
+
+struct ccd_cache *ccd_cache_new (const char *dir, const int max_entries, const int refresh);
+void ccd_cache_free (struct ccd_cache *cc);
+
+/*
+ * Import the ccd file for common_name into o, or the
+ * CCD_DEFAULT file if there is none.
+ */
+void ccd_cache_import (struct ccd_cache *cc,
+		       struct options *o,
+		       const char *common_name,
+		       int msglevel,
+		       unsigned int permission_mask,
+		       unsigned int *option_types_found,
+		       struct env_set *es);
+
+/*
+ * Drop the entry for common_name, or all entries if
+ * common_name is NULL.  Returns number of entries dropped.
+ */
+int ccd_cache_flush (struct ccd_cache *cc, const char *common_name);
+
+void ccd_cache_print (const struct ccd_cache *cc, const bool list, const int msglevel);
+
+#endif
+#endif
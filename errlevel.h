@@ -99,6 +99,8 @@
 #define D_DHCP_OPT           LOGLEV(4, 53, 0)        /* show DHCP options binary string */
 #define D_OSBUF              LOGLEV(4, 54, 0)        /* show socket/tun/tap buffer sizes */
 #define D_MBUF               LOGLEV(4, 55, 0)        /* mbuf.[ch] routines */
+#define D_HASH               LOGLEV(4, 56, 0)        /* show hash table growth */
+#define D_MCAST              LOGLEV(4, 57, 0)        /* show IGMP snooping group joins/leaves */
 
 #define D_LOG_RW             LOGLEV(5, 0,  0)        /* Print 'R' or 'W' to stdout for read/write */
 
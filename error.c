@@ -173,15 +173,214 @@ msg_fp()
 
 int x_msg_line_num; /* GLOBAL */
 
+/*
+ * Deferred log output.
+ *
+ * If --log-buffer is used, messages destined for the
+ * log file or syslog are copied into a fixed-size ring
+ * and written out in batches by the event loop, so that
+ * a burst of messages costs one fflush rather than one
+ * per line.  If the ring fills before it can be drained,
+ * new messages are dropped and counted.  Fatal errors and
+ * usage messages are never deferred, and they flush the
+ * ring before being output, so ordering is preserved.
+ */
+
+struct msg_buffer_entry
+{
+  unsigned int flags;
+  struct timeval tv;
+  char text[ERR_BUF_SIZE];
+};
+
+static struct msg_buffer_entry *msg_buf;   /* GLOBAL */
+static int msg_buf_size;                   /* GLOBAL */
+static int msg_buf_head;                   /* GLOBAL */
+static unsigned int msg_buf_dropped;       /* GLOBAL */
+static unsigned int msg_buf_dropped_shown; /* GLOBAL */
+static time_t msg_buf_last_flush;          /* GLOBAL */
+int x_msg_buffer_len;                      /* GLOBAL */
+
+/*
+ * Write a fully formatted message to syslog or the
+ * message FILE.  Return the FILE written to, if any,
+ * so that the caller may flush it.
+ */
+static FILE *
+msg_output (const unsigned int flags,
+	    const struct timeval *tv,
+	    const char *text,
+	    struct gc_arena *gc)
+{
+  FILE *fp = NULL;
+
+  if (use_syslog && !std_redir)
+    {
+#if SYSLOG_CAPABILITY
+      int level;
+      if (flags & (M_FATAL|M_NONFATAL|M_USAGE_SMALL))
+	level = LOG_ERR;
+      else if (flags & M_WARN)
+	level = LOG_WARNING;
+      else
+	level = LOG_NOTICE;
+      syslog (level, "%s", text);
+#endif
+    }
+  else
+    {
+      fp = msg_fp();
+      if ((flags & M_NOPREFIX) || suppress_timestamps)
+	{
+	  fprintf (fp, "%s\n", text);
+	}
+      else
+	{
+	  const bool show_usec = check_debug_level (DEBUG_LEVEL_USEC_TIME);
+	  const char *ts = tv
+	    ? time_string (tv->tv_sec, tv->tv_usec, show_usec, gc)
+	    : time_string (0, 0, show_usec, gc);
+#ifdef USE_PTHREAD
+	  fprintf (fp, "%s [%d] %s\n",
+		   ts,
+		   (int) openvpn_thread_self (),
+		   text);
+#else
+	  fprintf (fp, "%s %s\n",
+		   ts,
+		   text);
+#endif
+	}
+      ++x_msg_line_num;
+    }
+  return fp;
+}
+
+/*
+ * Write out all queued messages.  Caller must hold L_MSG.
+ */
+static void
+msg_buffer_drain (void)
+{
+  FILE *fp = NULL;
+  struct gc_arena gc = gc_new ();
+
+  while (x_msg_buffer_len)
+    {
+      const struct msg_buffer_entry *e = &msg_buf[msg_buf_head];
+      fp = msg_output (e->flags, &e->tv, e->text, &gc);
+      msg_buf_head = (msg_buf_head + 1) % msg_buf_size;
+      --x_msg_buffer_len;
+      gc_free (&gc);
+    }
+
+  if (msg_buf_dropped != msg_buf_dropped_shown)
+    {
+      char text[64];
+      openvpn_snprintf (text, sizeof (text), "NOTE: %u log message(s) dropped by --log-buffer",
+			msg_buf_dropped - msg_buf_dropped_shown);
+      msg_buf_dropped_shown = msg_buf_dropped;
+      fp = msg_output (M_INFO, NULL, text, &gc);
+      gc_free (&gc);
+    }
+
+  if (fp)
+    fflush (fp);
+  msg_buf_last_flush = now;
+}
+
+/*
+ * Queue a message for later output.  Caller must hold L_MSG.
+ */
+static void
+msg_buffer_add (const unsigned int flags, const char *text)
+{
+  if (x_msg_buffer_len < msg_buf_size)
+    {
+      struct msg_buffer_entry *e = &msg_buf[(msg_buf_head + x_msg_buffer_len) % msg_buf_size];
+      e->flags = flags;
+#ifdef HAVE_GETTIMEOFDAY
+      if (gettimeofday (&e->tv, NULL))
+#endif
+	{
+	  e->tv.tv_sec = time (NULL);
+	  e->tv.tv_usec = 0;
+	}
+      strncpynt (e->text, text, sizeof (e->text));
+      ++x_msg_buffer_len;
+    }
+  else
+    ++msg_buf_dropped;
+}
+
+/*
+ * Enable message buffering with room for size
+ * messages, or disable it if size is 0.
+ */
+void
+msg_buffer_init (const int size)
+{
+  mutex_lock_static (L_MSG);
+  if (size != msg_buf_size)
+    {
+      if (msg_buf)
+	{
+	  msg_buffer_drain ();
+	  free (msg_buf);
+	  msg_buf = NULL;
+	}
+      msg_buf_size = msg_buf_head = x_msg_buffer_len = 0;
+      if (size > 0)
+	{
+	  ALLOC_ARRAY (msg_buf, struct msg_buffer_entry, size);
+	  msg_buf_size = size;
+	  msg_buf_last_flush = now;
+	}
+    }
+  mutex_unlock_static (L_MSG);
+}
+
+void
+msg_buffer_flush (void)
+{
+  mutex_lock_static (L_MSG);
+  if (x_msg_buffer_len || msg_buf_dropped != msg_buf_dropped_shown)
+    msg_buffer_drain ();
+  mutex_unlock_static (L_MSG);
+}
+
+unsigned int
+msg_buffer_dropped (void)
+{
+  return msg_buf_dropped;
+}
+
+/*
+ * Called from the event loop before we wait.  Write out
+ * queued messages once per second, or sooner if the
+ * buffer is half full.  Otherwise make sure that we
+ * wake up in time to write them.
+ */
+void
+check_msg_buffer_dowork (struct timeval *timeout)
+{
+  if (now != msg_buf_last_flush || x_msg_buffer_len * 2 >= msg_buf_size)
+    msg_buffer_flush ();
+  else if (timeout->tv_sec >= 1)
+    {
+      timeout->tv_sec = 1;
+      timeout->tv_usec = 0;
+    }
+}
+
 void x_msg (const unsigned int flags, const char *format, ...)
 {
   struct gc_arena gc;
   va_list arglist;
-#if SYSLOG_CAPABILITY
-  int level;
-#endif
-  char *m1;
-  char *m2;
+  char buf1[ERR_BUF_SIZE];
+  char buf2[ERR_BUF_SIZE];
+  char *m1 = buf1;
+  char *m2 = buf2;
   char *tmp;
   int e;
   const char *prefix;
@@ -213,9 +412,6 @@ void x_msg (const unsigned int flags, const char *format, ...)
 
   mutex_lock_static (L_MSG);
 
-  m1 = (char *) gc_malloc (ERR_BUF_SIZE, false, &gc);
-  m2 = (char *) gc_malloc (ERR_BUF_SIZE, false, &gc);
-
   va_start (arglist, format);
   vsnprintf (m1, ERR_BUF_SIZE, format, arglist);
   va_end (arglist);
@@ -254,76 +450,38 @@ void x_msg (const unsigned int flags, const char *format, ...)
       SWAP;
     }
 
-#if SYSLOG_CAPABILITY
-  if (flags & (M_FATAL|M_NONFATAL|M_USAGE_SMALL))
-    level = LOG_ERR;
-  else if (flags & M_WARN)
-    level = LOG_WARNING;
-  else
-    level = LOG_NOTICE;
-#endif
-
   /* set up client prefix */
   prefix = msg_get_prefix ();
   prefix_sep = " ";
   if (!prefix)
     prefix_sep = prefix = "";
 
+  openvpn_snprintf (m2, ERR_BUF_SIZE, "%s%s%s",
+		    prefix,
+		    prefix_sep,
+		    m1);
+
   /* virtual output capability used to copy output to management subsystem */
   {
     const struct virtual_output *vo = msg_get_virtual_output ();
     if (vo)
-      {
-	openvpn_snprintf (m2, ERR_BUF_SIZE, "%s%s%s",
-			  prefix,
-			  prefix_sep,
-			  m1);
-	virtual_output_print (vo, flags, m2);
-      }
+      virtual_output_print (vo, flags, m2);
   }
 
   if (!(flags & M_MSG_VIRT_OUT))
     {
-      if (use_syslog && !std_redir)
+      if (msg_buf && !(flags & (M_FATAL|M_USAGE_SMALL)))
 	{
-#if SYSLOG_CAPABILITY
-	  syslog (level, "%s%s%s",
-		  prefix,
-		  prefix_sep,
-		  m1);
-#endif
+	  msg_buffer_add (flags, m2);
 	}
       else
 	{
-	  FILE *fp = msg_fp();
-	  const bool show_usec = check_debug_level (DEBUG_LEVEL_USEC_TIME);
-
-	  if ((flags & M_NOPREFIX) || suppress_timestamps)
-	    {
-	      fprintf (fp, "%s%s%s\n",
-		       prefix,
-		       prefix_sep,
-		       m1);
-	    }
-	  else
-	    {
-#ifdef USE_PTHREAD
-	      fprintf (fp, "%s [%d] %s%s%s\n",
-		       time_string (0, 0, show_usec, &gc),
-		       (int) openvpn_thread_self (),
-		       prefix,
-		       prefix_sep,
-		       m1);
-#else
-	      fprintf (fp, "%s %s%s%s\n",
-		       time_string (0, 0, show_usec, &gc),
-		       prefix,
-		       prefix_sep,
-		       m1);
-#endif
-	    }
-	  fflush(fp);
-	  ++x_msg_line_num;
+	  FILE *fp;
+	  if (x_msg_buffer_len)
+	    msg_buffer_drain ();
+	  fp = msg_output (flags, NULL, m2, &gc);
+	  if (fp)
+	    fflush (fp);
 	}
     }
 
@@ -418,6 +576,7 @@ close_syslog ()
 #if SYSLOG_CAPABILITY
   if (use_syslog)
     {
+      msg_buffer_flush ();
       closelog();
       use_syslog = false;
       if (pgmname_syslog)
@@ -661,6 +820,8 @@ openvpn_exit (const int status)
   void plugin_abort (void);
 #endif
 
+  msg_buffer_flush ();
+
 #ifdef WIN32
   uninit_win32 ();
 #endif
@@ -218,6 +218,25 @@ HANDLE get_orig_stderr (void);
 /* exit program */
 void openvpn_exit (const int status);
 
+/*
+ * Deferred log output (--log-buffer).  When enabled,
+ * messages bound for the log file or syslog are queued
+ * by x_msg and written out in batches from the event loop.
+ */
+void msg_buffer_init (const int size);
+void msg_buffer_flush (void);
+unsigned int msg_buffer_dropped (void);
+
+extern int x_msg_buffer_len;
+
+static inline void
+check_msg_buffer (struct timeval *timeout)
+{
+  void check_msg_buffer_dowork (struct timeval *timeout);
+  if (x_msg_buffer_len)
+    check_msg_buffer_dowork (timeout);
+}
+
 /*
  * Check the return status of read/write routines.
  */
@@ -191,6 +191,34 @@ check_packet_id_persist_flush (struct context *c)
 }
 #endif
 
+/*
+ * Return true if none of the components serviced by
+ * pre_select() has had its state changed since the
+ * last call, so that pre_select() may be skipped until
+ * its previously computed wakeup time arrives.
+ */
+static inline bool
+pre_select_idle (const struct context *c)
+{
+  if (now >= c->c2.coarse_timer_wakeup)
+    return false;
+#if defined(USE_CRYPTO) && defined(USE_SSL)
+  if (c->c2.tls_multi && interval_active (&c->c2.tmp_int))
+    return false;
+#endif
+#if P2MP
+  if (tls_test_payload_len (c->c2.tls_multi) > 0)
+    return false;
+#endif
+#ifdef ENABLE_OCC
+  if (c->c2.occ_op >= 0)
+    return false;
+#endif
+  if (TO_LINK_FRAG (c))
+    return false;
+  return true;
+}
+
 /*
  * Set our wakeup to 0 seconds, so we will be rescheduled
  * immediately.
@@ -263,6 +291,7 @@ io_wait (struct context *c, const unsigned int flags)
       if (flags & (IOW_TO_LINK|IOW_MBUF))
 	ret |= SOCKET_WRITE;
       c->c2.event_set_status = ret;
+      update_now_tv ();
     }
   else
     {
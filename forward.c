@@ -43,6 +43,8 @@
 #include "occ-inline.h"
 #include "ping-inline.h"
 
+struct pre_select_stats pre_select_stats; /* GLOBAL */
+
 /* show event wait debugging info */
 
 #ifdef ENABLE_DEBUG
@@ -88,6 +90,7 @@ check_tls_dowork (struct context *c)
 
   if (interval_test (&c->c2.tmp_int))
     {
+      ++pre_select_stats.tls;
       if (tls_multi_process
 	  (c->c2.tls_multi, &c->c2.to_link, &c->c2.to_link_addr,
 	   get_link_socket_info (c), &wakeup))
@@ -111,6 +114,7 @@ check_tls_dowork (struct context *c)
 void
 check_tls_errors_co (struct context *c)
 {
+  ++pre_select_stats.tls_errors;
   msg (D_STREAM_ERRORS, "Fatal TLS error (check_tls_errors_co), restarting");
   c->sig->signal_received = c->c2.tls_exit_signal; /* SOFT-SIGUSR1 -- TLS error */
   c->sig->signal_text = "tls-error";
@@ -119,6 +123,7 @@ check_tls_errors_co (struct context *c)
 void
 check_tls_errors_nco (struct context *c)
 {
+  ++pre_select_stats.tls_errors;
   c->sig->signal_received = c->c2.tls_exit_signal; /* SOFT-SIGUSR1 -- TLS error */
   c->sig->signal_text = "tls-error";
 }
@@ -135,6 +140,7 @@ void
 check_incoming_control_channel_dowork (struct context *c)
 {
   const int len = tls_test_payload_len (c->c2.tls_multi);
+  ++pre_select_stats.control_channel;
   if (len)
     {
       struct gc_arena gc = gc_new ();
@@ -347,6 +353,7 @@ check_fragment_dowork (struct context *c)
       if (!c->c2.to_link.len)
 	{
 	  /* encrypt a fragment for output to TCP/UDP port */
+	  ++pre_select_stats.fragment;
 	  ASSERT (fragment_ready_to_send (c->c2.fragment, &c->c2.buf, &c->c2.frame_fragment));
 	  encrypt_sign (c, false);
 	}
@@ -504,6 +511,7 @@ static void
 check_coarse_timers_dowork (struct context *c)
 {
   const struct timeval save = c->c2.timeval;
+  ++pre_select_stats.coarse_timers;
   c->c2.timeval.tv_sec = BIG_TIMEOUT;
   c->c2.timeval.tv_usec = 0;
   process_coarse_timers (c);
@@ -530,6 +538,7 @@ static void
 check_timeout_random_component_dowork (struct context *c)
 {
   const int update_interval = 10; /* seconds */
+  ++pre_select_stats.random_component;
   c->c2.update_timeout_random_component = now + update_interval;
   c->c2.timeout_random_component.tv_usec = (time_t) get_random () & 0x0003FFFF;
   c->c2.timeout_random_component.tv_sec = 0;
@@ -1138,6 +1147,8 @@ pre_select (struct context *c)
   c->c2.timeval.tv_sec = BIG_TIMEOUT;
   c->c2.timeval.tv_usec = 0;
 
+  ++pre_select_stats.full;
+
 #if defined(WIN32)
   if (check_debug_level (D_TAP_WIN32_DEBUG))
     {
@@ -1188,7 +1199,7 @@ io_wait_dowork (struct context *c, const unsigned int flags)
 {
   unsigned int socket = 0;
   unsigned int tuntap = 0;
-  struct event_set_return esr[4];
+  struct event_set_return esr[5];
 
   /* These shifts all depend on EVENT_READ and EVENT_WRITE */
   static const int socket_shift = 0;     /* depends on SOCKET_READ and SOCKET_WRITE */
@@ -1197,6 +1208,9 @@ io_wait_dowork (struct context *c, const unsigned int flags)
 #ifdef ENABLE_MANAGEMENT
   static const int management_shift = 6; /* depends on MANAGEMENT_READ and MANAGEMENT_WRITE */
 #endif
+#ifdef ENABLE_PLUGIN_DEFERRED
+  static const int plugin_shift = 8;     /* depends on PLUGIN_READ */
+#endif
 
   /*
    * Decide what kind of events we want to wait for.
@@ -1291,6 +1305,10 @@ io_wait_dowork (struct context *c, const unsigned int flags)
     management_socket_set (management, c->c2.event_set, (void*)&management_shift, NULL);
 #endif
 
+#ifdef ENABLE_PLUGIN_DEFERRED
+  plugin_event_set (c->c1.plugins, c->c2.event_set, (void*)&plugin_shift, NULL);
+#endif
+
   /*
    * Possible scenarios:
    *  (1) tcp/udp port has data available to read
@@ -1317,6 +1335,7 @@ io_wait_dowork (struct context *c, const unsigned int flags)
 	  /*
 	   * Wait for something to happen.
 	   */
+	  check_msg_buffer (&c->c2.timeval);
 	  status = event_wait (c->c2.event_set, &c->c2.timeval, esr, SIZE(esr));
 
 	  check_status (status, "event_wait", NULL, NULL);
@@ -1344,6 +1363,7 @@ io_wait_dowork (struct context *c, const unsigned int flags)
 
   /* 'now' should always be a reasonably up-to-date timestamp */
   update_time ();
+  update_now_tv ();
 
   /* set signal_received if a signal was received */
   if (c->c2.event_set_status & ES_ERROR)
@@ -1365,6 +1385,11 @@ process_io (struct context *c)
     }
 #endif
 
+#ifdef ENABLE_PLUGIN_DEFERRED
+  if (status & PLUGIN_READ)
+    plugin_process_completions (c->c1.plugins);
+#endif
+
   /* TCP/UDP port ready to accept write */
   if (status & SOCKET_WRITE)
     {
@@ -54,6 +54,26 @@
 
 #define IOW_READ            (IOW_READ_TUN|IOW_READ_LINK)
 
+/*
+ * Counters showing how often pre_select() was run
+ * or skipped, and how often each of its components
+ * actually had work to do.
+ */
+struct pre_select_stats
+{
+  counter_type full;             /* pre_select() was run */
+  counter_type lazy;             /* pre_select() was skipped (server mode) */
+  counter_type coarse_timers;
+  counter_type tls;
+  counter_type tls_errors;
+  counter_type control_channel;
+  counter_type occ;
+  counter_type fragment;
+  counter_type random_component;
+};
+
+extern struct pre_select_stats pre_select_stats;
+
 void pre_select (struct context *c);
 
 void process_io (struct context *c);
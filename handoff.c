@@ -0,0 +1,450 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2005 OpenVPN Solutions LLC <info@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef WIN32
+#include "config-win32.h"
+#else
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#ifdef ENABLE_HANDOFF
+
+#include "error.h"
+#include "buffer.h"
+#include "fdmisc.h"
+#include "misc.h"
+#include "options.h"
+#include "tun.h"
+#include "handoff.h"
+
+#include "memdbg.h"
+
+#define HANDOFF_MAGIC    0x4f564844 /* "OVHD" */
+#define HANDOFF_VERSION  1
+#define HANDOFF_ACK      'A'
+
+/* what the new server received from the old one */
+static struct
+{
+  socket_descriptor_t sd;
+  int tun_fd;
+  char *tun_name;
+  struct buffer *records;
+  int n_records;
+  int next;
+} handoff_received = { SOCKET_UNDEFINED, -1, NULL, NULL, 0, 0 };
+
+/*
+ * Blocking read/write of exactly len bytes.
+ */
+
+static bool
+handoff_write_full (const int fd, const uint8_t *data, int len)
+{
+  while (len > 0)
+    {
+      const ssize_t n = write (fd, data, len);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n <= 0)
+	return false;
+      data += n;
+      len -= n;
+    }
+  return true;
+}
+
+static bool
+handoff_read_full (const int fd, uint8_t *data, int len)
+{
+  while (len > 0)
+    {
+      const ssize_t n = read (fd, data, len);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n <= 0)
+	return false;
+      data += n;
+      len -= n;
+    }
+  return true;
+}
+
+/*
+ * Records are written with a u16 length prefix.
+ */
+static bool
+handoff_read_record (const int fd, struct buffer *buf, struct gc_arena *gc)
+{
+  uint16_t len;
+  if (!handoff_read_full (fd, (uint8_t *) &len, sizeof (len)))
+    return false;
+  len = ntohs (len);
+  *buf = gc ? alloc_buf_gc (len, gc) : alloc_buf (len);
+  if (!handoff_read_full (fd, BPTR (buf), len))
+    return false;
+  buf->len = len;
+  return true;
+}
+
+/*
+ * Pass the UDP socket and TUN/TAP descriptors, attached
+ * to a single byte of data.
+ */
+
+static bool
+handoff_send_fds (const int fd, const int *fds)
+{
+  struct msghdr mh;
+  struct iovec iov;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE (2 * sizeof (int))];
+  } control;
+  struct cmsghdr *cm;
+  uint8_t tag = 0;
+  ssize_t n;
+
+  CLEAR (mh);
+  CLEAR (control);
+  iov.iov_base = &tag;
+  iov.iov_len = 1;
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = control.buf;
+  mh.msg_controllen = sizeof (control.buf);
+
+  cm = CMSG_FIRSTHDR (&mh);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN (2 * sizeof (int));
+  memcpy (CMSG_DATA (cm), fds, 2 * sizeof (int));
+
+  do
+    n = sendmsg (fd, &mh, 0);
+  while (n < 0 && errno == EINTR);
+  return n == 1;
+}
+
+static bool
+handoff_recv_fds (const int fd, int *fds)
+{
+  struct msghdr mh;
+  struct iovec iov;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE (2 * sizeof (int))];
+  } control;
+  struct cmsghdr *cm;
+  uint8_t tag;
+  ssize_t n;
+
+  CLEAR (mh);
+  CLEAR (control);
+  iov.iov_base = &tag;
+  iov.iov_len = 1;
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = control.buf;
+  mh.msg_controllen = sizeof (control.buf);
+
+  do
+    n = recvmsg (fd, &mh, 0);
+  while (n < 0 && errno == EINTR);
+
+  cm = CMSG_FIRSTHDR (&mh);
+  if (n != 1
+      || !cm
+      || cm->cmsg_level != SOL_SOCKET
+      || cm->cmsg_type != SCM_RIGHTS
+      || cm->cmsg_len != CMSG_LEN (2 * sizeof (int)))
+    return false;
+  memcpy (fds, CMSG_DATA (cm), 2 * sizeof (int));
+  return true;
+}
+
+/*
+ * Old server side.
+ */
+
+/*
+ * In the forked child, exec the new server with our
+ * command line, less the --handoff-fd of an earlier
+ * handoff, plus --handoff-fd fd.
+ */
+static void
+handoff_exec (const int argc, char *argv[], const int fd)
+{
+  char fd_string[16];
+  char **args;
+  int i, j = 0;
+
+  ALLOC_ARRAY_CLEAR (args, char *, argc + 3);
+  for (i = 0; i < argc; ++i)
+    {
+      if (streq (argv[i], "--handoff-fd") && i + 1 < argc)
+	++i;
+      else
+	args[j++] = argv[i];
+    }
+  openvpn_snprintf (fd_string, sizeof (fd_string), "%d", fd);
+  args[j++] = "--handoff-fd";
+  args[j++] = fd_string;
+  args[j] = NULL;
+
+  execvp (args[0], args);
+  msg (M_WARN | M_ERRNO, "HANDOFF: cannot execute %s", args[0]);
+  _exit (OPENVPN_EXIT_STATUS_ERROR);
+}
+
+bool
+handoff_start (struct handoff *h,
+	       const int argc,
+	       char *argv[],
+	       const socket_descriptor_t sd,
+	       const struct tuntap *tt,
+	       const int n_records)
+{
+  struct gc_arena gc = gc_new ();
+  struct buffer buf = alloc_buf_gc (64 + strlen (tt->actual_name), &gc);
+  int fds[2];
+  bool ret = false;
+
+  h->fd = -1;
+  h->pid = -1;
+
+  if (socketpair (PF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+      msg (M_WARN | M_ERRNO, "HANDOFF: socketpair failed");
+      goto done;
+    }
+  set_cloexec (fds[0]);
+
+  h->pid = fork ();
+  if (h->pid == 0)
+    handoff_exec (argc, argv, fds[1]);
+  close (fds[1]);
+  h->fd = fds[0];
+  if (h->pid < 0)
+    {
+      msg (M_WARN | M_ERRNO, "HANDOFF: fork failed");
+      goto done;
+    }
+  msg (M_INFO, "HANDOFF: started new server process %d, passing %d client(s)",
+       (int) h->pid, n_records);
+
+  fds[0] = sd;
+  fds[1] = tt->fd;
+  buf_write_u32 (&buf, HANDOFF_MAGIC);
+  buf_write_u16 (&buf, HANDOFF_VERSION);
+  buf_write_u32 (&buf, n_records);
+  buf_write_u16 (&buf, strlen (tt->actual_name));
+  buf_write (&buf, tt->actual_name, strlen (tt->actual_name));
+
+  ret = handoff_send_fds (h->fd, fds) && handoff_write (h, &buf);
+
+ done:
+  gc_free (&gc);
+  return ret;
+}
+
+bool
+handoff_write (struct handoff *h, const struct buffer *buf)
+{
+  const uint16_t len = htons (BLEN (buf));
+  ASSERT (BLEN (buf) <= 0xFFFF);
+  return h->fd >= 0
+    && handoff_write_full (h->fd, (const uint8_t *) &len, sizeof (len))
+    && handoff_write_full (h->fd, BPTR (buf), BLEN (buf));
+}
+
+bool
+handoff_finish (struct handoff *h, bool ok)
+{
+  if (ok)
+    {
+      struct timeval tv;
+      fd_set reads;
+      uint8_t ack = 0;
+      int status;
+
+      tv.tv_sec = HANDOFF_TIMEOUT;
+      tv.tv_usec = 0;
+      do
+	{
+	  FD_ZERO (&reads);
+	  FD_SET (h->fd, &reads);
+	  status = select (h->fd + 1, &reads, NULL, NULL, &tv);
+	}
+      while (status < 0 && errno == EINTR);
+
+      ok = (status > 0 && read (h->fd, &ack, 1) == 1 && ack == HANDOFF_ACK);
+      if (!ok)
+	msg (M_WARN, "HANDOFF: new server process did not take over");
+    }
+
+  /*
+   * On success we keep our end open; it is closed when we
+   * exit, which is what the new server is waiting for.
+   */
+  if (!ok)
+    {
+      if (h->pid > 0)
+	{
+	  kill (h->pid, SIGKILL);
+	  waitpid (h->pid, NULL, 0);
+	}
+      if (h->fd >= 0)
+	close (h->fd);
+      h->fd = -1;
+      h->pid = -1;
+    }
+  return ok;
+}
+
+/*
+ * New server side.
+ */
+
+void
+handoff_receive (const int fd)
+{
+  struct gc_arena gc = gc_new ();
+  struct buffer buf;
+  uint8_t ack = HANDOFF_ACK;
+  int fds[2];
+  bool good = false;
+  int i, n = 0, len;
+
+  if (!handoff_recv_fds (fd, fds))
+    msg (M_FATAL, "HANDOFF: no socket or TUN/TAP descriptor received on fd %d", fd);
+  handoff_received.sd = fds[0];
+  handoff_received.tun_fd = fds[1];
+
+  if (handoff_read_record (fd, &buf, &gc)
+      && buf_read_u32 (&buf, &good) == HANDOFF_MAGIC && good
+      && buf_read_u16 (&buf) == HANDOFF_VERSION)
+    {
+      n = buf_read_u32 (&buf, &good);
+      len = buf_read_u16 (&buf);
+      if (good && n >= 0 && len > 0 && len <= BLEN (&buf))
+	{
+	  handoff_received.tun_name = (char *) malloc (len + 1);
+	  check_malloc_return (handoff_received.tun_name);
+	  buf_read (&buf, handoff_received.tun_name, len);
+	  handoff_received.tun_name[len] = '\0';
+	}
+    }
+  if (!handoff_received.tun_name)
+    msg (M_FATAL, "HANDOFF: bad header received from the old server");
+
+  ALLOC_ARRAY_CLEAR (handoff_received.records, struct buffer, n);
+  for (i = 0; i < n; ++i)
+    {
+      if (!handoff_read_record (fd, &handoff_received.records[i], NULL))
+	msg (M_FATAL, "HANDOFF: client record %d of %d not received", i + 1, n);
+      handoff_received.n_records = i + 1;
+    }
+
+  if (!handoff_write_full (fd, &ack, 1))
+    msg (M_FATAL | M_ERRNO, "HANDOFF: cannot acknowledge old server");
+
+  msg (M_INFO, "HANDOFF: received %d client(s) and TUN/TAP device %s, waiting for the old server to exit",
+       n, handoff_received.tun_name);
+
+  /* the old server closes its end when it exits */
+  while (true)
+    {
+      const ssize_t status = read (fd, &ack, 1);
+      if (!status || (status < 0 && errno != EINTR))
+	break;
+    }
+  close (fd);
+
+  gc_free (&gc);
+}
+
+socket_descriptor_t
+handoff_take_socket (struct sockaddr_in *local)
+{
+  const socket_descriptor_t sd = handoff_received.sd;
+  if (socket_defined (sd))
+    {
+      socklen_t len = sizeof (*local);
+      if (getsockname (sd, (struct sockaddr *) local, &len))
+	msg (M_ERR, "HANDOFF: getsockname failed on socket received from the old server");
+      handoff_received.sd = SOCKET_UNDEFINED;
+    }
+  return sd;
+}
+
+bool
+handoff_take_tun (struct tuntap *tt, const bool ipv6)
+{
+  if (handoff_received.tun_fd < 0)
+    return false;
+
+  tt->fd = handoff_received.tun_fd;
+  tt->actual_name = handoff_received.tun_name;
+  tt->ipv6 = ipv6;
+  set_nonblock (tt->fd);
+  set_cloexec (tt->fd);
+  msg (M_INFO, "TUN/TAP device %s taken over from the old server", tt->actual_name);
+
+  handoff_received.tun_fd = -1;
+  handoff_received.tun_name = NULL;
+  return true;
+}
+
+bool
+handoff_read (struct buffer *buf)
+{
+  if (handoff_received.next < handoff_received.n_records)
+    {
+      *buf = handoff_received.records[handoff_received.next++];
+      return true;
+    }
+  return false;
+}
+
+void
+handoff_close (void)
+{
+  int i;
+  for (i = 0; i < handoff_received.n_records; ++i)
+    {
+      /* records hold data channel keys */
+      buf_clear (&handoff_received.records[i]);
+      free_buf (&handoff_received.records[i]);
+    }
+  free (handoff_received.records);
+  handoff_received.records = NULL;
+  handoff_received.n_records = handoff_received.next = 0;
+}
+
+#else
+static void dummy(void) {}
+#endif /* ENABLE_HANDOFF */
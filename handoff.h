@@ -0,0 +1,109 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2005 OpenVPN Solutions LLC <info@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+/*
+ * Zero-downtime restart of a UDP server (--handoff).
+ *
+ * On the management interface "handoff" command, the running
+ * server forks and execs a new copy of itself with its original
+ * command line plus "--handoff-fd n".  Over that socket pair
+ * it passes its UDP socket and TUN/TAP file descriptor using
+ * SCM_RIGHTS, followed by one record per established client
+ * holding the client's address, virtual address and current
+ * data channel keys.  The new process acknowledges once it has
+ * read everything, and then waits for the old one to exit
+ * before it initializes, so that it can bind the management
+ * port and so that only one process ever serves the clients.
+ * Clients keep their session and don't renegotiate.
+ */
+
+#ifdef ENABLE_HANDOFF
+
+#include "basic.h"
+#include "buffer.h"
+
+/* how long the old server waits for the new one to take over */
+#define HANDOFF_TIMEOUT 30
+
+/* maximum size of a client record */
+#define HANDOFF_RECORD_SIZE 1024
+
+struct tuntap;
+
+/*
+ * Old server side.
+ */
+
+struct handoff
+{
+  int fd;       /* our end of the socket pair */
+  pid_t pid;    /* the new server */
+};
+
+/*
+ * Start the new server with command line argc/argv, pass it
+ * sd and the fd of tt, and announce n_records client records
+ * to follow.
+ */
+bool handoff_start (struct handoff *h,
+		    const int argc,
+		    char *argv[],
+		    const socket_descriptor_t sd,
+		    const struct tuntap *tt,
+		    const int n_records);
+
+bool handoff_write (struct handoff *h, const struct buffer *buf);
+
+/*
+ * If ok, wait for the new server to acknowledge and
+ * return true, after which we must exit without closing
+ * anything.  Otherwise, or if no acknowledgement comes,
+ * kill the new server and return false.
+ */
+bool handoff_finish (struct handoff *h, bool ok);
+
+/*
+ * New server side.
+ */
+
+/* read everything handed over on fd, then wait for the old server to exit */
+void handoff_receive (const int fd);
+
+/* take over the old server's UDP socket, if any */
+socket_descriptor_t handoff_take_socket (struct sockaddr_in *local);
+
+/* take over the old server's TUN/TAP device, if any */
+bool handoff_take_tun (struct tuntap *tt, const bool ipv6);
+
+/* return the next client record, or false when none are left */
+bool handoff_read (struct buffer *buf);
+
+/* free the client records */
+void handoff_close (void);
+
+#endif
+#endif
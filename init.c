@@ -35,9 +35,11 @@
 #include "sig.h"
 #include "occ.h"
 #include "list.h"
+#include "mroute.h"
 #include "otime.h"
 #include "pool.h"
 #include "gremlin.h"
+#include "handoff.h"
 
 #include "memdbg.h"
 
@@ -193,11 +195,21 @@ init_static (void)
   return false;
 #endif
 
+#ifdef SCRIPT_TEST
+  script_test ();
+  return false;
+#endif
+
 #ifdef LIST_TEST
   list_test ();
   return false;
 #endif
 
+#ifdef MROUTE_TEST
+  mroute_hash_bench ();
+  return false;
+#endif
+
 #ifdef IFCONFIG_POOL_TEST
   ifconfig_pool_test (0x0A010004, 0x0A0100FF);
   return false;
@@ -243,7 +255,13 @@ init_verb_mute (struct context *c, unsigned int flags)
 
   /* special D_LOG_RW mode */
   if (flags & IVM_LEVEL_2)
-    c->c2.log_rw = (check_debug_level (D_LOG_RW) && !check_debug_level (D_LOG_RW + 1));
+    {
+      c->c2.log_rw = (check_debug_level (D_LOG_RW) && !check_debug_level (D_LOG_RW + 1));
+
+      /* start deferred log output, now that we have daemonized */
+      if (c->mode == CM_P2P || c->mode == CM_TOP)
+	msg_buffer_init (c->options.log_buffer);
+    }
 }
 
 /*
@@ -258,6 +276,71 @@ init_options_dev (struct options *options)
     options->dev = dev_component_in_dev_node (options->dev_node);
 }
 
+#ifdef ENABLE_RELOAD
+
+/*
+ * Re-read options from the command line and config file
+ * into o, for a server reload.  Option errors are fatal,
+ * so the options are first parsed by a forked child,
+ * and only parsed again here if the child succeeded.
+ * Returns false and leaves o uninitialized on error.
+ */
+bool
+init_options_reload (struct options *o, const int argc, char *argv[])
+{
+  struct gc_arena gc = gc_new ();
+  struct env_set *es = env_set_create (&gc);
+  int status = -1;
+  pid_t pid;
+
+  msg_buffer_flush ();
+  pid = fork ();
+  if (pid == 0)
+    {
+#ifdef ENABLE_PLUGIN
+      /* a fatal error in the child must not abort the parent's plug-ins */
+      plugin_list_forget ();
+#endif
+      init_options (o);
+      parse_argv (o, argc, argv, M_USAGE, OPT_P_DEFAULT, NULL, es);
+      init_options_dev (o);
+      options_postprocess (o, false);
+      _exit (OPENVPN_EXIT_STATUS_GOOD);
+    }
+  else if (pid < 0)
+    {
+      msg (M_WARN | M_ERRNO, "RELOAD: fork failed");
+      goto err;
+    }
+
+  while (waitpid (pid, &status, 0) < 0)
+    {
+      if (errno != EINTR)
+	{
+	  status = -1;
+	  break;
+	}
+    }
+  if (status == -1 || !WIFEXITED (status) || WEXITSTATUS (status) != OPENVPN_EXIT_STATUS_GOOD)
+    {
+      msg (M_WARN, "RELOAD: the new options could not be parsed, keeping the current configuration");
+      goto err;
+    }
+
+  init_options (o);
+  parse_argv (o, argc, argv, M_WARN|M_OPTERR, OPT_P_DEFAULT, NULL, es);
+  init_options_dev (o);
+  options_postprocess (o, false);
+  gc_free (&gc);
+  return true;
+
+ err:
+  gc_free (&gc);
+  return false;
+}
+
+#endif
+
 bool
 print_openssl_info (const struct options *options)
 {
@@ -456,6 +539,7 @@ static void
 do_init_timers (struct context *c, bool deferred)
 {
   update_time ();
+  update_now_tv ();
   reset_coarse_timers (c);
 
   /* initialize inactivity timeout */
@@ -715,6 +799,20 @@ do_open_tun (struct context *c)
       if (c->c1.route_list && c->c2.link_socket)
 	do_init_route_list (&c->options, c->c1.route_list, &c->c2.link_socket->info, false, c->c2.es);
 
+#ifdef ENABLE_HANDOFF
+      /*
+       * Take over the device of the server we replace, which
+       * has already done ifconfig, --up and --route.
+       */
+      if (handoff_take_tun (c->c1.tuntap, c->options.tun_ipv6))
+	{
+	  if (c->c1.route_list)
+	    c->c1.route_list->routes_added = true;
+	  gc_free (&gc);
+	  return true;
+	}
+#endif
+
       /* do ifconfig */
       if (!c->options.ifconfig_noexec
 	  && ifconfig_order () == IFCONFIG_BEFORE_TUN_OPEN)
@@ -942,6 +1040,29 @@ do_up (struct context *c, bool pulled_options, unsigned int option_types_found)
     }
 }
 
+#if defined(USE_CRYPTO) && defined(USE_SSL)
+/*
+ * Data channel packets may carry a peer-id in UDP client/server
+ * mode, so that the server can follow a client whose address
+ * changes, e.g. after NAT rebinding.
+ */
+static bool
+peer_id_enabled (const struct options *o)
+{
+  if (o->proto != PROTO_UDPv4)
+    return false;
+#if P2MP_SERVER
+  if (o->mode == MODE_SERVER)
+    return true;
+#endif
+#if P2MP
+  if (o->pull)
+    return true;
+#endif
+  return false;
+}
+#endif
+
 /*
  * These are the option categories which will be accepted by pull.
  */
@@ -957,7 +1078,9 @@ pull_permission_mask (void)
 	  | OPT_P_PERSIST
 	  | OPT_P_MESSAGES
 	  | OPT_P_EXPLICIT_NOTIFY
-	  | OPT_P_ECHO);
+	  | OPT_P_ECHO
+	  | OPT_P_PULL_MODE
+	  | OPT_P_PEER_ID);
 }
 
 /*
@@ -1006,6 +1129,19 @@ do_deferred_options (struct context *c, const unsigned int found)
     msg (D_PUSH, "OPTIONS IMPORT: --ip-win32 and/or --dhcp-option options modified");
   if (found & OPT_P_SETENV)
     msg (D_PUSH, "OPTIONS IMPORT: environment modified");
+
+#if P2MP
+  if (found & OPT_P_PEER_ID)
+    {
+      if (c->options.use_peer_id && peer_id_enabled (&c->options))
+	{
+	  msg (D_PUSH, "OPTIONS IMPORT: peer-id set");
+	  tls_set_peer_id (c->c2.tls_multi, c->options.peer_id, true);
+	}
+      else
+	msg (D_PUSH, "OPTIONS IMPORT: peer-id ignored");
+    }
+#endif
 }
 
 /*
@@ -1331,6 +1467,10 @@ do_init_crypto_tls (struct context *c, const unsigned int flags)
 				  options->replay, packet_id_long_form);
   tls_adjust_frame_parameters (&c->c2.frame);
 
+  /* leave room for the peer-id of P_DATA_V2 packets */
+  if (peer_id_enabled (options))
+    frame_add_to_extra_link (&c->c2.frame, TLS_PEER_ID_LEN);
+
   /* Set all command-line TLS-related options */
   CLEAR (to);
 
@@ -1352,6 +1492,12 @@ do_init_crypto_tls (struct context *c, const unsigned int flags)
   to.renegotiate_packets = options->renegotiate_packets;
   to.renegotiate_seconds = options->renegotiate_seconds;
   to.single_session = options->single_session;
+#if P2MP
+  to.push_peer_info = options->pull && peer_id_enabled (options);
+#endif
+#ifdef ENABLE_HANDOFF
+  to.handoff = options->handoff;
+#endif
 
 #ifdef ENABLE_OCC
   to.disable_occ = !options->occ;
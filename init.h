@@ -31,7 +31,7 @@
  * Baseline maximum number of events
  * to wait for.
  */
-#define BASE_N_EVENTS 4
+#define BASE_N_EVENTS 5
 
 void context_clear (struct context *c);
 void context_clear_1 (struct context *c);
@@ -49,6 +49,10 @@ void init_verb_mute (struct context *c, unsigned int flags);
 
 void init_options_dev (struct options *options);
 
+#ifdef ENABLE_RELOAD
+bool init_options_reload (struct options *o, const int argc, char *argv[]);
+#endif
+
 bool print_openssl_info (const struct options *options);
 
 bool do_genkey (const struct options *options);
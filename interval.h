@@ -116,6 +116,15 @@ interval_future_trigger (struct interval* top, interval_t wakeup) {
     }
 }
 
+/*
+ * Make interval_test return true on its next call.
+ */
+static inline void
+interval_trigger (struct interval* top)
+{
+  top->future_trigger = now;
+}
+
 /*
  * Once an action is triggered, interval_test will remain true for
  * horizon seconds.
@@ -129,6 +138,16 @@ interval_action (struct interval* top)
   top->last_action = now;
 }
 
+/*
+ * Has an action been triggered within the last
+ * horizon seconds?
+ */
+static inline bool
+interval_active (const struct interval* top)
+{
+  return top->last_action + top->horizon > now;
+}
+
 /*
  * Measure when n seconds beyond an event have elapsed
  */
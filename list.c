@@ -37,81 +37,237 @@
 
 #include "memdbg.h"
 
+static void
+hash_slots_init (struct hash_slots *t, const int n_slots, const int max_probe)
+{
+  t->n_slots = n_slots;
+  t->mask = n_slots - 1;
+  t->max_probe = max_probe;
+  t->n_alloc = n_slots + max_probe;
+  ALLOC_ARRAY_CLEAR (t->slots, struct hash_element, t->n_alloc);
+}
+
+static void
+hash_slots_free (struct hash_slots *t)
+{
+  free (t->slots);
+  t->slots = NULL;
+}
+
 struct hash *
 hash_init (const int n_buckets,
 	   uint32_t (*hash_function)(const void *key, uint32_t iv),
 	   bool (*compare_function)(const void *key1, const void *key2))
 {
   struct hash *h;
-  int i;
 
   ASSERT (n_buckets > 0);
   ALLOC_OBJ_CLEAR (h, struct hash);
-  h->n_buckets = (int) adjust_power_of_2 (n_buckets);
-  h->mask = h->n_buckets - 1;
   h->hash_function = hash_function;
   h->compare_function = compare_function;
   h->iv = get_random ();
-  ALLOC_ARRAY (h->buckets, struct hash_bucket, h->n_buckets);
-  for (i = 0; i < h->n_buckets; ++i)
-    {
-      struct hash_bucket *b = &h->buckets[i];
-      b->list = NULL;
-      mutex_init (&b->mutex);
-    }
+  mutex_init (&h->lock.mutex);
+  hash_slots_init (&h->cur, (int) adjust_power_of_2 (max_int (n_buckets, HASH_MIN_SLOTS)), HASH_MAX_PROBE);
   return h;
 }
 
 void
 hash_free (struct hash *hash)
 {
-  int i;
-  for (i = 0; i < hash->n_buckets; ++i)
+  mutex_destroy (&hash->lock.mutex);
+  hash_slots_free (&hash->cur);
+  hash_slots_free (&hash->old);
+  free (hash);
+}
+
+/*
+ * Find key in t, starting no earlier than slot start.
+ *
+ * Elements are ordered by home slot, so the search can
+ * stop as soon as it reaches an empty slot or an element
+ * which is closer to its own home slot than key would be.
+ */
+static inline struct hash_element *
+hash_slots_find (const struct hash *hash,
+		 const struct hash_slots *t,
+		 const void *key,
+		 const uint32_t hv,
+		 const int start)
+{
+  const int home = hv & t->mask;
+  int i = max_int (home, start);
+
+  for (; i < t->n_alloc; ++i)
     {
-      struct hash_bucket *b = &hash->buckets[i];
-      struct hash_element *he = b->list;
+      struct hash_element *he = &t->slots[i];
+      if (he->dist < (unsigned int) (i - home + 1))
+	break;
+      if (hv == he->hash_value && (*hash->compare_function)(key, he->key))
+	return he;
+    }
+  return NULL;
+}
+
+/*
+ * Robin Hood insert: walk forward from the home slot,
+ * swapping the element being placed with any element
+ * which is closer to its own home slot.  Returns false
+ * if the element being carried would exceed max_probe,
+ * in which case *e holds the element which could not be
+ * placed (not necessarily the one passed in).
+ */
+static bool
+hash_slots_insert (struct hash_slots *t, struct hash_element *e)
+{
+  int i = e->hash_value & t->mask;
 
-      mutex_destroy (&b->mutex);
-      while (he)
+  for (e->dist = 1; e->dist <= (unsigned int) t->max_probe; ++i, ++e->dist)
+    {
+      struct hash_element *he = &t->slots[i];
+      if (!he->dist)
 	{
-	  struct hash_element *next = he->next;
-	  free (he);
-	  he = next;
+	  *he = *e;
+	  return true;
+	}
+      if (he->dist < e->dist)
+	{
+	  const struct hash_element tmp = *he;
+	  *he = *e;
+	  *e = tmp;
 	}
     }
-  free (hash->buckets);
-  free (hash);
+  return false;
 }
 
-struct hash_element *
-hash_lookup_fast (struct hash *hash,
-		  struct hash_bucket *bucket,
-		  const void *key,
-		  uint32_t hv)
+/*
+ * Remove the element in slot i, shifting back the
+ * following elements which are not in their home slot.
+ */
+static void
+hash_slots_delete (struct hash_slots *t, int i)
 {
-  struct hash_element *he;
-  struct hash_element *prev = NULL;
+  for (; i + 1 < t->n_alloc && t->slots[i + 1].dist > 1; ++i)
+    {
+      t->slots[i] = t->slots[i + 1];
+      --t->slots[i].dist;
+    }
+  CLEAR (t->slots[i]);
+}
 
-  he = bucket->list;
+/*
+ * Rebuild the table synchronously, merging in the old
+ * table if we are in the middle of growing.  Only needed
+ * when an element cannot be placed within max_probe of
+ * its home slot, which is rare with a good hash function.
+ */
+static void
+hash_rehash (struct hash *hash, const struct hash_element *extra)
+{
+  struct hash_slots t;
+  struct hash_element e;
+  int n_slots = hash->cur.n_slots;
+  int max_probe = hash->cur.max_probe;
+  int i;
 
-  while (he)
+ retry:
+  if (n_slots < (hash->n_elements + 1) * 2)
+    n_slots *= 2;
+  else
+    max_probe *= 2;
+  hash_slots_init (&t, n_slots, max_probe);
+  for (i = 0; i < hash->cur.n_alloc; ++i)
     {
-      if (hv == he->hash_value && (*hash->compare_function)(key, he->key))
+      e = hash->cur.slots[i];
+      if (e.dist && !hash_slots_insert (&t, &e))
+	goto fail;
+    }
+  if (hash->old.slots)
+    {
+      for (i = hash->old_index; i < hash->old.n_alloc; ++i)
 	{
-	  /* move to head of list */
-	  if (prev)
-	    {
-	      prev->next = he->next;
-	      he->next = bucket->list;
-	      bucket->list = he;
-	    }
-	  return he;
+	  e = hash->old.slots[i];
+	  if (e.dist && !hash_slots_insert (&t, &e))
+	    goto fail;
 	}
-      prev = he;
-      he = he->next;
+    }
+  if (extra)
+    {
+      e = *extra;
+      if (!hash_slots_insert (&t, &e))
+	goto fail;
     }
 
-  return NULL;
+  msg (D_HASH, "HASH: rehashed %d elements into %d slots, max probe %d",
+       hash->n_elements, n_slots, max_probe);
+  hash_slots_free (&hash->cur);
+  hash_slots_free (&hash->old);
+  hash->cur = t;
+  return;
+
+ fail:
+  hash_slots_free (&t);
+  goto retry;
+}
+
+static void
+hash_put (struct hash *hash, const struct hash_element *he)
+{
+  struct hash_element e = *he;
+  if (!hash_slots_insert (&hash->cur, &e))
+    hash_rehash (hash, &e);
+}
+
+/*
+ * Move up to n slots of the old table to the new one.
+ */
+static void
+hash_migrate (struct hash *hash, int n)
+{
+  struct hash_slots *old = &hash->old;
+
+  while (old->slots && n-- > 0)
+    {
+      struct hash_element *he = &old->slots[hash->old_index];
+      if (he->dist)
+	{
+	  const struct hash_element e = *he;
+	  CLEAR (*he);
+	  ++hash->old_index;
+	  hash_put (hash, &e); /* may free old if a rehash was needed */
+	}
+      else
+	++hash->old_index;
+
+      if (old->slots && hash->old_index >= old->n_alloc)
+	hash_slots_free (old);
+    }
+}
+
+/*
+ * Start growing once the table is 7/8 full.
+ */
+static void
+hash_grow (struct hash *hash)
+{
+  if (hash->n_elements >= hash->cur.n_slots - (hash->cur.n_slots >> 3))
+    {
+      msg (D_HASH, "HASH: growing from %d to %d slots", hash->cur.n_slots, hash->cur.n_slots * 2);
+      hash->old = hash->cur;
+      hash->old_index = 0;
+      hash_slots_init (&hash->cur, hash->cur.n_slots * 2, hash->cur.max_probe);
+    }
+}
+
+struct hash_element *
+hash_lookup_fast (struct hash *hash,
+		  struct hash_bucket *bucket,
+		  const void *key,
+		  uint32_t hv)
+{
+  struct hash_element *he = hash_slots_find (hash, &hash->cur, key, hv, 0);
+  if (!he && hash->old.slots)
+    he = hash_slots_find (hash, &hash->old, key, hv, hash->old_index);
+  return he;
 }
 
 bool
@@ -120,29 +276,45 @@ hash_remove_fast (struct hash *hash,
 		  const void *key,
 		  uint32_t hv)
 {
-  struct hash_element *he;
-  struct hash_element *prev = NULL;
-
-  he = bucket->list;
+  struct hash_slots *t = &hash->cur;
+  struct hash_element *he = hash_slots_find (hash, t, key, hv, 0);
 
-  while (he)
+  if (!he && hash->old.slots)
     {
-      if (hv == he->hash_value && (*hash->compare_function)(key, he->key))
-	{
-	  if (prev)
-	    prev->next = he->next;
-	  else
-	    bucket->list = he->next;
-	  free (he);
-	  --hash->n_elements;
-	  return true;
-	}
-      prev = he;
-      he = he->next;
+      t = &hash->old;
+      he = hash_slots_find (hash, t, key, hv, hash->old_index);
+    }
+  if (he)
+    {
+      hash_slots_delete (t, he - t->slots);
+      --hash->n_elements;
+      return true;
     }
   return false;
 }
 
+void
+hash_add_fast (struct hash *hash,
+	       struct hash_bucket *bucket,
+	       const void *key,
+	       uint32_t hv,
+	       void *value)
+{
+  struct hash_element e;
+
+  if (hash->old.slots)
+    hash_migrate (hash, HASH_MIGRATE_STEP);
+  else
+    hash_grow (hash);
+
+  e.value = value;
+  e.key = key;
+  e.hash_value = hv;
+  e.dist = 0;
+  hash_put (hash, &e);
+  ++hash->n_elements;
+}
+
 bool
 hash_add (struct hash *hash, const void *key, void *value, bool replace)
 {
@@ -152,7 +324,7 @@ hash_add (struct hash *hash, const void *key, void *value, bool replace)
   bool ret = false;
 
   hv = hash_value (hash, key);
-  bucket = &hash->buckets[hv & hash->mask];
+  bucket = &hash->lock;
   mutex_lock (&bucket->mutex);
 
   if ((he = hash_lookup_fast (hash, bucket, key, hv))) /* already exists? */
@@ -189,33 +361,6 @@ hash_remove_by_value (struct hash *hash, void *value, bool autolock)
   hash_iterator_free (&hi);
 }
 
-static void
-hash_remove_marked (struct hash *hash, struct hash_bucket *bucket)
-{
-  struct hash_element *prev = NULL;
-  struct hash_element *he = bucket->list;
-
-  while (he)
-    {
-      if (!he->key) /* marked? */
-	{
-	  struct hash_element *newhe;
-	  if (prev)
-	    newhe = prev->next = he->next;
-	  else
-	    newhe = bucket->list = he->next;
-	  free (he);
-	  --hash->n_elements;
-	  he = newhe;
-	}
-      else
-	{
-	  prev = he;
-	  he = he->next;
-	}
-    }
-}
-
 uint32_t
 void_ptr_hash_function (const void *key, uint32_t iv)
 {
@@ -228,6 +373,22 @@ void_ptr_compare_function (const void *key1, const void *key2)
   return key1 == key2;
 }
 
+/*
+ * Map an iterator slot index to the slot array holding
+ * it: indices of the old table (if any) come first.
+ */
+static inline struct hash_slots *
+hash_iterator_slots (struct hash *hash, int *index)
+{
+  if (hash->old.slots)
+    {
+      if (*index < hash->old.n_alloc)
+	return &hash->old;
+      *index -= hash->old.n_alloc;
+    }
+  return &hash->cur;
+}
+
 void
 hash_iterator_init_range (struct hash *hash,
 		       struct hash_iterator *hi,
@@ -235,20 +396,18 @@ hash_iterator_init_range (struct hash *hash,
 		       int start_bucket,
 		       int end_bucket)
 {
-  if (end_bucket > hash->n_buckets)
-    end_bucket = hash->n_buckets;
+  if (end_bucket > hash_n_buckets (hash))
+    end_bucket = hash_n_buckets (hash);
 
   ASSERT (start_bucket >= 0 && start_bucket <= end_bucket);
 
   hi->hash = hash;
-  hi->elem = NULL;
-  hi->bucket = NULL;
   hi->autolock = autolock;
-  hi->last = NULL;
-  hi->bucket_marked = false;
-  hi->bucket_index_start = start_bucket;
-  hi->bucket_index_end = end_bucket;
-  hi->bucket_index = hi->bucket_index_start - 1;
+  hi->index = start_bucket;
+  hi->index_end = end_bucket;
+  hi->last = -1;
+  if (autolock)
+    mutex_lock (&hash->lock.mutex);
 }
 
 void
@@ -256,94 +415,53 @@ hash_iterator_init (struct hash *hash,
 		    struct hash_iterator *hi,
 		    bool autolock)
 {
-  hash_iterator_init_range (hash, hi, autolock, 0, hash->n_buckets);
-}
-
-static inline void
-hash_iterator_lock (struct hash_iterator *hi, struct hash_bucket *b)
-{
-  if (hi->autolock)
-    {
-      mutex_lock (&b->mutex);
-    }
-  hi->bucket = b;
-  hi->last = NULL;
-  hi->bucket_marked = false;
-}
-
-static inline void
-hash_iterator_unlock (struct hash_iterator *hi)
-{
-  if (hi->bucket)
-    {
-      if (hi->bucket_marked)
-	{
-	  hash_remove_marked (hi->hash, hi->bucket);
-	  hi->bucket_marked = false;
-	}
-      if (hi->autolock)
-	{
-	  mutex_unlock (&hi->bucket->mutex);
-	}
-      hi->bucket = NULL;
-      hi->last = NULL;
-    }
-}
-
-static inline void
-hash_iterator_advance (struct hash_iterator *hi)
-{
-  hi->last = hi->elem;
-  hi->elem = hi->elem->next;
+  hash_iterator_init_range (hash, hi, autolock, 0, hash_n_buckets (hash));
 }
 
 void
 hash_iterator_free (struct hash_iterator *hi)
 {
-  hash_iterator_unlock (hi);
+  if (hi->autolock)
+    mutex_unlock (&hi->hash->lock.mutex);
+  hi->autolock = false;
 }
 
 struct hash_element *
 hash_iterator_next (struct hash_iterator *hi)
 {
-  struct hash_element *ret = NULL;
-  if (hi->elem)
+  while (hi->index < hi->index_end)
     {
-      ret = hi->elem;
-      hash_iterator_advance (hi);
-    }
-  else
-    {
-      while (++hi->bucket_index < hi->bucket_index_end)
-	{
-	  struct hash_bucket *b;
-	  hash_iterator_unlock (hi);
-	  b = &hi->hash->buckets[hi->bucket_index];
-	  if (b->list)
-	    {
-	      hash_iterator_lock (hi, b);
-	      hi->elem = b->list;
-	      if (hi->elem)
-		{
-		  ret = hi->elem;
-		  hash_iterator_advance (hi);
-		  break;
-		}
-	    }
-	}
+      int i = hi->index;
+      const struct hash_slots *t = hash_iterator_slots (hi->hash, &i);
+      struct hash_element *he = &t->slots[i];
+
+      hi->last = hi->index++;
+      if (he->dist)
+	return he;
     }
-  return ret;
+  hi->last = -1;
+  return NULL;
 }
 
+/*
+ * Delete the element last returned by hash_iterator_next.
+ * Deletion shifts the following element back into its
+ * slot, so that slot is examined again.
+ */
 void
 hash_iterator_delete_element (struct hash_iterator *hi)
 {
-  ASSERT (hi->last);
-  hi->last->key = NULL;
-  hi->bucket_marked = true;
+  int i = hi->last;
+  struct hash_slots *t;
+
+  ASSERT (i >= 0);
+  t = hash_iterator_slots (hi->hash, &i);
+  hash_slots_delete (t, i);
+  --hi->hash->n_elements;
+  hi->index = hi->last;
+  hi->last = -1;
 }
 
-
 #ifdef LIST_TEST
 
 /*
@@ -397,6 +515,82 @@ rmhash (struct hash *hash, const char *word)
   hash_remove (hash, word);
 }
 
+/*
+ * Benchmark with keys the size of an IPv4 address:port,
+ * in a table which starts small and has to grow.
+ */
+#define BENCH_KEY_SIZE 6
+
+struct bench_key
+{
+  uint8_t addr[BENCH_KEY_SIZE];
+};
+
+static uint32_t
+bench_hash_function (const void *key, uint32_t iv)
+{
+  return hash_func ((const uint8_t *) key, BENCH_KEY_SIZE, iv);
+}
+
+static bool
+bench_compare_function (const void *key1, const void *key2)
+{
+  return memcmp (key1, key2, BENCH_KEY_SIZE) == 0;
+}
+
+/* nanoseconds per operation since start */
+static double
+bench_ns (const struct timeval *start, const int n)
+{
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return ((double) (tv.tv_sec - start->tv_sec) * 1000000000.0
+	  + (double) (tv.tv_usec - start->tv_usec) * 1000.0) / (double) n;
+}
+
+static void
+list_bench (const int n)
+{
+  struct hash *hash = hash_init (256, bench_hash_function, bench_compare_function);
+  struct bench_key *keys;
+  struct timeval start;
+  double add, hit, miss, del;
+  int found = 0;
+  int i, j;
+
+  /* keys [0,n) are added, keys [n,2n) are only looked up */
+  ALLOC_ARRAY (keys, struct bench_key, n * 2);
+  for (i = 0; i < n * 2; ++i)
+    for (j = 0; j < BENCH_KEY_SIZE; ++j)
+      keys[i].addr[j] = (uint8_t) random ();
+
+  gettimeofday (&start, NULL);
+  for (i = 0; i < n; ++i)
+    hash_add (hash, &keys[i], &keys[i], false);
+  add = bench_ns (&start, n);
+
+  gettimeofday (&start, NULL);
+  for (i = 0; i < n; ++i)
+    found += (hash_lookup (hash, &keys[i]) != NULL);
+  hit = bench_ns (&start, n);
+
+  gettimeofday (&start, NULL);
+  for (i = n; i < n * 2; ++i)
+    found -= (hash_lookup (hash, &keys[i]) != NULL);
+  miss = bench_ns (&start, n);
+
+  gettimeofday (&start, NULL);
+  for (i = 0; i < n; ++i)
+    hash_remove (hash, &keys[i]);
+  del = bench_ns (&start, n);
+
+  printf ("BENCH n=%d add=%.1fns hit=%.1fns miss=%.1fns remove=%.1fns found=%d left=%d\n",
+	  n, add, hit, miss, del, found, hash_n_elements (hash));
+
+  free (keys);
+  hash_free (hash);
+}
+
 void
 list_test (void)
 {
@@ -407,7 +601,7 @@ list_test (void)
     struct hash *hash = hash_init (10000, word_hash_function, word_compare_function);
     struct hash *nhash = hash_init (256, word_hash_function, word_compare_function);
 
-    printf ("hash_init n_buckets=%d mask=0x%08x\n", hash->n_buckets, hash->mask);
+    printf ("hash_init n_slots=%d mask=0x%08x\n", hash->cur.n_slots, hash->cur.mask);
   
     /* parse words from stdin */
     while (true)
@@ -515,6 +709,10 @@ list_test (void)
     gc_free (&gc);
   }
 
+  list_bench (1000);
+  list_bench (100000);
+  list_bench (1000000);
+
   openvpn_thread_cleanup ();
 }
 
@@ -32,6 +32,19 @@
  *
  * Hash tables are used in OpenVPN to keep track of
  * client instances over various key spaces.
+ *
+ * The table uses open addressing with Robin Hood
+ * linear probing: elements are stored directly in a
+ * slot array, ordered by home slot, together with
+ * their hash value, so that a lookup normally touches
+ * a single cache line before comparing keys.  Removal
+ * shifts the following elements back rather than
+ * leaving tombstones.
+ *
+ * When the table fills up, a table of twice the size
+ * is allocated and the old slots are moved over a few
+ * at a time on each subsequent add, so that growing a
+ * large table never stalls the event loop.
  */
 
 #if P2MP_SERVER
@@ -46,29 +59,66 @@
 #define hashsize(n) ((uint32_t)1<<(n))
 #define hashmask(n) (hashsize(n)-1)
 
+/*
+ * Probing does not wrap around at the end of the
+ * table.  Instead, max_probe overflow slots follow the
+ * last home slot, and the table is rebuilt if an element
+ * would be displaced further than that from its home
+ * slot: at twice the size if it is more than half full,
+ * otherwise with a doubled max_probe, so that a poor
+ * hash function degrades to a linear search rather than
+ * unbounded growth.
+ */
+#define HASH_MAX_PROBE    32
+
+/* smallest number of home slots */
+#define HASH_MIN_SLOTS    16
+
+/* old slots moved to the new table per add, while growing */
+#define HASH_MIGRATE_STEP 8
+
 struct hash_element
 {
   void *value;
   const void *key;
   unsigned int hash_value;
-  struct hash_element *next;
+  unsigned int dist; /* distance from home slot + 1, or 0 if slot is empty */
 };
 
+/*
+ * A single lock covers the whole table.
+ */
 struct hash_bucket
 {
   MUTEX_DEFINE (mutex);
-  struct hash_element * volatile list;
+};
+
+struct hash_slots
+{
+  int n_slots;    /* number of home slots, a power of 2 */
+  int mask;
+  int max_probe;  /* initially HASH_MAX_PROBE */
+  int n_alloc;    /* n_slots + max_probe */
+  struct hash_element *slots;
 };
 
 struct hash
 {
-  int n_buckets;
   int n_elements;
-  int mask;
   uint32_t iv;
   uint32_t (*hash_function)(const void *key, uint32_t iv);
   bool (*compare_function)(const void *key1, const void *key2); /* return true if equal */
-  struct hash_bucket *buckets;
+  struct hash_bucket lock;
+
+  /* new elements are always added here */
+  struct hash_slots cur;
+
+  /*
+   * While growing, the previous slot array.  Slots
+   * below old_index have already been moved to cur.
+   */
+  struct hash_slots old;
+  int old_index;
 };
 
 struct hash *hash_init (const int n_buckets,
@@ -79,6 +129,10 @@ void hash_free (struct hash *hash);
 
 bool hash_add (struct hash *hash, const void *key, void *value, bool replace);
 
+/*
+ * The element returned by hash_lookup_fast remains valid
+ * until the next add or remove on the same table.
+ */
 struct hash_element *hash_lookup_fast (struct hash *hash,
 				       struct hash_bucket *bucket,
 				       const void *key,
@@ -89,19 +143,28 @@ bool hash_remove_fast (struct hash *hash,
 		       const void *key,
 		       uint32_t hv);
 
+/* NOTE: assumes that key is not a duplicate */
+void hash_add_fast (struct hash *hash,
+		    struct hash_bucket *bucket,
+		    const void *key,
+		    uint32_t hv,
+		    void *value);
+
 void hash_remove_by_value (struct hash *hash, void *value, bool autolock);
 
+/*
+ * Iteration is over slot indices, which take the place
+ * of bucket indices in hash_iterator_init_range.  Elements
+ * may be deleted through the iterator, but the table must
+ * not otherwise be modified while an iterator is open.
+ */
 struct hash_iterator
 {
   struct hash *hash;
-  int bucket_index;
-  struct hash_bucket *bucket;
-  struct hash_element *elem;
-  struct hash_element *last;
-  bool bucket_marked;
+  int index;       /* next slot to examine */
+  int index_end;
+  int last;        /* slot of last returned element, or -1 */
   bool autolock;
-  int bucket_index_start;
-  int bucket_index_end;
 };
 
 void hash_iterator_init_range (struct hash *hash,
@@ -136,16 +199,23 @@ hash_n_elements (const struct hash *hash)
   return hash->n_elements;
 }
 
+/*
+ * Number of slot indices which may be passed to
+ * hash_iterator_init_range.
+ */
 static inline int
 hash_n_buckets (const struct hash *hash)
 {
-  return hash->n_buckets;
+  if (hash->old.slots)
+    return hash->old.n_alloc + hash->cur.n_alloc;
+  else
+    return hash->cur.n_alloc;
 }
 
 static inline struct hash_bucket *
 hash_bucket (struct hash *hash, uint32_t hv)
 {
-  return &hash->buckets[hv & hash->mask];
+  return &hash->lock;
 }
 
 static inline void
@@ -165,7 +235,7 @@ hash_lookup_lock (struct hash *hash, const void *key, uint32_t hv)
 {
   void *ret = NULL;
   struct hash_element *he;
-  struct hash_bucket *bucket = &hash->buckets[hv & hash->mask];
+  struct hash_bucket *bucket = &hash->lock;
 
   mutex_lock (&bucket->mutex);
   he = hash_lookup_fast (hash, bucket, key, hv);
@@ -182,25 +252,6 @@ hash_lookup (struct hash *hash, const void *key)
   return hash_lookup_lock (hash, key, hash_value (hash, key));
 }
 
-/* NOTE: assumes that key is not a duplicate */
-static inline void
-hash_add_fast (struct hash *hash,
-	       struct hash_bucket *bucket,
-	       const void *key,
-	       uint32_t hv,
-	       void *value)
-{
-  struct hash_element *he;
-
-  ALLOC_OBJ (he, struct hash_element);
-  he->value = value;
-  he->key = key;
-  he->hash_value = hv;
-  he->next = bucket->list;
-  bucket->list = he;
-  ++hash->n_elements;
-}
-
 static inline bool
 hash_remove (struct hash *hash, const void *key)
 {
@@ -209,7 +260,7 @@ hash_remove (struct hash *hash, const void *key)
   bool ret;
 
   hv = hash_value (hash, key);
-  bucket = &hash->buckets[hv & hash->mask];
+  bucket = &hash->lock;
   mutex_lock (&bucket->mutex);
   ret = hash_remove_fast (hash, bucket, key, hv);
   mutex_unlock (&bucket->mutex);
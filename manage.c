@@ -40,6 +40,7 @@
 #include "otime.h"
 #include "integer.h"
 #include "manage.h"
+#include "perf.h"
 
 #include "memdbg.h"
 
@@ -55,8 +56,18 @@ man_help ()
   msg (M_CLIENT, "Management Interface for %s", title_string);
   msg (M_CLIENT, "Commands:");
   msg (M_CLIENT, "auth-retry t           : Auth failure retry mode (none,interact,nointeract).");
+  msg (M_CLIENT, "bytecount n            : Show bytes in/out of each client every n seconds");
+  msg (M_CLIENT, "                         (0 to disable).");
+  msg (M_CLIENT, "ccd-cache [list]       : Show --ccd-cache statistics, or list cached files.");
+  msg (M_CLIENT, "ccd-cache flush [cn]   : Drop cached ccd file for cn, or all files.");
+  msg (M_CLIENT, "client-filter cn       : Show --client-filter rules and hit counts of");
+  msg (M_CLIENT, "                         client(s) having common name cn.");
+  msg (M_CLIENT, "client-shaper cn o [i] : Limit output to/input from client(s) having");
+  msg (M_CLIENT, "                         common name cn to o/i bytes per second.");
   msg (M_CLIENT, "echo [on|off] [N|all]  : Like log, but only show messages in echo buffer.");
   msg (M_CLIENT, "exit|quit              : Close management session.");
+  msg (M_CLIENT, "handoff                : Restart the server as a new process, keeping");
+  msg (M_CLIENT, "                         clients connected (needs --handoff).");
   msg (M_CLIENT, "help                   : Print this message.");
   msg (M_CLIENT, "hold [on|off|release]  : Set/show hold flag to on/off state, or"); 
   msg (M_CLIENT, "                         release current hold and start tunnel."); 
@@ -67,6 +78,9 @@ man_help ()
   msg (M_CLIENT, "mute [n]               : Set log mute level to n, or show level if n is absent.");
   msg (M_CLIENT, "net                    : (Windows only) Show network info and routing table.");
   msg (M_CLIENT, "password type p        : Enter password p for a queried OpenVPN password.");
+  msg (M_CLIENT, "perf [reset]           : Show per-stage latency percentiles, or clear them.");
+  msg (M_CLIENT, "reload                 : Re-read server options, applying those which");
+  msg (M_CLIENT, "                         can change without disconnecting clients.");
   msg (M_CLIENT, "signal s               : Send signal s to daemon,");
   msg (M_CLIENT, "                         s = SIGHUP|SIGTERM|SIGUSR1|SIGUSR2.");
   msg (M_CLIENT, "state [on|off] [N|all] : Like log, but show state history.");
@@ -283,6 +297,122 @@ man_status (struct management *man, const int version, struct status_output *so)
     }
 }
 
+static void
+man_client_shaper (struct management *man, const char *cn, const char *out, const char *in)
+{
+  if (man->persist.callback.shaper_by_cn)
+    {
+      const int n = (*man->persist.callback.shaper_by_cn) (man->persist.callback.arg,
+							   cn,
+							   atoi (out),
+							   in ? atoi (in) : 0);
+      if (n > 0)
+	msg (M_CLIENT, "SUCCESS: common name '%s' found, %d client(s) shaped", cn, n);
+      else if (n < 0)
+	msg (M_CLIENT, "ERROR: bad rate, must be 0 or a bytes per second value");
+      else
+	msg (M_CLIENT, "ERROR: common name '%s' not found", cn);
+    }
+  else
+    {
+      msg (M_CLIENT, "ERROR: The 'client-shaper' command is not supported by the current daemon mode");
+    }
+}
+
+static void
+man_client_filter (struct management *man, const char *cn)
+{
+  if (man->persist.callback.client_filter_show)
+    {
+      const int n = (*man->persist.callback.client_filter_show) (man->persist.callback.arg, cn);
+      if (n > 0)
+	msg (M_CLIENT, "END");
+      else
+	msg (M_CLIENT, "ERROR: common name '%s' not found", cn);
+    }
+  else
+    {
+      msg (M_CLIENT, "ERROR: The 'client-filter' command is not supported by the current daemon mode");
+    }
+}
+
+static void
+man_ccd_cache (struct management *man, const char *cmd, const char *cn)
+{
+  if (man->persist.callback.ccd_cache_show && man->persist.callback.ccd_cache_flush)
+    {
+      if (!cmd || streq (cmd, "list"))
+	{
+	  if (!(*man->persist.callback.ccd_cache_show) (man->persist.callback.arg, cmd != NULL))
+	    msg (M_CLIENT, "ERROR: --ccd-cache is not enabled");
+	}
+      else if (streq (cmd, "flush"))
+	{
+	  const int n = (*man->persist.callback.ccd_cache_flush) (man->persist.callback.arg, cn);
+	  if (n >= 0)
+	    msg (M_CLIENT, "SUCCESS: %d cached ccd file(s) flushed", n);
+	  else
+	    msg (M_CLIENT, "ERROR: --ccd-cache is not enabled");
+	}
+      else
+	msg (M_CLIENT, "ERROR: unknown ccd-cache command: %s", cmd);
+    }
+  else
+    {
+      msg (M_CLIENT, "ERROR: The 'ccd-cache' command is not supported by the current daemon mode");
+    }
+}
+
+static void
+man_handoff (struct management *man)
+{
+  if (man->persist.callback.handoff)
+    {
+      if ((*man->persist.callback.handoff) (man->persist.callback.arg))
+	msg (M_CLIENT, "SUCCESS: handoff scheduled");
+      else
+	msg (M_CLIENT, "ERROR: --handoff is not enabled");
+    }
+  else
+    {
+      msg (M_CLIENT, "ERROR: The 'handoff' command is not supported by the current daemon mode");
+    }
+}
+
+static void
+man_reload (struct management *man)
+{
+  if (man->persist.callback.reload)
+    {
+      (*man->persist.callback.reload) (man->persist.callback.arg);
+      msg (M_CLIENT, "SUCCESS: reload scheduled");
+    }
+  else
+    {
+      msg (M_CLIENT, "ERROR: The 'reload' command is not supported by the current daemon mode");
+    }
+}
+
+static void
+man_bytecount (struct management *man, const int update_seconds)
+{
+  if (man->persist.callback.bytecount)
+    {
+      if (update_seconds >= 0)
+	{
+	  man->connection.bytecount_update_seconds = update_seconds;
+	  (*man->persist.callback.bytecount) (man->persist.callback.arg, update_seconds);
+	  msg (M_CLIENT, "SUCCESS: bytecount interval changed");
+	}
+      else
+	msg (M_CLIENT, "ERROR: bytecount interval must be 0 or a number of seconds");
+    }
+  else
+    {
+      msg (M_CLIENT, "ERROR: The 'bytecount' command is not supported by the current daemon mode");
+    }
+}
+
 static void
 man_kill (struct management *man, const char *victim)
 {
@@ -614,6 +744,33 @@ man_dispatch_command (struct management *man, struct status_output *so, const ch
       if (man_need (man, p, 1, 0))
 	man_kill (man, p[1]);
     }
+  else if (streq (p[0], "bytecount"))
+    {
+      if (man_need (man, p, 1, 0))
+	man_bytecount (man, atoi (p[1]));
+    }
+  else if (streq (p[0], "handoff"))
+    {
+      man_handoff (man);
+    }
+  else if (streq (p[0], "reload"))
+    {
+      man_reload (man);
+    }
+  else if (streq (p[0], "ccd-cache"))
+    {
+      man_ccd_cache (man, p[1], p[1] ? p[2] : NULL);
+    }
+  else if (streq (p[0], "client-filter"))
+    {
+      if (man_need (man, p, 1, 0))
+	man_client_filter (man, p[1]);
+    }
+  else if (streq (p[0], "client-shaper"))
+    {
+      if (man_need (man, p, 2, MN_AT_LEAST))
+	man_client_shaper (man, p[1], p[2], p[3]);
+    }
   else if (streq (p[0], "verb"))
     {
       if (p[1])
@@ -654,6 +811,25 @@ man_dispatch_command (struct management *man, struct status_output *so, const ch
 	msg (M_CLIENT, "SUCCESS: auth-retry=%s", auth_retry_print ());	
 #else
       msg (M_CLIENT, "ERROR: auth-retry feature is unavailable");
+#endif
+    }
+  else if (streq (p[0], "perf"))
+    {
+#ifdef ENABLE_PERFORMANCE_METRICS
+      if (p[1] && streq (p[1], "reset"))
+	{
+	  perf_reset ();
+	  msg (M_CLIENT, "SUCCESS: latency histograms cleared");
+	}
+      else if (p[1])
+	msg (M_CLIENT, "ERROR: bad perf parameter");
+      else
+	{
+	  perf_print (M_CLIENT);
+	  msg (M_CLIENT, "END");
+	}
+#else
+      msg (M_CLIENT, "ERROR: perf feature is unavailable");
 #endif
     }
   else if (streq (p[0], "state"))
@@ -785,6 +961,7 @@ man_accept (struct management *man)
       man->connection.state_realtime = false;
       man->connection.log_realtime = false;
       man->connection.echo_realtime = false;
+      man->connection.bytecount_update_seconds = 0;
       man->connection.password_verified = false;
       man->connection.password_tries = 0;
       man->connection.halt = false;
@@ -1360,6 +1537,21 @@ management_set_state (struct management *man,
     }
 }
 
+/*
+ * Queue one >BYTECOUNT_CLI notification.
+ */
+void
+management_bytecount_client (struct management *man,
+			     const unsigned long cid,
+			     const counter_type bytes_in,
+			     const counter_type bytes_out)
+{
+  char out[128];
+  openvpn_snprintf (out, sizeof (out), ">BYTECOUNT_CLI:%lu," counter_format "," counter_format "\r\n",
+		    cid, bytes_in, bytes_out);
+  man_output_list_push (man, out);
+}
+
 void
 management_echo (struct management *man, const char *string)
 {
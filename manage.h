@@ -149,6 +149,13 @@ struct management_callback
   void (*show_net) (void *arg, const int msglevel);
   int (*kill_by_cn) (void *arg, const char *common_name);
   int (*kill_by_addr) (void *arg, const in_addr_t addr, const int port);
+  int (*shaper_by_cn) (void *arg, const char *common_name, const int out, const int in);
+  int (*client_filter_show) (void *arg, const char *common_name);
+  bool (*ccd_cache_show) (void *arg, const bool list);
+  int (*ccd_cache_flush) (void *arg, const char *common_name);
+  void (*bytecount) (void *arg, const int seconds);
+  bool (*handoff) (void *arg);
+  void (*reload) (void *arg);
   void (*delete_event) (void *arg, event_t event);
 };
 
@@ -230,6 +237,7 @@ struct man_connection {
   bool state_realtime;
   bool log_realtime;
   bool echo_realtime;
+  int bytecount_update_seconds;
 
   const char *up_query_type;
   int up_query_mode;
@@ -292,6 +300,34 @@ management_connected (const struct management *man)
   return man->connection.state == MS_CC_WAIT_READ || man->connection.state == MS_CC_WAIT_WRITE;
 }
 
+/*
+ * Periodic per-client byte counts, requested by the
+ * "bytecount n" command in server mode.  Notifications
+ * are not queued while the output queue holds more
+ * than MANAGEMENT_BYTECOUNT_QUEUE_MAX lines.
+ */
+#define MANAGEMENT_BYTECOUNT_QUEUE_MAX 256
+
+static inline int
+management_bytecount_interval (const struct management *man)
+{
+  if (management_connected (man))
+    return man->connection.bytecount_update_seconds;
+  else
+    return 0;
+}
+
+static inline bool
+management_bytecount_ready (const struct management *man)
+{
+  return man->connection.out->size < MANAGEMENT_BYTECOUNT_QUEUE_MAX;
+}
+
+void management_bytecount_client (struct management *man,
+				  const unsigned long cid,
+				  const counter_type bytes_in,
+				  const counter_type bytes_out);
+
 static inline bool
 management_query_user_pass_enabled (const struct management *man)
 {
@@ -36,6 +36,7 @@
 #include "error.h"
 #include "misc.h"
 #include "mbuf.h"
+#include "integer.h"
 
 #include "memdbg.h"
 
@@ -91,9 +92,17 @@ mbuf_free_buf (struct mbuf_buffer *mb)
     }
 }
 
-void
+/*
+ * Add item to the tail of the queue.  If the queue is
+ * full, the oldest item is dropped to make room, and
+ * false is returned.
+ */
+bool
 mbuf_add_item (struct mbuf_set *ms, const struct mbuf_item *item)
 {
+  bool ret = true;
+  struct mbuf_item *dest;
+
   ASSERT (ms);
   mutex_lock (&ms->mutex);
   if (ms->len == ms->capacity)
@@ -102,15 +111,19 @@ mbuf_add_item (struct mbuf_set *ms, const struct mbuf_item *item)
       ASSERT (mbuf_extract_item (ms, &rm, false));
       mbuf_free_buf (rm.buffer);
       msg (D_MULTI_DROPPED, "MBUF: mbuf packet dropped");
+      ret = false;
     }
 
   ASSERT (ms->len < ms->capacity);
 
-  ms->array[MBUF_INDEX(ms->head, ms->len, ms->capacity)] = *item;
+  dest = &ms->array[MBUF_INDEX(ms->head, ms->len, ms->capacity)];
+  *dest = *item;
+  dest->tv = now_tv;
   if (++ms->len > ms->max_queued)
     ms->max_queued = ms->len;
   ++item->buffer->refcount;
   mutex_unlock (&ms->mutex);
+  return ret;
 }
 
 bool
@@ -182,6 +195,436 @@ mbuf_dereference_instance (struct mbuf_set *ms, struct multi_instance *mi)
     }
 }
 
+struct mbuf_fq *
+mbuf_fq_init (unsigned int flow_capacity, int quantum)
+{
+  struct mbuf_fq *ret;
+  ALLOC_OBJ_CLEAR (ret, struct mbuf_fq);
+  mutex_init (&ret->mutex);
+  ret->flow_capacity = flow_capacity;
+  ret->quantum = max_int (quantum, 1);
+  return ret;
+}
+
+/*
+ * Flows belong to their instances, and are
+ * released by mbuf_fq_remove when the instance
+ * is closed.
+ */
+void
+mbuf_fq_free (struct mbuf_fq *fq)
+{
+  if (fq)
+    {
+      mutex_destroy (&fq->mutex);
+      free (fq);
+    }
+}
+
+void
+mbuf_flow_init (struct mbuf_flow *flow, struct multi_instance *instance)
+{
+  CLEAR (*flow);
+  flow->instance = instance;
+}
+
+static void
+mbuf_fq_activate (struct mbuf_fq *fq, struct mbuf_flow *flow)
+{
+  flow->active = true;
+  flow->deficit = fq->quantum;
+  flow->next = NULL;
+  if (fq->tail)
+    fq->tail->next = flow;
+  else
+    fq->head = flow;
+  fq->tail = flow;
+}
+
+/* remove the flow at the head of the active list */
+static void
+mbuf_fq_deactivate_head (struct mbuf_fq *fq)
+{
+  struct mbuf_flow *flow = fq->head;
+  fq->head = flow->next;
+  if (!fq->head)
+    fq->tail = NULL;
+  flow->next = NULL;
+  flow->active = false;
+}
+
+/* move the flow at the head of the active list to the tail */
+static void
+mbuf_fq_rotate (struct mbuf_fq *fq)
+{
+  struct mbuf_flow *flow = fq->head;
+  if (flow != fq->tail)
+    {
+      fq->head = flow->next;
+      flow->next = NULL;
+      fq->tail->next = flow;
+      fq->tail = flow;
+    }
+}
+
+bool
+mbuf_fq_add (struct mbuf_fq *fq, struct mbuf_flow *flow, struct mbuf_buffer *mb)
+{
+  struct mbuf_item item;
+  bool ret;
+
+  mutex_lock (&fq->mutex);
+
+  if (!flow->queue)
+    flow->queue = mbuf_init (fq->flow_capacity);
+
+  item.buffer = mb;
+  item.instance = flow->instance;
+  ret = mbuf_add_item (flow->queue, &item);
+  if (ret)
+    {
+      if (++fq->len > fq->max_queued)
+	fq->max_queued = fq->len;
+    }
+  else
+    ++flow->dropped;
+
+  if (!flow->active && !flow->throttled)
+    mbuf_fq_activate (fq, flow);
+
+  mutex_unlock (&fq->mutex);
+  return ret;
+}
+
+/*
+ * Move the flow at the head of the active list to
+ * the throttled list, until delay usec from now.
+ */
+static void
+mbuf_fq_throttle_head (struct mbuf_fq *fq, const int delay)
+{
+  struct mbuf_flow *flow = fq->head;
+  struct timeval tv;
+
+  mbuf_fq_deactivate_head (fq);
+  tv.tv_sec = delay / 1000000;
+  tv.tv_usec = delay % 1000000;
+  tv_future (&flow->release, &tv);
+  flow->throttled = true;
+  flow->next = fq->throttled;
+  fq->throttled = flow;
+}
+
+/*
+ * Return throttled flows whose release time has
+ * arrived to the active list.  If any flows remain
+ * throttled, return true, and if next is not NULL,
+ * set it to the earliest release time.
+ */
+static bool
+mbuf_fq_release_dowork (struct mbuf_fq *fq, struct timeval *next)
+{
+  struct mbuf_flow **pp = &fq->throttled;
+  bool ret = false;
+
+  while (*pp)
+    {
+      struct mbuf_flow *flow = *pp;
+      if (tv_expired (&flow->release))
+	{
+	  *pp = flow->next;
+	  flow->throttled = false;
+	  if (mbuf_defined (flow->queue))
+	    mbuf_fq_activate (fq, flow);
+	}
+      else
+	{
+	  if (next && (!ret || tv_lt (&flow->release, next)))
+	    *next = flow->release;
+	  ret = true;
+	  pp = &flow->next;
+	}
+    }
+  return ret;
+}
+
+bool
+mbuf_fq_release (struct mbuf_fq *fq, struct timeval *next)
+{
+  bool ret;
+  mutex_lock (&fq->mutex);
+  ret = mbuf_fq_release_dowork (fq, next);
+  mutex_unlock (&fq->mutex);
+  return ret;
+}
+
+/*
+ * Integer square root, used by the CoDel control law.
+ */
+static unsigned int
+mbuf_isqrt (unsigned int x)
+{
+  unsigned int r = 0;
+  unsigned int bit = 1u << 30;
+
+  while (bit > x)
+    bit >>= 2;
+  while (bit)
+    {
+      if (x >= r + bit)
+	{
+	  x -= r + bit;
+	  r = (r >> 1) + bit;
+	}
+      else
+	r >>= 1;
+      bit >>= 2;
+    }
+  return r;
+}
+
+/*
+ * CoDel control law: the time of the next drop is
+ * MBUF_CODEL_INTERVAL / sqrt(count) after t.
+ */
+static void
+mbuf_codel_control_law (struct timeval *dest, const struct timeval *t, unsigned int count)
+{
+  struct timeval delta;
+  const unsigned int usec = MBUF_CODEL_INTERVAL / max_int ((int) mbuf_isqrt (count), 1);
+
+  delta.tv_sec = usec / 1000000;
+  delta.tv_usec = usec % 1000000;
+  *dest = *t;
+  tv_add (dest, &delta);
+}
+
+/*
+ * Take the item at the head of the flow queue, and
+ * decide whether CoDel considers it a candidate for
+ * dropping.  Return false if the queue is empty.
+ */
+static bool
+mbuf_codel_dodequeue (struct mbuf_fq *fq, struct mbuf_flow *flow, struct mbuf_item *item, bool *ok_to_drop)
+{
+  *ok_to_drop = false;
+  if (!mbuf_extract_item (flow->queue, item, true))
+    {
+      tv_clear (&flow->first_above_time);
+      return false;
+    }
+
+  --fq->len;
+  flow->sojourn = tv_elapsed_usec (&item->tv, 60);
+
+  if (flow->sojourn < MBUF_CODEL_TARGET || !flow->queue->len)
+    {
+      /* went below target, or queue is almost empty */
+      tv_clear (&flow->first_above_time);
+    }
+  else if (!tv_defined (&flow->first_above_time))
+    {
+      /* went above target, allow one interval before dropping */
+      struct timeval interval;
+      interval.tv_sec = MBUF_CODEL_INTERVAL / 1000000;
+      interval.tv_usec = MBUF_CODEL_INTERVAL % 1000000;
+      tv_future (&flow->first_above_time, &interval);
+    }
+  else if (tv_expired (&flow->first_above_time))
+    {
+      /* stayed above target for at least one interval */
+      *ok_to_drop = true;
+    }
+  return true;
+}
+
+static void
+mbuf_codel_drop (struct mbuf_flow *flow, struct mbuf_item *item)
+{
+  mbuf_free_buf (item->buffer);
+  ++flow->dropped;
+  msg (D_MULTI_DROPPED, "MBUF: packet dropped by CoDel, sojourn=%d usec", flow->sojourn);
+}
+
+/*
+ * Dequeue an item from flow, applying the CoDel algorithm.
+ */
+static bool
+mbuf_codel_dequeue (struct mbuf_fq *fq, struct mbuf_flow *flow, struct mbuf_item *item)
+{
+  bool ok_to_drop;
+  bool ret = mbuf_codel_dodequeue (fq, flow, item, &ok_to_drop);
+
+  if (!ret)
+    {
+      flow->dropping = false;
+      return false;
+    }
+
+  if (flow->dropping)
+    {
+      if (!ok_to_drop)
+	{
+	  /* sojourn time below target -- leave dropping state */
+	  flow->dropping = false;
+	}
+      else
+	{
+	  while (flow->dropping && tv_expired (&flow->drop_next))
+	    {
+	      mbuf_codel_drop (flow, item);
+	      ++flow->count;
+	      ret = mbuf_codel_dodequeue (fq, flow, item, &ok_to_drop);
+	      if (!ret || !ok_to_drop)
+		flow->dropping = false;
+	      else
+		mbuf_codel_control_law (&flow->drop_next, &flow->drop_next, flow->count);
+	    }
+	}
+    }
+  else if (ok_to_drop)
+    {
+      unsigned int delta;
+
+      mbuf_codel_drop (flow, item);
+      ret = mbuf_codel_dodequeue (fq, flow, item, &ok_to_drop);
+      flow->dropping = true;
+
+      /*
+       * If we were in dropping state recently, start at
+       * the drop rate which was last in effect.
+       */
+      delta = flow->count - flow->lastcount;
+      if (delta > 1 && tv_elapsed_usec (&flow->drop_next, 60) < 16 * MBUF_CODEL_INTERVAL)
+	flow->count = delta;
+      else
+	flow->count = 1;
+      mbuf_codel_control_law (&flow->drop_next, &now_tv, flow->count);
+      flow->lastcount = flow->count;
+    }
+  return ret;
+}
+
+/*
+ * Bring the flow which should be serviced next to the
+ * head of the active list, retiring empty flows and
+ * topping up the credit of flows which have used
+ * their quantum.
+ */
+static struct mbuf_flow *
+mbuf_fq_next_flow (struct mbuf_fq *fq)
+{
+  struct mbuf_flow *flow;
+
+  if (fq->throttled)
+    mbuf_fq_release_dowork (fq, NULL);
+
+  while ((flow = fq->head))
+    {
+      if (!mbuf_defined (flow->queue))
+	mbuf_fq_deactivate_head (fq);
+      else if (flow->deficit <= 0)
+	{
+	  flow->deficit += fq->quantum;
+	  mbuf_fq_rotate (fq);
+	}
+      else if (flow->shaper && !token_bucket_conform (flow->shaper))
+	mbuf_fq_throttle_head (fq, token_bucket_delay (flow->shaper));
+      else
+	break;
+    }
+  return flow;
+}
+
+struct multi_instance *
+mbuf_fq_peek_dowork (struct mbuf_fq *fq)
+{
+  struct multi_instance *ret = NULL;
+  struct mbuf_flow *flow;
+
+  mutex_lock (&fq->mutex);
+  flow = mbuf_fq_next_flow (fq);
+  if (flow)
+    ret = flow->instance;
+  mutex_unlock (&fq->mutex);
+  return ret;
+}
+
+/*
+ * Extract the next item to be sent.  May return false
+ * even though packets are still queued, if CoDel dropped
+ * the remaining contents of the flow being serviced.
+ */
+bool
+mbuf_fq_extract (struct mbuf_fq *fq, struct mbuf_item *item)
+{
+  bool ret = false;
+  struct mbuf_flow *flow;
+
+  mutex_lock (&fq->mutex);
+  flow = mbuf_fq_next_flow (fq);
+  if (flow)
+    {
+      ret = mbuf_codel_dequeue (fq, flow, item);
+      if (ret)
+	{
+	  flow->deficit -= BLEN (&item->buffer->buf);
+	  if (flow->shaper)
+	    token_bucket_consume (flow->shaper, BLEN (&item->buffer->buf));
+	}
+      if (!mbuf_defined (flow->queue))
+	mbuf_fq_deactivate_head (fq);
+    }
+  mutex_unlock (&fq->mutex);
+  return ret;
+}
+
+/*
+ * Called when an instance is closed: drop any packets
+ * still queued for it and release its queue.
+ */
+void
+mbuf_fq_remove (struct mbuf_fq *fq, struct mbuf_flow *flow)
+{
+  if (fq)
+    {
+      mutex_lock (&fq->mutex);
+      if (flow->throttled)
+	{
+	  struct mbuf_flow **pp = &fq->throttled;
+	  while (*pp != flow)
+	    pp = &(*pp)->next;
+	  *pp = flow->next;
+	  flow->next = NULL;
+	  flow->throttled = false;
+	}
+      else if (flow->active)
+	{
+	  struct mbuf_flow **pp = &fq->head;
+	  struct mbuf_flow *prev = NULL;
+
+	  while (*pp != flow)
+	    {
+	      prev = *pp;
+	      pp = &prev->next;
+	    }
+	  *pp = flow->next;
+	  if (fq->tail == flow)
+	    fq->tail = prev;
+	  flow->next = NULL;
+	  flow->active = false;
+	}
+      if (flow->queue)
+	{
+	  fq->len -= flow->queue->len;
+	  mbuf_free (flow->queue);
+	  flow->queue = NULL;
+	  msg (D_MBUF, "MBUF: released client output queue");
+	}
+      mutex_unlock (&fq->mutex);
+    }
+}
+
 #else
 static void dummy(void) {}
 #endif /* P2MP */
@@ -36,6 +36,9 @@
 
 #include "basic.h"
 #include "buffer.h"
+#include "common.h"
+#include "otime.h"
+#include "shaper.h"
 
 struct multi_instance;
 
@@ -54,6 +57,7 @@ struct mbuf_item
 {
   struct mbuf_buffer *buffer;
   struct multi_instance *instance;
+  struct timeval tv;             /* time queued (now_tv) */
 };
 
 struct mbuf_set
@@ -72,7 +76,7 @@ void mbuf_free (struct mbuf_set *ms);
 struct mbuf_buffer *mbuf_alloc_buf (const struct buffer *buf);
 void mbuf_free_buf (struct mbuf_buffer *mb);
 
-void mbuf_add_item (struct mbuf_set *ms, const struct mbuf_item *item);
+bool mbuf_add_item (struct mbuf_set *ms, const struct mbuf_item *item);
 
 bool mbuf_extract_item (struct mbuf_set *ms, struct mbuf_item *item, const bool lock);
 
@@ -106,5 +110,124 @@ mbuf_peek (struct mbuf_set *ms)
     return NULL;
 }
 
+/*
+ * Fair queueing of client output.
+ *
+ * Each client instance has its own output queue (struct mbuf_flow).
+ * Queues with pending packets are kept on an active list which
+ * is serviced by deficit round robin, so that every client gets
+ * an equal share of output bytes, regardless of how much traffic
+ * is queued for other clients.
+ *
+ * Each queue is also managed by CoDel: if packets have been
+ * waiting in a queue for longer than MBUF_CODEL_TARGET for at
+ * least MBUF_CODEL_INTERVAL, packets are dropped at the head of
+ * the queue at an increasing rate until the queueing delay falls
+ * back below target.
+ *
+ * A queue may be rate limited by a token bucket.  When the bucket
+ * runs dry, the queue is moved from the active list to a list of
+ * throttled queues until the bucket has refilled, and the server
+ * event loop is told when to wake up to release it.
+ */
+
+#define MBUF_CODEL_TARGET    5000   /* usec */
+#define MBUF_CODEL_INTERVAL  100000 /* usec */
+
+struct mbuf_flow
+{
+  struct mbuf_set *queue;        /* allocated on first use */
+  struct multi_instance *instance;
+  struct mbuf_flow *next;        /* active or throttled list link */
+  bool active;
+  int deficit;                   /* DRR byte credit */
+
+  /* rate limit */
+  struct token_bucket *shaper;   /* NULL if unlimited */
+  bool throttled;
+  struct timeval release;        /* when throttled flow may send again */
+
+  /* CoDel state */
+  bool dropping;
+  unsigned int count;
+  unsigned int lastcount;
+  struct timeval first_above_time;
+  struct timeval drop_next;
+
+  /* statistics */
+  int sojourn;                   /* usec spent queued by last packet sent */
+  counter_type dropped;
+};
+
+struct mbuf_fq
+{
+  MUTEX_DEFINE (mutex);
+  struct mbuf_flow *head;        /* active flows in service order */
+  struct mbuf_flow *tail;
+  struct mbuf_flow *throttled;   /* flows waiting for their shaper */
+  unsigned int flow_capacity;
+  int quantum;
+  unsigned int len;              /* packets queued over all flows */
+  unsigned int max_queued;
+};
+
+struct mbuf_fq *mbuf_fq_init (unsigned int flow_capacity, int quantum);
+void mbuf_fq_free (struct mbuf_fq *fq);
+
+void mbuf_flow_init (struct mbuf_flow *flow, struct multi_instance *instance);
+
+bool mbuf_fq_add (struct mbuf_fq *fq, struct mbuf_flow *flow, struct mbuf_buffer *mb);
+
+bool mbuf_fq_extract (struct mbuf_fq *fq, struct mbuf_item *item);
+
+void mbuf_fq_remove (struct mbuf_fq *fq, struct mbuf_flow *flow);
+
+bool mbuf_fq_release (struct mbuf_fq *fq, struct timeval *next);
+
+/* is there output which may be sent now? */
+static inline bool
+mbuf_fq_defined (const struct mbuf_fq *fq)
+{
+  return fq && fq->head;
+}
+
+static inline bool
+mbuf_fq_throttled (const struct mbuf_fq *fq)
+{
+  return fq && fq->throttled;
+}
+
+static inline int
+mbuf_fq_maximum_queued (const struct mbuf_fq *fq)
+{
+  return (int) fq->max_queued;
+}
+
+static inline int
+mbuf_flow_len (const struct mbuf_flow *flow)
+{
+  return flow->queue ? (int) flow->queue->len : 0;
+}
+
+static inline int
+mbuf_flow_maximum_queued (const struct mbuf_flow *flow)
+{
+  return flow->queue ? mbuf_maximum_queued (flow->queue) : 0;
+}
+
+/*
+ * Return the instance whose output will be
+ * returned by the next call to mbuf_fq_extract.
+ */
+static inline struct multi_instance *
+mbuf_fq_peek (struct mbuf_fq *fq)
+{
+  struct multi_instance *mbuf_fq_peek_dowork (struct mbuf_fq *fq);
+  if (mbuf_fq_defined (fq))
+    return mbuf_fq_peek_dowork (fq);
+  else
+    return NULL;
+}
+
 #endif
 #endif
@@ -0,0 +1,421 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2005 OpenVPN Solutions LLC <info@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef WIN32
+#include "config-win32.h"
+#else
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#if P2MP_SERVER
+
+#include "multi.h"
+#include "mcast.h"
+#include "proto.h"
+
+#include "memdbg.h"
+
+/*
+ * IGMP message types (RFC 1112, 2236, 3376)
+ */
+#define IGMP_QUERY      0x11
+#define IGMP_V1_REPORT  0x12
+#define IGMP_V2_REPORT  0x16
+#define IGMP_V2_LEAVE   0x17
+#define IGMP_V3_REPORT  0x22
+
+/* size of a v1/v2 message, also of a v3 report header */
+#define IGMP_MIN_LEN    8
+
+/*
+ * IGMPv3 group record types
+ */
+#define IGMP_V3_MODE_IS_INCLUDE    1
+#define IGMP_V3_MODE_IS_EXCLUDE    2
+#define IGMP_V3_CHANGE_TO_INCLUDE  3
+#define IGMP_V3_CHANGE_TO_EXCLUDE  4
+#define IGMP_V3_ALLOW_NEW_SOURCES  5
+#define IGMP_V3_BLOCK_OLD_SOURCES  6
+
+/* 224.0.0.0/24 is never subject to snooping (RFC 4541 2.1.2) */
+#define IP_MCAST_LOCAL_MASK     ((in_addr_t)0xFFFFFF00)
+#define IP_MCAST_LOCAL_NETWORK  ((in_addr_t)0xE0000000)
+
+struct mcast_set *
+mcast_set_init (void)
+{
+  struct mcast_set *ms;
+  ALLOC_OBJ_CLEAR (ms, struct mcast_set);
+  ms->hash = hash_init (16,
+			mroute_addr_hash_function,
+			mroute_addr_compare_function);
+  ms->next_expire = now + MCAST_EXPIRE_INTERVAL;
+  return ms;
+}
+
+static void
+mcast_group_free (struct mcast_group *g)
+{
+  free (g->members);
+  free (g);
+}
+
+void
+mcast_set_free (struct mcast_set *ms)
+{
+  if (ms)
+    {
+      struct hash_iterator hi;
+      struct hash_element *he;
+
+      hash_iterator_init (ms->hash, &hi, true);
+      while ((he = hash_iterator_next (&hi)))
+	{
+	  struct mcast_group *g = (struct mcast_group *) he->value;
+	  hash_iterator_delete_element (&hi);
+	  mcast_group_free (g);
+	}
+      hash_iterator_free (&hi);
+      hash_free (ms->hash);
+      free (ms);
+    }
+}
+
+/*
+ * Build a group key from a network byte order IPv4 address.
+ * Returns false if the address is not a multicast group
+ * which we snoop.
+ */
+static bool
+mcast_group_addr (struct mroute_addr *group, const uint8_t *addr)
+{
+  in_addr_t a;
+
+  memcpy (&a, addr, sizeof (a));
+  a = ntohl (a);
+  if ((a & IP_MCAST_SUBNET_MASK) != IP_MCAST_NETWORK
+      || (a & IP_MCAST_LOCAL_MASK) == IP_MCAST_LOCAL_NETWORK)
+    return false;
+
+  mroute_addr_init (group);
+  group->type = MR_ADDR_IPV4;
+  group->len = 4;
+  memcpy (group->addr, addr, 4);
+  return true;
+}
+
+/*
+ * Locate the IPv4 header of a tun or tap packet.  The header
+ * is not necessarily aligned in the tap case.
+ */
+static const uint8_t *
+mcast_ip_header (const struct buffer *buf, const int dev_type, int *len)
+{
+  const uint8_t *p = BPTR (buf);
+  int n = BLEN (buf);
+
+  if (dev_type == DEV_TYPE_TAP)
+    {
+      const struct openvpn_ethhdr *eth = (const struct openvpn_ethhdr *) p;
+      if (n < (int) sizeof (struct openvpn_ethhdr)
+	  || eth->proto != htons (OPENVPN_ETH_P_IPV4))
+	return NULL;
+      p += sizeof (struct openvpn_ethhdr);
+      n -= sizeof (struct openvpn_ethhdr);
+    }
+  else if (dev_type != DEV_TYPE_TUN)
+    return NULL;
+
+  if (n < (int) sizeof (struct openvpn_iphdr) || OPENVPN_IPH_GET_VER (*p) != 4)
+    return NULL;
+  *len = n;
+  return p;
+}
+
+int
+mcast_classify (const struct buffer *buf, const int dev_type, struct mroute_addr *group)
+{
+  int len;
+  const uint8_t *ip = mcast_ip_header (buf, dev_type, &len);
+
+  if (ip
+      && ip[offsetof (struct openvpn_iphdr, protocol)] != OPENVPN_IPPROTO_IGMP
+      && mcast_group_addr (group, ip + offsetof (struct openvpn_iphdr, daddr)))
+    return MCAST_GROUP;
+  return MCAST_FLOOD;
+}
+
+static int
+mcast_member_index (const struct mcast_group *g, const struct multi_instance *mi)
+{
+  int i;
+  for (i = 0; i < g->n_members; ++i)
+    if (g->members[i].mi == mi)
+      return i;
+  return -1;
+}
+
+/*
+ * Remove member i from g.  Returns true if g is now empty,
+ * in which case the caller should remove it from the hash
+ * and free it.
+ */
+static bool
+mcast_member_del (struct mcast_group *g, const int i)
+{
+  g->members[i] = g->members[--g->n_members];
+  return !g->n_members;
+}
+
+static void
+mcast_join (struct mcast_set *ms, struct multi_instance *mi, const uint8_t *addr)
+{
+  struct gc_arena gc = gc_new ();
+  struct mroute_addr key;
+  struct mcast_group *g;
+  int i;
+
+  if (mcast_group_addr (&key, addr))
+    {
+      g = mcast_lookup (ms, &key);
+      if (!g)
+	{
+	  ALLOC_OBJ_CLEAR (g, struct mcast_group);
+	  g->addr = key;
+	  hash_add (ms->hash, &g->addr, g, false);
+	}
+
+      i = mcast_member_index (g, mi);
+      if (i < 0)
+	{
+	  if (g->n_members == g->max_members)
+	    {
+	      struct mcast_member *members;
+	      g->max_members = max_int (4, g->max_members * 2);
+	      ALLOC_ARRAY (members, struct mcast_member, g->max_members);
+	      if (g->n_members)
+		memcpy (members, g->members, g->n_members * sizeof (struct mcast_member));
+	      free (g->members);
+	      g->members = members;
+	    }
+	  i = g->n_members++;
+	  g->members[i].mi = mi;
+	  ++ms->joins;
+	  msg (D_MCAST, "MCAST: %s joined group %s",
+	       multi_instance_string (mi, false, &gc),
+	       mroute_addr_print (&key, &gc));
+	}
+      g->members[i].last_report = now;
+    }
+  gc_free (&gc);
+}
+
+static void
+mcast_leave (struct mcast_set *ms, struct multi_instance *mi, const uint8_t *addr)
+{
+  struct gc_arena gc = gc_new ();
+  struct mroute_addr key;
+  struct mcast_group *g;
+  int i;
+
+  if (mcast_group_addr (&key, addr)
+      && (g = mcast_lookup (ms, &key))
+      && (i = mcast_member_index (g, mi)) >= 0)
+    {
+      ++ms->leaves;
+      msg (D_MCAST, "MCAST: %s left group %s",
+	   multi_instance_string (mi, false, &gc),
+	   mroute_addr_print (&key, &gc));
+      if (mcast_member_del (g, i))
+	{
+	  hash_remove (ms->hash, &g->addr);
+	  mcast_group_free (g);
+	}
+    }
+  gc_free (&gc);
+}
+
+/*
+ * An IGMPv3 report carries one record per group.  Filtering
+ * is done per group only, so source lists are ignored except
+ * to recognize an INCLUDE of nothing as a leave.
+ */
+static void
+mcast_snoop_v3 (struct mcast_set *ms,
+		struct multi_instance *mi,
+		const uint8_t *igmp,
+		int len)
+{
+  int n_rec = (igmp[6] << 8) | igmp[7];
+  const uint8_t *rec = igmp + IGMP_MIN_LEN;
+
+  len -= IGMP_MIN_LEN;
+  while (n_rec-- > 0 && len >= 8)
+    {
+      const int n_src = (rec[2] << 8) | rec[3];
+      const int rec_len = 8 + 4 * (n_src + rec[1]);
+
+      if (rec_len > len)
+	break;
+
+      switch (rec[0])
+	{
+	case IGMP_V3_MODE_IS_EXCLUDE:
+	case IGMP_V3_CHANGE_TO_EXCLUDE:
+	  mcast_join (ms, mi, rec + 4);
+	  break;
+	case IGMP_V3_MODE_IS_INCLUDE:
+	case IGMP_V3_CHANGE_TO_INCLUDE:
+	  if (n_src)
+	    mcast_join (ms, mi, rec + 4);
+	  else
+	    mcast_leave (ms, mi, rec + 4);
+	  break;
+	case IGMP_V3_ALLOW_NEW_SOURCES:
+	  if (n_src)
+	    mcast_join (ms, mi, rec + 4);
+	  break;
+	}
+
+      rec += rec_len;
+      len -= rec_len;
+    }
+}
+
+void
+mcast_snoop (struct mcast_set *ms,
+	     struct multi_instance *mi,
+	     const struct buffer *buf,
+	     const int dev_type)
+{
+  int len, hlen, tot_len;
+  const uint8_t *ip = mcast_ip_header (buf, dev_type, &len);
+  const uint8_t *igmp;
+
+  if (!ip || ip[offsetof (struct openvpn_iphdr, protocol)] != OPENVPN_IPPROTO_IGMP)
+    return;
+
+  hlen = OPENVPN_IPH_GET_LEN (ip[offsetof (struct openvpn_iphdr, version_len)]);
+  tot_len = (ip[offsetof (struct openvpn_iphdr, tot_len)] << 8)
+    | ip[offsetof (struct openvpn_iphdr, tot_len) + 1];
+  if (tot_len < len)
+    len = tot_len;
+  if (hlen < (int) sizeof (struct openvpn_iphdr) || len < hlen + IGMP_MIN_LEN)
+    return;
+  igmp = ip + hlen;
+  len -= hlen;
+
+  switch (igmp[0])
+    {
+    case IGMP_QUERY:
+      ms->last_query = now;
+      break;
+    case IGMP_V1_REPORT:
+    case IGMP_V2_REPORT:
+      if (mi)
+	mcast_join (ms, mi, igmp + 4);
+      break;
+    case IGMP_V2_LEAVE:
+      if (mi)
+	mcast_leave (ms, mi, igmp + 4);
+      break;
+    case IGMP_V3_REPORT:
+      if (mi)
+	mcast_snoop_v3 (ms, mi, igmp, len);
+      break;
+    }
+}
+
+void
+mcast_leave_all (struct mcast_set *ms, struct multi_instance *mi)
+{
+  struct hash_iterator hi;
+  struct hash_element *he;
+
+  hash_iterator_init (ms->hash, &hi, true);
+  while ((he = hash_iterator_next (&hi)))
+    {
+      struct mcast_group *g = (struct mcast_group *) he->value;
+      const int i = mcast_member_index (g, mi);
+      if (i >= 0 && mcast_member_del (g, i))
+	{
+	  hash_iterator_delete_element (&hi);
+	  mcast_group_free (g);
+	}
+    }
+  hash_iterator_free (&hi);
+}
+
+/*
+ * Age out memberships which have not been refreshed by a
+ * report since before the last query was seen.
+ */
+void
+mcast_expire_dowork (struct mcast_set *ms)
+{
+  ms->next_expire = now + MCAST_EXPIRE_INTERVAL;
+
+  if (ms->last_query && now - ms->last_query <= MCAST_MEMBER_TIMEOUT)
+    {
+      struct gc_arena gc = gc_new ();
+      struct hash_iterator hi;
+      struct hash_element *he;
+
+      hash_iterator_init (ms->hash, &hi, true);
+      while ((he = hash_iterator_next (&hi)))
+	{
+	  struct mcast_group *g = (struct mcast_group *) he->value;
+	  bool empty = false;
+	  int i;
+
+	  for (i = g->n_members - 1; i >= 0; --i)
+	    {
+	      const struct mcast_member *mm = &g->members[i];
+	      if (mm->last_report < ms->last_query
+		  && now - mm->last_report > MCAST_MEMBER_TIMEOUT)
+		{
+		  ++ms->expired;
+		  msg (D_MCAST, "MCAST: %s membership of group %s expired",
+		       multi_instance_string (mm->mi, false, &gc),
+		       mroute_addr_print (&g->addr, &gc));
+		  empty = mcast_member_del (g, i);
+		}
+	    }
+
+	  if (empty)
+	    {
+	      hash_iterator_delete_element (&hi);
+	      mcast_group_free (g);
+	    }
+	}
+      hash_iterator_free (&hi);
+      gc_free (&gc);
+    }
+}
+
+#else
+static void dummy(void) {}
+#endif
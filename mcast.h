@@ -0,0 +1,134 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2005 OpenVPN Solutions LLC <info@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef MCAST_H
+#define MCAST_H
+
+/*
+ * IGMP snooping for server mode (--igmp-snooping).
+ *
+ * IGMP v1/v2/v3 membership reports and v2 leave messages
+ * sent by clients are used to maintain, for each IPv4
+ * multicast group, the set of client instances which have
+ * joined it.  Multicast packets to a known group are then
+ * queued only to the group's members rather than to every
+ * client.  Link-local groups (224.0.0.0/24), IGMP itself,
+ * and non-IPv4 multicast are still flooded.
+ *
+ * Memberships which are not refreshed by a report are aged
+ * out, but only while an IGMP querier is seen to be active,
+ * since without one clients only report when they first join.
+ */
+
+#if P2MP_SERVER
+
+#include "basic.h"
+#include "common.h"
+#include "buffer.h"
+#include "otime.h"
+#include "list.h"
+#include "mroute.h"
+
+/* RFC 2236 Group Membership Interval: 2 * 125s + 10s */
+#define MCAST_MEMBER_TIMEOUT 260
+
+/* how often to look for expired memberships */
+#define MCAST_EXPIRE_INTERVAL 10
+
+struct multi_instance;
+
+struct mcast_member
+{
+  struct multi_instance *mi;
+  time_t last_report;
+};
+
+struct mcast_group
+{
+  struct mroute_addr addr;    /* hash key, group address */
+  struct mcast_member *members;
+  int n_members;
+  int max_members;
+};
+
+struct mcast_set
+{
+  struct hash *hash;
+  time_t last_query;
+  time_t next_expire;
+
+  /* statistics */
+  counter_type joins;
+  counter_type leaves;
+  counter_type expired;
+  counter_type dropped;       /* packets to a group with no members */
+};
+
+/* mcast_classify return values */
+#define MCAST_FLOOD  0  /* send to all clients */
+#define MCAST_GROUP  1  /* send to group members only */
+
+struct mcast_set *mcast_set_init (void);
+void mcast_set_free (struct mcast_set *ms);
+
+/*
+ * Given a packet flagged by mroute_extract_addr_from_packet as
+ * broadcast or multicast, decide whether it may be restricted
+ * to the members of a group, and if so, return the group in
+ * *group.
+ */
+int mcast_classify (const struct buffer *buf, const int dev_type, struct mroute_addr *group);
+
+/*
+ * Look at a packet for IGMP messages.  If mi is defined, the
+ * packet came from that client and its reports/leaves update
+ * group membership.  Queries are noted in either direction.
+ */
+void mcast_snoop (struct mcast_set *ms,
+		  struct multi_instance *mi,
+		  const struct buffer *buf,
+		  const int dev_type);
+
+/*
+ * Remove mi from all groups, called when instance is closed.
+ */
+void mcast_leave_all (struct mcast_set *ms, struct multi_instance *mi);
+
+void mcast_expire_dowork (struct mcast_set *ms);
+
+static inline void
+mcast_expire (struct mcast_set *ms)
+{
+  if (now >= ms->next_expire)
+    mcast_expire_dowork (ms);
+}
+
+static inline struct mcast_group *
+mcast_lookup (struct mcast_set *ms, const struct mroute_addr *group)
+{
+  return (struct mcast_group *) hash_lookup (ms->hash, group);
+}
+
+#endif
+#endif
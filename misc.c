@@ -373,13 +373,202 @@ save_inetd_socket_descriptor (void)
 #endif
 }
 
+#ifdef ENABLE_SPAWN
+
+extern char **environ;
+
+static bool env_string_equal (const char *s1, const char *s2);
+
+/*
+ * Characters which, outside of double quotes, mean that
+ * a command must be run by the shell.
+ */
+#define SHELL_SPECIAL "|&;<>()$`\\'*?[]#~{}!\n"
+
+/*
+ * Can command be split into parameters by make_arg_array
+ * and executed directly, with the same result as
+ * passing it to /bin/sh -c?
+ */
+static bool
+command_needs_shell (const char *command)
+{
+  const char *c;
+  bool quoted = false;
+  bool first = true;
+  int n_parms = 0;
+  int parm_len = 0;
+
+  for (c = command; *c; ++c)
+    {
+      if (*c == '\"')
+	{
+	  /* quotes must enclose a whole parameter */
+	  if (quoted ? (c[1] && !isspace (c[1])) : (c > command && !isspace (c[-1])))
+	    return true;
+	  quoted = !quoted;
+	}
+      else if (isspace (*c) && !quoted)
+	{
+	  if (parm_len)
+	    {
+	      first = false;
+	      parm_len = 0;
+	    }
+	  continue;
+	}
+      else if (strchr (quoted ? "$`\\" : SHELL_SPECIAL, *c))
+	return true;
+      else if (*c == '=' && first)
+	return true; /* variable assignment */
+
+      if (!parm_len++)
+	++n_parms;
+      if (parm_len >= OPTION_PARM_SIZE || n_parms >= MAX_PARMS)
+	return true;
+    }
+  return quoted || !n_parms;
+}
+
+/*
+ * Build the environment of a child process -- the
+ * env_set if flags includes S_SCRIPT, and whatever
+ * part of our own environment it doesn't override.
+ */
+static const char **
+make_child_env_array (const struct env_set *es, unsigned int flags, struct gc_arena *gc)
+{
+  const char **envp;
+  const char **es_envp;
+  int n_es = 0, n_env = 0, n = 0;
+  int i, j;
+
+  if (!(flags & S_SCRIPT) || !es)
+    return (const char **) environ;
+
+  while (environ[n_env])
+    ++n_env;
+
+  mutex_lock_static (L_ENV_SET);
+  es_envp = make_env_array (es, gc);
+  while (es_envp[n_es])
+    ++n_es;
+
+  ALLOC_ARRAY_CLEAR_GC (envp, const char *, n_es + n_env + 1, gc);
+  for (i = 0; i < n_es; ++i)
+    envp[n++] = es_envp[i];
+  for (i = 0; i < n_env; ++i)
+    {
+      for (j = 0; j < n_es; ++j)
+	if (env_string_equal (environ[i], es_envp[j]))
+	  break;
+      if (j == n_es)
+	envp[n++] = environ[i];
+    }
+  envp[n] = NULL;
+  mutex_unlock_static (L_ENV_SET);
+
+  return envp;
+}
+
+/*
+ * Start command under /bin/sh -c.
+ */
+static int
+spawn_shell (pid_t *pid, const char *command, const char **envp)
+{
+  const char *argv[4];
+  argv[0] = "sh";
+  argv[1] = "-c";
+  argv[2] = command;
+  argv[3] = NULL;
+  return posix_spawn (pid, "/bin/sh", NULL, NULL, (char *const *) argv, (char *const *) envp);
+}
+
+/*
+ * Start command in a child process with environment
+ * envp, without waiting for it.  posix_spawn doesn't
+ * copy our address space the way fork() does, and
+ * we only run /bin/sh if the command needs it.
+ * Return the child's pid, or -1 on error.
+ */
+static pid_t
+openvpn_spawn (const char *command, const char **envp, struct gc_arena *gc)
+{
+  pid_t pid = -1;
+  int status;
+
+  if (command_needs_shell (command))
+    status = spawn_shell (&pid, command, envp);
+  else
+    {
+      const char **argv = make_arg_array (NULL, command, gc);
+      status = posix_spawnp (&pid, argv[0], NULL, NULL, (char *const *) argv, (char *const *) envp);
+
+      /*
+       * Leave scripts without a #! line, shell builtins
+       * and commands which don't exist to the shell, so
+       * they behave (and fail with status 127) exactly
+       * as they would under system().
+       */
+      if (status == ENOEXEC || status == ENOENT)
+	status = spawn_shell (&pid, command, envp);
+    }
+
+  if (status)
+    {
+      errno = status;
+      msg (M_WARN | M_ERRNO, "WARNING: could not execute '%s'", command);
+      return -1;
+    }
+  return pid;
+}
+
+#endif
+
 /*
- * Wrapper around the system() call.
+ * Run a command and wait for it to exit, returning
+ * its status in the format of system().
  */
 int
 openvpn_system (const char *command, const struct env_set *es, unsigned int flags)
 {
-#ifdef HAVE_SYSTEM
+#if defined(ENABLE_SPAWN)
+  struct gc_arena gc = gc_new ();
+  int ret = -1;
+  pid_t pid;
+
+  perf_push (PERF_SCRIPT);
+
+  /* debugging */
+  dmsg (D_SCRIPT, "SYSTEM[%u] '%s'", flags, command);
+  if (flags & S_SCRIPT)
+    env_set_print (D_SCRIPT, es);
+
+  /*
+   * execute the command
+   */
+  pid = openvpn_spawn (command, make_child_env_array (es, flags, &gc), &gc);
+  if (pid > 0)
+    {
+      while (waitpid (pid, &ret, 0) < 0)
+	{
+	  if (errno != EINTR)
+	    {
+	      ret = -1;
+	      break;
+	    }
+	}
+    }
+
+  /* debugging */
+  dmsg (D_SCRIPT, "SYSTEM return=%u", ret);
+
+  perf_pop ();
+  gc_free (&gc);
+  return ret;
+
+#elif defined(HAVE_SYSTEM)
   int ret;
 
   /*
@@ -525,6 +714,265 @@ system_check (const char *command, const struct env_set *es, unsigned int flags,
   return ret;
 }
 
+#ifdef ENABLE_ASYNC_SCRIPT
+
+int script_async_max = 0;                     /* GLOBAL */
+static int script_async_timeout = 0;          /* GLOBAL */
+static int script_async_running = 0;          /* GLOBAL */
+struct script_job *script_detached = NULL;    /* GLOBAL */
+static struct script_job *script_detached_tail = NULL; /* GLOBAL */
+
+void
+script_async_init (const int max_running, const int timeout)
+{
+  script_async_max = max_running;
+  script_async_timeout = timeout;
+}
+
+/*
+ * Fork a child to run the job's command.  The child
+ * adds the job's env_set copy to its own environment
+ * before exec'ing the shell, so unlike openvpn_system,
+ * we don't need to touch our own environment.
+ */
+static void
+script_job_fork (struct script_job *job)
+{
+  const pid_t pid = openvpn_spawn (job->command, job->envp, &job->gc);
+  if (pid > 0)
+    {
+      dmsg (D_SCRIPT, "SCRIPT ASYNC pid=%d '%s'", (int) pid, job->command);
+      job->pid = pid;
+      job->state = SJ_RUNNING;
+      ++script_async_running;
+    }
+  else
+    {
+      job->status = -1;
+      job->state = SJ_DONE;
+    }
+}
+
+static void
+script_job_schedule_poll (struct script_job *job)
+{
+  struct timeval tv;
+  tv.tv_sec = 0;
+  tv.tv_usec = job->poll_interval;
+  tv_future (&job->next_poll, &tv);
+}
+
+void
+script_job_start (struct script_job *job, const char *command, const struct env_set *es, unsigned int flags)
+{
+  ASSERT (job->state == SJ_IDLE);
+
+  job->gc = gc_new ();
+  job->command = string_alloc (command, &job->gc);
+  {
+    const char **envp = make_child_env_array (es, flags, &job->gc);
+    int i, n = 0;
+
+    /* the env_set and our environment may change before the child is started */
+    while (envp[n])
+      ++n;
+    ALLOC_ARRAY_CLEAR_GC (job->envp, const char *, n + 1, &job->gc);
+    for (i = 0; i < n; ++i)
+      job->envp[i] = string_alloc (envp[i], &job->gc);
+    if (flags & S_SCRIPT)
+      env_set_print (D_SCRIPT, es);
+  }
+  job->pid = 0;
+  job->deadline = now + script_async_timeout;
+  job->poll_interval = SCRIPT_POLL_MIN;
+  job->status = -1;
+  job->state = SJ_WAITING;
+
+  if (script_async_running < script_async_max)
+    script_job_fork (job);
+  else
+    dmsg (D_SCRIPT, "SCRIPT ASYNC waiting for a free slot '%s'", command);
+
+  script_job_schedule_poll (job);
+}
+
+/*
+ * Collect the exit status of a child process.
+ */
+static void
+script_job_reaped (struct script_job *job, const int status)
+{
+  dmsg (D_SCRIPT, "SCRIPT ASYNC pid=%d return=%u", (int) job->pid, status);
+  --script_async_running;
+  job->status = status;
+  job->pid = 0;
+  job->state = SJ_DONE;
+}
+
+/*
+ * Kill a running child and wait for it to exit.
+ */
+static void
+script_job_kill (struct script_job *job)
+{
+  int status = -1;
+  kill (job->pid, SIGKILL);
+  if (waitpid (job->pid, &status, 0) != job->pid)
+    status = -1;
+  script_job_reaped (job, status);
+}
+
+/*
+ * Start the job if it is waiting for a free slot,
+ * check if it has exited, and enforce the timeout.
+ * Return true once the job is done.
+ */
+bool
+script_job_poll (struct script_job *job)
+{
+  if (job->state == SJ_WAITING && script_async_running < script_async_max)
+    script_job_fork (job);
+
+  if (job->state == SJ_RUNNING)
+    {
+      int status = -1;
+      const pid_t pid = waitpid (job->pid, &status, WNOHANG);
+      if (pid == job->pid)
+	script_job_reaped (job, status);
+      else if (pid < 0)
+	{
+	  msg (M_WARN | M_ERRNO, "WARNING: waitpid failed for script '%s'", job->command);
+	  script_job_reaped (job, -1);
+	}
+      else if (now >= job->deadline)
+	{
+	  msg (M_WARN, "WARNING: script timed out after %d seconds and was killed: '%s'",
+	       script_async_timeout, job->command);
+	  script_job_kill (job);
+	}
+    }
+  else if (job->state == SJ_WAITING && now >= job->deadline)
+    {
+      msg (M_WARN, "WARNING: script timed out after %d seconds waiting to run: '%s'",
+	   script_async_timeout, job->command);
+      job->status = -1;
+      job->state = SJ_DONE;
+    }
+
+  if (job->state == SJ_DONE)
+    return true;
+
+  /* poll less often as the script runs longer */
+  job->poll_interval = min_int (job->poll_interval * 2, SCRIPT_POLL_MAX);
+  script_job_schedule_poll (job);
+  return false;
+}
+
+void
+script_job_free (struct script_job *job)
+{
+  gc_free (&job->gc);
+  CLEAR (*job);
+}
+
+/*
+ * Kill job if it is running and free it.
+ */
+void
+script_job_abort (struct script_job *job)
+{
+  if (job->state == SJ_RUNNING)
+    {
+      msg (D_SCRIPT, "SCRIPT ASYNC killing pid=%d '%s'", (int) job->pid, job->command);
+      script_job_kill (job);
+    }
+  if (job->state != SJ_IDLE)
+    script_job_free (job);
+}
+
+void
+system_check_nowait (const char *command, const struct env_set *es, unsigned int flags, const char *error_message)
+{
+  if (script_async_enabled ())
+    {
+      struct script_job *job;
+
+      ALLOC_OBJ_CLEAR (job, struct script_job);
+      script_job_start (job, command, es, flags);
+      if (error_message)
+	job->error_message = string_alloc (error_message, &job->gc);
+
+      if (script_detached_tail)
+	script_detached_tail->next = job;
+      else
+	script_detached = job;
+      script_detached_tail = job;
+    }
+  else
+    system_check (command, es, flags, error_message);
+}
+
+void
+check_script_async_dowork (struct timeval *timeout)
+{
+  struct script_job **pp = &script_detached;
+  struct script_job *prev = NULL;
+
+  while (*pp)
+    {
+      struct script_job *job = *pp;
+      if (script_job_poll (job))
+	{
+	  if (job->error_message && !system_ok (job->status))
+	    {
+	      struct gc_arena gc = gc_new ();
+	      msg (M_WARN, "%s: %s",
+		   job->error_message,
+		   system_error_message (job->status, &gc));
+	      gc_free (&gc);
+	    }
+	  *pp = job->next;
+	  if (script_detached_tail == job)
+	    script_detached_tail = prev;
+	  script_job_free (job);
+	  free (job);
+	}
+      else
+	{
+	  if (timeout)
+	    {
+	      struct timeval tv;
+	      tv_until (&tv, &job->next_poll);
+	      if (tv_lt (&tv, timeout))
+		*timeout = tv;
+	    }
+	  prev = job;
+	  pp = &job->next;
+	}
+    }
+}
+
+/*
+ * Wait for all detached scripts to finish, such as
+ * --client-disconnect scripts run during shutdown.
+ */
+void
+script_async_flush (void)
+{
+  while (script_detached)
+    {
+      check_script_async_dowork (NULL);
+      if (script_detached)
+	{
+	  sleep_milliseconds (SCRIPT_POLL_MIN / 1000);
+	  update_now_tv ();
+	  update_time ();
+	}
+    }
+}
+
+#endif
+
 /*
  * Initialize random number seed.  random() is only used
  * when "weak" random numbers are acceptable.
@@ -1357,3 +1805,82 @@ openvpn_sleep (const int n)
 #endif
   sleep (n);
 }
+
+#ifdef SCRIPT_TEST
+
+#define SCRIPT_TEST_N       500
+#define SCRIPT_TEST_HEAP    (256*1024*1024)
+#define SCRIPT_TEST_VARS    32
+
+/*
+ * Measure how many scripts per second we can run
+ * with a large resident heap and a typical
+ * client-connect environment.
+ */
+
+static double
+script_test_elapsed (const struct timeval *start)
+{
+  struct timeval end;
+  gettimeofday (&end, NULL);
+  return (double) (end.tv_sec - start->tv_sec) + (double) (end.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static void
+script_test_run (const char *title, const char *command, const struct env_set *es, const bool legacy)
+{
+  struct timeval start;
+  double elapsed;
+  int i;
+
+  gettimeofday (&start, NULL);
+  for (i = 0; i < SCRIPT_TEST_N; ++i)
+    {
+      if (legacy)
+	{
+	  /* the old way -- splice env_set into our environment and call system() */
+	  env_set_add_to_environment (es);
+	  ASSERT (system (command) == 0);
+	  env_set_remove_from_environment (es);
+	}
+      else
+	ASSERT (openvpn_system (command, es, S_SCRIPT) == 0);
+    }
+  elapsed = script_test_elapsed (&start);
+  printf ("%-24s %d runs in %.3f sec, %.1f scripts/sec\n",
+	  title, SCRIPT_TEST_N, elapsed, (double) SCRIPT_TEST_N / elapsed);
+}
+
+void
+script_test (void)
+{
+  struct gc_arena gc = gc_new ();
+  struct env_set *es = env_set_create (&gc);
+  char *heap;
+  int i;
+
+  /* make the process big, the way a busy server is */
+  heap = (char *) malloc (SCRIPT_TEST_HEAP);
+  check_malloc_return (heap);
+  for (i = 0; i < SCRIPT_TEST_HEAP; i += 4096)
+    heap[i] = (char) i;
+
+  for (i = 0; i < SCRIPT_TEST_VARS; ++i)
+    {
+      char name[32];
+      openvpn_snprintf (name, sizeof (name), "test_var_%d", i);
+      setenv_str (es, name, "some moderately long environmental value");
+    }
+
+  printf ("heap=%d MB env=%d vars\n", SCRIPT_TEST_HEAP / (1024*1024), SCRIPT_TEST_VARS);
+  script_test_run ("system()", "true", es, true);
+#ifdef ENABLE_SPAWN
+  script_test_run ("spawn /bin/sh -c", "true >/dev/null", es, false);
+  script_test_run ("spawn direct", "true", es, false);
+#endif
+
+  free (heap);
+  gc_free (&gc);
+}
+
+#endif
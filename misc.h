@@ -117,9 +117,16 @@ void warn_if_group_others_accessible(const char* filename);
 #define S_SCRIPT (1<<0)
 #define S_FATAL  (1<<1)
 
-/* wrapper around the system() call. */
+/* run a command and wait for it to exit */
 int openvpn_system (const char *command, const struct env_set *es, unsigned int flags);
 
+/* define to enable a special test mode */
+/*#define SCRIPT_TEST*/
+
+#ifdef SCRIPT_TEST
+void script_test (void);
+#endif
+
 /* interpret the status code returned by system() */
 bool system_ok(int);
 int system_executed (int stat);
@@ -129,6 +136,118 @@ const char *system_error_message (int, struct gc_arena *gc);
    false if error, exit if error and fatal==true */
 bool system_check (const char *command, const struct env_set *es, unsigned int flags, const char *error_message);
 
+#ifdef ENABLE_ASYNC_SCRIPT
+
+/*
+ * Run scripts without blocking (--script-async).
+ *
+ * script_job_start forks a shell to run command, taking a
+ * private copy of command and of the env_set, so that the caller
+ * may go on to modify or free them.  The caller then calls
+ * script_job_poll until it returns true, at which point
+ * job->status holds the exit status in system() format,
+ * and finally releases the job with script_job_free.
+ * script_job_next_poll returns the time at which the
+ * next poll should be made.
+ *
+ * At most script_async_max children run at once -- jobs
+ * started beyond that point wait for a free slot.  A job
+ * which hasn't finished script_async_timeout seconds after
+ * it was started is killed and fails.
+ *
+ * job->gc may be used by the caller to store data which
+ * should live as long as the job.
+ */
+
+#define SJ_IDLE     0  /* not in use */
+#define SJ_WAITING  1  /* waiting for a free child slot */
+#define SJ_RUNNING  2  /* child is running */
+#define SJ_DONE     3  /* child has exited, status is valid */
+
+#define SCRIPT_POLL_MIN 10000   /* microseconds */
+#define SCRIPT_POLL_MAX 250000  /* microseconds */
+
+#define SCRIPT_ASYNC_TIMEOUT_DEFAULT 60 /* seconds */
+
+struct script_job
+{
+  int state;
+  struct gc_arena gc;
+  const char *command;
+  const char **envp;            /* private copy of child environment */
+  pid_t pid;
+  time_t deadline;
+  struct timeval next_poll;
+  int poll_interval;            /* microseconds */
+  int status;
+
+  const char *error_message;    /* for detached jobs */
+  struct script_job *next;
+};
+
+void script_async_init (const int max_running, const int timeout);
+void script_async_flush (void);
+
+void script_job_start (struct script_job *job, const char *command, const struct env_set *es, unsigned int flags);
+bool script_job_poll (struct script_job *job);
+void script_job_abort (struct script_job *job);
+void script_job_free (struct script_job *job);
+
+/*
+ * Like system_check, but with --script-async, don't wait for
+ * the command to complete.  Errors are logged when the
+ * child is reaped by check_script_async.
+ */
+void system_check_nowait (const char *command, const struct env_set *es, unsigned int flags, const char *error_message);
+
+extern int script_async_max;
+extern struct script_job *script_detached;
+
+static inline bool
+script_async_enabled (void)
+{
+  return script_async_max > 0;
+}
+
+static inline bool
+script_job_defined (const struct script_job *job)
+{
+  return job->state != SJ_IDLE;
+}
+
+static inline bool
+script_job_next_poll (const struct script_job *job, struct timeval *tv)
+{
+  if (job->state == SJ_WAITING || job->state == SJ_RUNNING)
+    {
+      *tv = job->next_poll;
+      return true;
+    }
+  return false;
+}
+
+/*
+ * Reap detached scripts, and reduce timeout if
+ * any of them are still running.
+ */
+static inline void
+check_script_async (struct timeval *timeout)
+{
+  void check_script_async_dowork (struct timeval *timeout);
+  if (script_detached)
+    check_script_async_dowork (timeout);
+}
+
+#else
+
+static inline void
+system_check_nowait (const char *command, const struct env_set *es, unsigned int flags, const char *error_message)
+{
+  system_check (command, es, flags, error_message);
+}
+
+#endif
+
 #ifdef HAVE_STRERROR
 /* a thread-safe version of strerror */
 const char* strerror_ts (int errnum, struct gc_arena *gc);
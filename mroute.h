@@ -31,6 +31,9 @@
 #include "list.h"
 #include "route.h"
 
+/* define this to enable special mroute hash benchmark mode */
+/*#define MROUTE_TEST*/
+
 #define IP_MCAST_SUBNET_MASK  ((in_addr_t)240<<24)
 #define IP_MCAST_NETWORK      ((in_addr_t)224<<24)
 
@@ -100,9 +103,14 @@ bool mroute_extract_sockaddr_in (struct mroute_addr *addr,
 
 bool mroute_learnable_address (const struct mroute_addr *addr);
 
+void mroute_hash_seed (void);
 uint32_t mroute_addr_hash_function (const void *key, uint32_t iv);
 bool mroute_addr_compare_function (const void *key1, const void *key2);
 
+#ifdef MROUTE_TEST
+void mroute_hash_bench (void);
+#endif
+
 void mroute_addr_init (struct mroute_addr *addr);
 
 const char *mroute_addr_print (const struct mroute_addr *ma,
@@ -127,16 +135,47 @@ mroute_helper_unlock (struct mroute_helper *mh)
   /*mutex_unlock (&mh->mutex);*/
 }
 
+/*
+ * Load the first 4 and next 2 bytes of an address.
+ * addr is 4-byte aligned within struct mroute_addr.
+ */
+static inline uint32_t
+mroute_addr_word (const struct mroute_addr *a)
+{
+  uint32_t w;
+  memcpy (&w, a->addr, sizeof (w));
+  return w;
+}
+
+static inline uint16_t
+mroute_addr_port (const struct mroute_addr *a)
+{
+  uint16_t p;
+  memcpy (&p, a->addr + 4, sizeof (p));
+  return p;
+}
+
 static inline bool
 mroute_addr_equal (const struct mroute_addr *a1, const struct mroute_addr *a2)
 {
+  if (a1->len != a2->len)
+    return false;
   if (a1->type != a2->type)
     return false;
   if (a1->netbits != a2->netbits)
     return false;
-  if (a1->len != a2->len)
-    return false;
-  return memcmp (a1->addr, a2->addr, a1->len) == 0;
+
+  /* IPv4 address, IPv4 address + port, and ethernet address */
+  switch (a1->len)
+    {
+    case 4:
+      return mroute_addr_word (a1) == mroute_addr_word (a2);
+    case 6:
+      return mroute_addr_word (a1) == mroute_addr_word (a2)
+	&& mroute_addr_port (a1) == mroute_addr_port (a2);
+    default:
+      return memcmp (a1->addr, a2->addr, a1->len) == 0;
+    }
 }
 
 static inline const uint8_t *
@@ -0,0 +1,250 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2005 OpenVPN Solutions LLC <info@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef WIN32
+#include "config-win32.h"
+#else
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#ifdef ENABLE_MSTATS
+
+#include "mstats.h"
+#include "error.h"
+#include "buffer.h"
+#include "otime.h"
+#include "misc.h"
+#include "fdmisc.h"
+
+#include "memdbg.h"
+
+/*
+ * Make sure that the stores to a record are visible
+ * to readers in the order of the sequence lock.
+ */
+#if defined(__GNUC__)
+#define mstats_barrier() __sync_synchronize ()
+#else
+#define mstats_barrier()
+#endif
+
+static inline void
+mstats_write_begin (volatile uint32_t *seq)
+{
+  ++*seq;
+  mstats_barrier ();
+}
+
+static inline void
+mstats_write_end (volatile uint32_t *seq)
+{
+  mstats_barrier ();
+  ++*seq;
+}
+
+struct mstats *
+mstats_open (const char *filename, const int n_slots)
+{
+  struct mstats *ms;
+  int i;
+
+  ASSERT (filename);
+  ASSERT (n_slots > 0);
+
+  ALLOC_OBJ_CLEAR (ms, struct mstats);
+  ms->filename = string_alloc (filename, NULL);
+  ms->size = sizeof (struct mstats_header) + n_slots * sizeof (struct mstats_client);
+
+  ms->fd = open (filename, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP);
+  if (ms->fd < 0)
+    {
+      msg (M_WARN | M_ERRNO, "Note: cannot open --status-mmap file %s", filename);
+      goto err;
+    }
+  set_cloexec (ms->fd);
+
+  if (ftruncate (ms->fd, (off_t) ms->size) < 0)
+    {
+      msg (M_WARN | M_ERRNO, "Note: cannot size --status-mmap file %s to %u bytes", filename, (unsigned int) ms->size);
+      goto err;
+    }
+
+  ms->header = (struct mstats_header *) mmap (NULL, ms->size, PROT_READ | PROT_WRITE, MAP_SHARED, ms->fd, 0);
+  if (ms->header == (struct mstats_header *) MAP_FAILED)
+    {
+      ms->header = NULL;
+      msg (M_WARN | M_ERRNO, "Note: cannot mmap --status-mmap file %s", filename);
+      goto err;
+    }
+  ms->clients = (struct mstats_client *) (ms->header + 1);
+
+  ALLOC_ARRAY (ms->free_slots, int, n_slots);
+  for (i = 0; i < n_slots; ++i)
+    ms->free_slots[i] = n_slots - 1 - i;
+  ms->n_free = n_slots;
+
+  /* fill in the header last, so that readers see a complete file */
+  ms->header->header_size = sizeof (struct mstats_header);
+  ms->header->client_size = sizeof (struct mstats_client);
+  ms->header->n_slots = n_slots;
+  ms->header->pid = (uint32_t) openvpn_getpid ();
+  ms->header->started = ms->header->updated = now;
+  ms->header->version = MSTATS_VERSION;
+  mstats_barrier ();
+  ms->header->magic = MSTATS_MAGIC;
+
+  msg (D_MULTI_LOW, "MSTATS: exporting statistics for %d clients in %s (%u bytes)",
+       n_slots, filename, (unsigned int) ms->size);
+  return ms;
+
+ err:
+  mstats_close (ms);
+  return NULL;
+}
+
+void
+mstats_close (struct mstats *ms)
+{
+  if (ms)
+    {
+      if (ms->header)
+	{
+	  /* tell readers that the numbers are no longer live */
+	  mstats_write_begin (&ms->header->seq);
+	  ms->header->pid = 0;
+	  ms->header->updated = now;
+	  mstats_write_end (&ms->header->seq);
+	  munmap ((void *) ms->header, ms->size);
+	}
+      if (ms->fd >= 0)
+	close (ms->fd);
+      free (ms->free_slots);
+      free (ms->filename);
+      free (ms);
+    }
+}
+
+/*
+ * Allocate a client record, returning its slot
+ * number, or -1 if none are left.
+ */
+int
+mstats_client_add (struct mstats *ms,
+		   const char *common_name,
+		   const char *real_address,
+		   const char *virtual_address,
+		   const time_t created)
+{
+  struct mstats_client *mc;
+  int slot;
+
+  if (!ms->n_free)
+    return -1;
+  slot = ms->free_slots[--ms->n_free];
+  mc = &ms->clients[slot];
+
+  mstats_write_begin (&mc->seq);
+  mc->flags = MSTATS_CLIENT_ACTIVE;
+  mc->created = created;
+  mc->updated = now;
+  mc->link_read_bytes = mc->link_write_bytes = 0;
+  mc->tun_read_bytes = mc->tun_write_bytes = 0;
+  strncpynt (mc->common_name, common_name ? common_name : "", MSTATS_NAME_LEN);
+  strncpynt (mc->real_address, real_address ? real_address : "", MSTATS_NAME_LEN);
+  strncpynt (mc->virtual_address, virtual_address ? virtual_address : "", MSTATS_NAME_LEN);
+  mstats_write_end (&mc->seq);
+
+  mstats_write_begin (&ms->header->seq);
+  ++ms->header->n_clients;
+  ++ms->header->n_connects;
+  mstats_write_end (&ms->header->seq);
+
+  return slot;
+}
+
+/*
+ * Store the current counters of a client, and add the
+ * increase since the last update to the server totals.
+ */
+void
+mstats_client_update (struct mstats *ms,
+		      const int slot,
+		      const counter_type link_read_bytes,
+		      const counter_type link_write_bytes,
+		      const counter_type tun_read_bytes,
+		      const counter_type tun_write_bytes)
+{
+  struct mstats_client *mc = &ms->clients[slot];
+  struct mstats_header *h = ms->header;
+
+  mstats_write_begin (&h->seq);
+  h->link_read_bytes += link_read_bytes - mc->link_read_bytes;
+  h->link_write_bytes += link_write_bytes - mc->link_write_bytes;
+  h->tun_read_bytes += tun_read_bytes - mc->tun_read_bytes;
+  h->tun_write_bytes += tun_write_bytes - mc->tun_write_bytes;
+  mstats_write_end (&h->seq);
+
+  mstats_write_begin (&mc->seq);
+  mc->updated = now;
+  mc->link_read_bytes = link_read_bytes;
+  mc->link_write_bytes = link_write_bytes;
+  mc->tun_read_bytes = tun_read_bytes;
+  mc->tun_write_bytes = tun_write_bytes;
+  mstats_write_end (&mc->seq);
+}
+
+void
+mstats_client_remove (struct mstats *ms, const int slot)
+{
+  struct mstats_client *mc = &ms->clients[slot];
+
+  mstats_write_begin (&mc->seq);
+  mc->flags = 0;
+  mc->updated = now;
+  mstats_write_end (&mc->seq);
+
+  ms->free_slots[ms->n_free++] = slot;
+
+  mstats_write_begin (&ms->header->seq);
+  --ms->header->n_clients;
+  mstats_write_end (&ms->header->seq);
+}
+
+/*
+ * Called once per second, so that readers can tell
+ * that the server is alive.
+ */
+void
+mstats_tick (struct mstats *ms)
+{
+  mstats_write_begin (&ms->header->seq);
+  ms->header->updated = now;
+  mstats_write_end (&ms->header->seq);
+}
+
+#else
+static void dummy(void) {}
+#endif /* ENABLE_MSTATS */
@@ -0,0 +1,134 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2005 OpenVPN Solutions LLC <info@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef MSTATS_H
+#define MSTATS_H
+
+/*
+ * Server statistics exported in a shared memory file
+ * (--status-mmap), so that monitoring tools can read live
+ * counters by mapping the file, without sending a request
+ * to the server.
+ *
+ * The file holds a struct mstats_header followed by n_slots
+ * struct mstats_client records, in host byte order.  Records
+ * are updated in place under a sequence lock: seq is odd while
+ * the server is writing a record.  A reader should copy a
+ * record, and retry unless seq was even and unchanged before
+ * and after the copy.  A client record is in use while
+ * MSTATS_CLIENT_ACTIVE is set in flags.
+ *
+ * The layout is identified by magic/version, and readers should
+ * use header_size/client_size to locate records, so that fields
+ * may be appended in later versions.
+ */
+
+#ifdef ENABLE_MSTATS
+
+#include "basic.h"
+#include "common.h"
+
+#define MSTATS_MAGIC   0x4f56504e /* "OVPN" */
+#define MSTATS_VERSION 1
+
+#define MSTATS_NAME_LEN 64
+
+struct mstats_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t client_size;
+  uint32_t n_slots;             /* client records following header */
+  uint32_t pid;                 /* 0 after server has exited */
+
+  volatile uint32_t seq;        /* sequence lock for the fields below */
+  uint32_t n_clients;           /* client records in use */
+  uint64_t started;
+  uint64_t updated;
+
+  /* totals over all clients since startup */
+  uint64_t n_connects;
+  uint64_t link_read_bytes;
+  uint64_t link_write_bytes;
+  uint64_t tun_read_bytes;
+  uint64_t tun_write_bytes;
+};
+
+struct mstats_client
+{
+  volatile uint32_t seq;        /* sequence lock for the fields below */
+# define MSTATS_CLIENT_ACTIVE (1<<0)
+  uint32_t flags;
+  uint64_t created;
+  uint64_t updated;
+
+  uint64_t link_read_bytes;
+  uint64_t link_write_bytes;
+  uint64_t tun_read_bytes;
+  uint64_t tun_write_bytes;
+
+  char common_name[MSTATS_NAME_LEN];
+  char real_address[MSTATS_NAME_LEN];
+  char virtual_address[MSTATS_NAME_LEN];
+};
+
+/*
+ * Server-side state
+ */
+struct mstats
+{
+  char *filename;
+  int fd;
+  size_t size;
+  struct mstats_header *header;
+  struct mstats_client *clients;
+
+  /* stack of unused client records */
+  int *free_slots;
+  int n_free;
+};
+
+struct mstats *mstats_open (const char *filename, const int n_slots);
+void mstats_close (struct mstats *ms);
+
+int mstats_client_add (struct mstats *ms,
+		       const char *common_name,
+		       const char *real_address,
+		       const char *virtual_address,
+		       const time_t created);
+
+void mstats_client_update (struct mstats *ms,
+			   const int slot,
+			   const counter_type link_read_bytes,
+			   const counter_type link_write_bytes,
+			   const counter_type tun_read_bytes,
+			   const counter_type tun_write_bytes);
+
+void mstats_client_remove (struct mstats *ms, const int slot);
+
+void mstats_tick (struct mstats *ms);
+
+#endif
+#endif
@@ -61,6 +61,9 @@
 #ifdef ENABLE_MANAGEMENT
 # define MTCP_MANAGEMENT ((void*)4)
 #endif
+#ifdef ENABLE_PLUGIN_DEFERRED
+# define MTCP_PLUGIN     ((void*)5)
+#endif
 
 #define MTCP_N           ((void*)16) /* upper bound on MTCP_x */
 
@@ -244,9 +247,13 @@ multi_tcp_wait (const struct context *c,
 #ifdef ENABLE_MANAGEMENT
   if (management)
     management_socket_set (management, mtcp->es, MTCP_MANAGEMENT, &mtcp->management_persist_flags);
+#endif
+#ifdef ENABLE_PLUGIN_DEFERRED
+  plugin_event_set (c->c1.plugins, mtcp->es, MTCP_PLUGIN, &mtcp->plugin_persist_flags);
 #endif
   status = event_wait (mtcp->es, &c->c2.timeval, mtcp->esr, mtcp->maxevents);
   update_time ();
+  update_now_tv ();
   mtcp->n_esr = 0;
   if (status > 0)
     mtcp->n_esr = status;
@@ -581,6 +588,21 @@ multi_tcp_action (struct multi_context *m, struct multi_instance *mi, int action
   } while (action != TA_UNDEF);
 }
 
+/*
+ * Process queued mbuf packets destined for TCP socket
+ */
+static void
+multi_tcp_process_mbuf (struct multi_context *m)
+{
+  struct multi_instance *mi;
+  if (mbuf_fq_throttled (m->mbuf))
+    mbuf_fq_release (m->mbuf, NULL);
+  while (!IS_SIG (&m->top) && (mi = mbuf_fq_peek (m->mbuf)) != NULL)
+    {
+      multi_tcp_action (m, mi, TA_SOCKET_WRITE, true);
+    }
+}
+
 static void
 multi_tcp_process_io (struct multi_context *m)
 {
@@ -612,6 +634,14 @@ multi_tcp_process_io (struct multi_context *m)
 	      management_io (management);
 	    }
 	  else
+#endif
+#ifdef ENABLE_PLUGIN_DEFERRED
+	  /* deferred plug-in calls completed? */
+	  if (e->arg == MTCP_PLUGIN)
+	    {
+	      plugin_process_completions (m->top.c1.plugins);
+	    }
+	  else
 #endif
 	  /* incoming data on TUN? */
 	  if (e->arg == MTCP_TUN)
@@ -642,16 +672,7 @@ multi_tcp_process_io (struct multi_context *m)
     }
   mtcp->n_esr = 0;
 
-  /*
-   * Process queued mbuf packets destined for TCP socket
-   */
-  {
-    struct multi_instance *mi;
-    while (!IS_SIG (&m->top) && (mi = mbuf_peek (m->mbuf)) != NULL)
-      {
-	multi_tcp_action (m, mi, TA_SOCKET_WRITE, true);
-      }
-  }
+  multi_tcp_process_mbuf (m);
 }
 
 /*
@@ -691,11 +712,13 @@ tunnel_server_tcp (struct context *top)
 
       /* wait on tun/socket list */
       multi_get_timeout (&multi, &multi.top.c2.timeval);
+      check_msg_buffer (&multi.top.c2.timeval);
       status = multi_tcp_wait (&multi.top, multi.mtcp);
       MULTI_CHECK_SIG (&multi);
 
       /* check on status of coarse timers */
       multi_process_per_second_timers (&multi);
+      multi_process_bytecount (&multi);
 
       /* timeout? */
       if (status > 0)
@@ -707,6 +730,9 @@ tunnel_server_tcp (struct context *top)
       else if (status == 0)
 	{
 	  multi_tcp_action (&multi, NULL, TA_TIMEOUT, false);
+
+	  /* output of rate limited clients may have been released */
+	  multi_tcp_process_mbuf (&multi);
 	}
 
       perf_pop ();
@@ -46,6 +46,9 @@ struct multi_tcp
 #ifdef ENABLE_MANAGEMENT
   unsigned int management_persist_flags;
 #endif
+#ifdef ENABLE_PLUGIN_DEFERRED
+  unsigned int plugin_persist_flags;
+#endif
 };
 
 struct multi_instance;
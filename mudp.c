@@ -38,8 +38,30 @@
 #include "memdbg.h"
 
 /*
- * Get a client instance based on real address.  If
- * the instance doesn't exist, create it while
+ * Get the client instance which owns the peer-id of a
+ * P_DATA_V2 packet, by direct index into m->peers.
+ * The packet may come from a new address, if the client
+ * has roamed; it is up to the instance to authenticate it.
+ */
+static inline struct multi_instance *
+multi_get_instance_by_peer_id (struct multi_context *m, const struct buffer *buf)
+{
+  if (m->peers && BLEN (buf) >= 1 + TLS_PEER_ID_LEN)
+    {
+      const uint8_t *p = BPTR (buf);
+      if ((p[0] >> P_OPCODE_SHIFT) == P_DATA_V2)
+	{
+	  const int id = (p[1] << 16) | (p[2] << 8) | p[3];
+	  if (id < m->max_peers && m->peers[id] && !m->peers[id]->halt)
+	    return m->peers[id];
+	}
+    }
+  return NULL;
+}
+
+/*
+ * Get a client instance based on peer-id or real address.
+ * If the instance doesn't exist, create it while
  * maintaining real address hash table atomicity.
  */
 
@@ -51,6 +73,13 @@ multi_get_create_instance_udp (struct multi_context *m)
   struct multi_instance *mi = NULL;
   struct hash *hash = m->hash;
 
+  mi = multi_get_instance_by_peer_id (m, &m->top.c2.buf);
+  if (mi)
+    {
+      gc_free (&gc);
+      return mi;
+    }
+
   if (mroute_extract_sockaddr_in (&real, &m->top.c2.from, true))
     {
       struct hash_element *he;
@@ -157,6 +186,11 @@ multi_process_io_udp (struct multi_context *m)
     }
 #endif
 
+#ifdef ENABLE_PLUGIN_DEFERRED
+  if (status & PLUGIN_READ)
+    plugin_process_completions (m->top.c1.plugins);
+#endif
+
   /* UDP port ready to accept write */
   if (status & SOCKET_WRITE)
     {
@@ -200,7 +234,7 @@ p2mp_iow_flags (const struct multi_context *m)
       if (LINK_OUT (&m->pending->context))
 	flags |= IOW_TO_LINK;
     }
-  else if (mbuf_defined (m->mbuf))
+  else if (mbuf_fq_defined (m->mbuf))
     flags |= IOW_MBUF;
   else
     flags |= IOW_READ;
@@ -231,6 +265,11 @@ tunnel_server_udp_single_threaded (struct context *top)
   /* initialize our cloned top object */
   multi_top_init (&multi, top, true);
 
+#ifdef ENABLE_HANDOFF
+  /* take over clients from an old server, if it handed off to us */
+  multi_handoff_restore (&multi);
+#endif
+
   /* initialize management interface */
   init_management_callback_multi (&multi);
 
@@ -249,6 +288,7 @@ tunnel_server_udp_single_threaded (struct context *top)
 
       /* check on status of coarse timers */
       multi_process_per_second_timers (&multi);
+      multi_process_bytecount (&multi);
 
       /* timeout? */
       if (multi.top.c2.event_set_status == ES_TIMEOUT)
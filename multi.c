@@ -37,6 +37,7 @@
 #include "misc.h"
 #include "otime.h"
 #include "gremlin.h"
+#include "handoff.h"
 
 #include "memdbg.h"
 
@@ -121,6 +122,24 @@ multi_ifconfig_pool_persist (struct multi_context *m, bool force)
     }
 }
 
+#ifdef ENABLE_MSTATS
+/*
+ * Copy a client's traffic counters to its --status-mmap record.
+ */
+static void
+multi_mstats_update (struct multi_context *m, struct multi_instance *mi)
+{
+  const struct context *c = &mi->context;
+  mstats_client_update (m->mstats,
+			mi->mstats_slot,
+			c->c2.link_read_bytes,
+			c->c2.link_write_bytes,
+			c->c2.tun_read_bytes,
+			c->c2.tun_write_bytes);
+  mi->mstats_updated = now;
+}
+#endif
+
 static void
 multi_reap_range (const struct multi_context *m,
 		  int start_bucket,
@@ -160,13 +179,21 @@ multi_reap_all (const struct multi_context *m)
   multi_reap_range (m, -1, 0);
 }
 
+/*
+ * How many buckets in vhash to reap per pass.
+ */
+static int
+reap_buckets_per_pass (int n_buckets)
+{
+  return constrain_int (n_buckets / REAP_DIVISOR, REAP_MIN, REAP_MAX);
+}
+
 static struct multi_reap *
-multi_reap_new (int buckets_per_pass)
+multi_reap_new (void)
 {
   struct multi_reap *mr;
   ALLOC_OBJ (mr, struct multi_reap);
   mr->bucket_base = 0;
-  mr->buckets_per_pass = buckets_per_pass;
   mr->last_call = now;
   return mr;
 }
@@ -175,10 +202,14 @@ void
 multi_reap_process_dowork (const struct multi_context *m)
 {
   struct multi_reap *mr = m->reaper;
-  if (mr->bucket_base >= hash_n_buckets (m->vhash))
+  const int n_buckets = hash_n_buckets (m->vhash);
+  /* vhash grows, so size each pass from its current size */
+  const int buckets_per_pass = reap_buckets_per_pass (n_buckets);
+
+  if (mr->bucket_base >= n_buckets)
     mr->bucket_base = 0;
-  multi_reap_range (m, mr->bucket_base, mr->bucket_base + mr->buckets_per_pass); 
-  mr->bucket_base += mr->buckets_per_pass;
+  multi_reap_range (m, mr->bucket_base, mr->bucket_base + buckets_per_pass); 
+  mr->bucket_base += buckets_per_pass;
   mr->last_call = now;
 }
 
@@ -189,17 +220,32 @@ multi_reap_free (struct multi_reap *mr)
 }
 
 /*
- * How many buckets in vhash to reap per pass.
+ * Main initialization function, init multi_context object.
  */
-static int
-reap_buckets_per_pass (int n_buckets)
-{
-  return constrain_int (n_buckets / REAP_DIVISOR, REAP_MIN, REAP_MAX);
-}
+#ifdef ENABLE_PLUGIN_DEFERRED
 
 /*
- * Main initialization function, init multi_context object.
+ * Called by plugin_process_completions when all deferred
+ * plug-in calls owned by an instance have completed.
+ * Wake the instance up right away, and make sure that
+ * it runs tls_multi_process.
  */
+static void
+multi_plugin_notify (void *arg, void *owner)
+{
+  struct multi_context *m = (struct multi_context *) arg;
+  struct multi_instance *mi = (struct multi_instance *) owner;
+
+  if (!mi->halt)
+    {
+      interval_trigger (&mi->context.c2.tmp_int);
+      mi->wakeup = now_tv;
+      schedule_add_entry (m->schedule, (struct schedule_entry *) mi, &mi->wakeup, 0);
+    }
+}
+
+#endif
+
 void
 multi_init (struct multi_context *m, struct context *t, bool tcp_mode, int thread_mode)
 {
@@ -221,6 +267,9 @@ multi_init (struct multi_context *m, struct context *t, bool tcp_mode, int threa
   
   m->thread_mode = thread_mode;
 
+  /* choose a new secret key for hashing addresses */
+  mroute_hash_seed ();
+
   /*
    * Real address hash table (source port number is
    * considered to be part of the address).  Used
@@ -239,21 +288,26 @@ multi_init (struct multi_context *m, struct context *t, bool tcp_mode, int threa
 			mroute_addr_hash_function,
 			mroute_addr_compare_function);
 
-  /*
-   * This hash table is a clone of m->hash but with a
-   * bucket size of one so that it can be used
-   * for fast iteration through the list.
-   */
-  m->iter = hash_init (1,
-		       mroute_addr_hash_function,
-		       mroute_addr_compare_function);
-
   /*
    * This is our scheduler, for time-based wakeup
    * events.
    */
   m->schedule = schedule_init ();
 
+  /*
+   * Cache of parsed --client-config-dir files
+   */
+  if (t->options.ccd_cache_max && t->options.client_config_dir)
+    m->ccd_cache = ccd_cache_new (t->options.client_config_dir,
+				  t->options.ccd_cache_max,
+				  t->options.ccd_cache_refresh);
+
+  /*
+   * Build the PUSH_REPLY messages for --push options once,
+   * before client instances start sharing the push list.
+   */
+  push_reply_template_init (&t->options);
+
   /*
    * Limit frequency of incoming connections to control
    * DoS.
@@ -262,9 +316,30 @@ multi_init (struct multi_context *m, struct context *t, bool tcp_mode, int threa
 						    t->options.cf_per);
 
   /*
-   * Allocate broadcast/multicast buffer list
+   * Allocate fair queue for client-to-client and
+   * broadcast/multicast output, with a quantum of
+   * one full-sized packet.
+   */
+  m->mbuf = mbuf_fq_init (t->options.n_bcast_buf, BUF_SIZE (&t->c2.frame));
+
+  /*
+   * Aggregate rate limit on output to clients
+   */
+  token_bucket_init (&m->shaper, t->options.client_shaper_total, NULL);
+
+#ifdef ENABLE_ASYNC_SCRIPT
+  /*
+   * Non-blocking scripts
+   */
+  script_async_init (t->options.script_async_max, t->options.script_async_timeout);
+#endif
+
+#ifdef ENABLE_PLUGIN_DEFERRED
+  /*
+   * Plug-in calls which complete asynchronously
    */
-  m->mbuf = mbuf_init (t->options.n_bcast_buf);
+  plugin_set_notify (t->c1.plugins, multi_plugin_notify, m);
+#endif
 
   /*
    * Different status file format options are available
@@ -310,7 +385,7 @@ multi_init (struct multi_context *m, struct context *t, bool tcp_mode, int threa
   /*
    * Initialize route and instance reaper.
    */
-  m->reaper = multi_reap_new (reap_buckets_per_pass (t->options.virtual_hash_size));
+  m->reaper = multi_reap_new ();
 
   /*
    * Get local ifconfig address
@@ -330,12 +405,57 @@ multi_init (struct multi_context *m, struct context *t, bool tcp_mode, int threa
   if (tcp_mode)
     m->mtcp = multi_tcp_init (t->options.max_clients, &m->max_clients);
   m->tcp_queue_limit = t->options.tcp_queue_limit;
+
+#ifdef ENABLE_MANAGEMENT
+  m->bytecount_index = -1;
+#endif
+
+#ifdef ENABLE_MSTATS
+  /*
+   * Shared memory statistics, with one record
+   * per client.
+   */
+  if (t->options.status_mmap_file)
+    m->mstats = mstats_open (t->options.status_mmap_file, m->max_clients);
+#endif
   
   /*
    * Allow client <-> client communication, without going through
    * tun/tap interface and network stack?
    */
   m->enable_c2c = t->options.enable_c2c;
+
+  /*
+   * Track multicast group membership, so that
+   * multicast is only sent to interested clients.
+   */
+  if (t->options.igmp_snooping)
+    m->mcast = mcast_set_init ();
+
+  /*
+   * Answer ARP requests for client addresses
+   * rather than broadcasting them.
+   */
+  if (t->options.proxy_arp && dev == DEV_TYPE_TAP)
+    m->arp_proxy = arp_proxy_init ();
+
+  /*
+   * Peer-id table, so that UDP clients can
+   * roam to a new address.
+   */
+  if (!tcp_mode)
+    {
+      m->max_peers = min_int (m->max_clients, TLS_PEER_ID_UNDEF);
+      ALLOC_ARRAY_CLEAR (m->peers, struct multi_instance *, m->max_peers);
+    }
+
+#ifdef ENABLE_RELOAD
+  /*
+   * A reload may lower --max-clients, but not raise
+   * it above what was allocated for here.
+   */
+  m->max_clients_alloc = m->max_clients;
+#endif
 }
 
 const char *
@@ -424,13 +544,84 @@ multi_client_disconnect_script (struct multi_context *m,
 	  
 	  buf_printf (&cmd, "%s", mi->context.options.client_disconnect_script);
 
-	  system_check (BSTR (&cmd), mi->context.c2.es, S_SCRIPT, "client-disconnect command failed");
+	  system_check_nowait (BSTR (&cmd), mi->context.c2.es, S_SCRIPT, "client-disconnect command failed");
 	  
 	  gc_free (&gc);
 	}
     }
 }
 
+/*
+ * Add/remove an instance to/from m->instances.
+ */
+static void
+multi_instance_list_add (struct multi_context *m, struct multi_instance *mi)
+{
+  if (m->n_instances == m->max_instances)
+    {
+      struct multi_instance **instances;
+      m->max_instances = max_int (m->max_instances * 2, 16);
+      ALLOC_ARRAY (instances, struct multi_instance *, m->max_instances);
+      if (m->n_instances)
+	memcpy (instances, m->instances, m->n_instances * sizeof (struct multi_instance *));
+      free (m->instances);
+      m->instances = instances;
+    }
+  mi->iter_index = m->n_instances;
+  m->instances[m->n_instances++] = mi;
+}
+
+static void
+multi_instance_list_del (struct multi_context *m, struct multi_instance *mi)
+{
+  const int i = mi->iter_index;
+  ASSERT (i >= 0 && i < m->n_instances && m->instances[i] == mi);
+  m->instances[i] = m->instances[--m->n_instances];
+  m->instances[i]->iter_index = i;
+  mi->iter_index = -1;
+}
+
+/*
+ * Give a UDP client instance a peer-id.  Ids are handed out
+ * round-robin, so that a recently released id is not reused
+ * right away by another client.
+ */
+static void
+multi_peer_id_assign (struct multi_context *m, struct multi_instance *mi)
+{
+  int i;
+
+  for (i = 0; i < m->max_peers; ++i)
+    {
+      const int id = (m->peer_next + i) % m->max_peers;
+      if (!m->peers[id])
+	{
+	  m->peers[id] = mi;
+	  m->peer_next = id + 1;
+	  mi->peer_id = id;
+	  tls_set_peer_id (mi->context.c2.tls_multi, id, false);
+	  return;
+	}
+    }
+}
+
+static void
+multi_peer_id_release (struct multi_context *m, struct multi_instance *mi)
+{
+  ASSERT (m->peers[mi->peer_id] == mi);
+  m->peers[mi->peer_id] = NULL;
+  mi->peer_id = -1;
+}
+
+#ifdef ENABLE_DEFERRED_AUTH
+static inline void
+multi_client_connect_undefer (struct multi_instance *mi)
+{
+  free (mi->client_connect_file);
+  mi->client_connect_file = NULL;
+}
+#endif
+
 void
 multi_close_instance (struct multi_context *m,
 		      struct multi_instance *mi,
@@ -455,10 +646,11 @@ multi_close_instance (struct multi_context *m,
 	{
 	  ASSERT (hash_remove (m->hash, &mi->real));
 	}
-      if (mi->did_iter)
-	{
-	  ASSERT (hash_remove (m->iter, &mi->real));
-	}
+      if (mi->iter_index >= 0)
+	multi_instance_list_del (m, mi);
+
+      if (mi->peer_id >= 0)
+	multi_peer_id_release (m, mi);
 
       schedule_remove_entry (m->schedule, (struct schedule_entry *) mi);
 
@@ -473,8 +665,35 @@ multi_close_instance (struct multi_context *m,
       if (m->mtcp)
 	multi_tcp_dereference_instance (m->mtcp, mi);
 
-      mbuf_dereference_instance (m->mbuf, mi);
+      if (m->mcast)
+	mcast_leave_all (m->mcast, mi);
+
+      if (m->arp_proxy)
+	arp_proxy_forget (m->arp_proxy, mi);
+    }
+
+  if (mi->pf)
+    {
+      pf_free (mi->pf);
+      mi->pf = NULL;
+      --m->n_filtered;
+    }
+
+  mbuf_fq_remove (m->mbuf, &mi->mbuf_flow);
+
+#ifdef ENABLE_ASYNC_SCRIPT
+  script_job_abort (&mi->client_connect_job);
+#endif
+#ifdef ENABLE_PLUGIN_DEFERRED
+  plugin_request_cancel (&mi->client_connect_plugin);
+#endif
+#ifdef ENABLE_DEFERRED_AUTH
+  if (mi->client_connect_file)
+    {
+      delete_file (mi->client_connect_file);
+      multi_client_connect_undefer (mi);
     }
+#endif
 
   multi_client_disconnect_script (m, mi);
 
@@ -485,6 +704,15 @@ multi_close_instance (struct multi_context *m,
 
   ungenerate_prefix (mi);
 
+#ifdef ENABLE_MSTATS
+  if (mi->mstats_slot >= 0)
+    {
+      multi_mstats_update (m, mi);
+      mstats_client_remove (m->mstats, mi->mstats_slot);
+      mi->mstats_slot = -1;
+    }
+#endif
+
   /*
    * Don't actually delete the instance memory allocation yet,
    * because virtual routes may still point to it.  Let the
@@ -510,28 +738,44 @@ multi_uninit (struct multi_context *m)
     {
       if (m->hash)
 	{
-	  struct hash_iterator hi;
-	  struct hash_element *he;
+	  int i;
 
-	  hash_iterator_init (m->iter, &hi, true);
-	  while ((he = hash_iterator_next (&hi)))
-	    {
-	      struct multi_instance *mi = (struct multi_instance *) he->value;
-	      mi->did_iter = false;
-	      multi_close_instance (m, mi, true);
-	    }
-	  hash_iterator_free (&hi);
+	  for (i = m->n_instances - 1; i >= 0; --i)
+	    multi_close_instance (m, multi_instance_at (m, i, -1), true);
 
 	  multi_reap_all (m);
 
+#ifdef ENABLE_ASYNC_SCRIPT
+	  /* wait for --client-disconnect scripts */
+	  script_async_flush ();
+#endif
+
+#ifdef ENABLE_PLUGIN_DEFERRED
+	  plugin_set_notify (m->top.c1.plugins, NULL, NULL);
+#endif
+
 	  hash_free (m->hash);
 	  hash_free (m->vhash);
-	  hash_free (m->iter);
+	  free (m->instances);
+	  m->instances = NULL;
+	  m->n_instances = m->max_instances = 0;
+	  free (m->peers);
+	  m->peers = NULL;
+	  m->max_peers = 0;
 	  m->hash = NULL;
 
 	  schedule_free (m->schedule);
-	  mbuf_free (m->mbuf);
+	  mbuf_fq_free (m->mbuf);
 	  ifconfig_pool_free (m->ifconfig_pool);
+	  ccd_cache_free (m->ccd_cache);
+	  mcast_set_free (m->mcast);
+	  m->mcast = NULL;
+	  arp_proxy_free (m->arp_proxy);
+	  m->arp_proxy = NULL;
+#ifdef ENABLE_MSTATS
+	  mstats_close (m->mstats);
+	  m->mstats = NULL;
+#endif
 	  frequency_limit_free (m->new_connection_limiter);
 	  multi_reap_free (m->reaper);
 	  mroute_helper_free (m->route_helper);
@@ -560,8 +804,15 @@ multi_create_instance (struct multi_context *m, const struct mroute_addr *real)
   mi->gc = gc_new ();
   multi_instance_inc_refcount (mi);
   mi->vaddr_handle = -1;
+  mi->iter_index = -1;
+  mi->peer_id = -1;
+  mi->cid = m->cid_counter++;
+#ifdef ENABLE_MSTATS
+  mi->mstats_slot = -1;
+#endif
   mi->created = now;
   mroute_addr_init (&mi->real);
+  mbuf_flow_init (&mi->mbuf_flow, mi);
 
   if (real)
     {
@@ -576,6 +827,11 @@ multi_create_instance (struct multi_context *m, const struct mroute_addr *real)
 
   mi->context.c2.context_auth = CAS_PENDING;
 
+#ifdef ENABLE_PLUGIN_DEFERRED
+  /* allow auth-user-pass-verify plug-ins to complete asynchronously */
+  tls_set_deferred_owner (mi->context.c2.tls_multi, mi);
+#endif
+
   if (hash_n_elements (m->hash) >= m->max_clients)
     {
       msg (D_MULTI_ERRORS, "MULTI: new incoming connection would exceed maximum number of clients (%d)", m->max_clients);
@@ -589,13 +845,16 @@ multi_create_instance (struct multi_context *m, const struct mroute_addr *real)
       generate_prefix (mi);
     }
 
-  if (!hash_add (m->iter, &mi->real, mi, false))
+  if (hash_lookup_fast (m->hash, hash_bucket (m->hash, 0), &mi->real, hash_value (m->hash, &mi->real)))
     {
-      msg (D_MULTI_LOW, "MULTI: unable to add real address [%s] to iterator hash table",
+      msg (D_MULTI_LOW, "MULTI: real address [%s] is already in use by another client instance",
 	   mroute_addr_print (&mi->real, &gc));
       goto err;
     }
-  mi->did_iter = true;
+  multi_instance_list_add (m, mi);
+
+  if (m->peers)
+    multi_peer_id_assign (m, mi);
 
   mi->context.c2.push_reply_deferred = true;
 
@@ -616,6 +875,74 @@ multi_create_instance (struct multi_context *m, const struct mroute_addr *real)
   return NULL;
 }
 
+/*
+ * Show how often pre_select() and its components
+ * needed to run, in the GLOBAL STATS section of
+ * the status output.
+ */
+static void
+multi_print_pre_select_stats (struct status_output *so, const char *prefix)
+{
+  const struct pre_select_stats *ps = &pre_select_stats;
+  status_printf (so, "%spre_select run," counter_format, prefix, ps->full);
+  status_printf (so, "%spre_select skipped," counter_format, prefix, ps->lazy);
+  status_printf (so, "%spre_select coarse timers," counter_format, prefix, ps->coarse_timers);
+  status_printf (so, "%spre_select TLS," counter_format, prefix, ps->tls);
+  status_printf (so, "%spre_select TLS errors," counter_format, prefix, ps->tls_errors);
+  status_printf (so, "%spre_select control channel," counter_format, prefix, ps->control_channel);
+  status_printf (so, "%spre_select OCC," counter_format, prefix, ps->occ);
+  status_printf (so, "%spre_select fragment," counter_format, prefix, ps->fragment);
+  status_printf (so, "%spre_select random timeout," counter_format, prefix, ps->random_component);
+}
+
+/*
+ * Print the --igmp-snooping group table, one line per
+ * group member.
+ */
+static void
+multi_print_mcast_groups (struct multi_context *m, struct status_output *so, const int version)
+{
+  struct hash_iterator hi;
+  const struct hash_element *he;
+
+  if (version == 1)
+    {
+      status_printf (so, "MULTICAST GROUPS");
+      status_printf (so, "Group Address,Common Name,Real Address,Last Report");
+    }
+  else
+    status_printf (so, "HEADER,MCAST_GROUP,Group Address,Common Name,Real Address,Last Report,Last Report (time_t)");
+
+  hash_iterator_init (m->mcast->hash, &hi, true);
+  while ((he = hash_iterator_next (&hi)))
+    {
+      const struct mcast_group *g = (struct mcast_group *) he->value;
+      int i;
+
+      for (i = 0; i < g->n_members; ++i)
+	{
+	  struct gc_arena gc = gc_new ();
+	  const struct mcast_member *mm = &g->members[i];
+
+	  if (version == 1)
+	    status_printf (so, "%s,%s,%s,%s",
+			   mroute_addr_print (&g->addr, &gc),
+			   tls_common_name (mm->mi->context.c2.tls_multi, false),
+			   mroute_addr_print (&mm->mi->real, &gc),
+			   time_string (mm->last_report, 0, false, &gc));
+	  else
+	    status_printf (so, "MCAST_GROUP,%s,%s,%s,%s,%u",
+			   mroute_addr_print (&g->addr, &gc),
+			   tls_common_name (mm->mi->context.c2.tls_multi, false),
+			   mroute_addr_print (&mm->mi->real, &gc),
+			   time_string (mm->last_report, 0, false, &gc),
+			   (unsigned int)mm->last_report);
+	  gc_free (&gc);
+	}
+    }
+  hash_iterator_free (&hi);
+}
+
 /*
  * Dump tables -- triggered by SIGUSR2.
  * If status file is defined, write to file.
@@ -629,6 +956,7 @@ multi_print_status (struct multi_context *m, struct status_output *so, const int
       struct gc_arena gc_top = gc_new ();
       struct hash_iterator hi;
       const struct hash_element *he;
+      int i;
 
       status_reset (so);
 
@@ -640,11 +968,10 @@ multi_print_status (struct multi_context *m, struct status_output *so, const int
 	  status_printf (so, PACKAGE_NAME " CLIENT LIST");
 	  status_printf (so, "Updated,%s", time_string (0, 0, false, &gc_top));
 	  status_printf (so, "Common Name,Real Address,Bytes Received,Bytes Sent,Connected Since");
-	  hash_iterator_init (m->hash, &hi, true);
-	  while ((he = hash_iterator_next (&hi)))
+	  for (i = 0; i < m->n_instances; ++i)
 	    {
 	      struct gc_arena gc = gc_new ();
-	      const struct multi_instance *mi = (struct multi_instance *) he->value;
+	      const struct multi_instance *mi = multi_instance_at (m, i, 1);
 
 	      if (!mi->halt)
 		{
@@ -657,7 +984,6 @@ multi_print_status (struct multi_context *m, struct status_output *so, const int
 		}
 	      gc_free (&gc);
 	    }
-	  hash_iterator_free (&hi);
 
 	  status_printf (so, "ROUTING TABLE");
 	  status_printf (so, "Virtual Address,Common Name,Real Address,Last Ref");
@@ -686,10 +1012,54 @@ multi_print_status (struct multi_context *m, struct status_output *so, const int
 	    }
 	  hash_iterator_free (&hi);
 
+	  status_printf (so, "OUTPUT QUEUES");
+	  status_printf (so, "Common Name,Real Address,Queue Length,Max Queue Length,Sojourn Time (us),Dropped");
+	  for (i = 0; i < m->n_instances; ++i)
+	    {
+	      struct gc_arena gc = gc_new ();
+	      const struct multi_instance *mi = multi_instance_at (m, i, 1);
+
+	      if (!mi->halt)
+		{
+		  status_printf (so, "%s,%s,%d,%d,%d," counter_format,
+				 tls_common_name (mi->context.c2.tls_multi, false),
+				 mroute_addr_print (&mi->real, &gc),
+				 mbuf_flow_len (&mi->mbuf_flow),
+				 mbuf_flow_maximum_queued (&mi->mbuf_flow),
+				 mi->mbuf_flow.sojourn,
+				 mi->mbuf_flow.dropped);
+		}
+	      gc_free (&gc);
+	    }
+
+	  if (m->mcast)
+	    multi_print_mcast_groups (m, so, version);
+
 	  status_printf (so, "GLOBAL STATS");
 	  if (m->mbuf)
 	    status_printf (so, "Max bcast/mcast queue length,%d",
-			   mbuf_maximum_queued (m->mbuf));
+			   mbuf_fq_maximum_queued (m->mbuf));
+	  if (m->mcast)
+	    status_printf (so, "Multicast groups,%d,joins," counter_format ",leaves," counter_format ",expired," counter_format ",dropped," counter_format,
+			   hash_n_elements (m->mcast->hash),
+			   m->mcast->joins,
+			   m->mcast->leaves,
+			   m->mcast->expired,
+			   m->mcast->dropped);
+	  if (m->arp_proxy)
+	    status_printf (so, "ARP proxy bindings,%d,answered," counter_format ",flooded," counter_format,
+			   hash_n_elements (m->arp_proxy->hash),
+			   m->arp_proxy->answered,
+			   m->arp_proxy->flooded);
+	  if (m->enable_c2c)
+	    status_printf (so, "Client-to-client,direct," counter_format ",queued," counter_format,
+			   m->c2c_direct,
+			   m->c2c_queued);
+	  if (m->peers)
+	    status_printf (so, "Client floats," counter_format, m->floats);
+	  multi_print_pre_select_stats (so, "");
+	  plugin_print_stats (m->top.c1.plugins, so, "");
+	  status_printf (so, "Log messages dropped,%u", msg_buffer_dropped ());
 
 	  status_printf (so, "END");
 	}
@@ -700,27 +1070,26 @@ multi_print_status (struct multi_context *m, struct status_output *so, const int
 	   */
 	  status_printf (so, "TITLE,%s", title_string);
 	  status_printf (so, "TIME,%s,%u", time_string (now, 0, false, &gc_top), (unsigned int)now);
-	  status_printf (so, "HEADER,CLIENT_LIST,Common Name,Real Address,Virtual Address,Bytes Received,Bytes Sent,Connected Since,Connected Since (time_t)");
-	  hash_iterator_init (m->hash, &hi, true);
-	  while ((he = hash_iterator_next (&hi)))
+	  status_printf (so, "HEADER,CLIENT_LIST,Common Name,Real Address,Virtual Address,Bytes Received,Bytes Sent,Connected Since,Connected Since (time_t),Client ID");
+	  for (i = 0; i < m->n_instances; ++i)
 	    {
 	      struct gc_arena gc = gc_new ();
-	      const struct multi_instance *mi = (struct multi_instance *) he->value;
+	      const struct multi_instance *mi = multi_instance_at (m, i, 1);
 
 	      if (!mi->halt)
 		{
-		  status_printf (so, "CLIENT_LIST,%s,%s,%s," counter_format "," counter_format ",%s,%u",
+		  status_printf (so, "CLIENT_LIST,%s,%s,%s," counter_format "," counter_format ",%s,%u,%lu",
 				 tls_common_name (mi->context.c2.tls_multi, false),
 				 mroute_addr_print (&mi->real, &gc),
 				 print_in_addr_t (mi->reporting_addr, IA_EMPTY_IF_UNDEF, &gc),
 				 mi->context.c2.link_read_bytes,
 				 mi->context.c2.link_write_bytes,
 				 time_string (mi->created, 0, false, &gc),
-				 (unsigned int)mi->created);
+				 (unsigned int)mi->created,
+				 mi->cid);
 		}
 	      gc_free (&gc);
 	    }
-	  hash_iterator_free (&hi);
 
 	  status_printf (so, "HEADER,ROUTING_TABLE,Virtual Address,Common Name,Real Address,Last Ref,Last Ref (time_t)");
 	  hash_iterator_init (m->vhash, &hi, true);
@@ -749,9 +1118,52 @@ multi_print_status (struct multi_context *m, struct status_output *so, const int
 	    }
 	  hash_iterator_free (&hi);
 
+	  status_printf (so, "HEADER,CLIENT_QUEUE,Common Name,Real Address,Queue Length,Max Queue Length,Sojourn Time (us),Dropped");
+	  for (i = 0; i < m->n_instances; ++i)
+	    {
+	      struct gc_arena gc = gc_new ();
+	      const struct multi_instance *mi = multi_instance_at (m, i, 1);
+
+	      if (!mi->halt)
+		{
+		  status_printf (so, "CLIENT_QUEUE,%s,%s,%d,%d,%d," counter_format,
+				 tls_common_name (mi->context.c2.tls_multi, false),
+				 mroute_addr_print (&mi->real, &gc),
+				 mbuf_flow_len (&mi->mbuf_flow),
+				 mbuf_flow_maximum_queued (&mi->mbuf_flow),
+				 mi->mbuf_flow.sojourn,
+				 mi->mbuf_flow.dropped);
+		}
+	      gc_free (&gc);
+	    }
+
+	  if (m->mcast)
+	    multi_print_mcast_groups (m, so, version);
+
 	  if (m->mbuf)
 	    status_printf (so, "GLOBAL_STATS,Max bcast/mcast queue length,%d",
-			   mbuf_maximum_queued (m->mbuf));
+			   mbuf_fq_maximum_queued (m->mbuf));
+	  if (m->mcast)
+	    status_printf (so, "GLOBAL_STATS,Multicast groups,%d,joins," counter_format ",leaves," counter_format ",expired," counter_format ",dropped," counter_format,
+			   hash_n_elements (m->mcast->hash),
+			   m->mcast->joins,
+			   m->mcast->leaves,
+			   m->mcast->expired,
+			   m->mcast->dropped);
+	  if (m->arp_proxy)
+	    status_printf (so, "GLOBAL_STATS,ARP proxy bindings,%d,answered," counter_format ",flooded," counter_format,
+			   hash_n_elements (m->arp_proxy->hash),
+			   m->arp_proxy->answered,
+			   m->arp_proxy->flooded);
+	  if (m->enable_c2c)
+	    status_printf (so, "GLOBAL_STATS,Client-to-client,direct," counter_format ",queued," counter_format,
+			   m->c2c_direct,
+			   m->c2c_queued);
+	  if (m->peers)
+	    status_printf (so, "GLOBAL_STATS,Client floats," counter_format, m->floats);
+	  multi_print_pre_select_stats (so, "GLOBAL_STATS,");
+	  plugin_print_stats (m->top.c1.plugins, so, "GLOBAL_STATS,");
+	  status_printf (so, "GLOBAL_STATS,Log messages dropped,%u", msg_buffer_dropped ());
 
 	  status_printf (so, "END");
 	}
@@ -1010,25 +1422,19 @@ multi_delete_dup (struct multi_context *m, struct multi_instance *new_mi)
       const char *new_cn = tls_common_name (new_mi->context.c2.tls_multi, true);
       if (new_cn)
 	{
-	  struct hash_iterator hi;
-	  struct hash_element *he;
+	  int i;
 
-	  hash_iterator_init (m->iter, &hi, true);
-	  while ((he = hash_iterator_next (&hi)))
+	  /* closing an instance moves the last one into its place */
+	  for (i = m->n_instances - 1; i >= 0; --i)
 	    {
-	      struct multi_instance *mi = (struct multi_instance *) he->value;
+	      struct multi_instance *mi = multi_instance_at (m, i, -1);
 	      if (mi != new_mi && !mi->halt)
 		{
 		  const char *cn = tls_common_name (mi->context.c2.tls_multi, true);
 		  if (cn && !strcmp (cn, new_cn))
-		    {
-		      mi->did_iter = false;
-		      multi_close_instance (m, mi, false);
-		      hash_iterator_delete_element (&hi);
-		    }
+		    multi_close_instance (m, mi, false);
 		}
 	    }
-	  hash_iterator_free (&hi);
 	}
     }
 }
@@ -1172,79 +1578,461 @@ multi_client_connect_post (struct multi_context *m,
 }
 
 /*
- * Called as soon as the SSL/TLS connection authenticates.
- *
- * Instance-specific directives to be processed:
- *
- *   iroute start-ip end-ip
- *   ifconfig-push local remote-netmask
- *   push
+ * Compile the client's --client-filter rules, which may
+ * have come from the server config, the client's ccd file
+ * or a --client-connect script or plugin.
  */
 static void
-multi_connection_established (struct multi_context *m, struct multi_instance *mi)
+multi_set_filter (struct multi_context *m, struct multi_instance *mi)
 {
-  if (tls_authenticated (mi->context.c2.tls_multi))
+  const struct options *o = &mi->context.options;
+
+  if (mi->pf)
+    {
+      pf_free (mi->pf);
+      --m->n_filtered;
+    }
+  mi->pf = pf_compile (o->client_filter, !o->client_filter_drop);
+  if (mi->pf)
     {
       struct gc_arena gc = gc_new ();
-      unsigned int option_types_found = 0;
-      const unsigned int option_permissions_mask = OPT_P_INSTANCE|OPT_P_INHERIT|OPT_P_PUSH|OPT_P_TIMER|OPT_P_CONFIG|OPT_P_ECHO;
-      int cc_succeeded = true; /* client connect script status */
-      int cc_succeeded_count = 0;
+      ++m->n_filtered;
+      msg (D_MULTI_LOW, "MULTI: %s has %d --client-filter rules, default %s",
+	   multi_instance_string (mi, false, &gc),
+	   mi->pf->n_rules,
+	   mi->pf->default_accept ? "accept" : "drop");
+      gc_free (&gc);
+    }
+}
 
-      ASSERT (mi->context.c1.tuntap);
+/*
+ * Set client rate limits in bytes per second, 0 meaning
+ * unlimited.  Output is also subject to the aggregate
+ * --client-shaper-total limit.
+ */
+static void
+multi_set_shaper (struct multi_context *m, struct multi_instance *mi, const int out, const int in)
+{
+  token_bucket_init (&mi->shaper_out, out, &m->shaper);
+  token_bucket_init (&mi->shaper_in, in, NULL);
+  mi->mbuf_flow.shaper = token_bucket_defined (&mi->shaper_out) ? &mi->shaper_out : NULL;
+  if (out || in)
+    msg (D_MULTI_LOW, "MULTI: client traffic shaping set to output=%d input=%d bytes per second",
+	 out, in);
+}
 
-      /* lock down the common name so it can't change during future TLS renegotiations */
-      tls_lock_common_name (mi->context.c2.tls_multi);
+/*
+ * Options which may be set by --client-config-dir files
+ * and --client-connect scripts or plugins.
+ */
+#define CC_OPTION_PERMISSIONS_MASK (OPT_P_INSTANCE|OPT_P_INHERIT|OPT_P_PUSH|OPT_P_TIMER|OPT_P_CONFIG|OPT_P_ECHO)
 
-      /* generate a msg() prefix for this client instance */
-      generate_prefix (mi);
+/*
+ * Try to source a dynamic config file for the client from the
+ * --client-config-dir directory, by common name or else the
+ * default file.
+ */
+static void
+multi_client_config_dir_import (struct multi_context *m,
+				struct multi_instance *mi,
+				const unsigned int option_permissions_mask,
+				unsigned int *option_types_found)
+{
+  struct gc_arena gc = gc_new ();
 
-      /* delete instances of previous clients with same common-name */
-      if (!mi->context.options.duplicate_cn)
-	multi_delete_dup (m, mi);
+  if (mi->context.options.client_config_dir && m->ccd_cache)
+    {
+      ccd_cache_import (m->ccd_cache,
+			&mi->context.options,
+			tls_common_name (mi->context.c2.tls_multi, false),
+			D_IMPORT_ERRORS|M_OPTERR,
+			option_permissions_mask,
+			option_types_found,
+			mi->context.c2.es);
+    }
+  else if (mi->context.options.client_config_dir)
+    {
+      const char *ccd_file;
 
-      /* reset pool handle to null */
-      mi->vaddr_handle = -1;
+      ccd_file = gen_path (mi->context.options.client_config_dir,
+			   tls_common_name (mi->context.c2.tls_multi, false),
+			   &gc);
 
-      /*
-       * Try to source a dynamic config file from the
-       * --client-config-dir directory.
-       */
-      if (mi->context.options.client_config_dir)
+      /* try common-name file */
+      if (test_file (ccd_file))
+	{
+	  options_server_import (&mi->context.options,
+				 ccd_file,
+				 D_IMPORT_ERRORS|M_OPTERR,
+				 option_permissions_mask,
+				 option_types_found,
+				 mi->context.c2.es);
+	}
+      else /* try default file */
 	{
-	  const char *ccd_file;
-	  
 	  ccd_file = gen_path (mi->context.options.client_config_dir,
-			       tls_common_name (mi->context.c2.tls_multi, false),
+			       CCD_DEFAULT,
 			       &gc);
 
-	  /* try common-name file */
 	  if (test_file (ccd_file))
 	    {
 	      options_server_import (&mi->context.options,
 				     ccd_file,
 				     D_IMPORT_ERRORS|M_OPTERR,
 				     option_permissions_mask,
-				     &option_types_found,
+				     option_types_found,
 				     mi->context.c2.es);
 	    }
-	  else /* try default file */
-	    {
-	      ccd_file = gen_path (mi->context.options.client_config_dir,
-				   CCD_DEFAULT,
-				   &gc);
+	}
+    }
 
-	      if (test_file (ccd_file))
-		{
-		  options_server_import (&mi->context.options,
-					 ccd_file,
-					 D_IMPORT_ERRORS|M_OPTERR,
-					 option_permissions_mask,
-					 &option_types_found,
-					 mi->context.c2.es);
-		}
+  gc_free (&gc);
+}
+
+/*
+ * Act on the outcome of the client-connect plugin and script,
+ * and on the options which they and --client-config-dir sourced.
+ */
+static void
+multi_client_connect_finish (struct multi_context *m,
+			     struct multi_instance *mi,
+			     int cc_succeeded,
+			     const int cc_succeeded_count,
+			     const unsigned int option_types_found)
+{
+  struct gc_arena gc = gc_new ();
+
+  /*
+   * Check for "disable" directive in client-config-dir file
+   * or config file generated by --client-connect script.
+   */
+  if (mi->context.options.disable)
+    {
+      msg (D_MULTI_ERRORS, "MULTI: client has been rejected due to 'disable' directive");
+      cc_succeeded = false;
+    }
+
+  if (cc_succeeded)
+    {
+      /*
+       * Process sourced options.
+       */
+      do_deferred_options (&mi->context, option_types_found);
+
+      /*
+       * Set up --client-shaper rate limits.
+       */
+      multi_set_shaper (m, mi,
+			mi->context.options.client_shaper_out,
+			mi->context.options.client_shaper_in);
+
+      /*
+       * Compile --client-filter rules.
+       */
+      multi_set_filter (m, mi);
+
+      /*
+       * make sure we got ifconfig settings from somewhere
+       */
+      if (!mi->context.c2.push_ifconfig_defined)
+	{
+	  msg (D_MULTI_ERRORS, "MULTI: no dynamic or static remote --ifconfig address is available for %s",
+	       multi_instance_string (mi, false, &gc));
+	}
+
+      /*
+       * For routed tunnels, set up internal route to endpoint
+       * plus add all iroute routes.
+       */
+      if (TUNNEL_TYPE (mi->context.c1.tuntap) == DEV_TYPE_TUN)
+	{
+	  if (mi->context.c2.push_ifconfig_defined)
+	    {
+	      multi_learn_in_addr_t (m, mi, mi->context.c2.push_ifconfig_local, -1);
+	      msg (D_MULTI_LOW, "MULTI: primary virtual IP for %s: %s",
+		   multi_instance_string (mi, false, &gc),
+		   print_in_addr_t (mi->context.c2.push_ifconfig_local, 0, &gc));
 	    }
+
+	  /* add routes locally, pointing to new client, if
+	     --iroute options have been specified */
+	  multi_add_iroutes (m, mi);
+
+	  /*
+	   * iroutes represent subnets which are "owned" by a particular
+	   * client.  Therefore, do not actually push a route to a client
+	   * if it matches one of the client's iroutes.
+	   */
+	  remove_iroutes_from_push_route_list (&mi->context.options);
+	}
+      else if (mi->context.options.iroutes)
+	{
+	  msg (D_MULTI_ERRORS, "MULTI: --iroute options rejected for %s -- iroute only works with tun-style tunnels",
+	       multi_instance_string (mi, false, &gc));
+	}
+
+      /* set our client's VPN endpoint for status reporting purposes */
+      mi->reporting_addr = mi->context.c2.push_ifconfig_local;
+
+#ifdef ENABLE_MSTATS
+      /* export this client's counters in the --status-mmap file */
+      if (m->mstats && mi->mstats_slot < 0)
+	{
+	  mi->mstats_slot = mstats_client_add (m->mstats,
+					       tls_common_name (mi->context.c2.tls_multi, false),
+					       mroute_addr_print (&mi->real, &gc),
+					       print_in_addr_t (mi->reporting_addr, IA_EMPTY_IF_UNDEF, &gc),
+					       mi->created);
+	  mi->mstats_updated = now;
+	}
+#endif
+
+      /* set context-level authentication flag */
+      mi->context.c2.context_auth = CAS_SUCCEEDED;
+    }
+  else
+    {
+      /* set context-level authentication flag */
+      mi->context.c2.context_auth = cc_succeeded_count ? CAS_PARTIAL : CAS_FAILED;
+    }
+
+  /* set flag so we don't get called again */
+  mi->connection_established_flag = true;
+
+  gc_free (&gc);
+}
+
+#ifdef ENABLE_ASYNC_SCRIPT
+
+/*
+ * Make sure that mi is woken up no later than
+ * tv (absolute time), to poll a script.
+ */
+static void
+multi_script_wakeup (struct multi_context *m, struct multi_instance *mi, const struct timeval *tv)
+{
+  if (tv_lt (tv, &mi->wakeup))
+    {
+      mi->wakeup = *tv;
+      schedule_add_entry (m->schedule, (struct schedule_entry *) mi, &mi->wakeup, 0);
+    }
+}
+
+#endif
+
+static bool multi_client_connect_call_script (struct multi_context *m,
+					      struct multi_instance *mi,
+					      bool cc_succeeded,
+					      int cc_succeeded_count,
+					      unsigned int option_types_found);
+
+#ifdef ENABLE_DEFERRED_AUTH
+
+/*
+ * Save the state of a --client-connect stage which
+ * will complete after we have returned to the event loop.
+ */
+static void
+multi_client_connect_defer (struct multi_instance *mi,
+			    const char *dc_file,
+			    const unsigned int option_types_found,
+			    const int cc_succeeded_count)
+{
+  mi->client_connect_file = string_alloc (dc_file, NULL);
+  mi->client_connect_option_types_found = option_types_found;
+  mi->client_connect_succeeded_count = cc_succeeded_count;
+}
+
+/*
+ * Collect the outcome of a client-connect plug-in call
+ * or a --client-connect script run under --script-async,
+ * and carry on with the connection once it's available.
+ */
+static void
+multi_client_connect_deferred_check (struct multi_context *m, struct multi_instance *mi)
+{
+  unsigned int option_types_found = mi->client_connect_option_types_found;
+  int cc_succeeded_count = mi->client_connect_succeeded_count;
+  bool cc_succeeded = true;
+
+#ifdef ENABLE_PLUGIN_DEFERRED
+  /* req->pl is only set while plug-in calls are outstanding */
+  if (mi->client_connect_plugin.pl)
+    {
+      if (plugin_request_pending (&mi->client_connect_plugin))
+	return;
+
+      if (mi->client_connect_plugin.n_failed)
+	{
+	  msg (M_WARN, "WARNING: client-connect plugin call failed");
+	  delete_file (mi->client_connect_file);
+	  cc_succeeded = false;
 	}
+      else
+	{
+	  multi_client_connect_post (m, mi, mi->client_connect_file, CC_OPTION_PERMISSIONS_MASK, &option_types_found);
+	  ++cc_succeeded_count;
+	}
+      CLEAR (mi->client_connect_plugin);
+      multi_client_connect_undefer (mi);
+
+      /* the --client-connect script may defer us again */
+      if (multi_client_connect_call_script (m, mi, cc_succeeded, cc_succeeded_count, option_types_found))
+	mi->context.c2.push_reply_deferred = false;
+      return;
+    }
+#endif
+
+#ifdef ENABLE_ASYNC_SCRIPT
+  if (script_job_defined (&mi->client_connect_job))
+    {
+      struct script_job *job = &mi->client_connect_job;
+
+      if (script_job_poll (job))
+	{
+	  if (system_ok (job->status))
+	    {
+	      multi_client_connect_post (m, mi, mi->client_connect_file, CC_OPTION_PERMISSIONS_MASK, &option_types_found);
+	      ++cc_succeeded_count;
+	    }
+	  else
+	    {
+	      struct gc_arena gc = gc_new ();
+	      msg (M_WARN, "client-connect command failed: %s",
+		   system_error_message (job->status, &gc));
+	      delete_file (mi->client_connect_file);
+	      cc_succeeded = false;
+	      gc_free (&gc);
+	    }
+
+	  script_job_free (job);
+	  multi_client_connect_undefer (mi);
+
+	  multi_client_connect_finish (m, mi, cc_succeeded, cc_succeeded_count, option_types_found);
+
+	  /*
+	   * Reply now to client's PUSH_REQUEST query
+	   */
+	  mi->context.c2.push_reply_deferred = false;
+	}
+      else
+	{
+	  struct timeval tv;
+	  if (script_job_next_poll (job, &tv))
+	    multi_script_wakeup (m, mi, &tv);
+	}
+    }
+#endif
+}
+
+#endif
+
+/*
+ * Run the --client-connect script if there is one, and
+ * then complete the connection.  Returns false if the
+ * script was started under --script-async, in which case
+ * the connection is completed by
+ * multi_client_connect_deferred_check.
+ */
+static bool
+multi_client_connect_call_script (struct multi_context *m,
+				  struct multi_instance *mi,
+				  bool cc_succeeded,
+				  int cc_succeeded_count,
+				  unsigned int option_types_found)
+{
+  if (mi->context.options.client_connect_script && cc_succeeded)
+    {
+      struct gc_arena gc = gc_new ();
+      struct buffer cmd = alloc_buf_gc (256, &gc);
+      const char *dc_file = NULL;
+
+      setenv_str (mi->context.c2.es, "script_type", "client-connect");
+
+      dc_file = create_temp_filename (mi->context.options.tmp_dir, &gc);
+
+      delete_file (dc_file);
+
+      buf_printf (&cmd, "%s %s",
+		  mi->context.options.client_connect_script,
+		  dc_file);
+
+#ifdef ENABLE_ASYNC_SCRIPT
+      if (script_async_enabled ())
+	{
+	  script_job_start (&mi->client_connect_job, BSTR (&cmd), mi->context.c2.es, S_SCRIPT);
+	  multi_client_connect_defer (mi, dc_file, option_types_found, cc_succeeded_count);
+	  gc_free (&gc);
+	  multi_client_connect_deferred_check (m, mi);
+	  return false;
+	}
+#endif
+
+      if (system_check (BSTR (&cmd), mi->context.c2.es, S_SCRIPT, "client-connect command failed"))
+	{
+	  multi_client_connect_post (m, mi, dc_file, CC_OPTION_PERMISSIONS_MASK, &option_types_found);
+	  ++cc_succeeded_count;
+	}
+      else
+	cc_succeeded = false;
+
+      gc_free (&gc);
+    }
+
+  multi_client_connect_finish (m, mi, cc_succeeded, cc_succeeded_count, option_types_found);
+  return true;
+}
+
+/*
+ * Called as soon as the SSL/TLS connection authenticates.
+ *
+ * Instance-specific directives to be processed:
+ *
+ *   iroute start-ip end-ip
+ *   ifconfig-push local remote-netmask
+ *   push
+ *   client-shaper out [in]
+ */
+static void
+multi_connection_established (struct multi_context *m, struct multi_instance *mi)
+{
+#ifdef ENABLE_DEFERRED_AUTH
+  /* still waiting for client-connect plug-in or --client-connect script? */
+  if (mi->client_connect_file)
+    {
+      multi_client_connect_deferred_check (m, mi);
+      return;
+    }
+#endif
+
+  if (tls_authenticated (mi->context.c2.tls_multi))
+    {
+      struct gc_arena gc = gc_new ();
+      unsigned int option_types_found = 0;
+      const unsigned int option_permissions_mask = CC_OPTION_PERMISSIONS_MASK;
+      int cc_succeeded = true; /* client connect script status */
+      int cc_succeeded_count = 0;
+
+      ASSERT (mi->context.c1.tuntap);
+
+      /* lock down the common name so it can't change during future TLS renegotiations */
+      tls_lock_common_name (mi->context.c2.tls_multi);
+
+      /* generate a msg() prefix for this client instance */
+      generate_prefix (mi);
+
+      /* delete instances of previous clients with same common-name */
+      if (!mi->context.options.duplicate_cn)
+	multi_delete_dup (m, mi);
+
+      /* reset pool handle to null */
+      mi->vaddr_handle = -1;
+
+      /*
+       * Try to source a dynamic config file from the
+       * --client-config-dir directory.
+       */
+      multi_client_config_dir_import (m, mi, option_permissions_mask, &option_types_found);
 
       /*
        * Select a virtual address from either --ifconfig-push in --client-config-dir file
@@ -1267,10 +2055,25 @@ multi_connection_established (struct multi_context *m, struct multi_instance *mi
       if (plugin_defined (m->top.c1.plugins, OPENVPN_PLUGIN_CLIENT_CONNECT))
 	{
 	  const char *dc_file = create_temp_filename (mi->context.options.tmp_dir, &gc);
+	  int status;
 
 	  delete_file (dc_file);
 
-	  if (plugin_call (m->top.c1.plugins, OPENVPN_PLUGIN_CLIENT_CONNECT, dc_file, mi->context.c2.es))
+#ifdef ENABLE_PLUGIN_DEFERRED
+	  status = plugin_call_deferred (m->top.c1.plugins, OPENVPN_PLUGIN_CLIENT_CONNECT, dc_file, mi->context.c2.es,
+					 &mi->client_connect_plugin, mi);
+	  if (status == OPENVPN_PLUGIN_FUNC_DEFERRED)
+	    {
+	      /* connection is completed by multi_client_connect_deferred_check */
+	      multi_client_connect_defer (mi, dc_file, option_types_found, cc_succeeded_count);
+	      gc_free (&gc);
+	      return;
+	    }
+#else
+	  status = plugin_call (m->top.c1.plugins, OPENVPN_PLUGIN_CLIENT_CONNECT, dc_file, mi->context.c2.es);
+#endif
+
+	  if (status != OPENVPN_PLUGIN_FUNC_SUCCESS)
 	    {
 	      msg (M_WARN, "WARNING: client-connect plugin call failed");
 	      cc_succeeded = false;
@@ -1285,102 +2088,12 @@ multi_connection_established (struct multi_context *m, struct multi_instance *mi
       /*
        * Run --client-connect script.
        */
-      if (mi->context.options.client_connect_script && cc_succeeded)
+      if (!multi_client_connect_call_script (m, mi, cc_succeeded, cc_succeeded_count, option_types_found))
 	{
-	  struct buffer cmd = alloc_buf_gc (256, &gc);
-	  const char *dc_file = NULL;
-
-	  setenv_str (mi->context.c2.es, "script_type", "client-connect");
-
-	  dc_file = create_temp_filename (mi->context.options.tmp_dir, &gc);
-
-	  delete_file (dc_file);
-
-	  buf_printf (&cmd, "%s %s",
-		      mi->context.options.client_connect_script,
-		      dc_file);
-
-	  if (system_check (BSTR (&cmd), mi->context.c2.es, S_SCRIPT, "client-connect command failed"))
-	    {
-	      multi_client_connect_post (m, mi, dc_file, option_permissions_mask, &option_types_found);
-	      ++cc_succeeded_count;
-	    }
-	  else
-	    cc_succeeded = false;
-	}
-
-      /*
-       * Check for "disable" directive in client-config-dir file
-       * or config file generated by --client-connect script.
-       */
-      if (mi->context.options.disable)
-	{
-	  msg (D_MULTI_ERRORS, "MULTI: client has been rejected due to 'disable' directive");
-	  cc_succeeded = false;
-	}
-
-      if (cc_succeeded)
-	{
-	  /*
-	   * Process sourced options.
-	   */
-	  do_deferred_options (&mi->context, option_types_found);
-
-	  /*
-	   * make sure we got ifconfig settings from somewhere
-	   */
-	  if (!mi->context.c2.push_ifconfig_defined)
-	    {
-	      msg (D_MULTI_ERRORS, "MULTI: no dynamic or static remote --ifconfig address is available for %s",
-		   multi_instance_string (mi, false, &gc));
-	    }
-
-	  /*
-	   * For routed tunnels, set up internal route to endpoint
-	   * plus add all iroute routes.
-	   */
-	  if (TUNNEL_TYPE (mi->context.c1.tuntap) == DEV_TYPE_TUN)
-	    {
-	      if (mi->context.c2.push_ifconfig_defined)
-		{
-		  multi_learn_in_addr_t (m, mi, mi->context.c2.push_ifconfig_local, -1);
-		  msg (D_MULTI_LOW, "MULTI: primary virtual IP for %s: %s",
-		       multi_instance_string (mi, false, &gc),
-		       print_in_addr_t (mi->context.c2.push_ifconfig_local, 0, &gc));
-		}
-
-	      /* add routes locally, pointing to new client, if
-		 --iroute options have been specified */
-	      multi_add_iroutes (m, mi);
-
-	      /*
-	       * iroutes represent subnets which are "owned" by a particular
-	       * client.  Therefore, do not actually push a route to a client
-	       * if it matches one of the client's iroutes.
-	       */
-	      remove_iroutes_from_push_route_list (&mi->context.options);
-	    }
-	  else if (mi->context.options.iroutes)
-	    {
-	      msg (D_MULTI_ERRORS, "MULTI: --iroute options rejected for %s -- iroute only works with tun-style tunnels",
-		   multi_instance_string (mi, false, &gc));
-	    }
-
-	  /* set our client's VPN endpoint for status reporting purposes */
-	  mi->reporting_addr = mi->context.c2.push_ifconfig_local;
-
-	  /* set context-level authentication flag */
-	  mi->context.c2.context_auth = CAS_SUCCEEDED;
-	}
-      else
-	{
-	  /* set context-level authentication flag */
-	  mi->context.c2.context_auth = cc_succeeded_count ? CAS_PARTIAL : CAS_FAILED;
+	  gc_free (&gc);
+	  return;
 	}
 
-      /* set flag so we don't get called again */
-      mi->connection_established_flag = true;
-
       gc_free (&gc);
     }
 
@@ -1401,13 +2114,11 @@ multi_add_mbuf (struct multi_context *m,
 {
   if (multi_output_queue_ready (m, mi))
     {
-      struct mbuf_item item;
-      item.buffer = mb;
-      item.instance = mi;
-      mbuf_add_item (m->mbuf, &item);
+      mbuf_fq_add (m->mbuf, &mi->mbuf_flow, mb);
     }
   else
     {
+      ++mi->mbuf_flow.dropped;
       msg (D_MULTI_DROPPED, "MULTI: packet dropped due to output saturation (multi_add_mbuf)");
     }
 }
@@ -1431,6 +2142,133 @@ multi_unicast (struct multi_context *m,
     }
 }
 
+/*
+ * If the client's output is rate limited, and it may not
+ * send right now or already has packets waiting, add buf
+ * to its output queue to be sent when the rate limit allows,
+ * and return true.  Otherwise account for buf as sent
+ * immediately and return false.
+ */
+static inline bool
+multi_shaper_defer (struct multi_context *m,
+		    struct multi_instance *mi,
+		    const struct buffer *buf)
+{
+  struct token_bucket *tb = mi->mbuf_flow.shaper;
+  if (tb)
+    {
+      if (!mbuf_flow_len (&mi->mbuf_flow) && token_bucket_conform (tb))
+	token_bucket_consume (tb, BLEN (buf));
+      else
+	{
+	  multi_unicast (m, buf, mi);
+	  return true;
+	}
+    }
+  return false;
+}
+
+/*
+ * Enforce the client's input rate limit.  Return
+ * false if buf should be dropped.
+ */
+static inline bool
+multi_shaper_input_ok (struct multi_instance *mi, const struct buffer *buf)
+{
+  if (mi->shaper_in.bytes_per_second)
+    {
+      if (!token_bucket_conform (&mi->shaper_in))
+	{
+	  msg (D_MULTI_DROPPED, "MULTI: packet dropped due to --client-shaper input limit");
+	  return false;
+	}
+      token_bucket_consume (&mi->shaper_in, BLEN (buf));
+    }
+  return true;
+}
+
+/*
+ * Forward a client-to-client packet.  If the destination
+ * client has no output of its own in progress, and nothing
+ * queued ahead of this packet, encrypt the packet straight
+ * into its to_link buffer and make it the pending instance,
+ * so that it is sent on the next pass through the event loop
+ * without being copied into an mbuf.  Otherwise fall back to
+ * the client's output queue.
+ *
+ * Must be called after the source instance has been
+ * postprocessed, since there is only one pending instance.
+ * In TCP mode, a source with more packets already buffered
+ * from its stream must stay the pending instance so that
+ * they get processed, so the destination's queue is used.
+ */
+static void
+multi_unicast_direct (struct multi_context *m,
+		      const struct buffer *buf,
+		      const struct context *source,
+		      struct multi_instance *mi,
+		      const unsigned int mpp_flags)
+{
+  struct context *c = &mi->context;
+
+  if (BLEN (buf) <= 0)
+    return;
+
+  if (!m->pending
+      && !socket_read_residual (source->c2.link_socket)
+      && !mi->halt
+      && !ANY_OUT (c)
+      && !TO_LINK_FRAG (c)
+      && !mbuf_flow_len (&mi->mbuf_flow))
+    {
+      if (multi_shaper_defer (m, mi, buf))
+	{
+	  ++m->c2c_queued;
+	  return;
+	}
+
+      perf_push (PERF_MULTI_C2C_DIRECT);
+      set_prefix (mi);
+      c->c2.buf = *buf;
+      process_ipv4_header (c, PIPV4_PASSTOS|PIPV4_MSSFIX, &c->c2.buf);
+      encrypt_sign (c, true);
+      ++m->c2c_direct;
+
+      /* the source instance must remain the one recorded as touched */
+      multi_process_post (m, mi, mpp_flags & ~MPP_RECORD_TOUCH);
+      clear_prefix ();
+      perf_pop ();
+    }
+  else
+    {
+      multi_unicast (m, buf, mi);
+      ++m->c2c_queued;
+    }
+}
+
+/*
+ * Parse a packet which is about to be replicated to
+ * several clients, so that each recipient's --client-filter
+ * can be checked without reparsing it.  Returns false if
+ * no recipient filter needs to be consulted.
+ */
+static inline bool
+multi_filter_extract (const struct multi_context *m,
+		      const struct buffer *buf,
+		      struct pf_packet *pkt)
+{
+  return m->n_filtered > 0
+    && pf_extract (pkt, buf, TUNNEL_TYPE (m->top.c1.tuntap));
+}
+
+static inline bool
+multi_filter_accepts (struct multi_instance *mi,
+		      const struct pf_packet *pkt,
+		      const bool filtered)
+{
+  return !filtered || !mi->pf || pf_test (mi->pf, pkt, true);
+}
+
 /*
  * Broadcast a packet to all clients.
  */
@@ -1439,10 +2277,11 @@ multi_bcast (struct multi_context *m,
 	     const struct buffer *buf,
 	     struct multi_instance *omit)
 {
-  struct hash_iterator hi;
-  struct hash_element *he;
   struct multi_instance *mi;
   struct mbuf_buffer *mb;
+  struct pf_packet pkt;
+  bool filtered;
+  int i;
 
   if (BLEN (buf) > 0)
     {
@@ -1451,21 +2290,126 @@ multi_bcast (struct multi_context *m,
       printf ("BCAST len=%d\n", BLEN (buf));
 #endif
       mb = mbuf_alloc_buf (buf);
-      hash_iterator_init (m->iter, &hi, true);
+      filtered = multi_filter_extract (m, buf, &pkt);
 
-      while ((he = hash_iterator_next (&hi)))
+      for (i = 0; i < m->n_instances; ++i)
 	{
-	  mi = (struct multi_instance *) he->value;
-	  if (mi != omit && !mi->halt)
+	  mi = multi_instance_at (m, i, 1);
+	  if (mi != omit && !mi->halt && multi_filter_accepts (mi, &pkt, filtered))
 	    multi_add_mbuf (m, mi, mb);
 	}
 
-      hash_iterator_free (&hi);
       mbuf_free_buf (mb);
       perf_pop ();
     }
 }
 
+/*
+ * Answer a broadcast ARP request for the address of a
+ * connected client on that client's behalf, so that the
+ * request need not be flooded.  from is the requesting
+ * client, or NULL if the request came from the TAP
+ * interface, in which case the reply is written to TAP
+ * as if the owning client had sent it.  Returns true if
+ * the request was answered.
+ */
+static bool
+multi_proxy_arp (struct multi_context *m,
+		 const struct buffer *buf,
+		 struct multi_instance *from,
+		 const unsigned int mpp_flags)
+{
+  const struct arp_binding *b = arp_proxy_lookup (m->arp_proxy, buf);
+
+  if (b && b->mi != from && !b->mi->halt && !ANY_OUT (&b->mi->context))
+    {
+      struct mroute_addr mac;
+
+      mroute_addr_init (&mac);
+      mac.type = MR_ADDR_ETHER;
+      mac.len = OPENVPN_ETH_ALEN;
+      memcpy (mac.addr, b->mac, OPENVPN_ETH_ALEN);
+
+      /* make sure that the client still owns the MAC address */
+      if (multi_get_instance_by_virtual_addr (m, &mac, false) == b->mi)
+	{
+	  if (from)
+	    {
+	      struct gc_arena gc = gc_new ();
+	      const struct frame *frame = &from->context.c2.frame;
+	      struct buffer reply = alloc_buf_gc (BUF_SIZE (frame), &gc);
+
+	      ASSERT (buf_init (&reply, FRAME_HEADROOM (frame)));
+	      arp_proxy_build_reply (buf, b, &reply);
+	      multi_unicast (m, &reply, from);
+	      gc_free (&gc);
+	    }
+	  else
+	    {
+	      struct multi_instance *mi = b->mi;
+	      struct context *c = &mi->context;
+
+	      c->c2.to_tun = c->c2.buffers->decrypt_buf;
+	      ASSERT (buf_init (&c->c2.to_tun, FRAME_HEADROOM (&c->c2.frame)));
+	      arp_proxy_build_reply (buf, b, &c->c2.to_tun);
+
+	      /* mi is now pending on the TAP write */
+	      set_prefix (mi);
+	      multi_process_post (m, mi, mpp_flags);
+	      clear_prefix ();
+	    }
+	  ++m->arp_proxy->answered;
+	  return true;
+	}
+    }
+  return false;
+}
+
+/*
+ * Send a multicast packet only to the clients which have
+ * joined its group.  Packets which are not subject to
+ * --igmp-snooping are broadcast.
+ */
+static void
+multi_mcast (struct multi_context *m,
+	     const struct buffer *buf,
+	     struct multi_instance *omit,
+	     const int dev_type)
+{
+  struct mroute_addr group;
+
+  if (m->mcast && mcast_classify (buf, dev_type, &group) == MCAST_GROUP)
+    {
+      const struct mcast_group *g;
+
+      if (BLEN (buf) <= 0)
+	return;
+
+      perf_push (PERF_MULTI_MCAST);
+      g = mcast_lookup (m->mcast, &group);
+      if (g && (g->n_members > 1 || g->members[0].mi != omit))
+	{
+	  struct mbuf_buffer *mb = mbuf_alloc_buf (buf);
+	  struct pf_packet pkt;
+	  const bool filtered = multi_filter_extract (m, buf, &pkt);
+	  int i;
+
+	  for (i = 0; i < g->n_members; ++i)
+	    {
+	      struct multi_instance *mi = g->members[i].mi;
+	      if (mi != omit && !mi->halt && multi_filter_accepts (mi, &pkt, filtered))
+		multi_add_mbuf (m, mi, mb);
+	    }
+	  mbuf_free_buf (mb);
+	}
+      else
+	++m->mcast->dropped;
+      perf_pop ();
+    }
+  else
+    multi_bcast (m, buf, omit);
+}
+
 /*
  * Given a time delta, indicating that we wish to be
  * awoken by the scheduler at time now + delta, figure
@@ -1495,6 +2439,23 @@ compute_wakeup_sigma (const struct timeval *delta)
     }
 }
 
+/*
+ * Can pre_select() be skipped for this instance?  Only if
+ * the connection is established, the wakeup which we
+ * previously gave to the scheduler has not yet arrived,
+ * and no pre_select() component has had its
+ * state changed in the meantime.  In that case the scheduled
+ * wakeup remains valid and will trigger a full pre_select()
+ * when it arrives.
+ */
+static inline bool
+multi_pre_select_lazy (const struct multi_instance *mi)
+{
+  return mi->connection_established_flag
+    && !tv_expired (&mi->wakeup)
+    && pre_select_idle (&mi->context);
+}
+
 /*
  * Figure instance-specific timers, convert
  * earliest to absolute time in mi->wakeup,
@@ -1509,26 +2470,53 @@ multi_process_post (struct multi_context *m, struct multi_instance *mi, const un
 
   if (!IS_SIG (&mi->context) && ((flags & MPP_PRE_SELECT) || ((flags & MPP_CONDITIONAL_PRE_SELECT) && !ANY_OUT (&mi->context))))
     {
-      /* figure timeouts and fetch possible outgoing
-	 to_link packets (such as ping or TLS control) */
-      pre_select (&mi->context);
-
-      if (!IS_SIG (&mi->context))
+      if (!(flags & MPP_FORCE_PRE_SELECT) && multi_pre_select_lazy (mi))
+	{
+	  /* TLS errors must still be acted on immediately */
+	  ++pre_select_stats.lazy;
+	  check_tls_errors (&mi->context);
+	}
+      else
 	{
-	  /* calculate an absolute wakeup time */
-	  ASSERT (!gettimeofday (&mi->wakeup, NULL));
-	  tv_add (&mi->wakeup, &mi->context.c2.timeval);
-
-	  /* tell scheduler to wake us up at some point in the future */
-	  schedule_add_entry (m->schedule,
-			      (struct schedule_entry *) mi,
-			      &mi->wakeup,
-			      compute_wakeup_sigma (&mi->context.c2.timeval));
-
-	  /* connection is "established" when SSL/TLS key negotiation succeeds
-	     and (if specified) auth user/pass succeeds */
-	  if (!mi->connection_established_flag && CONNECTION_ESTABLISHED (&mi->context))
-	    multi_connection_established (m, mi);
+#ifdef ENABLE_ASYNC_SCRIPT
+	  /* make sure tls_multi_process polls an --auth-user-pass-verify
+	     script which is due, rather than waiting for tmp_int */
+	  {
+	    struct timeval tv;
+	    if (tls_authentication_next_poll (mi->context.c2.tls_multi, &tv) && tv_expired (&tv))
+	      interval_trigger (&mi->context.c2.tmp_int);
+	  }
+#endif
+
+	  /* figure timeouts and fetch possible outgoing
+	     to_link packets (such as ping or TLS control) */
+	  pre_select (&mi->context);
+
+	  if (!IS_SIG (&mi->context))
+	    {
+	      /* calculate an absolute wakeup time */
+	      tv_future (&mi->wakeup, &mi->context.c2.timeval);
+
+	      /* tell scheduler to wake us up at some point in the future */
+	      schedule_add_entry (m->schedule,
+				  (struct schedule_entry *) mi,
+				  &mi->wakeup,
+				  compute_wakeup_sigma (&mi->context.c2.timeval));
+
+	      /* connection is "established" when SSL/TLS key negotiation succeeds
+		 and (if specified) auth user/pass succeeds */
+	      if (!mi->connection_established_flag && CONNECTION_ESTABLISHED (&mi->context))
+		multi_connection_established (m, mi);
+
+#ifdef ENABLE_ASYNC_SCRIPT
+	      /* poll --auth-user-pass-verify script */
+	      {
+		struct timeval tv;
+		if (tls_authentication_next_poll (mi->context.c2.tls_multi, &tv))
+		  multi_script_wakeup (m, mi, &tv);
+	      }
+#endif
+	    }
 	}
     }
 
@@ -1557,12 +2545,77 @@ multi_process_post (struct multi_context *m, struct multi_instance *mi, const un
 #endif
     }
 
+#ifdef ENABLE_MSTATS
+  /* refresh the client's --status-mmap record at most once per second */
+  if (mi->mstats_slot >= 0 && mi->mstats_updated != now && ret)
+    multi_mstats_update (m, mi);
+#endif
+
   if ((flags & MPP_RECORD_TOUCH) && m->mpp_touched)
     *m->mpp_touched = mi;
 
   return ret;
 }
 
+/*
+ * A UDP client has sent an authenticated P_DATA_V2 packet
+ * from a new address, typically because a NAT mapping on its
+ * path has changed or it has moved to another network.  Rather
+ * than leaving it to renegotiate from scratch, move the
+ * instance to the new address.
+ */
+static void
+multi_process_float (struct multi_context *m, struct multi_instance *mi)
+{
+  struct gc_arena gc = gc_new ();
+  struct context *c = &mi->context;
+  struct mroute_addr real;
+  struct multi_instance *ex;
+  const char *cn = tls_common_name (c->c2.tls_multi, true);
+
+  if (!mroute_extract_sockaddr_in (&real, &c->c2.from, true))
+    goto done;
+
+  /* the new address may belong to a stale instance of the same client */
+  ex = (struct multi_instance *) hash_lookup (m->hash, &real);
+  if (ex == mi)
+    goto done;
+  if (ex)
+    {
+      const char *ex_cn = tls_common_name (ex->context.c2.tls_multi, true);
+      if (ex->connection_established_flag && (!cn || !ex_cn || strcmp (cn, ex_cn)))
+	{
+	  msg (D_MULTI_LOW, "MULTI: client may not float to %s, which is in use by another client",
+	       mroute_addr_print (&real, &gc));
+	  goto done;
+	}
+      msg (D_MULTI_LOW, "MULTI: closing instance %s, to let client float to its address",
+	   multi_instance_string (ex, false, &gc));
+      multi_close_instance (m, ex, false);
+    }
+
+  msg (D_MULTI_LOW, "MULTI: client floated from %s to %s",
+       mroute_addr_print (&mi->real, &gc),
+       mroute_addr_print (&real, &gc));
+
+  if (mi->did_real_hash)
+    ASSERT (hash_remove (m->hash, &mi->real));
+  mi->real = real;
+  ASSERT (hash_add (m->hash, &mi->real, mi, false));
+  mi->did_real_hash = true;
+
+  tls_update_remote_addr (c->c2.tls_multi, &c->c2.from);
+  link_socket_set_outgoing_addr (NULL, get_link_socket_info (c), &c->c2.from, cn, c->c2.es);
+
+  /* the message prefix shows the real address */
+  generate_prefix (mi);
+
+  ++m->floats;
+
+ done:
+  gc_free (&gc);
+}
+
 /*
  * Process packets in the TCP/UDP socket -> TUN/TAP interface direction,
  * i.e. client -> server direction.
@@ -1576,6 +2629,8 @@ multi_process_incoming_link (struct multi_context *m, struct multi_instance *ins
   struct mroute_addr src, dest;
   unsigned int mroute_flags;
   struct multi_instance *mi;
+  struct multi_instance *direct = NULL;
+  struct buffer direct_buf;
   bool ret = true;
 
   ASSERT (!m->pending);
@@ -1608,9 +2663,29 @@ multi_process_incoming_link (struct multi_context *m, struct multi_instance *ins
 
       if (BLEN (&c->c2.buf) > 0)
 	{
+	  const counter_type auth_bytes = c->c2.link_read_bytes_auth;
+
 	  /* decrypt in instance context */
 	  process_incoming_link (c);
 
+	  /* authenticated packet from a new address, found by its peer-id? */
+	  if (!instance
+	      && c->c2.link_read_bytes_auth > auth_bytes
+	      && !addr_port_match (&c->c2.from, &get_link_socket_info (c)->lsa->actual))
+	    multi_process_float (m, m->pending);
+
+	  /* enforce --client-shaper input limit */
+	  if (BLEN (&c->c2.to_tun) > 0 && !multi_shaper_input_ok (m->pending, &c->c2.to_tun))
+	    c->c2.to_tun.len = 0;
+
+	  /* enforce --client-filter rules on packets sent by the client */
+	  if (BLEN (&c->c2.to_tun) > 0
+	      && !pf_filter_packet (m->pending->pf, &c->c2.to_tun, TUNNEL_TYPE (m->top.c1.tuntap), false))
+	    {
+	      msg (D_MULTI_DROPPED, "MULTI: packet from client dropped by --client-filter");
+	      c->c2.to_tun.len = 0;
+	    }
+
 	  if (TUNNEL_TYPE (m->top.c1.tuntap) == DEV_TYPE_TUN)
 	    {
 	      /* extract packet source and dest addresses */
@@ -1631,26 +2706,36 @@ multi_process_incoming_link (struct multi_context *m, struct multi_instance *ins
 		       mroute_addr_print (&src, &gc));
 		  c->c2.to_tun.len = 0;
 		}
-	      /* client-to-client communication enabled? */
-	      else if (m->enable_c2c)
+	      else
 		{
-		  /* multicast? */
-		  if (mroute_flags & MROUTE_EXTRACT_MCAST)
-		    {
-		      /* for now, treat multicast as broadcast */
-		      multi_bcast (m, &c->c2.to_tun, m->pending);
-		    }
-		  else /* possible client to client routing */
+		  /* IGMP membership report or leave? */
+		  if (m->mcast && (mroute_flags & MROUTE_EXTRACT_IGMP))
+		    mcast_snoop (m->mcast, m->pending, &c->c2.to_tun, DEV_TYPE_TUN);
+
+		  /* client-to-client communication enabled? */
+		  if (m->enable_c2c)
 		    {
-		      ASSERT (!(mroute_flags & MROUTE_EXTRACT_BCAST));
-		      mi = multi_get_instance_by_virtual_addr (m, &dest, true);
-		  
-		      /* if dest addr is a known client, route to it */
-		      if (mi)
+		      /* multicast? */
+		      if (mroute_flags & MROUTE_EXTRACT_MCAST)
 			{
-			  multi_unicast (m, &c->c2.to_tun, mi);
-			  register_activity (c);
-			  c->c2.to_tun.len = 0;
+			  multi_mcast (m, &c->c2.to_tun, m->pending, DEV_TYPE_TUN);
+			}
+		      else /* possible client to client routing */
+			{
+			  ASSERT (!(mroute_flags & MROUTE_EXTRACT_BCAST));
+			  mi = multi_get_instance_by_virtual_addr (m, &dest, true);
+
+			  /* if dest addr is a known client, route to it */
+			  if (mi)
+			    {
+			      if (pf_filter_packet (mi->pf, &c->c2.to_tun, TUNNEL_TYPE (m->top.c1.tuntap), true))
+				{
+				  direct = mi;
+				  direct_buf = c->c2.to_tun;
+				}
+			      register_activity (c);
+			      c->c2.to_tun.len = 0;
+			    }
 			}
 		    }
 		}
@@ -1667,12 +2752,27 @@ multi_process_incoming_link (struct multi_context *m, struct multi_instance *ins
 		{
 		  if (multi_learn_addr (m, m->pending, &src, 0) == m->pending)
 		    {
+		      /* IGMP membership report or leave? */
+		      if (m->mcast && (mroute_flags & MROUTE_EXTRACT_BCAST))
+			mcast_snoop (m->mcast, m->pending, &c->c2.to_tun, DEV_TYPE_TAP);
+
+		      /* learn IP -> MAC bindings from client ARP packets */
+		      if (m->arp_proxy)
+			arp_proxy_learn (m->arp_proxy, m->pending, &c->c2.to_tun);
+
+		      /* ARP request which we can answer by proxy? */
+		      if (m->arp_proxy
+			  && (mroute_flags & MROUTE_EXTRACT_BCAST)
+			  && multi_proxy_arp (m, &c->c2.to_tun, m->pending, mpp_flags))
+			{
+			  c->c2.to_tun.len = 0;
+			}
 		      /* check for broadcast */
-		      if (m->enable_c2c)
+		      else if (m->enable_c2c)
 			{
 			  if (mroute_flags & (MROUTE_EXTRACT_BCAST|MROUTE_EXTRACT_MCAST))
 			    {
-			      multi_bcast (m, &c->c2.to_tun, m->pending);
+			      multi_mcast (m, &c->c2.to_tun, m->pending, DEV_TYPE_TAP);
 			    }
 			  else /* try client-to-client routing */
 			    {
@@ -1681,7 +2781,11 @@ multi_process_incoming_link (struct multi_context *m, struct multi_instance *ins
 			      /* if dest addr is a known client, route to it */
 			      if (mi)
 				{
-				  multi_unicast (m, &c->c2.to_tun, mi);
+				  if (pf_filter_packet (mi->pf, &c->c2.to_tun, TUNNEL_TYPE (m->top.c1.tuntap), true))
+				    {
+				      direct = mi;
+				      direct_buf = c->c2.to_tun;
+				    }
 				  register_activity (c);
 				  c->c2.to_tun.len = 0;
 				}
@@ -1706,6 +2810,11 @@ multi_process_incoming_link (struct multi_context *m, struct multi_instance *ins
       ret = multi_process_post (m, m->pending, mpp_flags);
 
       clear_prefix ();
+
+      /* forward client-to-client packet, unless the source
+	 instance (which owns direct_buf) was just closed */
+      if (direct && ret)
+	multi_unicast_direct (m, &direct_buf, c, direct, mpp_flags);
     }
 
   gc_free (&gc);
@@ -1751,8 +2860,13 @@ multi_process_incoming_tun (struct multi_context *m, const unsigned int mpp_flag
 	  /* broadcast or multicast dest addr? */
 	  if (mroute_flags & (MROUTE_EXTRACT_BCAST|MROUTE_EXTRACT_MCAST))
 	    {
-	      /* for now, treat multicast as broadcast */
-	      multi_bcast (m, &m->top.c2.buf, NULL);
+	      /* note IGMP queries, so that stale memberships can expire */
+	      if (m->mcast)
+		mcast_snoop (m->mcast, NULL, &m->top.c2.buf, dev_type);
+
+	      /* ARP requests for client addresses are answered by proxy */
+	      if (!m->arp_proxy || !multi_proxy_arp (m, &m->top.c2.buf, NULL, mpp_flags))
+		multi_mcast (m, &m->top.c2.buf, NULL, dev_type);
 	    }
 	  else
 	    {
@@ -1765,16 +2879,27 @@ multi_process_incoming_tun (struct multi_context *m, const unsigned int mpp_flag
 		  
 		  set_prefix (m->pending);
 
-		  if (multi_output_queue_ready (m, m->pending))
+		  if (!multi_output_queue_ready (m, m->pending))
+		    {
+		      /* drop packet */
+		      msg (D_MULTI_DROPPED, "MULTI: packet dropped due to output saturation (multi_process_incoming_tun)");
+		      buf_clear (&c->c2.buf);
+		    }
+		  else if (!pf_filter_packet (m->pending->pf, &m->top.c2.buf, dev_type, true))
+		    {
+		      /* drop packet */
+		      msg (D_MULTI_DROPPED, "MULTI: packet to client dropped by --client-filter");
+		      buf_clear (&c->c2.buf);
+		    }
+		  else if (multi_shaper_defer (m, m->pending, &m->top.c2.buf))
 		    {
-		      /* transfer packet pointer from top-level context buffer to instance */
-		      c->c2.buf = m->top.c2.buf;
+		      /* packet was queued until rate limit allows it to be sent */
+		      buf_clear (&c->c2.buf);
 		    }
 		  else
 		    {
-		      /* drop packet */
-		      msg (D_MULTI_DROPPED, "MULTI: packet dropped due to output saturation (multi_process_incoming_tun)");
-		      buf_clear (&c->c2.buf);
+		      /* transfer packet pointer from top-level context buffer to instance */
+		      c->c2.buf = m->top.c2.buf;
 		    }
 	      
 		  /* encrypt in instance context */
@@ -1797,11 +2922,11 @@ multi_process_incoming_tun (struct multi_context *m, const unsigned int mpp_flag
  * queue.
  */
 struct multi_instance *
-multi_get_queue (struct mbuf_set *ms)
+multi_get_queue (struct mbuf_fq *fq)
 {
   struct mbuf_item item;
 
-  if (mbuf_extract_item (ms, &item, true)) /* cleartext IP packet */
+  if (mbuf_fq_extract (fq, &item)) /* cleartext IP packet */
     {
       unsigned int pipv4_flags = PIPV4_PASSTOS;
 
@@ -1841,7 +2966,7 @@ multi_process_timeout (struct multi_context *m, const unsigned int mpp_flags)
   if (m->earliest_wakeup)
     {
       set_prefix (m->earliest_wakeup);
-      ret = multi_process_post (m, m->earliest_wakeup, mpp_flags);
+      ret = multi_process_post (m, m->earliest_wakeup, mpp_flags|MPP_FORCE_PRE_SELECT);
       m->earliest_wakeup = NULL;
       clear_prefix ();
     }
@@ -1916,6 +3041,370 @@ gremlin_flood_clients (struct multi_context *m)
 }
 #endif
 
+#ifdef ENABLE_HANDOFF
+
+/*
+ * Serialize a client instance for --handoff.  Only
+ * fully connected clients are carried over; the rest
+ * will simply reconnect to the new server.
+ */
+static bool
+multi_handoff_save (const struct multi_instance *mi, struct buffer *buf)
+{
+  const struct context *c = &mi->context;
+  const struct sockaddr_in *from;
+
+  if (mi->halt || !mi->connection_established_flag
+      || c->c2.context_auth != CAS_SUCCEEDED
+      || !c->c2.link_socket_info)
+    return false;
+
+  from = &c->c2.link_socket_info->lsa->actual;
+  if (!addr_defined (from))
+    return false;
+
+  return buf_write (buf, &from->sin_addr.s_addr, sizeof (from->sin_addr.s_addr))
+    && buf_write (buf, &from->sin_port, sizeof (from->sin_port))
+    && buf_write_u32 (buf, (int) mi->created)
+    && buf_write_u32 (buf, mi->peer_id)
+    && buf_write_u32 (buf, mi->vaddr_handle)
+    && buf_write_u8 (buf, c->c2.push_ifconfig_defined)
+    && buf_write_u32 (buf, (int) c->c2.push_ifconfig_local)
+    && buf_write_u32 (buf, (int) c->c2.push_ifconfig_remote_netmask)
+    && tls_handoff_save (c->c2.tls_multi, buf);
+}
+
+/*
+ * Hand our UDP socket, TUN/TAP device and connected
+ * clients over to a newly exec'd copy of ourselves, then
+ * exit.  If the new server doesn't take over, carry on.
+ */
+static void
+multi_handoff (struct multi_context *m)
+{
+  struct gc_arena gc = gc_new ();
+  struct handoff h;
+  struct buffer *records;
+  int i, n = 0;
+  bool ok;
+
+  m->handoff_pending = false;
+
+  /* the new server will read the pool from --ifconfig-pool-persist */
+  multi_ifconfig_pool_persist (m, true);
+
+  ALLOC_ARRAY_CLEAR_GC (records, struct buffer, m->n_instances + 1, &gc);
+  for (i = 0; i < m->n_instances; ++i)
+    {
+      const struct multi_instance *mi = multi_instance_at (m, i, 1);
+      records[n] = alloc_buf_gc (HANDOFF_RECORD_SIZE, &gc);
+      if (multi_handoff_save (mi, &records[n]))
+	++n;
+    }
+
+  msg (M_INFO, "MULTI: handing off %d of %d clients to a new server process",
+       n, m->n_instances);
+
+  ok = handoff_start (&h, m->top.argc, m->top.argv,
+		      m->top.c2.link_socket->sd, m->top.c1.tuntap, n);
+  for (i = 0; ok && i < n; ++i)
+    ok = handoff_write (&h, &records[i]);
+  for (i = 0; i < n; ++i)
+    buf_clear (&records[i]);
+  ok = handoff_finish (&h, ok);
+
+  gc_free (&gc);
+
+  if (ok)
+    {
+      msg (M_INFO, "MULTI: new server has taken over, exiting");
+      openvpn_exit (OPENVPN_EXIT_STATUS_GOOD); /* exit point */
+    }
+  else
+    msg (M_WARN, "WARNING: handoff failed, continuing to serve clients");
+}
+
+/*
+ * Recreate one client instance saved by multi_handoff_save.
+ */
+static bool
+multi_handoff_restore_instance (struct multi_context *m, struct buffer *buf)
+{
+  struct gc_arena gc = gc_new ();
+  struct multi_instance *mi = NULL;
+  struct mroute_addr real;
+  struct sockaddr_in from;
+  unsigned int option_types_found = 0;
+  time_t created;
+  int peer_id, vaddr_handle, push_ifconfig_defined;
+  in_addr_t push_ifconfig_local, push_ifconfig_remote_netmask;
+  bool good = true;
+
+  CLEAR (from);
+  from.sin_family = AF_INET;
+  if (!buf_read (buf, &from.sin_addr.s_addr, sizeof (from.sin_addr.s_addr))
+      || !buf_read (buf, &from.sin_port, sizeof (from.sin_port)))
+    goto err;
+  created = (time_t) buf_read_u32 (buf, &good);
+  if (good)
+    peer_id = (int) buf_read_u32 (buf, &good);
+  if (good)
+    vaddr_handle = (int) buf_read_u32 (buf, &good);
+  if (!good || (push_ifconfig_defined = buf_read_u8 (buf)) < 0)
+    goto err;
+  push_ifconfig_local = buf_read_u32 (buf, &good);
+  if (good)
+    push_ifconfig_remote_netmask = buf_read_u32 (buf, &good);
+  if (!good || !mroute_extract_sockaddr_in (&real, &from, true))
+    goto err;
+
+  /* give the client the same peer-id as before */
+  if (m->peers && peer_id >= 0 && peer_id < m->max_peers)
+    m->peer_next = peer_id;
+
+  mi = multi_create_instance (m, &real);
+  if (!mi)
+    goto err;
+  ASSERT (hash_add (m->hash, &mi->real, mi, false));
+  mi->did_real_hash = true;
+  mi->created = created;
+
+  if (!tls_handoff_restore (mi->context.c2.tls_multi, buf, &from))
+    goto err;
+  if (mi->peer_id != peer_id)
+    {
+      msg (D_MULTI_ERRORS, "MULTI: handoff could not restore peer-id %d", peer_id);
+      goto err;
+    }
+  mi->context.c2.from = from;
+  generate_prefix (mi);
+
+  /* re-read the client's --client-config-dir file */
+  multi_client_config_dir_import (m, mi, CC_OPTION_PERMISSIONS_MASK, &option_types_found);
+
+  /* keep the virtual address which the client already has */
+  mi->vaddr_handle = -1;
+  if (vaddr_handle >= 0 && m->ifconfig_pool)
+    {
+      if (ifconfig_pool_acquire_handle (m->ifconfig_pool, vaddr_handle,
+					tls_common_name (mi->context.c2.tls_multi, false)))
+	mi->vaddr_handle = vaddr_handle;
+      else
+	msg (D_MULTI_ERRORS, "MULTI: handoff could not restore --ifconfig-pool entry %d", vaddr_handle);
+    }
+  mi->context.c2.push_ifconfig_defined = push_ifconfig_defined;
+  mi->context.c2.push_ifconfig_local = push_ifconfig_local;
+  mi->context.c2.push_ifconfig_remote_netmask = push_ifconfig_remote_netmask;
+
+  link_socket_set_outgoing_addr (NULL, get_link_socket_info (&mi->context), &from,
+				 tls_common_name (mi->context.c2.tls_multi, true),
+				 mi->context.c2.es);
+  multi_set_virtual_addr_env (m, mi);
+
+  multi_client_connect_finish (m, mi, true, 0, option_types_found);
+  if (mi->context.c2.context_auth != CAS_SUCCEEDED)
+    goto err;
+  mi->context.c2.push_reply_deferred = false;
+
+  msg (D_MULTI_LOW, "MULTI: %s taken over from the old server",
+       multi_instance_string (mi, false, &gc));
+  gc_free (&gc);
+  return true;
+
+ err:
+  msg (D_MULTI_ERRORS, "MULTI: handoff of client %s failed",
+       print_sockaddr (&from, &gc));
+  if (mi)
+    multi_close_instance (m, mi, false);
+  gc_free (&gc);
+  return false;
+}
+
+/*
+ * Take over the clients of a server which handed itself
+ * over to us with --handoff.
+ */
+void
+multi_handoff_restore (struct multi_context *m)
+{
+  struct buffer buf;
+  int n = 0, total = 0;
+
+  while (handoff_read (&buf))
+    {
+      ++total;
+      if (multi_handoff_restore_instance (m, &buf))
+	++n;
+    }
+  handoff_close ();
+
+  if (total)
+    msg (M_INFO, "MULTI: took over %d of %d clients from the old server", n, total);
+}
+
+#endif
+
+#ifdef ENABLE_RELOAD
+
+/*
+ * Re-read the server options and apply those which
+ * can be changed while clients are connected.  New
+ * --push and --client-config-dir settings apply to
+ * clients which connect afterwards, a new --crl-verify
+ * file to every client at its next TLS negotiation.
+ * Other changes are reported as needing a restart.
+ */
+static void
+multi_reload (struct multi_context *m)
+{
+  struct options *o = &m->top.options;
+  struct options n;
+  int n_changed = 0;
+  int n_restart;
+  int i;
+
+  m->reload_pending = false;
+
+  msg (M_INFO, "RELOAD: re-reading server options");
+  if (!init_options_reload (&n, m->top.argc, m->top.argv))
+    return;
+
+  n_restart = options_restart_needed (o, &n, &m->top.c2.frame, m->top.c1.tuntap);
+  o->reload_on_hup = n.reload_on_hup;
+
+  /* logging */
+  if (n.verbosity != o->verbosity || n.mute != o->mute)
+    {
+      o->verbosity = n.verbosity;
+      o->mute = n.mute;
+      set_debug_level (o->verbosity, SDL_CONSTRAIN);
+      set_mute_cutoff (o->mute);
+      msg (M_INFO, "RELOAD: --verb %d --mute %d", o->verbosity, o->mute);
+      ++n_changed;
+    }
+
+  /* push list, which existing clients keep sharing */
+  if (string_changed (o->push_list ? o->push_list->options : NULL,
+		      n.push_list ? n.push_list->options : NULL))
+    {
+      if (n.push_list)
+	{
+	  struct push_list *pl;
+	  ALLOC_OBJ_CLEAR_GC (pl, struct push_list, &o->gc);
+	  pl->options = string_alloc (n.push_list->options, &o->gc);
+	  pl->len = n.push_list->len;
+	  pl->capacity = pl->len + 1;
+	  o->push_list = pl;
+	  push_reply_template_init (o);
+	}
+      else
+	o->push_list = NULL;
+      msg (M_INFO, "RELOAD: new --push list applies to clients connecting from now on");
+      ++n_changed;
+    }
+
+  /* client config dir */
+  if (string_changed (o->client_config_dir, n.client_config_dir)
+      || o->ccd_exclusive != n.ccd_exclusive
+      || o->ccd_cache_max != n.ccd_cache_max
+      || o->ccd_cache_refresh != n.ccd_cache_refresh)
+    {
+      o->client_config_dir = n.client_config_dir ? string_alloc (n.client_config_dir, &o->gc) : NULL;
+      o->ccd_exclusive = n.ccd_exclusive;
+      o->ccd_cache_max = n.ccd_cache_max;
+      o->ccd_cache_refresh = n.ccd_cache_refresh;
+      ccd_cache_free (m->ccd_cache);
+      m->ccd_cache = NULL;
+      if (o->ccd_cache_max && o->client_config_dir)
+	m->ccd_cache = ccd_cache_new (o->client_config_dir,
+				      o->ccd_cache_max,
+				      o->ccd_cache_refresh);
+      msg (M_INFO, "RELOAD: --client-config-dir %s%s",
+	   o->client_config_dir ? o->client_config_dir : "[UNDEF]",
+	   o->ccd_exclusive ? " (exclusive)" : "");
+      ++n_changed;
+    }
+
+  /* CRL, which is re-read at each TLS verification */
+  if (string_changed (o->crl_file, n.crl_file))
+    {
+      if (n.crl_file && !test_file (n.crl_file))
+	msg (M_WARN, "RELOAD: cannot read --crl-verify file %s, keeping %s",
+	     n.crl_file, o->crl_file ? o->crl_file : "[UNDEF]");
+      else
+	{
+	  o->crl_file = n.crl_file ? string_alloc (n.crl_file, &o->gc) : NULL;
+	  for (i = 0; i < m->n_instances; ++i)
+	    {
+	      struct multi_instance *mi = multi_instance_at (m, i, 1);
+	      mi->context.options.crl_file = o->crl_file;
+	      tls_set_crl_file (mi->context.c2.tls_multi, o->crl_file);
+	    }
+	  msg (M_INFO, "RELOAD: --crl-verify %s", o->crl_file ? o->crl_file : "[UNDEF]");
+	  ++n_changed;
+	}
+    }
+
+  /* connection limits */
+  if (n.max_clients != o->max_clients)
+    {
+      if (n.max_clients > m->max_clients_alloc)
+	{
+	  msg (M_WARN, "RELOAD: --max-clients %d is above the %d this server was started with, a restart is needed to apply it",
+	       n.max_clients, m->max_clients_alloc);
+	  ++n_restart;
+	}
+      else
+	{
+	  o->max_clients = m->max_clients = n.max_clients;
+	  msg (M_INFO, "RELOAD: --max-clients %d", m->max_clients);
+	  ++n_changed;
+	}
+    }
+  if (n.cf_max != o->cf_max || n.cf_per != o->cf_per)
+    {
+      o->cf_max = n.cf_max;
+      o->cf_per = n.cf_per;
+      frequency_limit_free (m->new_connection_limiter);
+      m->new_connection_limiter = frequency_limit_init (o->cf_max, o->cf_per);
+      msg (M_INFO, "RELOAD: --connect-freq %d %d", o->cf_max, o->cf_per);
+      ++n_changed;
+    }
+  if (n.tcp_queue_limit != o->tcp_queue_limit)
+    {
+      o->tcp_queue_limit = m->tcp_queue_limit = n.tcp_queue_limit;
+      msg (M_INFO, "RELOAD: --tcp-queue-limit %d", m->tcp_queue_limit);
+      ++n_changed;
+    }
+  if (n.max_routes_per_client != o->max_routes_per_client)
+    {
+      o->max_routes_per_client = n.max_routes_per_client;
+      msg (M_INFO, "RELOAD: --max-routes-per-client %d applies to clients connecting from now on",
+	   o->max_routes_per_client);
+      ++n_changed;
+    }
+
+  /* status file */
+  if (n.status_file_update_freq != o->status_file_update_freq
+      || n.status_file_version != o->status_file_version)
+    {
+      o->status_file_update_freq = n.status_file_update_freq;
+      o->status_file_version = m->status_file_version = n.status_file_version;
+      if (m->top.c1.status_output)
+	status_set_refresh (m->top.c1.status_output, o->status_file_update_freq);
+      msg (M_INFO, "RELOAD: --status interval %d version %d",
+	   o->status_file_update_freq, m->status_file_version);
+      ++n_changed;
+    }
+
+  uninit_options (&n);
+
+  msg (M_INFO, "RELOAD: done, %d setting(s) changed, %d need a restart",
+       n_changed, n_restart);
+}
+
+#endif
+
 /*
  * Process timers in the top-level context
  */
@@ -1935,6 +3424,31 @@ multi_process_per_second_timers_dowork (struct multi_context *m)
   /* possibly flush ifconfig-pool file */
   multi_ifconfig_pool_persist (m, false);
 
+#ifdef ENABLE_MSTATS
+  if (m->mstats)
+    mstats_tick (m->mstats);
+#endif
+
+  /* possibly age out multicast group memberships */
+  if (m->mcast)
+    mcast_expire (m->mcast);
+
+  /* possibly purge stale ARP proxy bindings */
+  if (m->arp_proxy)
+    arp_proxy_expire (m->arp_proxy);
+
+#ifdef ENABLE_RELOAD
+  /* management interface asked us to re-read our options */
+  if (m->reload_pending)
+    multi_reload (m);
+#endif
+
+#ifdef ENABLE_HANDOFF
+  /* management interface asked us to hand off to a new server */
+  if (m->handoff_pending)
+    multi_handoff (m);
+#endif
+
 #ifdef ENABLE_DEBUG
   gremlin_flood_clients (m);
 #endif
@@ -1971,6 +3485,16 @@ multi_process_signal (struct multi_context *m)
       m->top.sig->signal_received = 0;
       return false;
     }
+#ifdef ENABLE_RELOAD
+  if (m->top.sig->signal_received == SIGHUP
+      && m->top.sig->hard
+      && m->top.options.reload_on_hup)
+    {
+      m->top.sig->signal_received = 0;
+      multi_reload (m);
+      return false;
+    }
+#endif
   return true;
 }
 
@@ -2016,14 +3540,12 @@ static int
 management_callback_kill_by_cn (void *arg, const char *del_cn)
 {
   struct multi_context *m = (struct multi_context *) arg;
-  struct hash_iterator hi;
-  struct hash_element *he;
   int count = 0;
+  int i;
 
-  hash_iterator_init (m->iter, &hi, true);
-  while ((he = hash_iterator_next (&hi)))
+  for (i = 0; i < m->n_instances; ++i)
     {
-      struct multi_instance *mi = (struct multi_instance *) he->value;
+      struct multi_instance *mi = multi_instance_at (m, i, 1);
       if (!mi->halt)
 	{
 	  const char *cn = tls_common_name (mi->context.c2.tls_multi, false);
@@ -2034,7 +3556,68 @@ management_callback_kill_by_cn (void *arg, const char *del_cn)
 	    }
 	}
     }
-  hash_iterator_free (&hi);
+  return count;
+}
+
+static int
+management_callback_shaper_by_cn (void *arg, const char *cn, const int out, const int in)
+{
+  struct multi_context *m = (struct multi_context *) arg;
+  int count = 0;
+  int i;
+
+  if ((out && (out < SHAPER_MIN || out > SHAPER_MAX))
+      || (in && (in < SHAPER_MIN || in > SHAPER_MAX)))
+    return -1;
+
+  for (i = 0; i < m->n_instances; ++i)
+    {
+      struct multi_instance *mi = multi_instance_at (m, i, 1);
+      if (!mi->halt)
+	{
+	  const char *mi_cn = tls_common_name (mi->context.c2.tls_multi, false);
+	  if (mi_cn && !strcmp (mi_cn, cn))
+	    {
+	      multi_set_shaper (m, mi, out, in);
+	      ++count;
+	    }
+	}
+    }
+  return count;
+}
+
+/*
+ * Show the --client-filter rules of each client having
+ * common name cn, one line per rule, prefixed by the
+ * client's real address.
+ */
+static int
+management_callback_client_filter_show (void *arg, const char *cn)
+{
+  struct multi_context *m = (struct multi_context *) arg;
+  struct gc_arena gc = gc_new ();
+  int count = 0;
+  int i;
+
+  for (i = 0; i < m->n_instances; ++i)
+    {
+      struct multi_instance *mi = multi_instance_at (m, i, 1);
+      if (!mi->halt)
+	{
+	  const char *mi_cn = tls_common_name (mi->context.c2.tls_multi, false);
+	  if (mi_cn && !strcmp (mi_cn, cn))
+	    {
+	      struct buffer prefix = alloc_buf_gc (64, &gc);
+	      buf_printf (&prefix, "%s,", mroute_addr_print (&mi->real, &gc));
+	      if (mi->pf)
+		pf_print (mi->pf, BSTR (&prefix), M_CLIENT);
+	      else
+		msg (M_CLIENT, "%snone", BSTR (&prefix));
+	      ++count;
+	    }
+	}
+    }
+  gc_free (&gc);
   return count;
 }
 
@@ -2042,11 +3625,10 @@ static int
 management_callback_kill_by_addr (void *arg, const in_addr_t addr, const int port)
 {
   struct multi_context *m = (struct multi_context *) arg;
-  struct hash_iterator hi;
-  struct hash_element *he;
   struct sockaddr_in saddr;
   struct mroute_addr maddr;
   int count = 0;
+  int i;
 
   CLEAR (saddr);
   saddr.sin_family = AF_INET;
@@ -2054,21 +3636,134 @@ management_callback_kill_by_addr (void *arg, const in_addr_t addr, const int por
   saddr.sin_port = htons (port);
   if (mroute_extract_sockaddr_in (&maddr, &saddr, true))
     {
-      hash_iterator_init (m->iter, &hi, true);
-      while ((he = hash_iterator_next (&hi)))
+      for (i = 0; i < m->n_instances; ++i)
 	{
-	  struct multi_instance *mi = (struct multi_instance *) he->value;
+	  struct multi_instance *mi = multi_instance_at (m, i, 1);
 	  if (!mi->halt && mroute_addr_equal (&maddr, &mi->real))
 	    {
 	      multi_signal_instance (m, mi, SIGTERM);
 	      ++count;
 	    }
 	}
-      hash_iterator_free (&hi);
     }
   return count;
 }
 
+static bool
+management_callback_ccd_cache_show (void *arg, const bool list)
+{
+  struct multi_context *m = (struct multi_context *) arg;
+  if (m->ccd_cache)
+    {
+      ccd_cache_print (m->ccd_cache, list, M_CLIENT);
+      return true;
+    }
+  return false;
+}
+
+static int
+management_callback_ccd_cache_flush (void *arg, const char *common_name)
+{
+  struct multi_context *m = (struct multi_context *) arg;
+  if (m->ccd_cache)
+    return ccd_cache_flush (m->ccd_cache, common_name);
+  return -1;
+}
+
+/*
+ * Per-client byte counts for the management interface are
+ * produced by sweeping m->instances a few at a time, so that
+ * a large number of clients is spread evenly over the update
+ * interval, and no pass queues more than the management
+ * output queue has room for.  Only clients whose counters have
+ * changed since they were last shown are included.
+ */
+
+#define MULTI_BYTECOUNT_PER_PASS   64     /* clients per pass */
+#define MULTI_BYTECOUNT_MAX_SPREAD 86400  /* spread a sweep over at most n seconds */
+
+static void
+management_callback_bytecount (void *arg, const int seconds)
+{
+  struct multi_context *m = (struct multi_context *) arg;
+  m->bytecount_index = -1;
+  m->bytecount_next = seconds > 0 ? now : 0;
+}
+
+/*
+ * Schedule the next part of the current sweep, spacing
+ * the parts which are left evenly over what is left of
+ * the interval.
+ */
+static void
+multi_bytecount_schedule (struct multi_context *m)
+{
+  const int parts = (m->n_instances - m->bytecount_index + MULTI_BYTECOUNT_PER_PASS - 1)
+    / MULTI_BYTECOUNT_PER_PASS;
+  struct timeval left;
+  int step_ms;
+
+  tv_until (&left, &m->bytecount_end);
+  step_ms = (min_int (left.tv_sec, MULTI_BYTECOUNT_MAX_SPREAD) * 1000 + left.tv_usec / 1000)
+    / (max_int (parts, 0) + 1);
+  left.tv_sec = step_ms / 1000;
+  left.tv_usec = (step_ms % 1000) * 1000;
+  tv_future (&m->bytecount_due, &left);
+}
+
+void
+multi_process_bytecount_dowork (struct multi_context *m)
+{
+  const int interval = management_bytecount_interval (management);
+
+  if (!interval)
+    {
+      /* management client has gone */
+      m->bytecount_next = 0;
+      m->bytecount_index = -1;
+      return;
+    }
+
+  if (m->bytecount_index < 0)
+    {
+      struct timeval tv;
+      tv.tv_sec = interval;
+      tv.tv_usec = 0;
+      m->bytecount_index = 0;
+      m->bytecount_next = now + interval;
+      m->bytecount_due = now_tv;
+      tv_future (&m->bytecount_end, &tv);
+    }
+
+  if (management_bytecount_ready (management))
+    {
+      const int end = min_int (m->bytecount_index + MULTI_BYTECOUNT_PER_PASS, m->n_instances);
+      int i;
+
+      for (i = m->bytecount_index; i < end; ++i)
+	{
+	  struct multi_instance *mi = multi_instance_at (m, i, 1);
+	  const struct context *c = &mi->context;
+	  if (!mi->halt
+	      && mi->connection_established_flag
+	      && (c->c2.link_read_bytes != mi->bytecount_in || c->c2.link_write_bytes != mi->bytecount_out))
+	    {
+	      mi->bytecount_in = c->c2.link_read_bytes;
+	      mi->bytecount_out = c->c2.link_write_bytes;
+	      management_bytecount_client (management, mi->cid, mi->bytecount_in, mi->bytecount_out);
+	    }
+	}
+
+      if (end < m->n_instances)
+	{
+	  m->bytecount_index = end;
+	  multi_bytecount_schedule (m);
+	}
+      else
+	m->bytecount_index = -1;
+    }
+}
+
 static void
 management_delete_event (void *arg, event_t event)
 {
@@ -2077,6 +3772,27 @@ management_delete_event (void *arg, event_t event)
     multi_tcp_delete_event (m->mtcp, event);
 }
 
+#ifdef ENABLE_HANDOFF
+static bool
+management_callback_handoff (void *arg)
+{
+  struct multi_context *m = (struct multi_context *) arg;
+  if (!m->top.options.handoff)
+    return false;
+  m->handoff_pending = true;
+  return true;
+}
+#endif
+
+#ifdef ENABLE_RELOAD
+static void
+management_callback_reload (void *arg)
+{
+  struct multi_context *m = (struct multi_context *) arg;
+  m->reload_pending = true;
+}
+#endif
+
 #endif
 
 void
@@ -2092,6 +3808,17 @@ init_management_callback_multi (struct multi_context *m)
       cb.show_net = management_show_net_callback;
       cb.kill_by_cn = management_callback_kill_by_cn;
       cb.kill_by_addr = management_callback_kill_by_addr;
+      cb.shaper_by_cn = management_callback_shaper_by_cn;
+      cb.client_filter_show = management_callback_client_filter_show;
+      cb.ccd_cache_show = management_callback_ccd_cache_show;
+      cb.ccd_cache_flush = management_callback_ccd_cache_flush;
+      cb.bytecount = management_callback_bytecount;
+#ifdef ENABLE_HANDOFF
+      cb.handoff = management_callback_handoff;
+#endif
+#ifdef ENABLE_RELOAD
+      cb.reload = management_callback_reload;
+#endif
       cb.delete_event = management_delete_event;
       management_set_callback (management, &cb);
     }
@@ -34,6 +34,11 @@
 #include "list.h"
 #include "schedule.h"
 #include "pool.h"
+#include "ccd.h"
+#include "mcast.h"
+#include "arp.h"
+#include "pf.h"
+#include "mstats.h"
 #include "mudp.h"
 #include "mtcp.h"
 #include "perf.h"
@@ -46,7 +51,6 @@
 struct multi_reap
 {
   int bucket_base;
-  int buckets_per_pass;
   time_t last_call;
 };
 
@@ -62,6 +66,7 @@ struct multi_instance {
   int refcount;
   int route_count;             /* number of routes (including cached routes) owned by this instance */
   time_t created;
+  unsigned long cid;           /* unique client ID */
   struct timeval wakeup;       /* absolute time */
   struct mroute_addr real;
   ifconfig_pool_handle vaddr_handle;
@@ -72,11 +77,50 @@ struct multi_instance {
   struct mbuf_set *tcp_link_out_deferred;
   bool socket_set_called;
 
+  /* cleartext client-to-client/bcast/mcast packets waiting to be sent */
+  struct mbuf_flow mbuf_flow;
+
+  /* --client-shaper rate limits */
+  struct token_bucket shaper_out;
+  struct token_bucket shaper_in;
+
+  /* compiled --client-filter rules, or NULL */
+  struct pf_filter *pf;
+
+#ifdef ENABLE_DEFERRED_AUTH
+  /* --client-connect stage which has not completed yet */
+  char *client_connect_file;	  /* NULL unless deferred */
+  unsigned int client_connect_option_types_found;
+  int client_connect_succeeded_count;
+#endif
+
+#ifdef ENABLE_ASYNC_SCRIPT
+  /* --client-connect script running under --script-async */
+  struct script_job client_connect_job;
+#endif
+
+#ifdef ENABLE_PLUGIN_DEFERRED
+  /* client-connect plug-in calls which returned DEFERRED */
+  struct plugin_request client_connect_plugin;
+#endif
+
   in_addr_t reporting_addr;       /* IP address shown in status listing */
 
+#ifdef ENABLE_MANAGEMENT
+  /* counters last shown in a >BYTECOUNT_CLI notification */
+  counter_type bytecount_in;
+  counter_type bytecount_out;
+#endif
+
+#ifdef ENABLE_MSTATS
+  int mstats_slot;                /* --status-mmap client record, or -1 */
+  time_t mstats_updated;
+#endif
+
   bool did_open_context;
   bool did_real_hash;
-  bool did_iter;
+  int iter_index;                 /* position in m->instances, or -1 */
+  int peer_id;                    /* index in m->peers, or -1 */
   bool connection_established_flag;
   bool did_iroutes;
 
@@ -97,11 +141,40 @@ struct multi_context {
 
   struct hash *hash;   /* client instances indexed by real address */
   struct hash *vhash;  /* client instances indexed by virtual address */
-  struct hash *iter;   /* like real address hash but optimized for iteration */
+
+  /*
+   * All client instances, packed into a contiguous array
+   * for fast iteration.  An instance is removed by moving
+   * the last one into its place, so loops which close
+   * instances as they go should run from the end.
+   */
+  struct multi_instance **instances;
+  int n_instances;
+  int max_instances;
+
+  /*
+   * UDP client instances indexed by the peer-id which
+   * they send in P_DATA_V2 packets, so that a client can
+   * be found after its real address has changed.
+   */
+  struct multi_instance **peers;
+  int max_peers;
+  int peer_next;               /* where to look for a free peer-id */
+  counter_type floats;         /* clients moved to a new real address */
+
   struct schedule *schedule;
-  struct mbuf_set *mbuf;
+  struct mbuf_fq *mbuf;
   struct multi_tcp *mtcp;
   struct ifconfig_pool *ifconfig_pool;
+  struct ccd_cache *ccd_cache;
+  struct mcast_set *mcast;     /* --igmp-snooping group table */
+  struct arp_proxy *arp_proxy; /* --proxy-arp bindings */
+  int n_filtered;              /* instances with a --client-filter */
+  counter_type c2c_direct;     /* client-to-client packets encrypted directly */
+  counter_type c2c_queued;     /* client-to-client packets queued as mbufs */
+#ifdef ENABLE_MSTATS
+  struct mstats *mstats;
+#endif
   struct frequency_limit *new_connection_limiter;
   struct mroute_helper *route_helper;
   struct multi_reap *reaper;
@@ -110,12 +183,31 @@ struct multi_context {
   int max_clients;
   int tcp_queue_limit;
   int status_file_version;
+  struct token_bucket shaper;  /* --client-shaper-total */
 
   struct multi_instance *pending;
   struct multi_instance *earliest_wakeup;
   struct multi_instance **mpp_touched;
   struct context_buffers *context_buffers;
   time_t per_second_trigger;
+  unsigned long cid_counter;
+
+#ifdef ENABLE_MANAGEMENT
+  /* management "bytecount" sweep through m->instances */
+  time_t bytecount_next;       /* start of next sweep, or 0 if disabled */
+  int bytecount_index;         /* next instance of current sweep, or -1 */
+  struct timeval bytecount_due; /* when the next part of current sweep is due */
+  struct timeval bytecount_end; /* end of current sweep's interval */
+#endif
+
+#ifdef ENABLE_HANDOFF
+  bool handoff_pending;        /* management "handoff" command waiting to run */
+#endif
+
+#ifdef ENABLE_RELOAD
+  bool reload_pending;         /* management "reload" command waiting to run */
+  int max_clients_alloc;       /* --max-clients which per-client tables were sized for */
+#endif
 
   struct context top;
 };
@@ -166,6 +258,7 @@ bool multi_process_timeout (struct multi_context *m, const unsigned int mpp_flag
 #define MPP_CONDITIONAL_PRE_SELECT (1<<1)
 #define MPP_CLOSE_ON_SIGNAL        (1<<2)
 #define MPP_RECORD_TOUCH           (1<<3)
+#define MPP_FORCE_PRE_SELECT       (1<<4)
 bool multi_process_post (struct multi_context *m, struct multi_instance *mi, const unsigned int flags);
 
 bool multi_process_incoming_link (struct multi_context *m, struct multi_instance *instance, const unsigned int mpp_flags);
@@ -175,7 +268,7 @@ void multi_process_drop_outgoing_tun (struct multi_context *m, const unsigned in
 
 void multi_print_status (struct multi_context *m, struct status_output *so, const int version);
 
-struct multi_instance *multi_get_queue (struct mbuf_set *ms);
+struct multi_instance *multi_get_queue (struct mbuf_fq *fq);
 
 void multi_add_mbuf (struct multi_context *m,
 		     struct multi_instance *mi,
@@ -187,6 +280,10 @@ bool multi_process_signal (struct multi_context *m);
 
 void multi_close_instance_on_signal (struct multi_context *m, struct multi_instance *mi);
 
+#ifdef ENABLE_HANDOFF
+void multi_handoff_restore (struct multi_context *m);
+#endif
+
 void init_management_callback_multi (struct multi_context *m);
 void uninit_management_callback_multi (struct multi_context *m);
 
@@ -203,6 +300,22 @@ multi_output_queue_ready (const struct multi_context *m,
     return true;
 }
 
+/*
+ * Return instance i of m->instances, and prefetch the
+ * instance which a loop moving by step (1 or -1) will
+ * reach MULTI_PREFETCH_DISTANCE iterations later.
+ */
+#define MULTI_PREFETCH_DISTANCE 4
+
+static inline struct multi_instance *
+multi_instance_at (const struct multi_context *m, const int i, const int step)
+{
+  const int j = i + step * MULTI_PREFETCH_DISTANCE;
+  if (j >= 0 && j < m->n_instances)
+    PREFETCH (m->instances[j]);
+  return m->instances[i];
+}
+
 /*
  * Determine which instance has pending output
  * and prepare the output for sending in
@@ -215,7 +328,7 @@ multi_process_outgoing_link_pre (struct multi_context *m)
 
   if (m->pending)
     mi = m->pending;
-  else if (mbuf_defined (m->mbuf))
+  else if (mbuf_fq_defined (m->mbuf))
     mi = multi_get_queue (m->mbuf);
   return mi;
 }
@@ -370,14 +483,13 @@ multi_process_per_second_timers (struct multi_context *m)
 static inline void
 multi_get_timeout (struct multi_context *m, struct timeval *dest)
 {
-  struct timeval tv, current;
+  struct timeval tv;
 
   CLEAR (tv);
   m->earliest_wakeup = (struct multi_instance *) schedule_get_earliest_wakeup (m->schedule, &tv);
   if (m->earliest_wakeup)
     {
-      ASSERT (!gettimeofday (&current, NULL));
-      tv_delta (dest, &current, &tv);
+      tv_until (dest, &tv);
       if (dest->tv_sec >= REAP_MAX_WAKEUP)
 	{
 	  m->earliest_wakeup = NULL;
@@ -390,6 +502,70 @@ multi_get_timeout (struct multi_context *m, struct timeval *dest)
       dest->tv_sec = REAP_MAX_WAKEUP;
       dest->tv_usec = 0;
     }
+
+  /* wake up in time to release output of rate limited clients */
+  if (mbuf_fq_throttled (m->mbuf) && mbuf_fq_release (m->mbuf, &tv))
+    {
+      struct timeval release;
+      tv_until (&release, &tv);
+      if (tv_lt (&release, dest))
+	{
+	  m->earliest_wakeup = NULL;
+	  *dest = release;
+	}
+    }
+
+#ifdef ENABLE_MANAGEMENT
+  /* wake up for the next part of a "bytecount" sweep */
+  if (m->bytecount_next)
+    {
+      struct timeval bc;
+      CLEAR (bc);
+      if (m->bytecount_index < 0)
+	bc.tv_sec = max_int (m->bytecount_next - now, 0);
+      else if (!management_bytecount_ready (management))
+	bc = *dest; /* output queue will wake us */
+      else
+	tv_until (&bc, &m->bytecount_due);
+      if (tv_lt (&bc, dest))
+	{
+	  m->earliest_wakeup = NULL;
+	  *dest = bc;
+	}
+    }
+#endif
+
+#ifdef ENABLE_ASYNC_SCRIPT
+  /* reap detached scripts such as --client-disconnect */
+  if (script_detached)
+    {
+      struct timeval reap = *dest;
+      check_script_async (&reap);
+      if (tv_lt (&reap, dest))
+	{
+	  m->earliest_wakeup = NULL;
+	  *dest = reap;
+	}
+    }
+#endif
+}
+
+/*
+ * Queue the next part of a management interface
+ * "bytecount" sweep.
+ */
+static inline void
+multi_process_bytecount (struct multi_context *m)
+{
+#ifdef ENABLE_MANAGEMENT
+  if (m->bytecount_next && (m->bytecount_index >= 0
+			    ? tv_expired (&m->bytecount_due)
+			    : now >= m->bytecount_next))
+    {
+      void multi_process_bytecount_dowork (struct multi_context *m);
+      multi_process_bytecount_dowork (m);
+    }
+#endif
 }
 
 /*
@@ -215,6 +215,8 @@ check_send_occ_msg_dowork (struct context *c)
 {
   bool doit = false;
 
+  ++pre_select_stats.occ;
+
   c->c2.buf = c->c2.buffers->aux_buf;
   ASSERT (buf_init (&c->c2.buf, FRAME_HEADROOM (&c->c2.frame)));
   ASSERT (buf_safe (&c->c2.buf, MAX_RW_SIZE_TUN (&c->c2.frame)));
@@ -49,10 +49,44 @@
 typedef void *openvpn_plugin_handle_t;
 
 /*
- * Return value for openvpn_plugin_func_v1 function
+ * Return value for openvpn_plugin_func_v1 and
+ * openvpn_plugin_func_v2 functions
  */
 #define OPENVPN_PLUGIN_FUNC_SUCCESS  0
 #define OPENVPN_PLUGIN_FUNC_ERROR    1
+#define OPENVPN_PLUGIN_FUNC_DEFERRED 2  /* v2 only */
+
+/*
+ * The outcome of a deferred openvpn_plugin_func_v2 call,
+ * as written to openvpn_plugin_callbacks.completion_fd.
+ */
+struct openvpn_plugin_completion
+{
+  unsigned int request_id;  /* as passed to openvpn_plugin_func_v2 */
+  int status;               /* OPENVPN_PLUGIN_FUNC_SUCCESS or OPENVPN_PLUGIN_FUNC_ERROR */
+};
+
+/*
+ * Passed by OpenVPN to openvpn_plugin_open_v2, and valid
+ * until openvpn_plugin_close_v1 returns.
+ *
+ * complete : report the outcome of a deferred call.  May be
+ *            called from any thread, including from inside
+ *            openvpn_plugin_func_v2 before it returns
+ *            OPENVPN_PLUGIN_FUNC_DEFERRED.
+ *
+ * completion_fd : a plug-in which prefers to can instead write
+ *                 a struct openvpn_plugin_completion to this
+ *                 file descriptor, in a single write() call.
+ *
+ * If this build of OpenVPN cannot defer plugin calls, complete
+ * is NULL and completion_fd is -1.
+ */
+struct openvpn_plugin_callbacks
+{
+  void (*complete) (const unsigned int request_id, const int status);
+  int completion_fd;
+};
 
 /*
  * For Windows (needs to be modified for MSVC)
@@ -115,7 +149,7 @@ typedef void *openvpn_plugin_handle_t;
 /*
  * FUNCTION: openvpn_plugin_open_v1
  *
- * REQUIRED: YES
+ * REQUIRED: YES, unless openvpn_plugin_open_v2 is defined
  * 
  * Called on initial plug-in load.  OpenVPN will preserve plug-in state
  * across SIGUSR1 restarts but not across SIGHUP restarts.  A SIGHUP reset
@@ -153,7 +187,7 @@ OPENVPN_PLUGIN_DEF openvpn_plugin_handle_t OPENVPN_PLUGIN_FUNC(openvpn_plugin_op
  *
  * Called to perform the work of a given script type.
  *
- * REQUIRED: YES
+ * REQUIRED: YES, unless openvpn_plugin_func_v2 is defined
  * 
  * ARGUMENTS
  *
@@ -209,3 +243,56 @@ OPENVPN_PLUGIN_DEF void OPENVPN_PLUGIN_FUNC(openvpn_plugin_close_v1)
  */
 OPENVPN_PLUGIN_DEF void OPENVPN_PLUGIN_FUNC(openvpn_plugin_abort_v1)
      (openvpn_plugin_handle_t handle);
+
+/*
+ * Version 2 of the plug-in interface allows a plug-in to
+ * return OPENVPN_PLUGIN_FUNC_DEFERRED from
+ * OPENVPN_PLUGIN_AUTH_USER_PASS_VERIFY and
+ * OPENVPN_PLUGIN_CLIENT_CONNECT, and report the outcome later,
+ * so that a slow authentication backend does not hold up
+ * OpenVPN's packet forwarding for other clients.
+ *
+ * A plug-in may define openvpn_plugin_open_v2 and
+ * openvpn_plugin_func_v2 instead of, or as well as, their
+ * v1 counterparts, which are then not called.
+ * openvpn_plugin_close_v1 is still required.
+ */
+
+/*
+ * FUNCTION: openvpn_plugin_open_v2
+ *
+ * REQUIRED: NO
+ *
+ * As openvpn_plugin_open_v1, with the addition of:
+ *
+ * callbacks : functions the plug-in may call back into
+ *             OpenVPN, see struct openvpn_plugin_callbacks.
+ */
+OPENVPN_PLUGIN_DEF openvpn_plugin_handle_t OPENVPN_PLUGIN_FUNC(openvpn_plugin_open_v2)
+     (unsigned int *type_mask, const char *argv[], const char *envp[],
+      const struct openvpn_plugin_callbacks *callbacks);
+
+/*
+ * FUNCTION: openvpn_plugin_func_v2
+ *
+ * REQUIRED: NO
+ *
+ * As openvpn_plugin_func_v1, with the addition of:
+ *
+ * request_id : identifies this call if the plug-in defers it.
+ *              Zero if the call may not be deferred.
+ *
+ * RETURN VALUE
+ *
+ * OPENVPN_PLUGIN_FUNC_SUCCESS on success, OPENVPN_PLUGIN_FUNC_ERROR on
+ * failure, or OPENVPN_PLUGIN_FUNC_DEFERRED if request_id is non-zero and
+ * the plug-in will report the outcome later through the complete
+ * callback or completion_fd.
+ *
+ * Any files named in argv (such as the --client-connect config file)
+ * must be written before the outcome is reported.  envp is only valid
+ * until this function returns.
+ */
+OPENVPN_PLUGIN_DEF int OPENVPN_PLUGIN_FUNC(openvpn_plugin_func_v2)
+     (openvpn_plugin_handle_t handle, const int type, const char *argv[], const char *envp[],
+      const unsigned int request_id);
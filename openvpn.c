@@ -33,6 +33,7 @@
 #include "init.h"
 #include "forward.h"
 #include "multi.h"
+#include "handoff.h"
 
 #include "memdbg.h"
 
@@ -125,6 +126,10 @@ main (int argc, char *argv[])
 	  /* zero context struct but leave first_time member alone */
 	  context_clear_all_except_first_time (&c);
 
+	  /* command line, for reloading options and --handoff */
+	  c.argc = argc;
+	  c.argv = argv;
+
 	  /* static signal info object */
 	  CLEAR (siginfo_static);
 	  c.sig = &siginfo_static;
@@ -179,6 +184,12 @@ main (int argc, char *argv[])
 	  /* test crypto? */
 	  if (do_test_crypto (&c.options))
 	    break;
+
+#ifdef ENABLE_HANDOFF
+	  /* take over from the server which started us with --handoff */
+	  if (c.first_time && c.options.handoff_fd >= 0)
+	    handoff_receive (c.options.handoff_fd);
+#endif
 	  
 #ifdef ENABLE_MANAGEMENT
 	  /* open management subsystem */
@@ -200,6 +200,9 @@ struct context_2
 # ifdef ENABLE_MANAGEMENT
 #  define MANAGEMENT_READ  (1<<6)
 #  define MANAGEMENT_WRITE (1<<7)
+# endif
+# ifdef ENABLE_PLUGIN_DEFERRED
+#  define PLUGIN_READ      (1<<8)
 # endif
 
   unsigned int event_set_status;
@@ -409,6 +412,8 @@ struct context_2
 
   struct event_timeout push_request_interval;
   const char *pulled_options_string;
+  bool push_continuation_pending; /* received PUSH_REPLY said more will follow */
+  unsigned int push_option_types_found; /* accumulated over all parts of a PUSH_REPLY */
 
   struct event_timeout scheduled_exit;
 
@@ -426,6 +431,10 @@ struct context
   /* true on initial VPN iteration */
   bool first_time;
 
+  /* command line which options were parsed from */
+  int argc;
+  char **argv;
+
   /* used by multi-client code to lock the context */
   /*MUTEX_DEFINE (mutex);*/
 
@@ -50,6 +50,7 @@
 #include "pool.h"
 #include "helper.h"
 #include "manage.h"
+#include "pf.h"
 
 #include "memdbg.h"
 
@@ -254,6 +255,8 @@ static const char usage_message[] =
   "                       and received from TCP/UDP (caps) or tun/tap (lc)\n"
   "                : 6 to 11 -- debug messages of increasing verbosity\n"
   "--mute n        : Log at most n consecutive messages in the same category.\n"
+  "--log-buffer n  : Queue up to n log messages and write them out in batches\n"
+  "                  from the event loop, dropping messages on overflow.\n"
   "--status file n : Write operational status to file every n seconds.\n"
   "--status-version [n] : Choose the status file format version number.\n"
   "                  Currently, n can be 1 or 2 (default=1).\n"
@@ -308,6 +311,13 @@ static const char usage_message[] =
   "--iroute network [netmask] : Route subnet to client.\n"
   "                  Sets up internal routes only.\n"
   "                  Only valid in a client-specific config file.\n"
+  "--client-filter accept|drop proto network netmask [port[-port]] :\n"
+  "                  Filter client's traffic to/from network (proto is\n"
+  "                  tcp, udp, icmp or any).  First matching rule wins.\n"
+  "                  IP fragments after the first only match rules\n"
+  "                  without a port range.\n"
+  "--client-filter-default accept|drop : Action if no --client-filter\n"
+  "                  rule matches, or for non-IPv4 packets (default=accept).\n"
   "--disable       : Client is disabled.\n"
   "                  Only valid in a client-specific config file.\n"
   "--client-cert-not-required : Don't require client certificate, client\n"
@@ -320,18 +330,50 @@ static const char usage_message[] =
   "                  user/pass via environment, if method='via-file', pass\n"
   "                  user/pass via temporary file.\n"
   "--client-to-client : Internally route client-to-client traffic.\n"
+  "--igmp-snooping : Send multicast only to clients which have joined\n"
+  "                  the group, as learned from their IGMP reports.\n"
+  "--proxy-arp     : In --dev tap mode, answer ARP requests for client\n"
+  "                  addresses rather than broadcasting them.\n"
   "--duplicate-cn  : Allow multiple clients with the same common name to\n"
   "                  concurrently connect.\n"
   "--client-connect cmd : Run script cmd on client connection.\n"
   "--client-disconnect cmd : Run script cmd on client disconnection.\n"
   "--client-config-dir dir : Directory for custom client config files.\n"
   "--ccd-exclusive : Refuse connection unless custom client config is found.\n"
+  "--ccd-cache n [t] : Cache up to n parsed --client-config-dir files in\n"
+  "                  memory, re-checking each file's mtime at most every\n"
+  "                  t seconds (default=0).\n"
+#ifdef ENABLE_MSTATS
+  "--status-mmap file : Export live server and per-client statistics in\n"
+  "                  a shared memory file.\n"
+#endif
+#ifdef ENABLE_HANDOFF
+  "--handoff       : Allow the management interface 'handoff' command to\n"
+  "                  restart the server without disconnecting clients.\n"
+#endif
+#ifdef ENABLE_RELOAD
+  "--reload-on-hup : On SIGHUP, re-read the configuration and apply the\n"
+  "                  options which can be changed without disconnecting\n"
+  "                  clients, rather than restarting.\n"
+#endif
   "--tmp-dir dir   : Temporary directory, used for --client-connect return file.\n"
   "--hash-size r v : Set the size of the real address hash table to r and the\n"
   "                  virtual address table to v.\n"
   "--bcast-buffers n : Allocate n broadcast buffers.\n"
   "--tcp-queue-limit n : Maximum number of queued TCP output packets.\n"
+  "--client-shaper out [in] : Limit output to each client to out bytes per\n"
+  "                  second, and input from each client to in bytes per\n"
+  "                  second (0 = unlimited).  May be used in a\n"
+  "                  --client-config-dir file to set limits for one client.\n"
+  "--client-shaper-total n : Limit total output to all clients to n bytes\n"
+  "                  per second.\n"
   "--learn-address cmd : Run script cmd to validate client virtual addresses.\n"
+#ifdef ENABLE_ASYNC_SCRIPT
+  "--script-async n [t] : Don't block while running --client-connect,\n"
+  "                  --client-disconnect and --auth-user-pass-verify scripts.\n"
+  "                  Run at most n scripts at once, and kill scripts which\n"
+  "                  are still running after t seconds (default=60).\n"
+#endif
   "--connect-freq n s : Allow a maximum of n new connections per s seconds.\n"
   "--max-clients n : Allow a maximum of n simultaneously connected clients.\n"
   "--max-routes-per-client n : Allow a maximum of n internal routes per client.\n"
@@ -577,6 +619,12 @@ init_options (struct options *o)
   o->max_clients = 1024;
   o->max_routes_per_client = 256;
   o->ifconfig_pool_persist_refresh_freq = 600;
+#ifdef ENABLE_HANDOFF
+  o->handoff_fd = -1;
+#endif
+#ifdef ENABLE_ASYNC_SCRIPT
+  o->script_async_timeout = SCRIPT_ASYNC_TIMEOUT_DEFAULT;
+#endif
 #endif
 #if P2MP
   o->scheduled_exit_interval = 5;
@@ -796,18 +844,38 @@ show_p2mp_parms (const struct options *o)
   SHOW_BOOL (ifconfig_pool_linear);
   SHOW_INT (n_bcast_buf);
   SHOW_INT (tcp_queue_limit);
+  SHOW_INT (client_shaper_out);
+  SHOW_INT (client_shaper_in);
+  SHOW_INT (client_shaper_total);
+  SHOW_BOOL (client_filter_drop);
   SHOW_INT (real_hash_size);
   SHOW_INT (virtual_hash_size);
   SHOW_STR (client_connect_script);
+  SHOW_INT (script_async_max);
+  SHOW_INT (script_async_timeout);
   SHOW_STR (learn_address_script);
   SHOW_STR (client_disconnect_script);
   SHOW_STR (client_config_dir);
   SHOW_BOOL (ccd_exclusive);
+  SHOW_INT (ccd_cache_max);
+  SHOW_INT (ccd_cache_refresh);
+#ifdef ENABLE_MSTATS
+  SHOW_STR (status_mmap_file);
+#endif
+#ifdef ENABLE_HANDOFF
+  SHOW_BOOL (handoff);
+  SHOW_INT (handoff_fd);
+#endif
+#ifdef ENABLE_RELOAD
+  SHOW_BOOL (reload_on_hup);
+#endif
   SHOW_STR (tmp_dir);
   SHOW_BOOL (push_ifconfig_defined);
   msg (D_SHOW_PARMS, "  push_ifconfig_local = %s", print_in_addr_t (o->push_ifconfig_local, 0, &gc));
   msg (D_SHOW_PARMS, "  push_ifconfig_remote_netmask = %s", print_in_addr_t (o->push_ifconfig_remote_netmask, 0, &gc));
   SHOW_BOOL (enable_c2c);
+  SHOW_BOOL (igmp_snooping);
+  SHOW_BOOL (proxy_arp);
   SHOW_BOOL (duplicate_cn);
   SHOW_INT (cf_max);
   SHOW_INT (cf_per);
@@ -904,15 +972,137 @@ options_detach (struct options *o)
   gc_detach (&o->gc);
   o->routes = NULL;
 #if P2MP_SERVER
-  if (o->push_list) /* clone push_list */
+  if (o->push_list) /* clone push_list, sharing its contents until modified */
     {
       const struct push_list *old = o->push_list;
       ALLOC_OBJ_GC (o->push_list, struct push_list, &o->gc);
-      strcpy (o->push_list->options, old->options);
+      *o->push_list = *old;
+      o->push_list->shared = true;
     }
 #endif
 }
 
+#ifdef ENABLE_RELOAD
+
+/*
+ * Options which multi_reload applies in place.  A
+ * change to any other option needs a restart.
+ */
+static const char *reloadable_options[] = {
+  "config",
+  "push",
+  "client-config-dir",
+  "ccd-exclusive",
+  "ccd-cache",
+  "crl-verify",
+  "max-clients",
+  "connect-freq",
+  "tcp-queue-limit",
+  "max-routes-per-client",
+  "verb",
+  "mute",
+  "status",
+  "status-version",
+  "reload-on-hup",
+  NULL
+};
+
+static bool
+option_reloadable (const char *name)
+{
+  int i;
+  for (i = 0; reloadable_options[i]; ++i)
+    if (streq (name, reloadable_options[i]))
+      return true;
+  return false;
+}
+
+static bool
+option_recorded (const struct option_record *list, const char *line)
+{
+  for (; list; list = list->next)
+    if (streq (list->line, line))
+      return true;
+  return false;
+}
+
+/*
+ * Is there a record for option name in list, up to
+ * but not including end, which is not in other?
+ */
+static bool
+option_changed_before (const struct option_record *list,
+		       const struct option_record *other,
+		       const struct option_record *end,
+		       const char *name)
+{
+  for (; list && list != end; list = list->next)
+    if (streq (list->name, name) && !option_recorded (other, list->line))
+      return true;
+  return false;
+}
+
+/*
+ * Compare options re-read by a server reload (n)
+ * against the running options (o), and warn about
+ * each option which cannot be changed without a
+ * restart.  Every option given on the command line
+ * or in a config file is compared, except those
+ * multi_reload can apply.  Returns the number of
+ * options which need a restart.
+ */
+int
+options_restart_needed (const struct options *o,
+			const struct options *n,
+			const struct frame *frame,
+			struct tuntap *tt)
+{
+  const struct option_record *r;
+  int count = 0;
+
+#define RELOAD_CHECK(changed, name) \
+  if (changed) { \
+    msg (M_WARN, "RELOAD: --%s has changed, a restart is needed to apply it", name); \
+    ++count; \
+  }
+
+  /* options removed or changed */
+  for (r = o->option_records; r; r = r->next)
+    RELOAD_CHECK (!option_reloadable (r->name)
+		  && !option_recorded (n->option_records, r->line)
+		  && !option_changed_before (o->option_records, n->option_records, r, r->name),
+		  r->name);
+
+  /* options added */
+  for (r = n->option_records; r; r = r->next)
+    RELOAD_CHECK (!option_reloadable (r->name)
+		  && !option_recorded (o->option_records, r->line)
+		  && !option_changed_before (o->option_records, n->option_records, NULL, r->name)
+		  && !option_changed_before (n->option_records, o->option_records, r, r->name),
+		  r->name);
+
+  /* --status interval and version can be changed, but not the file */
+  RELOAD_CHECK (string_changed (o->status_file, n->status_file), "status");
+
+#ifdef ENABLE_OCC
+  /* catch anything else which would change what we tell our peers */
+  if (!count)
+    {
+      struct gc_arena gc = gc_new ();
+      RELOAD_CHECK (strcmp (options_string (o, frame, tt, false, &gc),
+			    options_string (n, frame, tt, false, &gc)),
+		    "[options string]");
+      gc_free (&gc);
+    }
+#endif
+
+#undef RELOAD_CHECK
+
+  return count;
+}
+
+#endif
+
 void
 rol_check_alloc (struct options *options)
 {
@@ -1029,6 +1219,7 @@ show_settings (const struct options *o)
   SHOW_INT (nice);
   SHOW_INT (verbosity);
   SHOW_INT (mute);
+  SHOW_INT (log_buffer);
 #ifdef ENABLE_DEBUG
   SHOW_INT (gremlin);
 #endif
@@ -1250,6 +1441,11 @@ options_postprocess (struct options *options, bool first_time)
   if (options->inetd == INETD_NOWAIT && dev != DEV_TYPE_TAP)
     msg (M_USAGE, "--inetd nowait only makes sense in --dev tap mode");
 
+#if P2MP_SERVER
+  if (options->proxy_arp && dev != DEV_TYPE_TAP)
+    msg (M_USAGE, "--proxy-arp only makes sense in --dev tap mode");
+#endif
+
   /*
    * In forking TCP server mode, you don't need to ifconfig
    * the tap device (the assumption is that it will be bridged).
@@ -1481,8 +1677,18 @@ options_postprocess (struct options *options, bool first_time)
 	msg (M_USAGE, "--auth-user-pass cannot be used with --mode server (it should be used on the client side only)");
       if (options->ccd_exclusive && !options->client_config_dir)
 	msg (M_USAGE, "--ccd-exclusive must be used with --client-config-dir");
+      if (options->ccd_cache_max && !options->client_config_dir)
+	msg (M_USAGE, "--ccd-cache must be used with --client-config-dir");
       if (options->key_method != 2)
 	msg (M_USAGE, "--mode server requires --key-method 2");
+#ifdef ENABLE_HANDOFF
+      if ((options->handoff || options->handoff_fd >= 0) && options->proto != PROTO_UDPv4)
+	msg (M_USAGE, "--handoff only works with --mode server --proto udp");
+      if (options->handoff && options->chroot_dir)
+	msg (M_USAGE, "--handoff cannot be used with --chroot");
+      if (options->handoff && (options->username || options->groupname))
+	msg (M_USAGE, "--handoff cannot be used with --user or --group");
+#endif
 
       if (PLUGIN_OPTION_LIST (options) == NULL)
 	{
@@ -1509,12 +1715,34 @@ options_postprocess (struct options *options, bool first_time)
 	msg (M_USAGE, "--client-connect requires --mode server");
       if (options->client_disconnect_script)
 	msg (M_USAGE, "--client-disconnect requires --mode server");
+      if (options->script_async_max)
+	msg (M_USAGE, "--script-async requires --mode server");
       if (options->tmp_dir)
 	msg (M_USAGE, "--tmp-dir requires --mode server");
       if (options->client_config_dir || options->ccd_exclusive)
 	msg (M_USAGE, "--client-config-dir/--ccd-exclusive requires --mode server");
+      if (options->ccd_cache_max)
+	msg (M_USAGE, "--ccd-cache requires --mode server");
+#ifdef ENABLE_MSTATS
+      if (options->status_mmap_file)
+	msg (M_USAGE, "--status-mmap requires --mode server");
+#endif
       if (options->enable_c2c)
 	msg (M_USAGE, "--client-to-client requires --mode server");
+      if (options->igmp_snooping)
+	msg (M_USAGE, "--igmp-snooping requires --mode server");
+      if (options->proxy_arp)
+	msg (M_USAGE, "--proxy-arp requires --mode server");
+      if (options->client_filter || options->client_filter_drop)
+	msg (M_USAGE, "--client-filter requires --mode server");
+#ifdef ENABLE_HANDOFF
+      if (options->handoff || options->handoff_fd >= 0)
+	msg (M_USAGE, "--handoff requires --mode server");
+#endif
+#ifdef ENABLE_RELOAD
+      if (options->reload_on_hup)
+	msg (M_USAGE, "--reload-on-hup requires --mode server");
+#endif
       if (options->duplicate_cn)
 	msg (M_USAGE, "--duplicate-cn requires --mode server");
       if (options->cf_max || options->cf_per)
@@ -1723,6 +1951,7 @@ pre_pull_restore (struct options *o)
 
       o->foreign_option_index = pp->foreign_option_index;
     }
+  o->use_peer_id = false;
 }
 
 #endif
@@ -2250,6 +2479,19 @@ string_defined_equal (const char *s1, const char *s2)
     return false;
 }
 
+/*
+ * Like !string_defined_equal, but two undefined
+ * strings are considered equal.
+ */
+bool
+string_changed (const char *s1, const char *s2)
+{
+  if (s1 && s2)
+    return strcmp (s1, s2) != 0;
+  else
+    return s1 != s2;
+}
+
 #if 0
 static void
 ping_rec_err (int msglevel)
@@ -2417,6 +2659,35 @@ add_option (struct options *options,
 	    unsigned int *option_types_found,
 	    struct env_set *es);
 
+#ifdef ENABLE_RELOAD
+
+/*
+ * Remember option p as it was given, see
+ * options_restart_needed.
+ */
+static void
+option_record (struct options *options, char *p[])
+{
+  struct option_record *r;
+  struct buffer line;
+  size_t len = 0;
+  int i;
+
+  for (i = 0; i < MAX_PARMS && p[i]; ++i)
+    len += strlen (p[i]) + 1;
+  line = alloc_buf_gc (len, &options->gc);
+  for (i = 0; i < MAX_PARMS && p[i]; ++i)
+    buf_printf (&line, i ? " %s" : "%s", p[i]);
+
+  ALLOC_OBJ_GC (r, struct option_record, &options->gc);
+  r->name = string_alloc (p[0], &options->gc);
+  r->line = BSTR (&line);
+  r->next = options->option_records;
+  options->option_records = r;
+}
+
+#endif
+
 static void
 read_config_file (struct options *options,
 		  const char *file,
@@ -2449,6 +2720,9 @@ read_config_file (struct options *options,
 		{
 		  if (strlen (p[0]) >= 3 && !strncmp (p[0], "--", 2))
 		    p[0] += 2;
+#ifdef ENABLE_RELOAD
+		  option_record (options, p);
+#endif
 		  add_option (options, 0, p, file, line_num, level, msglevel, permission_mask, option_types_found, es);
 		}
 	    }
@@ -2487,6 +2761,9 @@ parse_argv (struct options *options,
       CLEAR (p);
       p[0] = "config";
       p[1] = argv[1];
+#ifdef ENABLE_RELOAD
+      option_record (options, p);
+#endif
       add_option (options, 0, p, NULL, 0, 0, msglevel, permission_mask, option_types_found, es);
     }
   else
@@ -2515,6 +2792,9 @@ parse_argv (struct options *options,
 		    break;
 		}
 	    }
+#ifdef ENABLE_RELOAD
+	  option_record (options, p);
+#endif
 	  i = add_option (options, i, p, NULL, 0, 0, msglevel, permission_mask, option_types_found, es);
 	}
     }
@@ -2565,6 +2845,35 @@ options_server_import (struct options *o,
 		    es);
 }
 
+/*
+ * Like options_server_import, but for a file which has
+ * already been read and tokenized, such as one held in
+ * the --ccd-cache.  The parameters are copied into the
+ * options gc, since lines may be freed while o is in use.
+ */
+void
+options_server_import_lines (struct options *o,
+			     const char *filename,
+			     const struct option_line *lines,
+			     const int n_lines,
+			     int msglevel,
+			     unsigned int permission_mask,
+			     unsigned int *option_types_found,
+			     struct env_set *es)
+{
+  int i, j;
+
+  msg (D_PUSH, "OPTIONS IMPORT: reading client specific options from: %s (cached)", filename);
+  for (i = 0; i < n_lines; ++i)
+    {
+      char *p[MAX_PARMS];
+      CLEAR (p);
+      for (j = 0; j < MAX_PARMS && lines[i].p[j]; ++j)
+	p[j] = string_alloc (lines[i].p[j], &o->gc);
+      add_option (o, 0, p, filename, lines[i].line_num, 1, msglevel, permission_mask, option_types_found, es);
+    }
+}
+
 #if P2MP
 
 #define VERIFY_PERMISSION(mask) { if (!verify_permission(p[0], (mask), permission_mask, option_types_found, msglevel)) goto err; }
@@ -3076,6 +3385,12 @@ add_option (struct options *options,
       VERIFY_PERMISSION (OPT_P_MESSAGES);
       options->mute = positive_atoi (p[1]);
     }
+  else if (streq (p[0], "log-buffer") && p[1])
+    {
+      ++i;
+      VERIFY_PERMISSION (OPT_P_GENERAL);
+      options->log_buffer = positive_atoi (p[1]);
+    }
   else if (streq (p[0], "status") && p[1])
     {
       ++i;
@@ -3804,6 +4119,28 @@ add_option (struct options *options,
 	goto err;
       options->learn_address_script = p[1];
     }
+#ifdef ENABLE_ASYNC_SCRIPT
+  else if (streq (p[0], "script-async") && p[1])
+    {
+      int max_running, timeout = SCRIPT_ASYNC_TIMEOUT_DEFAULT;
+
+      ++i;
+      if (p[2])
+	{
+	  ++i;
+	  timeout = atoi (p[2]);
+	}
+      VERIFY_PERMISSION (OPT_P_GENERAL);
+      max_running = atoi (p[1]);
+      if (max_running < 1 || timeout < 1)
+	{
+	  msg (msglevel, "--script-async parameters must be > 0");
+	  goto err;
+	}
+      options->script_async_max = max_running;
+      options->script_async_timeout = timeout;
+    }
+#endif
   else if (streq (p[0], "tmp-dir") && p[1])
     {
       ++i;
@@ -3821,6 +4158,59 @@ add_option (struct options *options,
       VERIFY_PERMISSION (OPT_P_GENERAL);
       options->ccd_exclusive = true;
     }
+  else if (streq (p[0], "ccd-cache") && p[1])
+    {
+      int max, refresh = 0;
+
+      ++i;
+      VERIFY_PERMISSION (OPT_P_GENERAL);
+      max = atoi (p[1]);
+      if (p[2])
+	{
+	  ++i;
+	  refresh = atoi (p[2]);
+	}
+      if (max < 1 || refresh < 0)
+	{
+	  msg (msglevel, "--ccd-cache parameters are out of range");
+	  goto err;
+	}
+      options->ccd_cache_max = max;
+      options->ccd_cache_refresh = refresh;
+    }
+#ifdef ENABLE_MSTATS
+  else if (streq (p[0], "status-mmap") && p[1])
+    {
+      ++i;
+      VERIFY_PERMISSION (OPT_P_GENERAL);
+      options->status_mmap_file = p[1];
+    }
+#endif
+#ifdef ENABLE_HANDOFF
+  else if (streq (p[0], "handoff"))
+    {
+      VERIFY_PERMISSION (OPT_P_GENERAL);
+      options->handoff = true;
+    }
+  else if (streq (p[0], "handoff-fd") && p[1])
+    {
+      ++i;
+      VERIFY_PERMISSION (OPT_P_GENERAL);
+      options->handoff_fd = atoi (p[1]);
+      if (options->handoff_fd < 0)
+	{
+	  msg (msglevel, "--handoff-fd must be a file descriptor number");
+	  goto err;
+	}
+    }
+#endif
+#ifdef ENABLE_RELOAD
+  else if (streq (p[0], "reload-on-hup"))
+    {
+      VERIFY_PERMISSION (OPT_P_GENERAL);
+      options->reload_on_hup = true;
+    }
+#endif
   else if (streq (p[0], "bcast-buffers") && p[1])
     {
       int n_bcast_buf;
@@ -3843,11 +4233,58 @@ add_option (struct options *options,
 	msg (msglevel, "--tcp-queue-limit parameter must be > 0");
       options->tcp_queue_limit = tcp_queue_limit;
     }
+  else if (streq (p[0], "client-shaper") && p[1])
+    {
+      int out, in = 0;
+
+      ++i;
+      VERIFY_PERMISSION (OPT_P_GENERAL|OPT_P_INSTANCE);
+      out = atoi (p[1]);
+      if (p[2])
+	{
+	  ++i;
+	  in = atoi (p[2]);
+	}
+      if ((out && (out < SHAPER_MIN || out > SHAPER_MAX))
+	  || (in && (in < SHAPER_MIN || in > SHAPER_MAX)))
+	{
+	  msg (msglevel, "Bad --client-shaper value, must be 0 or between %d and %d",
+	       SHAPER_MIN, SHAPER_MAX);
+	  goto err;
+	}
+      options->client_shaper_out = out;
+      options->client_shaper_in = in;
+    }
+  else if (streq (p[0], "client-shaper-total") && p[1])
+    {
+      int total;
+
+      ++i;
+      VERIFY_PERMISSION (OPT_P_GENERAL);
+      total = atoi (p[1]);
+      if (total && (total < SHAPER_MIN || total > SHAPER_MAX))
+	{
+	  msg (msglevel, "Bad --client-shaper-total value, must be 0 or between %d and %d",
+	       SHAPER_MIN, SHAPER_MAX);
+	  goto err;
+	}
+      options->client_shaper_total = total;
+    }
   else if (streq (p[0], "client-to-client"))
     {
       VERIFY_PERMISSION (OPT_P_GENERAL);
       options->enable_c2c = true;
     }
+  else if (streq (p[0], "igmp-snooping"))
+    {
+      VERIFY_PERMISSION (OPT_P_GENERAL);
+      options->igmp_snooping = true;
+    }
+  else if (streq (p[0], "proxy-arp"))
+    {
+      VERIFY_PERMISSION (OPT_P_GENERAL);
+      options->proxy_arp = true;
+    }
   else if (streq (p[0], "duplicate-cn"))
     {
       VERIFY_PERMISSION (OPT_P_GENERAL);
@@ -3866,6 +4303,34 @@ add_option (struct options *options,
 	}
       option_iroute (options, p[1], netmask, msglevel);
     }
+  else if (streq (p[0], "client-filter") && p[1] && p[2] && p[3] && p[4])
+    {
+      struct pf_rule *r;
+
+      i += 4;
+      VERIFY_PERMISSION (OPT_P_GENERAL|OPT_P_INSTANCE);
+      if (p[5])
+	++i;
+      r = pf_rule_parse ((const char **) &p[1], &options->gc, msglevel);
+      if (!r)
+	goto err;
+      r->next = options->client_filter;
+      options->client_filter = r;
+    }
+  else if (streq (p[0], "client-filter-default") && p[1])
+    {
+      ++i;
+      VERIFY_PERMISSION (OPT_P_GENERAL|OPT_P_INSTANCE);
+      if (streq (p[1], "accept"))
+	options->client_filter_drop = false;
+      else if (streq (p[1], "drop"))
+	options->client_filter_drop = true;
+      else
+	{
+	  msg (msglevel, "--client-filter-default must be 'accept' or 'drop'");
+	  goto err;
+	}
+    }
   else if (streq (p[0], "ifconfig-push") && p[1] && p[2])
     {
       in_addr_t local, remote_netmask;
@@ -3903,6 +4368,19 @@ add_option (struct options *options,
       VERIFY_PERMISSION (OPT_P_GENERAL);
       options->pull = true;
     }
+  else if (streq (p[0], "push-continuation") && p[1])
+    {
+      ++i;
+      VERIFY_PERMISSION (OPT_P_PULL_MODE);
+      options->push_continuation = atoi (p[1]);
+    }
+  else if (streq (p[0], "peer-id") && p[1])
+    {
+      ++i;
+      VERIFY_PERMISSION (OPT_P_PEER_ID);
+      options->use_peer_id = true;
+      options->peer_id = atoi (p[1]);
+    }
   else if (streq (p[0], "auth-user-pass"))
     {
       VERIFY_PERMISSION (OPT_P_GENERAL);
@@ -59,11 +59,26 @@ extern const char title_string[];
 #if P2MP_SERVER
 /* parameters to be pushed to peer */
 
+/*
+ * Maximum length of a single PUSH_REPLY message.  Longer
+ * push lists are split into several messages.
+ */
 #define MAX_PUSH_LIST_LEN TLS_CHANNEL_BUF_SIZE /* This parm is related to PLAINTEXT_BUFFER_SIZE in ssl.h */
 
+struct push_reply_template;
+struct pf_rule;
+
 struct push_list {
-  /* newline delimited options, like config file */
-  char options[MAX_PUSH_LIST_LEN];
+  /* comma delimited options */
+  char *options;
+  int len;
+  int capacity;
+
+  /* options string belongs to the options object we were cloned from */
+  bool shared;
+
+  /* PUSH_REPLY messages built from options, or NULL */
+  const struct push_reply_template *tmpl;
 };
 #endif
 
@@ -81,6 +96,20 @@ struct options_pre_pull
 
 #endif
 
+#ifdef ENABLE_RELOAD
+/*
+ * An option as it was given on the command line or
+ * in a config file, kept so that a reload can tell
+ * which options have changed.
+ */
+struct option_record
+{
+  struct option_record *next;
+  const char *name;
+  const char *line;
+};
+#endif
+
 /* Command line options */
 struct options
 {
@@ -210,6 +239,7 @@ struct options
   int nice;
   int verbosity;
   int mute;
+  int log_buffer;
 
 #ifdef ENABLE_DEBUG
   int gremlin;
@@ -302,17 +332,39 @@ struct options
   const char *client_connect_script;
   const char *client_disconnect_script;
   const char *learn_address_script;
+  int script_async_max;
+  int script_async_timeout;
   const char *tmp_dir;
   const char *client_config_dir;
   bool ccd_exclusive;
+  int ccd_cache_max;
+  int ccd_cache_refresh;
+#ifdef ENABLE_MSTATS
+  const char *status_mmap_file;
+#endif
+#ifdef ENABLE_HANDOFF
+  bool handoff;
+  int handoff_fd;   /* set on the command line of the new server by --handoff */
+#endif
+#ifdef ENABLE_RELOAD
+  bool reload_on_hup;
+  struct option_record *option_records;
+#endif
   bool disable;
   int n_bcast_buf;
   int tcp_queue_limit;
+  int client_shaper_out;
+  int client_shaper_in;
+  int client_shaper_total;
   struct iroute *iroutes;
+  struct pf_rule *client_filter;
+  bool client_filter_drop;
   bool push_ifconfig_defined;
   in_addr_t push_ifconfig_local;
   in_addr_t push_ifconfig_remote_netmask;
   bool enable_c2c;
+  bool igmp_snooping;
+  bool proxy_arp;
   bool duplicate_cn;
   int cf_max;
   int cf_per;
@@ -327,6 +379,9 @@ struct options
 
   bool client;
   bool pull; /* client pull of config options from server */
+  int push_continuation; /* from last PUSH_REPLY, 2 = more messages follow */
+  bool use_peer_id;      /* server pushed a peer-id for P_DATA_V2 packets */
+  int peer_id;
   const char *auth_user_pass_file;
   struct options_pre_pull *pre_pull;
 
@@ -437,6 +492,8 @@ struct options
 #define OPT_P_EXPLICIT_NOTIFY (1<<19)
 #define OPT_P_ECHO            (1<<20)
 #define OPT_P_INHERIT         (1<<21)
+#define OPT_P_PULL_MODE       (1<<22)
+#define OPT_P_PEER_ID         (1<<23)
 
 #define OPT_P_DEFAULT   (~OPT_P_INSTANCE)
 
@@ -492,6 +549,7 @@ void setenv_settings (struct env_set *es, const struct options *o);
 void show_settings (const struct options *o);
 
 bool string_defined_equal (const char *s1, const char *s2);
+bool string_changed (const char *s1, const char *s2);
 
 #ifdef ENABLE_OCC
 
@@ -526,6 +584,13 @@ bool is_stateful_restart (const struct options *o);
 
 void options_detach (struct options *o);
 
+#ifdef ENABLE_RELOAD
+int options_restart_needed (const struct options *o,
+			    const struct options *n,
+			    const struct frame *frame,
+			    struct tuntap *tt);
+#endif
+
 void options_server_import (struct options *o,
 			    const char *filename,
 			    int msglevel,
@@ -533,6 +598,24 @@ void options_server_import (struct options *o,
 			    unsigned int *option_types_found,
 			    struct env_set *es);
 
+/*
+ * A config file line, as tokenized by parse_line
+ */
+struct option_line
+{
+  int line_num;
+  char *p[MAX_PARMS];
+};
+
+void options_server_import_lines (struct options *o,
+				  const char *filename,
+				  const struct option_line *lines,
+				  const int n_lines,
+				  int msglevel,
+				  unsigned int permission_mask,
+				  unsigned int *option_types_found,
+				  struct env_set *es);
+
 void pre_pull_default (struct options *o);
 
 void rol_check_alloc (struct options *options);
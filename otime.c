@@ -36,6 +36,39 @@
 
 volatile time_t now; /* GLOBAL */
 
+struct timeval now_tv; /* GLOBAL */
+
+/*
+ * Sample the high resolution clock into tv.
+ * Prefer a monotonic source so that timers are
+ * immune to wall clock adjustments.
+ */
+void
+tv_sample (struct timeval *tv)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+    {
+      tv->tv_sec = ts.tv_sec;
+      tv->tv_usec = ts.tv_nsec / 1000;
+      return;
+    }
+#endif
+#ifdef HAVE_GETTIMEOFDAY
+  if (!gettimeofday (tv, NULL))
+    return;
+#endif
+  tv->tv_sec = time (NULL);
+  tv->tv_usec = 0;
+}
+
+void
+update_now_tv (void)
+{
+  tv_sample (&now_tv);
+}
+
 /* 
  * Return a numerical string describing a struct timeval.
  */
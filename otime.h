@@ -64,6 +64,22 @@ update_time (void)
     now = real_time;
 }
 
+/*
+ * High resolution clock, sampled once per event loop
+ * iteration by update_now_tv().  It is monotonic where the
+ * OS supports it, so its tv_sec is NOT comparable to now
+ * and must only be used to measure or schedule intervals.
+ */
+extern struct timeval now_tv;
+
+void update_now_tv (void);
+
+/*
+ * Sample the same clock into tv without touching now_tv,
+ * for timing work done within one event loop pass.
+ */
+void tv_sample (struct timeval *tv);
+
 static inline void
 tv_clear (struct timeval *tv)
 {
@@ -187,6 +203,40 @@ tv_within_sigma (const struct timeval *t1, const struct timeval *t2, unsigned in
   return -(int)sigma <= delta && delta <= (int)sigma;
 }
 
+/*
+ * Cheap helpers for timers which are based on the
+ * cached now_tv clock.
+ */
+
+/* set dest to the time which is delta after now_tv */
+static inline void
+tv_future (struct timeval *dest, const struct timeval *delta)
+{
+  *dest = now_tv;
+  tv_add (dest, delta);
+}
+
+/* set dest to the time remaining until tv, or zero if tv has passed */
+static inline void
+tv_until (struct timeval *dest, const struct timeval *tv)
+{
+  tv_delta (dest, &now_tv, tv);
+}
+
+/* return usec elapsed from tv until now_tv, constrained by max_seconds */
+static inline int
+tv_elapsed_usec (const struct timeval *tv, const unsigned int max_seconds)
+{
+  return tv_subtract (&now_tv, tv, max_seconds);
+}
+
+/* has now_tv reached tv? */
+static inline bool
+tv_expired (const struct timeval *tv)
+{
+  return tv_ge (&now_tv, tv);
+}
+
 /*
  * Used to determine in how many seconds we should be
  * called again.
@@ -298,6 +298,42 @@ packet_id_net_print (const struct packet_id_net *pin, bool print_timestamp, stru
   return BSTR (&out);
 }
 
+/*
+ * Save/restore the send and receive sequence state of
+ * a packet_id, so that a live session can be handed over
+ * to another process.  As with --replay-persist, the
+ * backtrack window itself is not saved, so any packet
+ * at or below the highest id received is rejected by
+ * the restored object.
+ */
+bool
+packet_id_save (const struct packet_id *p, struct buffer *buf)
+{
+  return buf_write_u32 (buf, (int) p->send.id)
+    && buf_write_u32 (buf, (int) p->send.time)
+    && buf_write_u32 (buf, (int) p->rec.id)
+    && buf_write_u32 (buf, (int) p->rec.time);
+}
+
+bool
+packet_id_restore (struct packet_id *p, struct buffer *buf)
+{
+  uint32_t v[4];
+  int i;
+  for (i = 0; i < 4; ++i)
+    {
+      bool good;
+      v[i] = buf_read_u32 (buf, &good);
+      if (!good)
+	return false;
+    }
+  p->send.id = (packet_id_type) v[0];
+  p->send.time = (time_t) v[1];
+  p->rec.id = (packet_id_type) v[2];
+  p->rec.time = (time_t) v[3];
+  return true;
+}
+
 /* initialize the packet_id_persist structure in a disabled state */
 void
 packet_id_persist_init (struct packet_id_persist *p)
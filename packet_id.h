@@ -251,6 +251,13 @@ const char *packet_id_persist_print (const struct packet_id_persist *p, struct g
 bool packet_id_read (struct packet_id_net *pin, struct buffer *buf, bool long_form);
 bool packet_id_write (const struct packet_id_net *pin, struct buffer *buf, bool long_form, bool prepend);
 
+/*
+ * Save/restore packet_id send and receive state (--handoff).
+ */
+
+bool packet_id_save (const struct packet_id *p, struct buffer *buf);
+bool packet_id_restore (struct packet_id *p, struct buffer *buf);
+
 /*
  * Inline functions.
  */
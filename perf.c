@@ -56,6 +56,7 @@ static const char *metric_names[] = {
   "PERF_MULTI_SHOW_STATS",
   "PERF_MULTI_BCAST",
   "PERF_MULTI_MCAST",
+  "PERF_MULTI_C2C_DIRECT",
   "PERF_SCRIPT",
   "PERF_READ_IN_LINK",
   "PERF_PROC_IN_LINK",
@@ -66,234 +67,334 @@ static const char *metric_names[] = {
   "PERF_PROC_OUT_TUN_MTCP"
 };
 
-struct perf
+/*
+ * Stage timings are measured in ticks of the CPU time stamp
+ * counter where available, otherwise in microseconds.  Ticks
+ * are converted to microseconds only when results are shown,
+ * by comparing the tick count to gettimeofday over the
+ * lifetime of the process.
+ */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define PERF_TSC
+
+static inline uint64_t
+perf_ticks (void)
 {
-# define PS_INITIAL            0
-# define PS_METER_RUNNING      1
-# define PS_METER_INTERRUPTED  2
-  int state;
+  unsigned int lo, hi;
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
 
-  struct timeval start;
-  double sofar;
-  double sum;
-  double max;
-  double count;
-};
+#else
 
-struct perf_set
+static inline uint64_t
+perf_ticks (void)
 {
-  int stack_len;
-  int stack[STACK_N];
-  struct perf perf[PERF_N];
-};
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
 
-static struct perf_set perf_set;
+#endif
 
-static void perf_print_state (int lev);
+/*
+ * Latency histogram with logarithmic buckets: each power
+ * of 2 is split into 2^PERF_HIST_SUB_BITS buckets, which
+ * bounds the error of a percentile estimate to 25%.
+ */
+#define PERF_HIST_SUB_BITS 2
+#define PERF_HIST_SUB      (1 << PERF_HIST_SUB_BITS)
+#define PERF_HIST_N        (64 << PERF_HIST_SUB_BITS)
 
 static inline int
-get_stack_index (int sdelta)
+perf_msb (uint64_t t)
 {
-  const int sindex = perf_set.stack_len + sdelta;
-  if (sindex >= 0 && sindex < STACK_N)
-    return sindex;
-  else
-    return -1;
+#if defined(__GNUC__)
+  return 63 - __builtin_clzll (t);
+#else
+  int msb = 0;
+  while (t >>= 1)
+    ++msb;
+  return msb;
+#endif
 }
 
-static int
-get_perf_index (int sdelta)
+static inline int
+perf_hist_bucket (const uint64_t t)
 {
-  const int sindex = get_stack_index (sdelta);
-  if (sindex >= 0)
+  if (t < PERF_HIST_SUB)
+    return (int) t;
+  else
     {
-      const int pindex = perf_set.stack[sindex];
-      if (pindex >= 0 && pindex < PERF_N)
-	return pindex;
-      else
-	return -1;
+      const int msb = perf_msb (t);
+      return ((msb - PERF_HIST_SUB_BITS + 1) << PERF_HIST_SUB_BITS)
+	| (int) ((t >> (msb - PERF_HIST_SUB_BITS)) & (PERF_HIST_SUB - 1));
     }
-  else
-    return -1;
 }
 
-static struct perf *
-get_perf (int sdelta)
+/* largest value which falls into bucket i */
+static uint64_t
+perf_hist_bucket_max (const int i)
 {
-  const int pindex = get_perf_index (sdelta);
-  if (pindex >= 0)
-    return &perf_set.perf[pindex];
+  if (i < PERF_HIST_SUB)
+    return i;
   else
-    return NULL;
-}
-
-static void
-push_perf_index (int pindex)
-{
-  const int sindex = get_stack_index (0);
-  const int newlen = get_stack_index (1);
-  if (sindex >= 0 && newlen >= 0
-      && pindex >= 0 && pindex < PERF_N)
     {
-      int i;
-      for (i = 0; i < sindex; ++i)
-	if (perf_set.stack[i] == pindex)
-	  {
-	    perf_print_state (M_INFO);
-	    msg (M_FATAL, "PERF: push_perf_index %s failed",
-		 metric_names [pindex]); 
-	  }
-
-      perf_set.stack[sindex] = pindex;
-      perf_set.stack_len = newlen;
+      const int shift = (i >> PERF_HIST_SUB_BITS) - 1;
+      const uint64_t low = (uint64_t) (PERF_HIST_SUB | (i & (PERF_HIST_SUB - 1))) << shift;
+      return low + ((uint64_t) 1 << shift) - 1;
     }
-  else
-    msg (M_FATAL, "PERF: push_perf_index: stack push error"); 
 }
 
-static void
-pop_perf_index (void)
+struct perf
 {
-  const int newlen = get_stack_index (-1);
-  if (newlen >= 0)
-    {
-      perf_set.stack_len = newlen;
-    }
-  else
-    msg (M_FATAL, "PERF: pop_perf_index: stack pop error"); 
-}
+# define PS_INITIAL            0
+# define PS_METER_RUNNING      1
+# define PS_METER_INTERRUPTED  2
+  int state;
 
-static void
-state_must_be (const struct perf *p, const int wanted)
+  uint64_t start;
+  uint64_t sofar;
+  uint64_t sum;
+  uint64_t max;
+  counter_type count;
+  counter_type hist[PERF_HIST_N];
+};
+
+/*
+ * One perf_set per thread of execution.  The server
+ * runs its event loop in a single thread, so a static
+ * perf_set is sufficient.
+ */
+struct perf_set
 {
-  if (p->state != wanted)
-    msg (M_FATAL, "PERF: bad state actual=%d wanted=%d",
-	 p->state,
-	 wanted);
-}
+  int stack_len;
+  int stack[STACK_N];
+  struct perf perf[PERF_N];
+
+  /* for converting ticks to microseconds */
+  uint64_t ticks_base;
+  struct timeval tv_base;
+
+  /* push/pop calls did not match */
+  bool unbalanced;
+};
+
+static struct perf_set perf_set;
+
+static void perf_print_state (int lev);
 
+/*
+ * A push without a pop (or vice versa) is a bug in the
+ * caller, but the process should not die because of it.
+ * Report it once, and start again with an empty stack.
+ */
 static void
-update_sofar (struct perf *p)
+perf_unbalanced (const char *what)
 {
-  struct timeval current;
-  ASSERT (!gettimeofday (&current, NULL));
-  p->sofar += (double) tv_subtract (&current, &p->start, 600) / 1000000.0;
-  tv_clear (&p->start);
+  int i;
+  if (!perf_set.unbalanced)
+    {
+      perf_print_state (M_INFO);
+      msg (M_WARN, "PERF: %s, resetting stack", what);
+      perf_set.unbalanced = true;
+    }
+  for (i = 0; i < PERF_N; ++i)
+    perf_set.perf[i].state = PS_INITIAL;
+  perf_set.stack_len = 0;
 }
 
-static void
-perf_start (struct perf *p)
+static inline struct perf *
+get_perf (int sdelta)
 {
-  state_must_be (p, PS_INITIAL);
-  ASSERT (!gettimeofday (&p->start, NULL));
-  p->sofar = 0.0;
-  p->state = PS_METER_RUNNING;
+  const int sindex = perf_set.stack_len + sdelta;
+  if (sindex >= 0)
+    return &perf_set.perf[perf_set.stack[sindex]];
+  else
+    return NULL;
 }
 
-static void
-perf_stop (struct perf *p)
+static inline void
+perf_stop (struct perf *p, const uint64_t now_ticks)
 {
-  state_must_be (p, PS_METER_RUNNING);
-  update_sofar (p);
+  p->sofar += now_ticks - p->start;
   p->sum += p->sofar;
   if (p->sofar > p->max)
     p->max = p->sofar;
-  p->count += 1.0;
-  p->sofar = 0.0;
+  ++p->count;
+  ++p->hist[perf_hist_bucket (p->sofar)];
+  p->sofar = 0;
   p->state = PS_INITIAL;
 }
 
-static void
-perf_interrupt (struct perf *p)
-{
-  state_must_be (p, PS_METER_RUNNING);
-  update_sofar (p);
-  p->state = PS_METER_INTERRUPTED;
-}
-
-static void
-perf_resume (struct perf *p)
-{
-  state_must_be (p, PS_METER_INTERRUPTED);
-  ASSERT (!gettimeofday (&p->start, NULL));
-  p->state = PS_METER_RUNNING;
-}
-
 void
 perf_push (int type)
 {
+  const uint64_t t = perf_ticks ();
   struct perf *prev;
   struct perf *cur;
 
   ASSERT (SIZE(metric_names) == PERF_N);
-  push_perf_index (type);
+  ASSERT (type >= 0 && type < PERF_N);
 
-  prev = get_perf (-2);
-  cur = get_perf (-1);
+  if (!perf_set.tv_base.tv_sec)
+    {
+      gettimeofday (&perf_set.tv_base, NULL);
+      perf_set.ticks_base = t;
+    }
 
-  ASSERT (cur);
+  cur = &perf_set.perf[type];
+  if (cur->state != PS_INITIAL || perf_set.stack_len >= STACK_N)
+    {
+      perf_unbalanced (metric_names[type]);
+      cur = &perf_set.perf[type];
+    }
 
+  /* time spent in a nested stage is not counted by the outer stage */
+  prev = get_perf (-1);
   if (prev)
-    perf_interrupt (prev);
-  perf_start (cur);
+    {
+      prev->sofar += t - prev->start;
+      prev->state = PS_METER_INTERRUPTED;
+    }
+
+  perf_set.stack[perf_set.stack_len++] = type;
+  cur->start = t;
+  cur->sofar = 0;
+  cur->state = PS_METER_RUNNING;
 }
 
 void
 perf_pop (void)
 {
+  const uint64_t t = perf_ticks ();
   struct perf *prev;
   struct perf *cur;
 
-  prev = get_perf (-2);
   cur = get_perf (-1);
+  if (!cur || cur->state != PS_METER_RUNNING)
+    {
+      perf_unbalanced ("perf_pop without perf_push");
+      return;
+    }
+  perf_stop (cur, t);
+  --perf_set.stack_len;
 
-  ASSERT (cur);
-  perf_stop (cur);
-
+  prev = get_perf (-1);
   if (prev)
-    perf_resume (prev);
+    {
+      prev->start = t;
+      prev->state = PS_METER_RUNNING;
+    }
+}
+
+/*
+ * Ticks per microsecond, measured over the lifetime
+ * of the process.
+ */
+static double
+perf_ticks_per_usec (void)
+{
+#ifdef PERF_TSC
+  struct timeval tv;
+  const uint64_t t = perf_ticks ();
+  double usec;
+
+  gettimeofday (&tv, NULL);
+  usec = (double) (tv.tv_sec - perf_set.tv_base.tv_sec) * 1000000.0
+    + (double) (tv.tv_usec - perf_set.tv_base.tv_usec);
+  if (perf_set.tv_base.tv_sec && usec >= 1000.0)
+    return (double) (t - perf_set.ticks_base) / usec;
+#endif
+  return 1.0;
+}
 
-  pop_perf_index ();
+/* smallest value which is greater than or equal to a fraction q of the samples */
+static uint64_t
+perf_percentile (const struct perf *p, const double q)
+{
+  const counter_type want = (counter_type) ((double) p->count * q + 0.5);
+  counter_type sofar = 0;
+  int i;
+
+  for (i = 0; i < PERF_HIST_N; ++i)
+    {
+      sofar += p->hist[i];
+      if (sofar >= want && sofar)
+	{
+	  const uint64_t t = perf_hist_bucket_max (i);
+	  return t < p->max ? t : p->max;
+	}
+    }
+  return p->max;
 }
 
+/*
+ * Show per-stage latencies in microseconds, one
+ * comma-separated line per stage which has been used.
+ */
 void
-perf_output_results (void)
+perf_print (const int msglevel)
+{
+  const double tpu = perf_ticks_per_usec ();
+  int i;
+
+  msg (msglevel, "stage,n,mean,p50,p99,p999,max");
+  for (i = 0; i < PERF_N; ++i)
+    {
+      const struct perf *p = &perf_set.perf[i];
+      if (p->count)
+	msg (msglevel, "%s," counter_format ",%.3f,%.3f,%.3f,%.3f,%.3f",
+	     metric_names[i],
+	     p->count,
+	     (double) p->sum / (double) p->count / tpu,
+	     (double) perf_percentile (p, 0.50) / tpu,
+	     (double) perf_percentile (p, 0.99) / tpu,
+	     (double) perf_percentile (p, 0.999) / tpu,
+	     (double) p->max / tpu);
+    }
+}
+
+/*
+ * Clear accumulated results, without disturbing
+ * stages which are currently being timed.
+ */
+void
+perf_reset (void)
 {
   int i;
-  msg (M_INFO, "LATENCY PROFILE (mean and max are in milliseconds)");
   for (i = 0; i < PERF_N; ++i)
     {
       struct perf *p = &perf_set.perf[i];
-      if (p->count > 0.0)
-	{
-	  const double mean = p->sum / p->count;
-	  msg (M_INFO, "%s n=%.0f mean=%.3f max=%.3f", metric_names[i], p->count, mean*1000.0, p->max*1000.0);
-	}
+      p->sum = p->max = 0;
+      p->count = 0;
+      CLEAR (p->hist);
     }
 }
 
+void
+perf_output_results (void)
+{
+  msg (M_INFO, "LATENCY PROFILE (times are in microseconds)");
+  perf_print (M_INFO);
+}
+
 static void
 perf_print_state (int lev)
 {
-  struct gc_arena gc = gc_new ();
   int i;
   msg (lev, "PERF STATE");
   msg (lev, "Stack:");
-  for (i = 0; i < perf_set.stack_len; ++i)
+  for (i = 0; i < perf_set.stack_len && i < STACK_N; ++i)
     {
       const int j = perf_set.stack[i];
       const struct perf *p = &perf_set.perf[j];
-      msg (lev, "[%d] %s state=%d start=%s sofar=%f sum=%f max=%f count=%f",
+      msg (lev, "[%d] %s state=%d count=" counter_format,
 	   i,
 	   metric_names[j],
 	   p->state,
-	   tv_string (&p->start, &gc),
-	   p->sofar,
-	   p->sum,
-	   p->max,
 	   p->count);
     }
-  gc_free (&gc);
 }
 
 #else
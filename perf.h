@@ -31,7 +31,10 @@
 #ifndef PERF_H
 #define PERF_H
 
-/*#define ENABLE_PERFORMANCE_METRICS*/
+/*
+ * ENABLE_PERFORMANCE_METRICS is defined by configure
+ * (--disable-perf-metrics to turn it off).
+ */
 
 /*
  * Metrics
@@ -48,15 +51,16 @@
 #define PERF_MULTI_SHOW_STATS       9
 #define PERF_MULTI_BCAST            10
 #define PERF_MULTI_MCAST            11
-#define PERF_SCRIPT                 12
-#define PERF_READ_IN_LINK           13
-#define PERF_PROC_IN_LINK           14
-#define PERF_READ_IN_TUN            15
-#define PERF_PROC_IN_TUN            16
-#define PERF_PROC_OUT_LINK          17
-#define PERF_PROC_OUT_TUN           18
-#define PERF_PROC_OUT_TUN_MTCP      19
-#define PERF_N                      20
+#define PERF_MULTI_C2C_DIRECT       12
+#define PERF_SCRIPT                 13
+#define PERF_READ_IN_LINK           14
+#define PERF_PROC_IN_LINK           15
+#define PERF_READ_IN_TUN            16
+#define PERF_PROC_IN_TUN            17
+#define PERF_PROC_OUT_LINK          18
+#define PERF_PROC_OUT_TUN           19
+#define PERF_PROC_OUT_TUN_MTCP      20
+#define PERF_N                      21
 
 #ifdef ENABLE_PERFORMANCE_METRICS
 
@@ -71,11 +75,17 @@ void perf_push (int type);
 void perf_pop (void);
 void perf_output_results (void);
 
+/* show per-stage latency percentiles, in microseconds */
+void perf_print (const int msglevel);
+void perf_reset (void);
+
 #else
 
 static inline void perf_push (int type) {}
 static inline void perf_pop (void) {}
 static inline void perf_output_results (void) {}
+static inline void perf_print (const int msglevel) {}
+static inline void perf_reset (void) {}
 
 #endif
 
@@ -0,0 +1,529 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2005 OpenVPN Solutions LLC <info@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef WIN32
+#include "config-win32.h"
+#else
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#if P2MP_SERVER
+
+#include "pf.h"
+#include "proto.h"
+#include "socket.h"
+#include "error.h"
+
+#include "memdbg.h"
+
+static const char *
+pf_proto_name (const int proto)
+{
+  switch (proto)
+    {
+    case PF_TCP:
+      return "tcp";
+    case PF_UDP:
+      return "udp";
+    case PF_ICMP:
+      return "icmp";
+    case PF_ANY:
+      return "any";
+    default:
+      return "?";
+    }
+}
+
+static bool
+pf_parse_ports (const char *str, int *lo, int *hi)
+{
+  char *end;
+  long l, h;
+
+  l = h = strtol (str, &end, 10);
+  if (end != str && *end == '-')
+    {
+      const char *p = end + 1;
+      h = strtol (p, &end, 10);
+      if (end == p)
+	return false;
+    }
+  if (end == str || *end || l < 0 || h > 65535 || l > h)
+    return false;
+  *lo = (int) l;
+  *hi = (int) h;
+  return true;
+}
+
+struct pf_rule *
+pf_rule_parse (const char *p[], struct gc_arena *gc, const int msglevel)
+{
+  struct pf_rule *r;
+  bool ok1, ok2;
+  int proto;
+
+  if (!p[0] || !p[1] || !p[2] || !p[3])
+    {
+      msg (msglevel, "--client-filter requires action, protocol, network and netmask");
+      return NULL;
+    }
+
+  ALLOC_OBJ_CLEAR_GC (r, struct pf_rule, gc);
+
+  if (!strcmp (p[0], "accept"))
+    r->accept = true;
+  else if (strcmp (p[0], "drop"))
+    {
+      msg (msglevel, "--client-filter action must be 'accept' or 'drop'");
+      return NULL;
+    }
+
+  for (proto = 0; proto <= PF_ANY; ++proto)
+    if (proto != PF_OTHER && !strcmp (p[1], pf_proto_name (proto)))
+      break;
+  if (proto > PF_ANY)
+    {
+      msg (msglevel, "--client-filter protocol must be 'tcp', 'udp', 'icmp' or 'any'");
+      return NULL;
+    }
+  r->proto = proto;
+
+  r->network = getaddr (GETADDR_HOST_ORDER, p[2], 0, &ok1, NULL);
+  r->netmask = getaddr (GETADDR_HOST_ORDER, p[3], 0, &ok2, NULL);
+  if (!ok1 || !ok2 || ((~r->netmask + 1) & ~r->netmask))
+    {
+      msg (msglevel, "--client-filter %s %s : Bad network/netmask specification", p[2], p[3]);
+      return NULL;
+    }
+  r->network &= r->netmask;
+
+  r->port_lo = 0;
+  r->port_hi = 65535;
+  if (p[4])
+    {
+      if (proto != PF_TCP && proto != PF_UDP && proto != PF_ANY)
+	{
+	  msg (msglevel, "--client-filter port range is only valid with tcp, udp or any");
+	  return NULL;
+	}
+      if (!pf_parse_ports (p[4], &r->port_lo, &r->port_hi))
+	{
+	  msg (msglevel, "--client-filter %s : Bad port or port range", p[4]);
+	  return NULL;
+	}
+    }
+
+  return r;
+}
+
+/*
+ * Does rule r apply at all to protocol class proto?  A port
+ * restricted rule can only match TCP and UDP.
+ */
+static bool
+pf_rule_proto (const struct pf_rule *r, const int proto)
+{
+  if (r->proto == PF_ANY)
+    return (proto == PF_TCP || proto == PF_UDP)
+      || (r->port_lo == 0 && r->port_hi == 65535);
+  return r->proto == proto;
+}
+
+static int
+pf_cmp_uint32 (const void *a, const void *b)
+{
+  const uint32_t x = *(const uint32_t *) a;
+  const uint32_t y = *(const uint32_t *) b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * Sort and remove duplicates, returning new length.
+ */
+static int
+pf_sort_unique (uint32_t *v, const int n)
+{
+  int i, j = 0;
+  qsort (v, n, sizeof (uint32_t), pf_cmp_uint32);
+  for (i = 0; i < n; ++i)
+    if (!j || v[i] != v[j - 1])
+      v[j++] = v[i];
+  return j;
+}
+
+static void
+pf_table_build (struct pf_table *t, const struct pf_rule *rules, const int n_rules, const int proto)
+{
+  const int max_bounds = 2 * n_rules + 1;
+  uint32_t *abounds, *pbounds;
+  int *cand, *cover;
+  int n_cand = 0, n_abounds = 0;
+  int n_port = 0, max_port;
+  int i, j, k;
+
+  ALLOC_ARRAY (cand, int, n_rules + 1);
+  ALLOC_ARRAY (cover, int, n_rules + 1);
+  ALLOC_ARRAY (abounds, uint32_t, max_bounds);
+  ALLOC_ARRAY (pbounds, uint32_t, max_bounds);
+
+  /* elementary address intervals */
+  abounds[n_abounds++] = 0;
+  for (i = 0; i < n_rules; ++i)
+    {
+      const struct pf_rule *r = &rules[i];
+      if (pf_rule_proto (r, proto))
+	{
+	  const uint32_t hi = r->network | ~r->netmask;
+	  cand[n_cand++] = i;
+	  abounds[n_abounds++] = r->network;
+	  if (hi != 0xFFFFFFFF)
+	    abounds[n_abounds++] = hi + 1;
+	}
+    }
+  n_abounds = pf_sort_unique (abounds, n_abounds);
+
+  max_port = n_abounds * (2 * n_cand + 1);
+  ALLOC_ARRAY (t->addr, in_addr_t, n_abounds);
+  ALLOC_ARRAY (t->port_index, int, n_abounds + 1);
+  ALLOC_ARRAY (t->port, uint16_t, max_port);
+  ALLOC_ARRAY (t->rule, int16_t, max_port);
+  t->n_addr = 0;
+
+  for (i = 0; i < n_abounds; ++i)
+    {
+      const uint32_t a = abounds[i];
+      const int first = n_port;
+      int n_cover = 0, n_pbounds = 0;
+
+      /* rules which cover this address interval, in order */
+      for (j = 0; j < n_cand; ++j)
+	{
+	  const struct pf_rule *r = &rules[cand[j]];
+	  if ((a & r->netmask) == r->network)
+	    cover[n_cover++] = cand[j];
+	}
+
+      /* elementary port intervals */
+      pbounds[n_pbounds++] = 0;
+      for (j = 0; j < n_cover; ++j)
+	{
+	  const struct pf_rule *r = &rules[cover[j]];
+	  pbounds[n_pbounds++] = r->port_lo;
+	  if (r->port_hi < 65535)
+	    pbounds[n_pbounds++] = r->port_hi + 1;
+	}
+      n_pbounds = pf_sort_unique (pbounds, n_pbounds);
+
+      /* first matching rule for each port interval, merging neighbours */
+      for (j = 0; j < n_pbounds; ++j)
+	{
+	  const int p = (int) pbounds[j];
+	  int match = -1;
+
+	  for (k = 0; k < n_cover; ++k)
+	    {
+	      const struct pf_rule *r = &rules[cover[k]];
+	      if (p >= r->port_lo && p <= r->port_hi)
+		{
+		  match = cover[k];
+		  break;
+		}
+	    }
+	  if (n_port == first || t->rule[n_port - 1] != match)
+	    {
+	      t->port[n_port] = (uint16_t) p;
+	      t->rule[n_port] = (int16_t) match;
+	      ++n_port;
+	    }
+	}
+
+      /* merge with previous address interval if port table is identical */
+      if (t->n_addr)
+	{
+	  const int prev = t->port_index[t->n_addr - 1];
+	  if (first - prev == n_port - first
+	      && !memcmp (&t->port[prev], &t->port[first], (n_port - first) * sizeof (uint16_t))
+	      && !memcmp (&t->rule[prev], &t->rule[first], (n_port - first) * sizeof (int16_t)))
+	    {
+	      n_port = first;
+	      continue;
+	    }
+	}
+
+      t->addr[t->n_addr] = a;
+      t->port_index[t->n_addr] = first;
+      ++t->n_addr;
+    }
+  t->port_index[t->n_addr] = n_port;
+
+  /* give back what merging saved */
+  if (n_port < max_port)
+    {
+      uint16_t *port;
+      int16_t *rule;
+
+      ALLOC_ARRAY (port, uint16_t, n_port);
+      ALLOC_ARRAY (rule, int16_t, n_port);
+      memcpy (port, t->port, n_port * sizeof (uint16_t));
+      memcpy (rule, t->rule, n_port * sizeof (int16_t));
+      free (t->port);
+      free (t->rule);
+      t->port = port;
+      t->rule = rule;
+    }
+
+  free (cand);
+  free (cover);
+  free (abounds);
+  free (pbounds);
+}
+
+struct pf_filter *
+pf_compile (const struct pf_rule *rules, const bool default_accept)
+{
+  struct pf_filter *pf;
+  const struct pf_rule *r;
+  int n = 0, total, i;
+
+  for (r = rules; r; r = r->next)
+    ++n;
+  total = n;
+
+  if (!n && default_accept)
+    return NULL;
+
+  if (n > PF_MAX_RULES)
+    {
+      msg (M_WARN, "WARNING: only the first %d --client-filter rules will be used", PF_MAX_RULES);
+      n = PF_MAX_RULES;
+    }
+
+  ALLOC_OBJ_CLEAR (pf, struct pf_filter);
+  pf->n_rules = n;
+  pf->default_accept = default_accept;
+  ALLOC_ARRAY_CLEAR (pf->rules, struct pf_rule, max_int (n, 1));
+  ALLOC_ARRAY_CLEAR (pf->hits, counter_type, max_int (n, 1));
+
+  /* the list is in reverse order of parsing */
+  for (r = rules, i = total; r; r = r->next)
+    {
+      if (--i < n)
+	{
+	  pf->rules[i] = *r;
+	  pf->rules[i].next = NULL;
+	}
+    }
+
+  for (i = 0; i < PF_N_PROTO; ++i)
+    pf_table_build (&pf->table[i], pf->rules, n, i);
+
+  return pf;
+}
+
+void
+pf_free (struct pf_filter *pf)
+{
+  if (pf)
+    {
+      int i;
+      for (i = 0; i < PF_N_PROTO; ++i)
+	{
+	  free (pf->table[i].addr);
+	  free (pf->table[i].port_index);
+	  free (pf->table[i].port);
+	  free (pf->table[i].rule);
+	}
+      free (pf->rules);
+      free (pf->hits);
+      free (pf);
+    }
+}
+
+void
+pf_print (const struct pf_filter *pf, const char *prefix, const int msglevel)
+{
+  struct gc_arena gc = gc_new ();
+  int i;
+
+  for (i = 0; i < pf->n_rules; ++i)
+    {
+      const struct pf_rule *r = &pf->rules[i];
+      struct buffer out = alloc_buf_gc (128, &gc);
+
+      buf_printf (&out, "%s %s %s %s",
+		  r->accept ? "accept" : "drop",
+		  pf_proto_name (r->proto),
+		  print_in_addr_t (r->network, 0, &gc),
+		  print_in_addr_t (r->netmask, 0, &gc));
+      if (r->port_lo != 0 || r->port_hi != 65535)
+	{
+	  if (r->port_lo == r->port_hi)
+	    buf_printf (&out, " %d", r->port_lo);
+	  else
+	    buf_printf (&out, " %d-%d", r->port_lo, r->port_hi);
+	}
+      msg (msglevel, "%s%d,%s," counter_format, prefix, i + 1, BSTR (&out), pf->hits[i]);
+    }
+  msg (msglevel, "%sdefault,%s," counter_format, prefix,
+       pf->default_accept ? "accept" : "drop",
+       pf->default_hits);
+  gc_free (&gc);
+}
+
+bool
+pf_extract (struct pf_packet *pkt, const struct buffer *buf, const int dev_type)
+{
+  const uint8_t *p = BPTR (buf);
+  int n = BLEN (buf);
+  struct openvpn_iphdr ip;
+  int hlen;
+
+  pkt->proto = PF_UNPARSED;
+  pkt->src = pkt->dst = 0;
+  pkt->sport = pkt->dport = 0;
+  pkt->fragment = false;
+
+  if (dev_type == DEV_TYPE_TAP)
+    {
+      const struct openvpn_ethhdr *eth = (const struct openvpn_ethhdr *) p;
+      if (n < (int) sizeof (struct openvpn_ethhdr))
+	return true;
+      /* IPv4 doesn't work without ARP, which rules can't match */
+      if (eth->proto == htons (OPENVPN_ETH_P_ARP))
+	return false;
+      if (eth->proto != htons (OPENVPN_ETH_P_IPV4))
+	return true;
+      p += sizeof (struct openvpn_ethhdr);
+      n -= sizeof (struct openvpn_ethhdr);
+    }
+
+  /* header may be unaligned in tap mode */
+  if (n < (int) sizeof (struct openvpn_iphdr) || OPENVPN_IPH_GET_VER (*p) != 4)
+    return true;
+  memcpy (&ip, p, sizeof (ip));
+
+  hlen = OPENVPN_IPH_GET_LEN (ip.version_len);
+  pkt->src = ntohl (ip.saddr);
+  pkt->dst = ntohl (ip.daddr);
+  pkt->fragment = (ntohs (ip.frag_off) & OPENVPN_IP_OFFMASK) != 0;
+
+  switch (ip.protocol)
+    {
+    case OPENVPN_IPPROTO_TCP:
+      pkt->proto = PF_TCP;
+      break;
+    case OPENVPN_IPPROTO_UDP:
+      pkt->proto = PF_UDP;
+      break;
+    case OPENVPN_IPPROTO_ICMP:
+      pkt->proto = PF_ICMP;
+      return true;
+    default:
+      pkt->proto = PF_OTHER;
+      return true;
+    }
+
+  /* TCP and UDP ports are at the same offset */
+  if (!pkt->fragment && n >= hlen + 4)
+    {
+      pkt->sport = (p[hlen] << 8) | p[hlen + 1];
+      pkt->dport = (p[hlen + 2] << 8) | p[hlen + 3];
+    }
+  return true;
+}
+
+/*
+ * Return the index of the last element of v[0..n-1]
+ * which is <= key.  v[0] is always 0.
+ */
+#define PF_SEARCH(v, n, key, ret) \
+  { \
+    int lo_ = 0, hi_ = (n) - 1; \
+    while (lo_ < hi_) \
+      { \
+	const int mid_ = (lo_ + hi_ + 1) >> 1; \
+	if ((v)[mid_] <= (key)) \
+	  lo_ = mid_; \
+	else \
+	  hi_ = mid_ - 1; \
+      } \
+    (ret) = lo_; \
+  }
+
+/*
+ * The ports of a non-initial fragment are unknown, so only
+ * rules which don't restrict ports can match it, on address
+ * and protocol.  Fragments are rare, so just scan the rules.
+ */
+static int
+pf_test_fragment (const struct pf_filter *pf, const int proto, const in_addr_t addr)
+{
+  int i;
+  for (i = 0; i < pf->n_rules; ++i)
+    {
+      const struct pf_rule *r = &pf->rules[i];
+      if (r->port_lo == 0 && r->port_hi == 65535
+	  && pf_rule_proto (r, proto)
+	  && (addr & r->netmask) == r->network)
+	return i;
+    }
+  return -1;
+}
+
+bool
+pf_test (struct pf_filter *pf, const struct pf_packet *pkt, const bool to_client)
+{
+  const in_addr_t addr = to_client ? pkt->src : pkt->dst;
+  const int port = to_client ? pkt->sport : pkt->dport;
+  int a, i, r;
+
+  if (pkt->proto == PF_UNPARSED)
+    r = -1;
+  else if (pkt->fragment)
+    r = pf_test_fragment (pf, pkt->proto, addr);
+  else
+    {
+      const struct pf_table *t = &pf->table[pkt->proto];
+      PF_SEARCH (t->addr, t->n_addr, addr, a);
+      {
+	const int first = t->port_index[a];
+	PF_SEARCH (t->port + first, t->port_index[a + 1] - first, port, i);
+	r = t->rule[first + i];
+      }
+    }
+
+  if (r >= 0)
+    {
+      ++pf->hits[r];
+      return pf->rules[r].accept;
+    }
+  ++pf->default_hits;
+  return pf->default_accept;
+}
+
+#else
+static void dummy(void) {}
+#endif
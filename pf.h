@@ -0,0 +1,143 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2005 OpenVPN Solutions LLC <info@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef PF_H
+#define PF_H
+
+/*
+ * Per-client packet filter (--client-filter).
+ *
+ * Each rule matches the remote end of a client's traffic:
+ * the destination of packets sent by the client, or the
+ * source of packets delivered to it.  Rules are evaluated
+ * in order and the first match wins; if none matches,
+ * --client-filter-default applies.
+ *
+ * When a client connects, its rules are compiled, for each
+ * protocol, into a sorted table of disjoint address intervals,
+ * each pointing to a sorted table of disjoint port intervals
+ * which holds the first matching rule.  Filtering a packet
+ * is then two binary searches.
+ */
+
+#if P2MP_SERVER
+
+#include "basic.h"
+#include "common.h"
+#include "buffer.h"
+
+/* protocol classes, each compiled to its own table */
+#define PF_TCP     0
+#define PF_UDP     1
+#define PF_ICMP    2
+#define PF_OTHER   3
+#define PF_N_PROTO 4
+#define PF_ANY     4  /* rule only */
+#define PF_UNPARSED (-1) /* packet only: not IPv4, --client-filter-default applies */
+
+/* bounds compile time, which is cubic in the worst case */
+#define PF_MAX_RULES 256
+
+struct pf_rule
+{
+  struct pf_rule *next;
+  bool accept;
+  int proto;
+  in_addr_t network;  /* host byte order */
+  in_addr_t netmask;
+  int port_lo;        /* 0-65535 if not restricted */
+  int port_hi;
+};
+
+struct pf_table
+{
+  int n_addr;
+  in_addr_t *addr;    /* start of each address interval */
+  int *port_index;    /* port intervals of addr[i] are [port_index[i], port_index[i+1]) */
+  uint16_t *port;     /* start of each port interval */
+  int16_t *rule;      /* first matching rule, or -1 */
+};
+
+struct pf_filter
+{
+  int n_rules;
+  struct pf_rule *rules;
+  counter_type *hits;
+  bool default_accept;
+  counter_type default_hits;
+  struct pf_table table[PF_N_PROTO];
+};
+
+/*
+ * The fields of an IPv4 packet which rules match.
+ */
+struct pf_packet
+{
+  int proto;
+  in_addr_t src;  /* host byte order */
+  in_addr_t dst;
+  int sport;
+  int dport;
+  bool fragment;  /* non-initial fragment, ports unknown */
+};
+
+/*
+ * Parse "action proto network netmask [port[-port]]" from p
+ * (the parameters of a --client-filter option).  Returns
+ * NULL after logging at msglevel if there is an error.
+ */
+struct pf_rule *pf_rule_parse (const char *p[], struct gc_arena *gc, const int msglevel);
+
+/*
+ * Compile a list of rules, most recently parsed first.
+ * Returns NULL if nothing would ever be filtered.
+ */
+struct pf_filter *pf_compile (const struct pf_rule *rules, const bool default_accept);
+void pf_free (struct pf_filter *pf);
+
+void pf_print (const struct pf_filter *pf, const char *prefix, const int msglevel);
+
+/*
+ * Extract the fields rules match from a tun or tap packet.
+ * Packets which are not IPv4 get proto PF_UNPARSED.
+ * Returns false for packets which are not filtered,
+ * which are only ARP packets on a tap device.
+ */
+bool pf_extract (struct pf_packet *pkt, const struct buffer *buf, const int dev_type);
+
+/*
+ * Return true if pkt may be sent by the client (to_client false)
+ * or delivered to it (to_client true).
+ */
+bool pf_test (struct pf_filter *pf, const struct pf_packet *pkt, const bool to_client);
+
+static inline bool
+pf_filter_packet (struct pf_filter *pf, const struct buffer *buf, const int dev_type, const bool to_client)
+{
+  struct pf_packet pkt;
+  return !pf || !pf_extract (&pkt, buf, dev_type) || pf_test (pf, &pkt, to_client);
+}
+
+#endif
+#endif
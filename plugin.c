@@ -35,6 +35,8 @@
 #include "buffer.h"
 #include "error.h"
 #include "misc.h"
+#include "otime.h"
+#include "fdmisc.h"
 #include "plugin.h"
 
 #include "memdbg.h"
@@ -174,7 +176,8 @@ dll_resolve_symbol (HMODULE module, void **dest, const char *symbol, const char
 #endif
 
 static void
-plugin_init_item (struct plugin *p, const struct plugin_option *o, const char **envp)
+plugin_init_item (struct plugin *p, const struct plugin_option *o, const char **envp,
+		  const struct openvpn_plugin_callbacks *callbacks)
 {
   struct gc_arena gc = gc_new ();
   const char **argv = make_arg_array (o->so_pathname, o->args, &gc);
@@ -185,16 +188,20 @@ plugin_init_item (struct plugin *p, const struct plugin_option *o, const char **
   p->handle = dlopen (p->so_pathname, RTLD_NOW);
   if (!p->handle)
     msg (M_ERR, "PLUGIN_INIT: could not load plugin shared object %s: %s", p->so_pathname, dlerror());
-  libdl_resolve_symbol (p->handle, (void*)&p->open,  "openvpn_plugin_open_v1", p->so_pathname, PLUGIN_SYMBOL_REQUIRED);
-  libdl_resolve_symbol (p->handle, (void*)&p->func,  "openvpn_plugin_func_v1", p->so_pathname, PLUGIN_SYMBOL_REQUIRED);
+  libdl_resolve_symbol (p->handle, (void*)&p->open2, "openvpn_plugin_open_v2", p->so_pathname, 0);
+  libdl_resolve_symbol (p->handle, (void*)&p->func2, "openvpn_plugin_func_v2", p->so_pathname, 0);
+  libdl_resolve_symbol (p->handle, (void*)&p->open1, "openvpn_plugin_open_v1", p->so_pathname, p->open2 ? 0 : PLUGIN_SYMBOL_REQUIRED);
+  libdl_resolve_symbol (p->handle, (void*)&p->func1, "openvpn_plugin_func_v1", p->so_pathname, p->func2 ? 0 : PLUGIN_SYMBOL_REQUIRED);
   libdl_resolve_symbol (p->handle, (void*)&p->close, "openvpn_plugin_close_v1", p->so_pathname, PLUGIN_SYMBOL_REQUIRED);
   libdl_resolve_symbol (p->handle, (void*)&p->abort, "openvpn_plugin_abort_v1", p->so_pathname, 0);
 #elif defined(USE_LOAD_LIBRARY)
   p->module = LoadLibrary (p->so_pathname);
   if (!p->module)
     msg (M_ERR, "PLUGIN_INIT: could not load plugin DLL: %s", p->so_pathname);
-  dll_resolve_symbol (p->module, (void*)&p->open,  "openvpn_plugin_open_v1", p->so_pathname, PLUGIN_SYMBOL_REQUIRED);
-  dll_resolve_symbol (p->module, (void*)&p->func,  "openvpn_plugin_func_v1", p->so_pathname, PLUGIN_SYMBOL_REQUIRED);
+  dll_resolve_symbol (p->module, (void*)&p->open2, "openvpn_plugin_open_v2", p->so_pathname, 0);
+  dll_resolve_symbol (p->module, (void*)&p->func2, "openvpn_plugin_func_v2", p->so_pathname, 0);
+  dll_resolve_symbol (p->module, (void*)&p->open1, "openvpn_plugin_open_v1", p->so_pathname, p->open2 ? 0 : PLUGIN_SYMBOL_REQUIRED);
+  dll_resolve_symbol (p->module, (void*)&p->func1, "openvpn_plugin_func_v1", p->so_pathname, p->func2 ? 0 : PLUGIN_SYMBOL_REQUIRED);
   dll_resolve_symbol (p->module, (void*)&p->close, "openvpn_plugin_close_v1", p->so_pathname, PLUGIN_SYMBOL_REQUIRED);
   dll_resolve_symbol (p->module, (void*)&p->close, "openvpn_plugin_abort_v1", p->so_pathname, 0);
 #endif
@@ -205,7 +212,10 @@ plugin_init_item (struct plugin *p, const struct plugin_option *o, const char **
   /*
    * Call the plugin initialization
    */
-  p->plugin_handle = (*p->open)(&p->plugin_type_mask, argv, envp);
+  if (p->open2)
+    p->plugin_handle = (*p->open2)(&p->plugin_type_mask, argv, envp, callbacks);
+  else
+    p->plugin_handle = (*p->open1)(&p->plugin_type_mask, argv, envp);
 
   msg (D_PLUGIN, "PLUGIN_INIT: POST %s '%s' intercepted=%s",
        p->so_pathname,
@@ -226,7 +236,7 @@ plugin_init_item (struct plugin *p, const struct plugin_option *o, const char **
 }
 
 static int
-plugin_call_item (const struct plugin *p, const int type, const char *args, const char **envp)
+plugin_call_item (const struct plugin *p, const int type, const char *args, const char **envp, const unsigned int request_id)
 {
   int status = OPENVPN_PLUGIN_FUNC_SUCCESS;
 
@@ -241,14 +251,24 @@ plugin_call_item (const struct plugin *p, const int type, const char *args, cons
       /*
        * Call the plugin work function
        */
-      status = (*p->func)(p->plugin_handle, type, argv, envp);
+      if (p->func2)
+	status = (*p->func2)(p->plugin_handle, type, argv, envp, request_id);
+      else
+	status = (*p->func1)(p->plugin_handle, type, argv, envp);
 
       msg (D_PLUGIN, "PLUGIN_CALL: POST %s/%s status=%d",
 	   p->so_pathname,
 	   plugin_type_name (type),
 	   status);
 
-      if (status != OPENVPN_PLUGIN_FUNC_SUCCESS)
+      if (status == OPENVPN_PLUGIN_FUNC_DEFERRED && !request_id)
+	{
+	  msg (M_WARN, "PLUGIN_CALL: plugin function %s deferred a call which may not be deferred: %s",
+	       plugin_type_name (type),
+	       p->so_pathname);
+	  status = OPENVPN_PLUGIN_FUNC_ERROR;
+	}
+      else if (status != OPENVPN_PLUGIN_FUNC_SUCCESS && status != OPENVPN_PLUGIN_FUNC_DEFERRED)
 	msg (M_WARN, "PLUGIN_CALL: plugin function %s failed with status %d: %s",
 	     plugin_type_name (type),
 	     status,
@@ -259,6 +279,362 @@ plugin_call_item (const struct plugin *p, const int type, const char *args, cons
   return status;
 }
 
+/*
+ * Account for the outcome of a call to all plug-ins
+ * of a given type, which started at start.
+ */
+static void
+plugin_stats_update (const struct plugin_list *pl, const int type, const struct timeval *start, const bool failed)
+{
+  struct plugin_hook_stats *st = &pl->rs->stats[type];
+  struct timeval end;
+  int latency;
+
+  /* the event loop's now_tv must stay fixed for the whole pass */
+  tv_sample (&end);
+  latency = tv_subtract (&end, start, 600);
+
+  if (failed)
+    ++st->failed;
+  if (latency > 0)
+    {
+      st->latency_sum += latency;
+      if ((unsigned int)latency > st->latency_max)
+	st->latency_max = latency;
+    }
+}
+
+void
+plugin_print_stats (const struct plugin_list *pl, struct status_output *so, const char *prefix)
+{
+  if (pl)
+    {
+      int i;
+      for (i = 0; i < OPENVPN_PLUGIN_N; ++i)
+	{
+	  const struct plugin_hook_stats *st = &pl->rs->stats[i];
+	  if (st->calls)
+	    status_printf (so, "%s%s calls/deferred/failed/avg us/max us," counter_format "," counter_format "," counter_format "," counter_format ",%u",
+			   prefix,
+			   plugin_type_name (i),
+			   st->calls,
+			   st->deferred,
+			   st->failed,
+			   st->latency_sum / st->calls,
+			   st->latency_max);
+	}
+    }
+}
+
+#ifdef ENABLE_PLUGIN_DEFERRED
+
+/* write end of the completion pipe of the open plugin list */
+static int plugin_completion_fd = -1; /* GLOBAL */
+
+/*
+ * The complete callback given to plug-ins.  Called
+ * from plug-in threads, so it may touch nothing but
+ * the completion pipe.  A write of this size to a
+ * pipe is atomic.
+ */
+static void
+plugin_complete (const unsigned int request_id, const int status)
+{
+  const int fd = plugin_completion_fd;
+  if (fd >= 0)
+    {
+      struct openvpn_plugin_completion c;
+      c.request_id = request_id;
+      c.status = status;
+      while (write (fd, &c, sizeof (c)) < 0 && errno == EINTR)
+	;
+    }
+}
+
+static void
+plugin_deferred_init (struct plugin_run_state *rs)
+{
+  if (pipe (rs->fd))
+    {
+      msg (M_WARN | M_ERRNO, "PLUGIN_INIT: could not create completion pipe, deferred plugin calls disabled");
+      rs->fd[0] = rs->fd[1] = -1;
+      return;
+    }
+  set_nonblock (rs->fd[0]);
+  set_cloexec (rs->fd[0]);
+  set_cloexec (rs->fd[1]);
+  rs->next_id = 1;
+  rs->callbacks.complete = plugin_complete;
+  rs->callbacks.completion_fd = rs->fd[1];
+  plugin_completion_fd = rs->fd[1];
+}
+
+static void
+plugin_deferred_uninit (struct plugin_run_state *rs)
+{
+  int i;
+
+  plugin_completion_fd = -1;
+  if (rs->fd[0] >= 0)
+    {
+      close (rs->fd[0]);
+      close (rs->fd[1]);
+    }
+
+  /* requests still pending will never complete */
+  for (i = 0; i < PLUGIN_DEFERRED_HASH_SIZE; ++i)
+    {
+      while (rs->deferred[i])
+	plugin_request_cancel (rs->deferred[i]->req);
+    }
+}
+
+static inline struct plugin_deferred **
+plugin_deferred_bucket (struct plugin_run_state *rs, const unsigned int id)
+{
+  return &rs->deferred[id & (PLUGIN_DEFERRED_HASH_SIZE - 1)];
+}
+
+/*
+ * Allocate an id for a call which may be deferred, and
+ * register it before the call, in case the plug-in
+ * completes it before returning.
+ */
+static struct plugin_deferred *
+plugin_deferred_new (struct plugin_request *req)
+{
+  struct plugin_run_state *rs = req->pl->rs;
+  struct plugin_deferred **bucket;
+  struct plugin_deferred *d;
+
+  ALLOC_OBJ_CLEAR (d, struct plugin_deferred);
+  d->id = rs->next_id++;
+  if (!rs->next_id)
+    rs->next_id = 1;
+  d->req = req;
+
+  bucket = plugin_deferred_bucket (rs, d->id);
+  d->next = *bucket;
+  *bucket = d;
+  d->req_next = req->deferred;
+  req->deferred = d;
+  ++rs->n_deferred;
+  return d;
+}
+
+static void
+plugin_deferred_free (struct plugin_run_state *rs, struct plugin_deferred *d)
+{
+  struct plugin_deferred **pp;
+
+  for (pp = plugin_deferred_bucket (rs, d->id); *pp; pp = &(*pp)->next)
+    {
+      if (*pp == d)
+	{
+	  *pp = d->next;
+	  break;
+	}
+    }
+  for (pp = &d->req->deferred; *pp; pp = &(*pp)->req_next)
+    {
+      if (*pp == d)
+	{
+	  *pp = d->req_next;
+	  break;
+	}
+    }
+  --rs->n_deferred;
+  free (d);
+}
+
+int
+plugin_call_deferred (const struct plugin_list *pl,
+		      const int type,
+		      const char *args,
+		      struct env_set *es,
+		      struct plugin_request *req,
+		      void *owner)
+{
+  int ret = OPENVPN_PLUGIN_FUNC_SUCCESS;
+
+  CLEAR (*req);
+
+  if (plugin_defined (pl, type))
+    {
+      struct gc_arena gc = gc_new ();
+      bool failed = false;
+      int i;
+      const char **envp;
+
+      mutex_lock_static (L_PLUGIN);
+
+      req->pl = pl;
+      req->owner = owner;
+      req->type = type;
+
+      setenv_del (es, "script_type");
+      envp = make_env_array (es, &gc);
+
+      tv_sample (&req->start);
+      ++pl->rs->stats[type].calls;
+
+      for (i = 0; i < pl->n; ++i)
+	{
+	  struct plugin_deferred *d = NULL;
+	  int status;
+
+	  if (owner && pl->rs->fd[0] >= 0 && pl->plugins[i].func2)
+	    d = plugin_deferred_new (req);
+
+	  status = plugin_call_item (&pl->plugins[i], type, args, envp, d ? d->id : 0);
+
+	  if (status == OPENVPN_PLUGIN_FUNC_DEFERRED)
+	    ++req->n_pending;
+	  else
+	    {
+	      if (d)
+		plugin_deferred_free (pl->rs, d);
+	      if (status != OPENVPN_PLUGIN_FUNC_SUCCESS)
+		failed = true;
+	    }
+	}
+
+      mutex_unlock_static (L_PLUGIN);
+
+      if (failed)
+	{
+	  plugin_request_cancel (req);
+	  ret = OPENVPN_PLUGIN_FUNC_ERROR;
+	}
+      else if (req->n_pending)
+	{
+	  ++pl->rs->stats[type].deferred;
+	  ret = OPENVPN_PLUGIN_FUNC_DEFERRED;
+	}
+
+      if (ret != OPENVPN_PLUGIN_FUNC_DEFERRED)
+	{
+	  plugin_stats_update (pl, type, &req->start, failed);
+	  CLEAR (*req);
+	}
+
+      gc_free (&gc);
+    }
+
+  return ret;
+}
+
+/*
+ * Forget about a request whose owner is going away.
+ * Completions which arrive for it later are ignored.
+ */
+void
+plugin_request_cancel (struct plugin_request *req)
+{
+  if (req->pl)
+    {
+      while (req->deferred)
+	plugin_deferred_free (req->pl->rs, req->deferred);
+    }
+  req->n_pending = 0;
+}
+
+void
+plugin_set_notify (const struct plugin_list *pl, plugin_notify_t notify, void *arg)
+{
+  if (pl)
+    {
+      pl->rs->notify = notify;
+      pl->rs->notify_arg = arg;
+    }
+}
+
+/*
+ * Wait for completions of deferred calls.  If the event
+ * set is persistent, we are added to it once, otherwise
+ * only while calls are outstanding.
+ */
+void
+plugin_event_set (const struct plugin_list *pl,
+		  struct event_set *es,
+		  void *arg,
+		  unsigned int *persistent)
+{
+  if (pl && pl->rs->fd[0] >= 0)
+    {
+      if (persistent)
+	{
+	  if (!*persistent)
+	    {
+	      event_ctl (es, pl->rs->fd[0], EVENT_READ, arg);
+	      *persistent = 1;
+	    }
+	}
+      else if (pl->rs->n_deferred)
+	event_ctl (es, pl->rs->fd[0], EVENT_READ, arg);
+    }
+}
+
+/*
+ * Read completions from the pipe and pass them to the
+ * requests which are waiting for them.
+ */
+void
+plugin_process_completions (const struct plugin_list *pl)
+{
+  struct plugin_run_state *rs;
+  struct openvpn_plugin_completion c[16];
+  ssize_t len;
+
+  if (!pl || pl->rs->fd[0] < 0)
+    return;
+  rs = pl->rs;
+
+  while ((len = read (rs->fd[0], c, sizeof (c))) > 0)
+    {
+      int i;
+
+      /* writes are atomic, so reads will never split a completion */
+      ASSERT (len % sizeof (c[0]) == 0);
+
+      for (i = 0; i < (int) (len / sizeof (c[0])); ++i)
+	{
+	  struct plugin_deferred *d;
+	  struct plugin_request *req;
+
+	  for (d = *plugin_deferred_bucket (rs, c[i].request_id); d; d = d->next)
+	    if (d->id == c[i].request_id)
+	      break;
+
+	  if (!d)
+	    {
+	      dmsg (D_PLUGIN_DEBUG, "PLUGIN_COMPLETE: ignoring unknown or cancelled request %u", c[i].request_id);
+	      continue;
+	    }
+
+	  req = d->req;
+	  msg (D_PLUGIN, "PLUGIN_COMPLETE: %s request=%u status=%d",
+	       plugin_type_name (req->type),
+	       c[i].request_id,
+	       c[i].status);
+
+	  plugin_deferred_free (rs, d);
+	  --req->n_pending;
+	  if (c[i].status != OPENVPN_PLUGIN_FUNC_SUCCESS)
+	    ++req->n_failed;
+
+	  if (!req->n_pending)
+	    {
+	      plugin_stats_update (pl, req->type, &req->start, req->n_failed > 0);
+	      if (rs->notify)
+		(*rs->notify) (rs->notify_arg, req->owner);
+	    }
+	}
+    }
+}
+
+#endif
+
 static void
 plugin_close_item (const struct plugin *p)
 {
@@ -297,13 +673,20 @@ plugin_list_open (const struct plugin_option_list *list, const struct env_set *e
   const char **envp;
 
   ALLOC_OBJ_CLEAR (pl, struct plugin_list);
+  ALLOC_OBJ_CLEAR (pl->rs, struct plugin_run_state);
   static_plugin_list = pl;
 
+  pl->rs->callbacks.complete = NULL;
+  pl->rs->callbacks.completion_fd = -1;
+#ifdef ENABLE_PLUGIN_DEFERRED
+  plugin_deferred_init (pl->rs);
+#endif
+
   envp = make_env_array (es, &gc);
 
   for (i = 0; i < list->n; ++i)
     {
-      plugin_init_item (&pl->plugins[i], &list->plugins[i], envp);
+      plugin_init_item (&pl->plugins[i], &list->plugins[i], envp, &pl->rs->callbacks);
       pl->n = i + 1;
     }
 
@@ -321,18 +704,24 @@ plugin_call (const struct plugin_list *pl, const int type, const char *args, str
       struct gc_arena gc = gc_new ();
       int i;
       const char **envp;
+      struct timeval start;
       
       mutex_lock_static (L_PLUGIN);
 
       setenv_del (es, "script_type");
       envp = make_env_array (es, &gc);
 
+      tv_sample (&start);
+      ++pl->rs->stats[type].calls;
+
       for (i = 0; i < pl->n; ++i)
 	{
-	  if (!plugin_call_item (&pl->plugins[i], type, args, envp))
+	  if (!plugin_call_item (&pl->plugins[i], type, args, envp, 0))
 	    ++count;
 	}
 
+      plugin_stats_update (pl, type, &start, count != pl->n);
+
       mutex_unlock_static (L_PLUGIN);
 
       gc_free (&gc);
@@ -351,6 +740,10 @@ plugin_list_close (struct plugin_list *pl)
 
       for (i = 0; i < pl->n; ++i)
 	plugin_close_item (&pl->plugins[i]);
+#ifdef ENABLE_PLUGIN_DEFERRED
+      plugin_deferred_uninit (pl->rs);
+#endif
+      free (pl->rs);
       free (pl);
     }
 }
@@ -369,6 +762,17 @@ plugin_abort (void)
     }
 }
 
+/*
+ * Forget the global plug-in list without closing it,
+ * so that plugin_abort won't touch plug-ins owned by
+ * our parent (used in a forked child).
+ */
+void
+plugin_list_forget (void)
+{
+  static_plugin_list = NULL;
+}
+
 bool
 plugin_defined (const struct plugin_list *pl, const int type)
 {
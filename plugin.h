@@ -34,6 +34,9 @@
 #ifdef ENABLE_PLUGIN
 
 #include "misc.h"
+#include "common.h"
+#include "event.h"
+#include "status.h"
 
 #define MAX_PLUGINS 32
 
@@ -55,19 +58,96 @@ struct plugin {
 #elif defined(USE_LOAD_LIBRARY)
   HMODULE module;
 #endif
-  openvpn_plugin_open_v1 open;
-  openvpn_plugin_func_v1 func;
+  openvpn_plugin_open_v1 open1;
+  openvpn_plugin_func_v1 func1;
+  openvpn_plugin_open_v2 open2;
+  openvpn_plugin_func_v2 func2;
   openvpn_plugin_close_v1 close;
   openvpn_plugin_abort_v1 abort;
 
   openvpn_plugin_handle_t plugin_handle;
 };
 
+/*
+ * Per plug-in type call statistics.  Latency
+ * runs from the call to the final outcome, so
+ * it includes the time a deferred call spent
+ * waiting for completion.
+ */
+struct plugin_hook_stats {
+  counter_type calls;
+  counter_type deferred;
+  counter_type failed;
+  counter_type latency_sum;     /* microseconds */
+  unsigned int latency_max;     /* microseconds */
+};
+
+#ifdef ENABLE_PLUGIN_DEFERRED
+
+#define PLUGIN_DEFERRED_HASH_SIZE 256 /* must be a power of 2 */
+
+/*
+ * A call to one plug-in which returned
+ * OPENVPN_PLUGIN_FUNC_DEFERRED.
+ */
+struct plugin_deferred {
+  unsigned int id;
+  struct plugin_request *req;
+  struct plugin_deferred *next;         /* hash chain */
+  struct plugin_deferred *req_next;     /* other deferred calls for req */
+};
+
+/*
+ * Completion of a deferred call whose request is owned by
+ * owner.  Set by the server with plugin_set_notify.
+ */
+typedef void (*plugin_notify_t) (void *arg, void *owner);
+
+#endif
+
+/*
+ * State which changes as plug-ins are called, kept
+ * apart from struct plugin_list so that the list
+ * itself can be passed around as const.
+ */
+struct plugin_run_state {
+  struct plugin_hook_stats stats[OPENVPN_PLUGIN_N];
+  struct openvpn_plugin_callbacks callbacks;
+
+#ifdef ENABLE_PLUGIN_DEFERRED
+  int fd[2];                            /* completion pipe */
+  unsigned int next_id;
+  int n_deferred;
+  struct plugin_deferred *deferred[PLUGIN_DEFERRED_HASH_SIZE];
+  plugin_notify_t notify;
+  void *notify_arg;
+#endif
+};
+
 struct plugin_list {
   int n;
   struct plugin plugins[MAX_PLUGINS];
+  struct plugin_run_state *rs;
 };
 
+#ifdef ENABLE_PLUGIN_DEFERRED
+
+/*
+ * The caller's handle on a plug-in call which
+ * may be deferred by one or more plug-ins.
+ */
+struct plugin_request {
+  const struct plugin_list *pl;	/* NULL unless the call was deferred */
+  void *owner;
+  int type;
+  struct timeval start;
+  int n_pending;        /* deferred calls not yet completed */
+  int n_failed;         /* deferred calls completed with an error */
+  struct plugin_deferred *deferred;
+};
+
+#endif
+
 struct plugin_option_list *plugin_option_list_new (struct gc_arena *gc);
 bool plugin_option_list_add (struct plugin_option_list *list, const char *so_pathname, const char *args);
 
@@ -78,11 +158,50 @@ void plugin_option_list_print (const struct plugin_option_list *list, int msglev
 struct plugin_list *plugin_list_open (const struct plugin_option_list *list, const struct env_set *es);
 int plugin_call (const struct plugin_list *pl, const int type, const char *args, struct env_set *es);
 void plugin_list_close (struct plugin_list *pl);
+void plugin_list_forget (void);
 bool plugin_defined (const struct plugin_list *pl, const int type);
 
+void plugin_print_stats (const struct plugin_list *pl, struct status_output *so, const char *prefix);
+
+#ifdef ENABLE_PLUGIN_DEFERRED
+
+/*
+ * Like plugin_call, but plug-ins may defer the outcome if
+ * owner is not NULL.  Returns OPENVPN_PLUGIN_FUNC_DEFERRED
+ * if they did, in which case req tracks the pending calls
+ * and the notify callback is passed owner when the last
+ * of them completes.
+ */
+int plugin_call_deferred (const struct plugin_list *pl,
+			  const int type,
+			  const char *args,
+			  struct env_set *es,
+			  struct plugin_request *req,
+			  void *owner);
+
+void plugin_request_cancel (struct plugin_request *req);
+
+void plugin_set_notify (const struct plugin_list *pl, plugin_notify_t notify, void *arg);
+
+void plugin_event_set (const struct plugin_list *pl,
+		       struct event_set *es,
+		       void *arg,
+		       unsigned int *persistent);
+
+void plugin_process_completions (const struct plugin_list *pl);
+
+static inline bool
+plugin_request_pending (const struct plugin_request *req)
+{
+  return req->n_pending > 0;
+}
+
+#endif
+
 #else
 
 struct plugin_list { int dummy; };
+struct status_output;
 
 static inline bool
 plugin_defined (const struct plugin_list *pl, const int type)
@@ -96,6 +215,11 @@ plugin_call (const struct plugin_list *pl, const int type, const char *args, str
   return 0;
 }
 
+static inline void
+plugin_print_stats (const struct plugin_list *pl, struct status_output *so, const char *prefix)
+{
+}
+
 #endif /* ENABLE_PLUGIN */
 
 #endif /* OPENVPN_PLUGIN_H */
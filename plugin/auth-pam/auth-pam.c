@@ -39,9 +39,12 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <syslog.h>
@@ -49,6 +52,7 @@
 #include "openvpn-plugin.h"
 
 #define DEBUG(verb) ((verb) >= 7)
+#define STATS(verb) ((verb) >= 4)
 
 /* Command codes for foreground -> background communication */
 #define COMMAND_VERIFY 0
@@ -60,17 +64,85 @@
 #define RESPONSE_VERIFY_SUCCEEDED 12
 #define RESPONSE_VERIFY_FAILED    13
 
+/* Size of PAM worker pool */
+#define N_WORKERS_DEFAULT 1
+#define N_WORKERS_MAX     64
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define USER_PASS_LEN 128
+
+/*
+ * Foreground -> background message.  Each message is sent as
+ * a single datagram on a socket which is shared by all
+ * workers, so that whichever worker is idle picks it up.
+ */
+struct auth_request
+{
+  int command;
+
+  /*
+   * Non-zero if the outcome should be written to OpenVPN's
+   * completion fd, or zero if the foreground is waiting
+   * for a response on the socket.
+   */
+  unsigned int request_id;
+
+  /* when the foreground queued the request */
+  struct timeval queued;
+
+  char username[USER_PASS_LEN];
+  char password[USER_PASS_LEN];
+};
+
+/*
+ * Background -> foreground message, used for pool
+ * initialization and for requests which could not
+ * be deferred.
+ */
+struct auth_response
+{
+  int code;
+  unsigned int request_id;
+};
+
+/*
+ * Per-worker counters, kept in memory shared between
+ * the foreground and the workers.  Each worker only
+ * writes to its own slot.  Times are in microseconds.
+ */
+struct worker_stats
+{
+  unsigned int requests;
+  unsigned int succeeded;
+  double queue_usec;        /* time spent waiting for an idle worker */
+  double pam_usec;          /* time spent in PAM */
+  unsigned int queue_max_usec;
+  unsigned int pam_max_usec;
+};
+
 /*
  * Plugin state, used by foreground
  */
 struct auth_pam_context
 {
-  /* Foreground's socket to background process */
+  /* Foreground's socket to background processes */
   int foreground_fd;
 
   /* Process ID of background process */
   pid_t background_pid;
 
+  /* Number of PAM worker processes */
+  int n_workers;
+
+  /* Shared with workers, n_workers entries */
+  struct worker_stats *stats;
+
+  /* Where workers report deferred outcomes, or -1 */
+  int completion_fd;
+
   /* Verbosity level of OpenVPN */
   int verb;
 };
@@ -102,14 +174,33 @@ struct name_value_list {
 struct user_pass {
   int verb;
 
-  char username[128];
-  char password[128];
+  char username[USER_PASS_LEN];
+  char password[USER_PASS_LEN];
 
   const struct name_value_list *name_value_list;
 };
 
+/*
+ * Background state, shared by all workers
+ */
+struct pam_server_context
+{
+  /* socket back to foreground */
+  int fd;
+
+  /* OpenVPN's completion fd, or -1 */
+  int completion_fd;
+
+  const char *service;
+  int verb;
+  const struct name_value_list *name_value_list;
+
+  int n_workers;
+  struct worker_stats *stats;
+};
+
 /* Background process function */
-static void pam_server (int fd, const char *service, int verb, const struct name_value_list *name_value_list);
+static void pam_server (const struct pam_server_context *sc);
 
 /*
  * Given an environmental variable name, search
@@ -152,55 +243,102 @@ string_array_len (const char *array[])
 }
 
 /*
- * Socket read/write functions.
+ * Return the number of microseconds from start to now,
+ * clamped to [0, UINT_MAX].
+ */
+static unsigned int
+usec_since (const struct timeval *start)
+{
+  struct timeval now;
+  double usec;
+
+  gettimeofday (&now, NULL);
+  usec = (now.tv_sec - start->tv_sec) * 1000000.0 + (now.tv_usec - start->tv_usec);
+  if (usec < 0.0)
+    return 0;
+  if (usec > 4294967295.0)
+    return 4294967295U;
+  return (unsigned int) usec;
+}
+
+/*
+ * Socket read/write functions.  Every message is
+ * exactly one datagram.
  */
 
 static int
-recv_control (int fd)
+send_request (int fd, const struct auth_request *req)
 {
-  unsigned char c;
-  const ssize_t size = read (fd, &c, sizeof (c));
-  if (size == sizeof (c))
-    return c;
+  const ssize_t size = send (fd, req, sizeof (*req), 0);
+  if (size == sizeof (*req))
+    return (int) size;
   else
+    return -1;
+}
+
+static int
+recv_request (int fd, struct auth_request *req)
+{
+  ssize_t size;
+  do {
+    size = recv (fd, req, sizeof (*req), 0);
+  } while (size == -1 && errno == EINTR);
+  if (size == sizeof (*req))
     {
-      /*fprintf (stderr, "AUTH-PAM: DEBUG recv_control.read=%d\n", (int)size);*/
-      return -1;
+      req->username[sizeof (req->username) - 1] = '\0';
+      req->password[sizeof (req->password) - 1] = '\0';
+      return (int) size;
     }
+  else
+    return -1;
 }
 
 static int
-send_control (int fd, int code)
+send_response (int fd, int code, unsigned int request_id)
 {
-  unsigned char c = (unsigned char) code;
-  const ssize_t size = write (fd, &c, sizeof (c));
-  if (size == sizeof (c))
+  struct auth_response resp;
+  ssize_t size;
+
+  memset (&resp, 0, sizeof (resp));
+  resp.code = code;
+  resp.request_id = request_id;
+  size = send (fd, &resp, sizeof (resp), 0);
+  if (size == sizeof (resp))
     return (int) size;
   else
     return -1;
 }
 
 static int
-recv_string (int fd, char *buffer, int len)
+recv_response (int fd, struct auth_response *resp)
 {
-  if (len > 0)
-    {
-      ssize_t size;
-      memset (buffer, 0, len);
-      size = read (fd, buffer, len);
-      buffer[len-1] = 0;
-      if (size >= 1)
-	return (int)size;
-    }
-  return -1;
+  ssize_t size;
+  do {
+    size = recv (fd, resp, sizeof (*resp), 0);
+  } while (size == -1 && errno == EINTR);
+  if (size == sizeof (*resp))
+    return (int) size;
+  else
+    return -1;
 }
 
+/*
+ * Report the outcome of a deferred request directly to OpenVPN.
+ * The message is smaller than PIPE_BUF, so writes by concurrent
+ * workers will not be interleaved.
+ */
 static int
-send_string (int fd, const char *string)
+send_completion (int fd, unsigned int request_id, int succeeded)
 {
-  const int len = strlen (string) + 1;
-  const ssize_t size = write (fd, string, len);
-  if (size == len)
+  struct openvpn_plugin_completion c;
+  ssize_t size;
+
+  c.request_id = request_id;
+  c.status = succeeded ? OPENVPN_PLUGIN_FUNC_SUCCESS : OPENVPN_PLUGIN_FUNC_ERROR;
+  do {
+    size = write (fd, &c, sizeof (c));
+  } while (size == -1 && errno == EINTR);
+  if (size == sizeof (c))
     return (int) size;
   else
     return -1;
@@ -235,22 +373,22 @@ daemonize (const char *envp[])
 
 /*
  * Close most of parent's fds.
- * Keep stdin/stdout/stderr, plus one
- * other fd which is presumed to be
- * our pipe back to parent.
+ * Keep stdin/stdout/stderr, plus our
+ * pipe back to parent and OpenVPN's
+ * completion fd (either may be -1).
  * Admittedly, a bit of a kludge,
  * but posix doesn't give us a kind
  * of FD_CLOEXEC which will stop
  * fds from crossing a fork().
  */
 static void
-close_fds_except (int keep)
+close_fds_except (int keep, int keep2)
 {
   int i;
   closelog ();
   for (i = 3; i <= 100; ++i)
     {
-      if (i != keep)
+      if (i != keep && i != keep2)
 	close (i);
     }
 }
@@ -286,8 +424,31 @@ name_value_match (const char *query, const char *match)
   return strncasecmp (match, query, strlen (match)) == 0;
 }
 
+/*
+ * Report per-worker counters.
+ */
+static void
+print_stats (const struct auth_pam_context *context)
+{
+  int i;
+  for (i = 0; i < context->n_workers; ++i)
+    {
+      const struct worker_stats *ws = &context->stats[i];
+      if (ws->requests)
+	fprintf (stderr, "AUTH-PAM: worker %d: requests=%u succeeded=%u queue avg/max=%.0f/%u us pam avg/max=%.0f/%u us\n",
+		 i,
+		 ws->requests,
+		 ws->succeeded,
+		 ws->queue_usec / ws->requests,
+		 ws->queue_max_usec,
+		 ws->pam_usec / ws->requests,
+		 ws->pam_max_usec);
+    }
+}
+
 OPENVPN_EXPORT openvpn_plugin_handle_t
-openvpn_plugin_open_v1 (unsigned int *type_mask, const char *argv[], const char *envp[])
+openvpn_plugin_open_v2 (unsigned int *type_mask, const char *argv[], const char *envp[],
+			const struct openvpn_plugin_callbacks *callbacks)
 {
   pid_t pid;
   int fd[2];
@@ -295,19 +456,35 @@ openvpn_plugin_open_v1 (unsigned int *type_mask, const char *argv[], const char
   struct auth_pam_context *context;
   struct name_value_list name_value_list;
 
-  const int base_parms = 2;
+  int base_parms = 2;
+  int n_workers = N_WORKERS_DEFAULT;
 
   /*
    * Allocate our context
    */
   context = (struct auth_pam_context *) calloc (1, sizeof (struct auth_pam_context));
   context->foreground_fd = -1;
+  context->completion_fd = callbacks ? callbacks->completion_fd : -1;
 
   /*
    * Intercept the --auth-user-pass-verify callback.
    */
   *type_mask = OPENVPN_PLUGIN_MASK (OPENVPN_PLUGIN_AUTH_USER_PASS_VERIFY);
 
+  /*
+   * Optional "-w n" sets the size of the PAM worker pool.
+   */
+  if (string_array_len (argv) >= 3 && !strcmp (argv[1], "-w"))
+    {
+      n_workers = atoi (argv[2]);
+      if (n_workers < 1 || n_workers > N_WORKERS_MAX)
+	{
+	  fprintf (stderr, "AUTH-PAM: number of workers must be between 1 and %d\n", N_WORKERS_MAX);
+	  goto error;
+	}
+      argv += 2;
+    }
+
   /*
    * Make sure we have two string arguments: the first is the .so name,
    * the second is the PAM service type.
@@ -352,6 +529,21 @@ openvpn_plugin_open_v1 (unsigned int *type_mask, const char *argv[], const char
       context->verb = atoi (verb_string);
   }
 
+  /*
+   * Worker counters live in anonymous shared memory
+   * so that the foreground can read them.
+   */
+  context->n_workers = n_workers;
+  context->stats = (struct worker_stats *) mmap (NULL, n_workers * sizeof (struct worker_stats),
+						 PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if (context->stats == MAP_FAILED)
+    {
+      context->stats = NULL;
+      fprintf (stderr, "AUTH-PAM: mmap call failed\n");
+      goto error;
+    }
+  memset (context->stats, 0, n_workers * sizeof (struct worker_stats));
+
   /*
    * Make a socket for foreground and background processes
    * to communicate.
@@ -370,7 +562,7 @@ openvpn_plugin_open_v1 (unsigned int *type_mask, const char *argv[], const char
 
   if (pid)
     {
-      int status;
+      struct auth_response resp;
 
       /*
        * Foreground Process
@@ -386,21 +578,27 @@ openvpn_plugin_open_v1 (unsigned int *type_mask, const char *argv[], const char
 	fprintf (stderr, "AUTH-PAM: Set FD_CLOEXEC flag on socket file descriptor failed\n");
 
       /* wait for background child process to initialize */
-      status = recv_control (fd[0]);
-      if (status == RESPONSE_INIT_SUCCEEDED)
+      if (recv_response (fd[0], &resp) != -1 && resp.code == RESPONSE_INIT_SUCCEEDED)
 	{
 	  context->foreground_fd = fd[0];
+	  if (DEBUG (context->verb))
+	    fprintf (stderr, "AUTH-PAM: started %d worker(s), deferred=%s\n",
+		     context->n_workers,
+		     context->completion_fd >= 0 ? "yes" : "no");
 	  return (openvpn_plugin_handle_t) context;
 	}
+      close (fd[0]);
     }
   else
     {
+      struct pam_server_context sc;
+
       /*
        * Background Process
        */
 
       /* close all parent fds except our socket back to parent */
-      close_fds_except (fd[1]);
+      close_fds_except (fd[1], context->completion_fd);
 
       /* Ignore most signals (the parent will receive them) */
       set_signals ();
@@ -409,7 +607,14 @@ openvpn_plugin_open_v1 (unsigned int *type_mask, const char *argv[], const char
       daemonize (envp);
 
       /* execute the event loop */
-      pam_server (fd[1], argv[1], context->verb, &name_value_list);
+      sc.fd = fd[1];
+      sc.completion_fd = context->completion_fd;
+      sc.service = argv[1];
+      sc.verb = context->verb;
+      sc.name_value_list = &name_value_list;
+      sc.n_workers = context->n_workers;
+      sc.stats = context->stats;
+      pam_server (&sc);
 
       close (fd[1]);
 
@@ -419,12 +624,27 @@ openvpn_plugin_open_v1 (unsigned int *type_mask, const char *argv[], const char
 
  error:
   if (context)
-    free (context);
+    {
+      if (context->stats)
+	munmap (context->stats, context->n_workers * sizeof (struct worker_stats));
+      free (context);
+    }
   return NULL;
 }
 
+/*
+ * For versions of OpenVPN which predate plugin API v2.
+ * All calls are synchronous.
+ */
+OPENVPN_EXPORT openvpn_plugin_handle_t
+openvpn_plugin_open_v1 (unsigned int *type_mask, const char *argv[], const char *envp[])
+{
+  return openvpn_plugin_open_v2 (type_mask, argv, envp, NULL);
+}
+
 OPENVPN_EXPORT int
-openvpn_plugin_func_v1 (openvpn_plugin_handle_t handle, const int type, const char *argv[], const char *envp[])
+openvpn_plugin_func_v2 (openvpn_plugin_handle_t handle, const int type, const char *argv[], const char *envp[],
+			const unsigned int request_id)
 {
   struct auth_pam_context *context = (struct auth_pam_context *) handle;
 
@@ -436,25 +656,60 @@ openvpn_plugin_func_v1 (openvpn_plugin_handle_t handle, const int type, const ch
 
       if (username && strlen (username) > 0 && password)
 	{
-	  if (send_control (context->foreground_fd, COMMAND_VERIFY) == -1
-	      || send_string (context->foreground_fd, username) == -1
-	      || send_string (context->foreground_fd, password) == -1)
+	  const int deferred = (request_id && context->completion_fd >= 0);
+	  struct auth_request req;
+	  int status = OPENVPN_PLUGIN_FUNC_ERROR;
+
+	  memset (&req, 0, sizeof (req));
+	  req.command = COMMAND_VERIFY;
+	  req.request_id = deferred ? request_id : 0;
+	  gettimeofday (&req.queued, NULL);
+	  strncpy (req.username, username, sizeof (req.username) - 1);
+	  strncpy (req.password, password, sizeof (req.password) - 1);
+
+	  if (send_request (context->foreground_fd, &req) == -1)
 	    {
 	      fprintf (stderr, "AUTH-PAM: Error sending auth info to background process\n");
 	    }
+	  else if (deferred)
+	    {
+	      /* a worker will write the outcome to completion_fd */
+	      status = OPENVPN_PLUGIN_FUNC_DEFERRED;
+	    }
 	  else
 	    {
-	      const int status = recv_control (context->foreground_fd);
-	      if (status == RESPONSE_VERIFY_SUCCEEDED)
-		return OPENVPN_PLUGIN_FUNC_SUCCESS;
-	      if (status == -1)
-		fprintf (stderr, "AUTH-PAM: Error receiving auth confirmation from background process\n");
+	      struct auth_response resp;
+
+	      /*
+	       * Only one non-deferred request is outstanding
+	       * at any time, but skip over any stale response
+	       * left behind by an earlier error.
+	       */
+	      while (recv_response (context->foreground_fd, &resp) != -1)
+		{
+		  if (resp.request_id == 0)
+		    {
+		      if (resp.code == RESPONSE_VERIFY_SUCCEEDED)
+			status = OPENVPN_PLUGIN_FUNC_SUCCESS;
+		      goto done;
+		    }
+		}
+	      fprintf (stderr, "AUTH-PAM: Error receiving auth confirmation from background process\n");
 	    }
+	done:
+	  memset (&req, 0, sizeof (req));
+	  return status;
 	}
     }
   return OPENVPN_PLUGIN_FUNC_ERROR;
 }
 
+OPENVPN_EXPORT int
+openvpn_plugin_func_v1 (openvpn_plugin_handle_t handle, const int type, const char *argv[], const char *envp[])
+{
+  return openvpn_plugin_func_v2 (handle, type, argv, envp, 0);
+}
+
 OPENVPN_EXPORT void
 openvpn_plugin_close_v1 (openvpn_plugin_handle_t handle)
 {
@@ -465,9 +720,20 @@ openvpn_plugin_close_v1 (openvpn_plugin_handle_t handle)
 
   if (context->foreground_fd >= 0)
     {
-      /* tell background process to exit */
-      if (send_control (context->foreground_fd, COMMAND_EXIT) == -1)
-	fprintf (stderr, "AUTH-PAM: Error signaling background process to exit\n");
+      struct auth_request req;
+      int i;
+
+      /* tell each worker to exit */
+      memset (&req, 0, sizeof (req));
+      req.command = COMMAND_EXIT;
+      for (i = 0; i < context->n_workers; ++i)
+	{
+	  if (send_request (context->foreground_fd, &req) == -1)
+	    {
+	      fprintf (stderr, "AUTH-PAM: Error signaling background process to exit\n");
+	      break;
+	    }
+	}
 
       /* wait for background process to exit */
       if (context->background_pid > 0)
@@ -477,6 +743,10 @@ openvpn_plugin_close_v1 (openvpn_plugin_handle_t handle)
       context->foreground_fd = -1;
     }
 
+  if (STATS (context->verb))
+    print_stats (context);
+
+  munmap (context->stats, context->n_workers * sizeof (struct worker_stats));
   free (context);
 }
 
@@ -488,7 +758,13 @@ openvpn_plugin_abort_v1 (openvpn_plugin_handle_t handle)
   /* tell background process to exit */
   if (context->foreground_fd >= 0)
     {
-      send_control (context->foreground_fd, COMMAND_EXIT);
+      struct auth_request req;
+      int i;
+
+      memset (&req, 0, sizeof (req));
+      req.command = COMMAND_EXIT;
+      for (i = 0; i < context->n_workers; ++i)
+	send_request (context->foreground_fd, &req);
       close (context->foreground_fd);
       context->foreground_fd = -1;
     }
@@ -644,13 +920,102 @@ pam_auth (const char *service, const struct user_pass *up)
 }
 
 /*
- * Background process -- runs with privilege.
+ * PAM worker event loop.  Each worker competes with the
+ * others to read requests from the shared socket.
  */
 static void
-pam_server (int fd, const char *service, int verb, const struct name_value_list *name_value_list)
+pam_worker (const struct pam_server_context *sc, struct worker_stats *ws, int worker)
 {
+  struct auth_request req;
   struct user_pass up;
-  int command;
+
+  while (1)
+    {
+      if (recv_request (sc->fd, &req) == -1)
+	{
+	  fprintf (stderr, "AUTH-PAM: BACKGROUND[%d]: read error on command channel\n", worker);
+	  return;
+	}
+
+      if (DEBUG (sc->verb))
+	fprintf (stderr, "AUTH-PAM: BACKGROUND[%d]: received command code: %d\n", worker, req.command);
+
+      switch (req.command)
+	{
+	case COMMAND_VERIFY:
+	  {
+	    const unsigned int queue_usec = usec_since (&req.queued);
+	    unsigned int pam_usec;
+	    struct timeval start;
+	    int ok;
+
+	    memset (&up, 0, sizeof (up));
+	    up.verb = sc->verb;
+	    up.name_value_list = sc->name_value_list;
+	    memcpy (up.username, req.username, sizeof (up.username));
+	    memcpy (up.password, req.password, sizeof (up.password));
+	    memset (req.password, 0, sizeof (req.password));
+
+	    if (DEBUG (sc->verb))
+	      fprintf (stderr, "AUTH-PAM: BACKGROUND[%d]: USER/PASS: %s/%s\n",
+		       worker, up.username, up.password);
+
+	    gettimeofday (&start, NULL);
+	    ok = pam_auth (sc->service, &up);
+	    pam_usec = usec_since (&start);
+	    memset (up.password, 0, sizeof (up.password));
+
+	    ++ws->requests;
+	    if (ok)
+	      ++ws->succeeded;
+	    ws->queue_usec += queue_usec;
+	    ws->pam_usec += pam_usec;
+	    if (queue_usec > ws->queue_max_usec)
+	      ws->queue_max_usec = queue_usec;
+	    if (pam_usec > ws->pam_max_usec)
+	      ws->pam_max_usec = pam_usec;
+
+	    if (DEBUG (sc->verb))
+	      fprintf (stderr, "AUTH-PAM: BACKGROUND[%d]: id=%u user='%s' %s queue=%u us pam=%u us\n",
+		       worker, req.request_id, up.username,
+		       ok ? "succeeded" : "failed",
+		       queue_usec, pam_usec);
+
+	    if (req.request_id)
+	      {
+		if (send_completion (sc->completion_fd, req.request_id, ok) == -1)
+		  fprintf (stderr, "AUTH-PAM: BACKGROUND[%d]: write error on completion fd, id=%u\n",
+			   worker, req.request_id);
+	      }
+	    else if (send_response (sc->fd, ok ? RESPONSE_VERIFY_SUCCEEDED : RESPONSE_VERIFY_FAILED, 0) == -1)
+	      {
+		fprintf (stderr, "AUTH-PAM: BACKGROUND[%d]: write error on response socket\n", worker);
+		return;
+	      }
+	  }
+	  break;
+
+	case COMMAND_EXIT:
+	  return;
+
+	default:
+	  fprintf (stderr, "AUTH-PAM: BACKGROUND[%d]: unknown command code: code=%d, exiting\n",
+		   worker, req.command);
+	  return;
+	}
+    }
+}
+
+/*
+ * Background process -- runs with privilege.
+ * Forks the rest of the worker pool, then
+ * serves as worker 0.
+ */
+static void
+pam_server (const struct pam_server_context *sc)
+{
+  int i;
+  int n_children = 0;
 #if DLOPEN_PAM
   static const char pam_so[] = "libpam.so";
 #endif
@@ -658,8 +1023,8 @@ pam_server (int fd, const char *service, int verb, const struct name_value_list
   /*
    * Do initialization
    */
-  if (DEBUG (verb))
-    fprintf (stderr, "AUTH-PAM: BACKGROUND: INIT service='%s'\n", service);
+  if (DEBUG (sc->verb))
+    fprintf (stderr, "AUTH-PAM: BACKGROUND: INIT service='%s' workers=%d\n", sc->service, sc->n_workers);
 
 #if DLOPEN_PAM
   /*
@@ -668,15 +1033,35 @@ pam_server (int fd, const char *service, int verb, const struct name_value_list
   if (!dlopen_pam (pam_so))
     {
       fprintf (stderr, "AUTH-PAM: BACKGROUND: could not load PAM lib %s: %s\n", pam_so, dlerror());
-      send_control (fd, RESPONSE_INIT_FAILED);
+      send_response (sc->fd, RESPONSE_INIT_FAILED, 0);
       goto done;
     }
 #endif
 
+  /*
+   * Start the other workers
+   */
+  for (i = 1; i < sc->n_workers; ++i)
+    {
+      const pid_t pid = fork ();
+      if (pid == 0)
+	{
+	  pam_worker (sc, &sc->stats[i], i);
+#if DLOPEN_PAM
+	  dlclose_pam ();
+#endif
+	  exit (0);
+	}
+      else if (pid < 0)
+	fprintf (stderr, "AUTH-PAM: BACKGROUND: could not fork worker %d\n", i);
+      else
+	++n_children;
+    }
+
   /*
    * Tell foreground that we initialized successfully
    */
-  if (send_control (fd, RESPONSE_INIT_SUCCEEDED) == -1)
+  if (send_response (sc->fd, RESPONSE_INIT_SUCCEEDED, 0) == -1)
     {
       fprintf (stderr, "AUTH-PAM: BACKGROUND: write error on response socket [1]\n");
       goto done;
@@ -685,70 +1070,24 @@ pam_server (int fd, const char *service, int verb, const struct name_value_list
   /*
    * Event loop
    */
-  while (1)
-    {
-      memset (&up, 0, sizeof (up));
-      up.verb = verb;
-      up.name_value_list = name_value_list;
-
-      /* get a command from foreground process */
-      command = recv_control (fd);
+  pam_worker (sc, &sc->stats[0], 0);
 
-      if (DEBUG (verb))
-	fprintf (stderr, "AUTH-PAM: BACKGROUND: received command code: %d\n", command);
-
-      switch (command)
-	{
-	case COMMAND_VERIFY:
-	  if (recv_string (fd, up.username, sizeof (up.username)) == -1
-	      || recv_string (fd, up.password, sizeof (up.password)) == -1)
-	    {
-	      fprintf (stderr, "AUTH-PAM: BACKGROUND: read error on command channel: code=%d, exiting\n",
-		       command);
-	      goto done;
-	    }
-
-	  if (DEBUG (verb))
-	    fprintf (stderr, "AUTH-PAM: BACKGROUND: USER/PASS: %s/%s\n",
-		     up.username, up.password);
-
-	  if (pam_auth (service, &up)) /* Succeeded */
-	    {
-	      if (send_control (fd, RESPONSE_VERIFY_SUCCEEDED) == -1)
-		{
-		  fprintf (stderr, "AUTH-PAM: BACKGROUND: write error on response socket [2]\n");
-		  goto done;
-		}
-	    }
-	  else /* Failed */
-	    {
-	      if (send_control (fd, RESPONSE_VERIFY_FAILED) == -1)
-		{
-		  fprintf (stderr, "AUTH-PAM: BACKGROUND: write error on response socket [3]\n");
-		  goto done;
-		}
-	    }
-	  break;
-
-	case COMMAND_EXIT:
-	  goto done;
-
-	case -1:
-	  fprintf (stderr, "AUTH-PAM: BACKGROUND: read error on command channel\n");
-	  goto done;
-
-	default:
-	  fprintf (stderr, "AUTH-PAM: BACKGROUND: unknown command code: code=%d, exiting\n",
-		   command);
-	  goto done;
-	}
-    }
  done:
+  /*
+   * The foreground sends one exit command per worker
+   */
+  while (n_children > 0)
+    {
+      if (wait (NULL) > 0)
+	--n_children;
+      else if (errno != EINTR)
+	break;
+    }
 
 #if DLOPEN_PAM
   dlclose_pam ();
 #endif
-  if (DEBUG (verb))
+  if (DEBUG (sc->verb))
     fprintf (stderr, "AUTH-PAM: BACKGROUND: EXIT\n");
 
   return;
@@ -35,14 +35,130 @@
 #include "error.h"
 #include "socket.h"
 #include "otime.h"
+#include "list.h"
 
 #include "memdbg.h"
 
 #if P2MP
 
+/*
+ * Common name index of unused entries
+ */
+
+static uint32_t
+cn_hash_function (const void *key, uint32_t iv)
+{
+  const char *str = (const char *) key;
+  return hash_func ((const uint8_t *) str, strlen (str), iv);
+}
+
+static bool
+cn_compare_function (const void *key1, const void *key2)
+{
+  return !strcmp ((const char *) key1, (const char *) key2);
+}
+
+static void
+ifconfig_pool_cn_index (struct ifconfig_pool *pool, const int h)
+{
+  struct ifconfig_pool_entry *ipe = &pool->list[h];
+  if (pool->cn_hash && ipe->common_name)
+    {
+      /* a later release of the same common name takes precedence */
+      hash_remove (pool->cn_hash, ipe->common_name);
+      hash_add (pool->cn_hash, ipe->common_name, ipe, false);
+    }
+}
+
+static void
+ifconfig_pool_cn_unindex (struct ifconfig_pool *pool, const int h)
+{
+  struct ifconfig_pool_entry *ipe = &pool->list[h];
+  if (pool->cn_hash && ipe->common_name
+      && hash_lookup (pool->cn_hash, ipe->common_name) == ipe)
+    hash_remove (pool->cn_hash, ipe->common_name);
+}
+
+/*
+ * Free list, ordered by release time
+ */
+
+static inline bool
+ifconfig_pool_free_listed (const struct ifconfig_pool *pool, const int h)
+{
+  return pool->list[h].free_prev >= 0 || pool->free_head == h;
+}
+
+static void
+ifconfig_pool_free_unlink (struct ifconfig_pool *pool, const int h)
+{
+  struct ifconfig_pool_entry *ipe = &pool->list[h];
+  if (ifconfig_pool_free_listed (pool, h))
+    {
+      if (ipe->free_prev >= 0)
+	pool->list[ipe->free_prev].free_next = ipe->free_next;
+      else
+	pool->free_head = ipe->free_next;
+      if (ipe->free_next >= 0)
+	pool->list[ipe->free_next].free_prev = ipe->free_prev;
+      else
+	pool->free_tail = ipe->free_prev;
+      ipe->free_prev = ipe->free_next = -1;
+    }
+}
+
+/*
+ * Put an unused entry on the free list, at the head if
+ * it has never been used, otherwise at the tail.  Fixed
+ * entries are only handed out by common name.
+ */
+static void
+ifconfig_pool_free_link (struct ifconfig_pool *pool, const int h)
+{
+  struct ifconfig_pool_entry *ipe = &pool->list[h];
+  if (ipe->fixed && !pool->duplicate_cn)
+    return;
+  if (!ipe->last_release)
+    {
+      ipe->free_prev = -1;
+      ipe->free_next = pool->free_head;
+      if (pool->free_head >= 0)
+	pool->list[pool->free_head].free_prev = h;
+      else
+	pool->free_tail = h;
+      pool->free_head = h;
+    }
+  else
+    {
+      ipe->free_next = -1;
+      ipe->free_prev = pool->free_tail;
+      if (pool->free_tail >= 0)
+	pool->list[pool->free_tail].free_next = h;
+      else
+	pool->free_head = h;
+      pool->free_tail = h;
+    }
+}
+
 static void
-ifconfig_pool_entry_free (struct ifconfig_pool_entry *ipe, bool hard)
+ifconfig_pool_mark_dirty (struct ifconfig_pool *pool, const int h)
 {
+  struct ifconfig_pool_entry *ipe = &pool->list[h];
+  if (!ipe->dirty)
+    {
+      ipe->dirty = true;
+      pool->dirty[pool->n_dirty++] = h;
+    }
+}
+
+static void
+ifconfig_pool_entry_free (struct ifconfig_pool *pool, const int h, bool hard)
+{
+  struct ifconfig_pool_entry *ipe = &pool->list[h];
+
+  ifconfig_pool_free_unlink (pool, h);
+  ifconfig_pool_cn_unindex (pool, h);
+
   ipe->in_use = false;
   if (hard && ipe->common_name)
     {
@@ -55,58 +171,36 @@ ifconfig_pool_entry_free (struct ifconfig_pool_entry *ipe, bool hard)
     ipe->last_release = now;
 }
 
+/*
+ * Release an entry back to the pool, making it available
+ * to clients again.
+ */
+static void
+ifconfig_pool_entry_release (struct ifconfig_pool *pool, const int h, bool hard)
+{
+  ifconfig_pool_entry_free (pool, h, hard);
+  ifconfig_pool_free_link (pool, h);
+  ifconfig_pool_cn_index (pool, h);
+}
+
 static int
 ifconfig_pool_find (struct ifconfig_pool *pool, const char *common_name)
 {
-  int i;
-  time_t earliest_release = 0;
-  int previous_usage = -1;
-  int new_usage = -1;
-
-  for (i = 0; i < pool->size; ++i)
+  /*
+   * Prefer an allocation to us from an earlier session.
+   */
+  if (common_name && pool->cn_hash)
     {
-      struct ifconfig_pool_entry *ipe = &pool->list[i];
-      if (!ipe->in_use)
-	{
-	  /*
-	   * If duplicate_cn mode, take first available IP address
-	   */
-	  if (pool->duplicate_cn)
-	    {
-	      new_usage = i;
-	      break;
-	    }
-
-	  /*
-	   * Keep track of the unused IP address entry which
-	   * was released earliest.
-	   */
-	  if ((new_usage == -1 || ipe->last_release < earliest_release) && !ipe->fixed)
-	    {
-	      earliest_release = ipe->last_release;
-	      new_usage = i;
-	    }
-
-	  /*
-	   * Keep track of a possible allocation to us
-	   * from an earlier session.
-	   */
-	  if (previous_usage < 0
-	      && common_name
-	      && ipe->common_name
-	      && !strcmp (common_name, ipe->common_name))
-	    previous_usage = i;
-
-	}
+      const struct ifconfig_pool_entry *ipe = (const struct ifconfig_pool_entry *) hash_lookup (pool->cn_hash, common_name);
+      if (ipe)
+	return ipe - pool->list;
     }
 
-  if (previous_usage >= 0)
-    return previous_usage;
-
-  if (new_usage >= 0)
-    return new_usage;
-
-  return -1;
+  /*
+   * Otherwise take the unused IP address entry which
+   * was released earliest.
+   */
+  return pool->free_head;
 }
 
 
@@ -115,6 +209,7 @@ ifconfig_pool_init (int type, in_addr_t start, in_addr_t end, const bool duplica
 {
   struct gc_arena gc = gc_new ();
   struct ifconfig_pool *pool = NULL;
+  int i;
 
   ASSERT (start <= end && end - start < IFCONFIG_POOL_MAX);
   ALLOC_OBJ_CLEAR (pool, struct ifconfig_pool);
@@ -137,6 +232,20 @@ ifconfig_pool_init (int type, in_addr_t start, in_addr_t end, const bool duplica
     }
 
   ALLOC_ARRAY_CLEAR (pool->list, struct ifconfig_pool_entry, pool->size);
+  ALLOC_ARRAY (pool->dirty, int, pool->size);
+
+  /* in duplicate_cn mode, addresses are never looked up by common name */
+  if (!duplicate_cn)
+    pool->cn_hash = hash_init (pool->size, cn_hash_function, cn_compare_function);
+
+  /* initially, addresses are handed out in order */
+  for (i = 0; i < pool->size; ++i)
+    {
+      pool->list[i].free_prev = i - 1;
+      pool->list[i].free_next = (i + 1 < pool->size) ? i + 1 : -1;
+    }
+  pool->free_head = 0;
+  pool->free_tail = pool->size - 1;
 
   msg (D_IFCONFIG_POOL, "IFCONFIG POOL: base=%s size=%d",
        print_in_addr_t (pool->base, 0, &gc),
@@ -152,13 +261,39 @@ ifconfig_pool_free (struct ifconfig_pool *pool)
   if (pool)
     {
       int i;
+      if (pool->cn_hash)
+	hash_free (pool->cn_hash);
+      pool->cn_hash = NULL;
       for (i = 0; i < pool->size; ++i)
-	ifconfig_pool_entry_free (&pool->list[i], true);
+	ifconfig_pool_entry_free (pool, i, true);
+      free (pool->dirty);
       free (pool->list);
       free (pool);
     }
 }
 
+/*
+ * Mark pool entry i as in use by common_name.
+ */
+static void
+ifconfig_pool_entry_take (struct ifconfig_pool *pool, const int i, const char *common_name)
+{
+  struct ifconfig_pool_entry *ipe = &pool->list[i];
+  ASSERT (!ipe->in_use);
+
+  if (common_name && ipe->common_name && !strcmp (common_name, ipe->common_name))
+    ifconfig_pool_entry_free (pool, i, false);
+  else
+    {
+      if (common_name || ipe->common_name)
+	ifconfig_pool_mark_dirty (pool, i);
+      ifconfig_pool_entry_free (pool, i, true);
+      if (common_name)
+	ipe->common_name = string_alloc (common_name, NULL);
+    }
+  ipe->in_use = true;
+}
+
 ifconfig_pool_handle
 ifconfig_pool_acquire (struct ifconfig_pool *pool, in_addr_t *local, in_addr_t *remote, const char *common_name)
 {
@@ -167,12 +302,7 @@ ifconfig_pool_acquire (struct ifconfig_pool *pool, in_addr_t *local, in_addr_t *
   i = ifconfig_pool_find (pool, common_name);
   if (i >= 0)
     {
-      struct ifconfig_pool_entry *ipe = &pool->list[i];
-      ASSERT (!ipe->in_use);
-      ifconfig_pool_entry_free (ipe, true);
-      ipe->in_use = true;
-      if (common_name)
-	ipe->common_name = string_alloc (common_name, NULL);
+      ifconfig_pool_entry_take (pool, i, common_name);
 
       switch (pool->type)
 	{
@@ -197,13 +327,30 @@ ifconfig_pool_acquire (struct ifconfig_pool *pool, in_addr_t *local, in_addr_t *
   return i;
 }
 
+/*
+ * Acquire a specific entry, which a previous server
+ * process had handed out to common_name (--handoff).
+ */
+bool
+ifconfig_pool_acquire_handle (struct ifconfig_pool *pool, ifconfig_pool_handle hand, const char *common_name)
+{
+  if (pool && hand >= 0 && hand < pool->size && !pool->list[hand].in_use)
+    {
+      ifconfig_pool_entry_take (pool, hand, common_name);
+      return true;
+    }
+  return false;
+}
+
 bool
 ifconfig_pool_release (struct ifconfig_pool* pool, ifconfig_pool_handle hand, const bool hard)
 {
   bool ret = false;
   if (pool && hand >= 0 && hand < pool->size)
     {
-      ifconfig_pool_entry_free (&pool->list[hand], hard);
+      if (hard && pool->list[hand].common_name)
+	ifconfig_pool_mark_dirty (pool, hand);
+      ifconfig_pool_entry_release (pool, hand, hard);
       ret = true;
     }
   return ret;
@@ -274,11 +421,17 @@ ifconfig_pool_set (struct ifconfig_pool* pool, const char *cn, const in_addr_t a
   if (h >= 0)
     {
       struct ifconfig_pool_entry *e = &pool->list[h];
-      ifconfig_pool_entry_free (e, true);
-      e->in_use = false;
-      e->common_name = string_alloc (cn, NULL);
-      e->last_release = now;
-      e->fixed = fixed;
+      ifconfig_pool_entry_free (pool, h, true);
+      if (*cn)
+	{
+	  e->common_name = string_alloc (cn, NULL);
+	  e->last_release = now;
+	  e->fixed = fixed;
+	}
+      else
+	e->fixed = false; /* address was released */
+      ifconfig_pool_free_link (pool, h);
+      ifconfig_pool_cn_index (pool, h);
     }
 }
 
@@ -396,6 +549,7 @@ ifconfig_pool_read (struct ifconfig_pool_persist *persist, struct ifconfig_pool
 		  if (succeeded)
 		    {
 		      ifconfig_pool_set (pool, cn_buf, addr, persist->fixed);
+		      ++persist->n_records;
 		    }
 		}
 	    }
@@ -407,14 +561,53 @@ ifconfig_pool_read (struct ifconfig_pool_persist *persist, struct ifconfig_pool
     }
 }
 
+/*
+ * Only entries whose common name has changed since the last
+ * call are written, appended to the end of the file.  Each record
+ * gives the full state of one address, so when the file is read
+ * back, later records override earlier ones.  An address which has
+ * been released is written with an empty common name.  The file is
+ * rewritten from scratch on the first call, and when the appended
+ * records outnumber the addresses in the pool.
+ */
 void
-ifconfig_pool_write (struct ifconfig_pool_persist *persist, const struct ifconfig_pool *pool)
+ifconfig_pool_write (struct ifconfig_pool_persist *persist, struct ifconfig_pool *pool)
 {
   if (persist && persist->file && (status_rw_flags (persist->file) & STATUS_OUTPUT_WRITE) && pool)
     {
-      status_reset (persist->file);
-      ifconfig_pool_list (pool, persist->file);
-      status_flush (persist->file);
+      int i;
+
+      if (!persist->compacted || persist->n_records + pool->n_dirty > pool->size)
+	{
+	  status_reset (persist->file);
+	  ifconfig_pool_list (pool, persist->file);
+	  status_flush (persist->file);
+	  persist->n_records = 0;
+	  for (i = 0; i < pool->size; ++i)
+	    if (pool->list[i].common_name)
+	      ++persist->n_records;
+	  persist->compacted = true;
+	}
+      else if (pool->n_dirty)
+	{
+	  struct gc_arena gc = gc_new ();
+	  status_seek_end (persist->file);
+	  for (i = 0; i < pool->n_dirty; ++i)
+	    {
+	      const int h = pool->dirty[i];
+	      const struct ifconfig_pool_entry *e = &pool->list[h];
+	      status_printf (persist->file, "%s,%s",
+			     e->common_name ? e->common_name : "",
+			     print_in_addr_t (ifconfig_pool_handle_to_ip_base (pool, h), 0, &gc));
+	    }
+	  persist->n_records += pool->n_dirty;
+	  dmsg (D_IFCONFIG_POOL, "IFCONFIG POOL: wrote %d changed entries", pool->n_dirty);
+	  gc_free (&gc);
+	}
+
+      for (i = 0; i < pool->n_dirty; ++i)
+	pool->list[pool->dirty[i]].dirty = false;
+      pool->n_dirty = 0;
     }
 }
 
@@ -45,8 +45,23 @@ struct ifconfig_pool_entry
   char *common_name;
   time_t last_release;
   bool fixed;
+
+  /* free list links, -1 terminated */
+  int free_prev;
+  int free_next;
+
+  /* common_name changed since last ifconfig_pool_write */
+  bool dirty;
 };
 
+/*
+ * Unused entries which may be handed out to any client are
+ * kept on a free list in order of release, so that the
+ * least recently used address is at the head.  Unused entries
+ * which still carry a common name are also indexed by
+ * common name, so that a returning client gets its previous
+ * address back without scanning the pool.
+ */
 struct ifconfig_pool
 {
   in_addr_t base;
@@ -54,12 +69,24 @@ struct ifconfig_pool
   int type;
   bool duplicate_cn;
   struct ifconfig_pool_entry *list;
+
+  int free_head;
+  int free_tail;
+  struct hash *cn_hash;
+
+  /* entries to be written by ifconfig_pool_write */
+  int *dirty;
+  int n_dirty;
 };
 
 struct ifconfig_pool_persist
 {
   struct status_output *file;
   bool fixed;
+
+  /* number of records in file, and whether it has been rewritten since it was read */
+  int n_records;
+  bool compacted;
 };
 
 typedef int ifconfig_pool_handle;
@@ -70,6 +97,8 @@ void ifconfig_pool_free (struct ifconfig_pool *pool);
 
 ifconfig_pool_handle ifconfig_pool_acquire (struct ifconfig_pool *pool, in_addr_t *local, in_addr_t *remote, const char *common_name);
 
+bool ifconfig_pool_acquire_handle (struct ifconfig_pool *pool, ifconfig_pool_handle hand, const char *common_name);
+
 bool ifconfig_pool_release (struct ifconfig_pool* pool, ifconfig_pool_handle hand, const bool hard);
 
 struct ifconfig_pool_persist *ifconfig_pool_persist_init (const char *filename, int refresh_freq);
@@ -77,7 +106,7 @@ void ifconfig_pool_persist_close (struct ifconfig_pool_persist *persist);
 bool ifconfig_pool_write_trigger (struct ifconfig_pool_persist *persist);
 
 void ifconfig_pool_read (struct ifconfig_pool_persist *persist, struct ifconfig_pool *pool);
-void ifconfig_pool_write (struct ifconfig_pool_persist *persist, const struct ifconfig_pool *pool);
+void ifconfig_pool_write (struct ifconfig_pool_persist *persist, struct ifconfig_pool *pool);
 
 #ifdef IFCONFIG_POOL_TEST
 void ifconfig_pool_test (in_addr_t start, in_addr_t end);
@@ -68,6 +68,7 @@ struct openvpn_iphdr {
 
   uint8_t    ttl;
 
+# define OPENVPN_IPPROTO_ICMP 1 /* ICMP protocol */
 # define OPENVPN_IPPROTO_IGMP 2 /* IGMP protocol */
 # define OPENVPN_IPPROTO_TCP  6 /* TCP protocol */
 # define OPENVPN_IPPROTO_UDP 17 /* UDP protocol */
@@ -79,6 +80,25 @@ struct openvpn_iphdr {
   /*The options start here. */
 };
 
+/*
+ * ARP packet for IPv4 over ethernet (RFC 826).  Protocol
+ * addresses are byte arrays since they are not aligned.
+ */
+struct openvpn_arp {
+# define OPENVPN_ARP_HTYPE_ETHER 1
+  uint16_t htype;                     /* hardware address type */
+  uint16_t ptype;                     /* protocol address type */
+  uint8_t  hlen;                      /* hardware address length */
+  uint8_t  plen;                      /* protocol address length */
+# define OPENVPN_ARP_REQUEST 1
+# define OPENVPN_ARP_REPLY   2
+  uint16_t op;
+  uint8_t  sha[OPENVPN_ETH_ALEN];     /* sender hardware address */
+  uint8_t  spa[4];                    /* sender protocol address */
+  uint8_t  tha[OPENVPN_ETH_ALEN];     /* target hardware address */
+  uint8_t  tpa[4];                    /* target protocol address */
+};
+
 /*
  * UDP header
  */
@@ -106,9 +106,14 @@ incoming_push_message (struct context *c, const struct buffer *buffer)
     msg (D_PUSH_ERRORS, "WARNING: Received bad push/pull message: %s", BSTR (buffer));
   else if (status == PUSH_MSG_REPLY)
     {
-      do_up (c, true, option_types_found); /* delay bringing tun/tap up until --push parms received from remote */
+      do_up (c, true, c->c2.push_option_types_found); /* delay bringing tun/tap up until --push parms received from remote */
       event_timeout_clear (&c->c2.push_request_interval);
     }
+  else if (status == PUSH_MSG_CONTINUATION)
+    {
+      /* more PUSH_REPLY messages are on their way, don't ask again yet */
+      event_timeout_reset (&c->c2.push_request_interval);
+    }
 
   gc_free (&gc);
 }
@@ -120,61 +125,217 @@ send_push_request (struct context *c)
 }
 
 #if P2MP_SERVER
+
+/*
+ * Push lists which don't fit in one control channel message
+ * are sent as several PUSH_REPLY messages, all but the last of
+ * which end with PUSH_CONTINUATION_MORE.
+ */
+#define PUSH_REPLY_PREFIX      "PUSH_REPLY"
+#define PUSH_CONTINUATION_MORE ",push-continuation 2"
+#define PUSH_CONTINUATION_LAST ",push-continuation 1"
+
+/*
+ * Room left in the last message for per-client options,
+ * i.e. ",ifconfig a.b.c.d e.f.g.h", ",peer-id n" and
+ * PUSH_CONTINUATION_LAST.
+ */
+#define PUSH_REPLY_RESERVE 96
+
+/*
+ * The PUSH_REPLY messages for a push_list, built once and
+ * then reused for every client which shares the push_list.
+ * msgs[0..n-2] are complete, while msgs[n-1] is completed
+ * for each client with its per-client options.
+ */
+struct push_reply_template
+{
+  int n;
+  const char **msgs;
+};
+
+/*
+ * Split a comma delimited push list into messages,
+ * returning the number of messages.  Messages are
+ * stored in msgs unless it is NULL.
+ */
+static int
+push_reply_split (const char *options, const char **msgs, struct gc_arena *gc)
+{
+  const int limit = MAX_PUSH_LIST_LEN - PUSH_REPLY_RESERVE;
+  const char *item = options;
+  int n = 0;
+  int len = 0;
+  const char *start = NULL;
+
+  while (item && *item)
+    {
+      const char *end = strchr (item, ',');
+      const int item_len = end ? end - item : (int) strlen (item);
+
+      if (start && len + 1 + item_len > limit)
+	{
+	  if (msgs)
+	    {
+	      struct buffer buf = alloc_buf_gc (MAX_PUSH_LIST_LEN, gc);
+	      buf_printf (&buf, PUSH_REPLY_PREFIX ",%.*s" PUSH_CONTINUATION_MORE, (int) (item - 1 - start), start);
+	      msgs[n] = BSTR (&buf);
+	    }
+	  ++n;
+	  start = NULL;
+	}
+      if (!start)
+	{
+	  start = item;
+	  len = sizeof (PUSH_REPLY_PREFIX) - 1;
+	}
+      len += 1 + item_len;
+      item = end ? end + 1 : NULL;
+    }
+
+  /* last message */
+  if (msgs)
+    {
+      struct buffer buf = alloc_buf_gc (MAX_PUSH_LIST_LEN, gc);
+      buf_printf (&buf, PUSH_REPLY_PREFIX);
+      if (start)
+	buf_printf (&buf, ",%s", start);
+      msgs[n] = BSTR (&buf);
+    }
+  return n + 1;
+}
+
+static const struct push_reply_template *
+push_reply_template_build (const struct push_list *pl, struct gc_arena *gc)
+{
+  struct push_reply_template *t;
+  const char *options = pl ? pl->options : NULL;
+
+  ALLOC_OBJ_CLEAR_GC (t, struct push_reply_template, gc);
+  t->n = push_reply_split (options, NULL, gc);
+  ALLOC_ARRAY_CLEAR_GC (t->msgs, const char *, t->n, gc);
+  push_reply_split (options, t->msgs, gc);
+
+  if (t->n > 1)
+    msg (D_PUSH, "PUSH: push list of %d bytes will be sent as %d PUSH_REPLY messages", pl->len, t->n);
+  return t;
+}
+
+/*
+ * Build the PUSH_REPLY template for the server-wide push list,
+ * before client instances start sharing it.
+ */
+void
+push_reply_template_init (struct options *o)
+{
+  if (o->push_list && !o->push_list->tmpl)
+    o->push_list->tmpl = push_reply_template_build (o->push_list, &o->gc);
+}
+
 bool
 send_push_reply (struct context *c)
 {
   struct gc_arena gc = gc_new ();
   struct buffer buf = alloc_buf_gc (MAX_PUSH_LIST_LEN + 256, &gc);
-  bool ret = false;
+  const struct push_reply_template *t;
+  bool ret = true;
+  int i;
 
-  buf_printf (&buf, "PUSH_REPLY");
+  /* the static part of the reply is only built once */
+  if (c->options.push_list)
+    {
+      push_reply_template_init (&c->options);
+      t = c->options.push_list->tmpl;
+    }
+  else
+    t = push_reply_template_build (NULL, &gc);
 
-  if (c->options.push_list && strlen (c->options.push_list->options))
-    buf_printf (&buf, ",%s", c->options.push_list->options);
+  for (i = 0; i < t->n - 1 && ret; ++i)
+    ret = send_control_channel_string (c, t->msgs[i], D_PUSH);
+
+  /* splice in per-client options */
+  buf_printf (&buf, "%s", t->msgs[t->n - 1]);
 
   if (c->c2.push_ifconfig_defined && c->c2.push_ifconfig_local && c->c2.push_ifconfig_remote_netmask)
     buf_printf (&buf, ",ifconfig %s %s",
 		print_in_addr_t (c->c2.push_ifconfig_local, 0, &gc),
 		print_in_addr_t (c->c2.push_ifconfig_remote_netmask, 0, &gc));
 
-  if (strlen (BSTR (&buf)) < MAX_PUSH_LIST_LEN)
-    ret = send_control_channel_string (c, BSTR (&buf), D_PUSH);
-  else
-    msg (M_WARN, "Maximum length of --push buffer (%d) has been exceeded", MAX_PUSH_LIST_LEN);
+  /* tell a client which understands P_DATA_V2 its peer-id */
+  if (c->c2.tls_multi
+      && c->c2.tls_multi->peer_id != TLS_PEER_ID_UNDEF
+      && c->c2.tls_multi->iv_proto >= TLS_IV_PROTO)
+    buf_printf (&buf, ",peer-id %u", (unsigned int) c->c2.tls_multi->peer_id);
+
+  if (t->n > 1)
+    buf_printf (&buf, PUSH_CONTINUATION_LAST);
+
+  if (ret)
+    {
+      if (strlen (BSTR (&buf)) < MAX_PUSH_LIST_LEN)
+	ret = send_control_channel_string (c, BSTR (&buf), D_PUSH);
+      else
+	{
+	  msg (M_WARN, "Maximum length of PUSH_REPLY message (%d) has been exceeded", MAX_PUSH_LIST_LEN);
+	  ret = false;
+	}
+    }
 
   gc_free (&gc);
   return ret;
 }
 
+/*
+ * Make room for n more characters in a push_list,
+ * taking a private copy of a shared options string.
+ */
+static void
+push_list_reserve (struct push_list *pl, const int n, struct gc_arena *gc)
+{
+  if (pl->shared || pl->len + n + 1 > pl->capacity)
+    {
+      int capacity = max_int (pl->capacity, 256);
+      char *options;
+
+      while (pl->len + n + 1 > capacity)
+	capacity *= 2;
+      options = (char *) gc_malloc (capacity, false, gc);
+      if (pl->len)
+	memcpy (options, pl->options, pl->len);
+      options[pl->len] = '\0';
+      pl->options = options;
+      pl->capacity = capacity;
+      pl->shared = false;
+    }
+}
+
 void
 push_option (struct options *o, const char *opt, int msglevel)
 {
-  int len;
-  bool first = false;
+  const int len = strlen (opt);
 
   if (!string_class (opt, CC_ANY, CC_COMMA))
     {
       msg (msglevel, "PUSH OPTION FAILED (illegal comma (',') in string): '%s'", opt);
     }
+  else if (len + (int) sizeof (PUSH_REPLY_PREFIX) + 1 >= MAX_PUSH_LIST_LEN - PUSH_REPLY_RESERVE)
+    {
+      msg (msglevel, "PUSH OPTION FAILED (longer than one PUSH_REPLY message): '%s'", opt);
+    }
   else
     {
-      if (!o->push_list)
-	{
-	  ALLOC_OBJ_CLEAR_GC (o->push_list, struct push_list, &o->gc);
-	  first = true;
-	}
+      struct push_list *pl;
 
-      len = strlen (o->push_list->options);
-      if (len + strlen (opt) + 2 >= MAX_PUSH_LIST_LEN)
-	{
-	  msg (msglevel, "Maximum length of --push buffer (%d) has been exceeded", MAX_PUSH_LIST_LEN);
-	}
-      else
-	{
-	  if (!first)
-	    strcat (o->push_list->options, ",");
-	  strcat (o->push_list->options, opt);
-	}
+      if (!o->push_list)
+	ALLOC_OBJ_CLEAR_GC (o->push_list, struct push_list, &o->gc);
+      pl = o->push_list;
+
+      push_list_reserve (pl, len + 1, &o->gc);
+      if (pl->len)
+	pl->options[pl->len++] = ',';
+      memcpy (pl->options + pl->len, opt, len + 1);
+      pl->len += len;
+      pl->tmpl = NULL;
     }
 }
 
@@ -198,6 +359,11 @@ process_incoming_push_msg (struct context *c,
 #if P2MP_SERVER
   if (buf_string_compare_advance (&buf, "PUSH_REQUEST"))
     {
+#ifdef ENABLE_DEFERRED_AUTH
+      if (tls_authentication_pending (c->c2.tls_multi))
+	ret = PUSH_MSG_REQUEST_DEFERRED;
+      else
+#endif
       if (!tls_authenticated (c->c2.tls_multi) || c->c2.context_auth == CAS_FAILED)
 	{
 	  send_auth_failed (c);
@@ -222,17 +388,41 @@ process_incoming_push_msg (struct context *c,
       const uint8_t ch = buf_read_u8 (&buf);
       if (ch == ',')
 	{
-	  pre_pull_restore (&c->options);
-	  c->c2.pulled_options_string = string_alloc (BSTR (&buf), &c->c2.gc);
+	  if (!c->c2.push_continuation_pending)
+	    {
+	      pre_pull_restore (&c->options);
+	      c->c2.pulled_options_string = string_alloc (BSTR (&buf), &c->c2.gc);
+	      c->c2.push_option_types_found = 0;
+	    }
+	  else
+	    {
+	      /* continuation of the previous PUSH_REPLY */
+	      struct buffer s = alloc_buf_gc (strlen (c->c2.pulled_options_string) + BLEN (&buf) + 2, &c->c2.gc);
+	      buf_printf (&s, "%s,%s", c->c2.pulled_options_string, BSTR (&buf));
+	      c->c2.pulled_options_string = BSTR (&s);
+	    }
+	  c->c2.push_continuation_pending = false;
+	  c->options.push_continuation = 0;
 	  if (apply_push_options (&c->options,
 				  &buf,
 				  permission_mask,
 				  option_types_found,
 				  c->c2.es))
-	    ret = PUSH_MSG_REPLY;
+	    {
+	      c->c2.push_option_types_found |= *option_types_found;
+	      if (c->options.push_continuation == 2)
+		{
+		  c->c2.push_continuation_pending = true;
+		  ret = PUSH_MSG_CONTINUATION;
+		}
+	      else
+		ret = PUSH_MSG_REPLY;
+	    }
 	}
       else if (ch == '\0')
 	{
+	  if (!c->c2.push_continuation_pending)
+	    c->c2.push_option_types_found = 0;
 	  ret = PUSH_MSG_REPLY;
 	}
       /* show_settings (&c->options); */
@@ -250,17 +440,19 @@ remove_iroutes_from_push_route_list (struct options *o)
   if (o && o->push_list && o->iroutes)
     {
       struct gc_arena gc = gc_new ();
-      struct push_list *pl;
+      struct push_list *pl = o->push_list;
       struct buffer in, out;
+      char *options;
       char *line;
       bool first = true;
+      bool changed = false;
 
       /* prepare input and output buffers */
-      ALLOC_OBJ_CLEAR_GC (pl, struct push_list, &gc);
+      ALLOC_ARRAY_CLEAR_GC (options, char, pl->len + 1, &o->gc);
       ALLOC_ARRAY_CLEAR_GC (line, char, MAX_PUSH_LIST_LEN, &gc);
 
-      buf_set_read (&in, (const uint8_t*) o->push_list->options, strlen (o->push_list->options));
-      buf_set_write (&out, (uint8_t*) pl->options, sizeof (pl->options));
+      buf_set_read (&in, (const uint8_t*) pl->options, pl->len);
+      buf_set_write (&out, (uint8_t*) options, pl->len + 1);
 
       /* cycle through the push list */
       while (buf_parse (&in, ',', line, MAX_PUSH_LIST_LEN))
@@ -307,16 +499,26 @@ remove_iroutes_from_push_route_list (struct options *o)
 	      first = false;
 	    }
 	  else
-	    msg (D_PUSH, "REMOVE PUSH ROUTE: '%s'", line);
+	    {
+	      msg (D_PUSH, "REMOVE PUSH ROUTE: '%s'", line);
+	      changed = true;
+	    }
 	}
 
 #if 0
-      msg (M_INFO, "BEFORE: '%s'", o->push_list->options);
-      msg (M_INFO, "AFTER:  '%s'", pl->options);
+      msg (M_INFO, "BEFORE: '%s'", pl->options);
+      msg (M_INFO, "AFTER:  '%s'", options);
 #endif
 
       /* copy new push list back to options */
-      *o->push_list = *pl;
+      if (changed)
+	{
+	  pl->options = options;
+	  pl->len = strlen (options);
+	  pl->capacity = pl->len + 1;
+	  pl->shared = false;
+	  pl->tmpl = NULL;
+	}
 
       gc_free (&gc);
     }
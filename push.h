@@ -34,6 +34,7 @@
 #define PUSH_MSG_REPLY            2
 #define PUSH_MSG_REQUEST_DEFERRED 3
 #define PUSH_MSG_AUTH_FAILURE     4
+#define PUSH_MSG_CONTINUATION     5
 
 void incoming_push_message (struct context *c,
 			    const struct buffer *buffer);
@@ -56,6 +57,8 @@ void push_reset (struct options *o);
 
 bool send_push_reply (struct context *c);
 
+void push_reply_template_init (struct options *o);
+
 void remove_iroutes_from_push_route_list (struct options *o);
 
 bool send_auth_failed (struct context *c);
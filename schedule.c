@@ -62,7 +62,7 @@ schedule_entry_debug_info (const char *caller, const struct schedule_entry *e)
     {
       dmsg (D_SCHEDULER, "SCHEDULE: %s wakeup=[%s] pri=%u",
 	   caller,
-	   tv_string_abs (&e->tv, &gc),
+	   tv_string (&e->tv, &gc),
 	   e->pri);
     }
   else
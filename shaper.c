@@ -95,6 +95,75 @@ shaper_msg (struct shaper *s)
        s->bytes_per_second);
 }
 
-#else
-static void dummy(void) {}
 #endif /* HAVE_GETTIMEOFDAY */
+
+void
+token_bucket_init (struct token_bucket *tb, int bytes_per_second, struct token_bucket *parent)
+{
+  CLEAR (*tb);
+  if (bytes_per_second)
+    {
+      tb->bytes_per_second = constrain_int (bytes_per_second, SHAPER_MIN, SHAPER_MAX);
+      tb->burst = max_int (tb->bytes_per_second / 10, TOKEN_BUCKET_BURST_MIN);
+      tb->tokens = tb->burst;
+    }
+  tb->last = now_tv;
+  tb->parent = parent;
+}
+
+static void
+token_bucket_refill (struct token_bucket *tb)
+{
+  const int elapsed = tv_elapsed_usec (&tb->last, SHAPER_MAX_TIMEOUT);
+  if (elapsed > 0)
+    {
+      tb->tokens += (double)elapsed * (double)tb->bytes_per_second / 1000000.0;
+      if (tb->tokens > tb->burst)
+	tb->tokens = tb->burst;
+      tb->last = now_tv;
+    }
+}
+
+bool
+token_bucket_conform (struct token_bucket *tb)
+{
+  for (; tb; tb = tb->parent)
+    {
+      if (tb->bytes_per_second)
+	{
+	  token_bucket_refill (tb);
+	  if (tb->tokens <= 0.0)
+	    return false;
+	}
+    }
+  return true;
+}
+
+void
+token_bucket_consume (struct token_bucket *tb, int nbytes)
+{
+  for (; tb; tb = tb->parent)
+    {
+      if (tb->bytes_per_second)
+	tb->tokens -= nbytes;
+    }
+}
+
+int
+token_bucket_delay (struct token_bucket *tb)
+{
+  int delay = 0;
+  for (; tb; tb = tb->parent)
+    {
+      if (tb->bytes_per_second)
+	{
+	  token_bucket_refill (tb);
+	  if (tb->tokens <= 0.0)
+	    {
+	      const double usec = (1.0 - tb->tokens) * 1000000.0 / (double)tb->bytes_per_second;
+	      delay = max_int (delay, min_int ((int)usec + 1, SHAPER_MAX_TIMEOUT * 1000000));
+	    }
+	}
+    }
+  return delay;
+}
@@ -27,24 +27,25 @@
 
 /*#define SHAPER_DEBUG*/
 
-#ifdef HAVE_GETTIMEOFDAY
-
 #include "basic.h"
 #include "integer.h"
 #include "misc.h"
 #include "error.h"
 #include "interval.h"
-
-/*
- * A simple traffic shaper for
- * the output direction.
- */
+#include "common.h"
 
 #define SHAPER_MIN 100          /* bytes per second */
 #define SHAPER_MAX 100000000
 
 #define SHAPER_MAX_TIMEOUT 10   /* seconds */
 
+#ifdef HAVE_GETTIMEOFDAY
+
+/*
+ * A simple traffic shaper for
+ * the output direction.
+ */
+
 #define SHAPER_USE_FP
 
 struct shaper 
@@ -104,13 +105,11 @@ shaper_current_bandwidth (struct shaper *s)
 static inline int
 shaper_delay (struct shaper* s)
 {
-  struct timeval tv;
   int delay = 0;
 
   if (tv_defined (&s->wakeup))
     {
-      ASSERT (!gettimeofday (&tv, NULL));
-      delay = tv_subtract (&s->wakeup, &tv, SHAPER_MAX_TIMEOUT);
+      delay = -tv_elapsed_usec (&s->wakeup, SHAPER_MAX_TIMEOUT);
 #ifdef SHAPER_DEBUG
       dmsg (D_SHAPER_DEBUG, "SHAPER shaper_delay delay=%d", delay);
 #endif
@@ -143,8 +142,7 @@ shaper_wrote_bytes (struct shaper* s, int nbytes)
 
   if (tv.tv_usec)
     {
-      ASSERT (!gettimeofday (&s->wakeup, NULL));
-      tv_add (&s->wakeup, &tv);
+      tv_future (&s->wakeup, &tv);
 
 #ifdef SHAPER_DEBUG
       dmsg (D_SHAPER_DEBUG, "SHAPER shaper_wrote_bytes bytes=%d delay=%d sec=%d usec=%d",
@@ -175,4 +173,52 @@ shaper_change_pct (struct shaper *s, int pct)
 
 #endif /* HAVE_GETTIMEOFDAY */
 
+/*
+ * A token bucket, used to limit the bandwidth
+ * of individual clients in server mode.
+ *
+ * Buckets may be chained to a parent bucket, in which
+ * case traffic must conform to both, so that per-client
+ * limits may be combined with an aggregate limit.
+ *
+ * Traffic conforms whenever the bucket is not empty,
+ * and a packet larger than the remaining tokens puts
+ * the bucket into debt, so that a bucket never stalls
+ * on packets which are larger than its burst size.
+ */
+
+#define TOKEN_BUCKET_BURST_MIN 4096 /* bytes */
+
+struct token_bucket
+{
+  int bytes_per_second;        /* 0 if unlimited */
+  int burst;                   /* maximum number of tokens */
+  double tokens;
+  struct timeval last;         /* time of last refill (now_tv) */
+  struct token_bucket *parent;
+};
+
+void token_bucket_init (struct token_bucket *tb, int bytes_per_second, struct token_bucket *parent);
+
+/* may traffic be sent now? */
+bool token_bucket_conform (struct token_bucket *tb);
+
+/* account for nbytes of traffic sent */
+void token_bucket_consume (struct token_bucket *tb, int nbytes);
+
+/* microseconds until traffic will conform */
+int token_bucket_delay (struct token_bucket *tb);
+
+/* does this bucket, or one of its parents, limit traffic? */
+static inline bool
+token_bucket_defined (const struct token_bucket *tb)
+{
+  for (; tb; tb = tb->parent)
+    {
+      if (tb->bytes_per_second)
+	return true;
+    }
+  return false;
+}
+
 #endif
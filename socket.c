@@ -36,6 +36,7 @@
 #include "misc.h"
 #include "gremlin.h"
 #include "plugin.h"
+#include "handoff.h"
 
 #include "memdbg.h"
 
@@ -1012,6 +1013,14 @@ link_socket_init_phase1 (struct link_socket *sock,
       ASSERT (socket_defined (inetd_socket_descriptor));
       sock->sd = inetd_socket_descriptor;
     }
+#ifdef ENABLE_HANDOFF
+  /* or by a server which handed its socket over to us? */
+  else if (sock->info.proto == PROTO_UDPv4
+	   && socket_defined (sock->sd = handoff_take_socket (&sock->info.lsa->local)))
+    {
+      msg (M_INFO, "UDPv4 socket taken over from the old server");
+    }
+#endif
   else if (mode != LS_MODE_TCP_ACCEPT_FROM)
     {
       create_socket (sock);
@@ -701,6 +701,118 @@ tls_authenticated (struct tls_multi *multi)
   return false;
 }
 
+#ifdef ENABLE_DEFERRED_AUTH
+/*
+ * Return true if username/password verification is
+ * still waiting for a --script-async script or a
+ * deferred plug-in call.
+ */
+bool
+tls_authentication_pending (const struct tls_multi *multi)
+{
+  if (multi)
+    {
+      int i, j;
+      for (i = 0; i < TM_SIZE; ++i)
+	for (j = 0; j < KS_SIZE; ++j)
+	  if (multi->session[i].key[j].auth_username)
+	    return true;
+    }
+  return false;
+}
+#endif
+
+#ifdef ENABLE_ASYNC_SCRIPT
+/*
+ * If a username/password verification script is
+ * running under --script-async, set tv to the time
+ * at which the earliest such script should next be
+ * polled, and return true.
+ */
+bool
+tls_authentication_next_poll (const struct tls_multi *multi, struct timeval *tv)
+{
+  bool ret = false;
+  if (multi)
+    {
+      int i, j;
+      for (i = 0; i < TM_SIZE; ++i)
+	for (j = 0; j < KS_SIZE; ++j)
+	  {
+	    struct timeval poll;
+	    if (script_job_next_poll (&multi->session[i].key[j].auth_job, &poll))
+	      {
+		if (!ret || tv_lt (&poll, tv))
+		  *tv = poll;
+		ret = true;
+	      }
+	  }
+    }
+  return ret;
+}
+#endif
+
+#ifdef ENABLE_PLUGIN_DEFERRED
+/*
+ * Allow auth-user-pass-verify plug-ins to defer their
+ * outcome.  owner is passed to the plug-in notify
+ * callback when they complete.
+ */
+void
+tls_set_deferred_owner (struct tls_multi *multi, void *owner)
+{
+  if (multi)
+    multi->opt.deferred_owner = owner;
+}
+#endif
+
+/*
+ * Set the peer-id of a session.  If use is true, our data
+ * channel packets will carry it as P_DATA_V2.
+ */
+void
+tls_set_peer_id (struct tls_multi *multi, const uint32_t peer_id, const bool use)
+{
+  if (multi)
+    {
+      multi->peer_id = peer_id;
+      multi->use_peer_id = use;
+    }
+}
+
+/*
+ * Point an existing tunnel at a new --crl-verify file
+ * (or none).  The CRL is read at each verification, so
+ * the change applies from the next TLS negotiation.
+ */
+void
+tls_set_crl_file (struct tls_multi *multi, const char *crl_file)
+{
+  if (multi)
+    multi->opt.crl_file = crl_file;
+}
+
+/*
+ * The remote peer has moved to a new address, which it
+ * proved by sending an authenticated P_DATA_V2 packet from
+ * there.  Expect control channel packets from the new address.
+ */
+void
+tls_update_remote_addr (struct tls_multi *multi, const struct sockaddr_in *addr)
+{
+  if (multi)
+    {
+      int i, j;
+      for (i = 0; i < TM_SIZE; ++i)
+	for (j = 0; j < KS_SIZE; ++j)
+	  {
+	    struct key_state *ks = &multi->session[i].key[j];
+	    if (ks->state >= S_INITIAL && addr_defined (&ks->remote_addr))
+	      ks->remote_addr = *addr;
+	  }
+    }
+}
+
 void
 tls_deauthenticate (struct tls_multi *multi)
 {
@@ -1093,6 +1205,8 @@ packet_opcode_name (int op)
       return "P_ACK_V1";
     case P_DATA_V1:
       return "P_DATA_V1";
+    case P_DATA_V2:
+      return "P_DATA_V2";
     default:
       return "P_???";
     }
@@ -1471,6 +1585,42 @@ key_state_free (struct key_state *ks, bool clear)
 
   packet_id_free (&ks->packet_id);
 
+#ifdef ENABLE_ASYNC_SCRIPT
+  if (script_job_defined (&ks->auth_job))
+    {
+      if (ks->auth_file)
+	delete_file (ks->auth_file);
+      script_job_abort (&ks->auth_job);
+      ks->auth_file = NULL;
+    }
+#endif
+
+#ifdef ENABLE_PLUGIN_DEFERRED
+  if (ks->auth_plugin)
+    {
+      plugin_request_cancel (ks->auth_plugin);
+      free (ks->auth_plugin);
+      ks->auth_plugin = NULL;
+    }
+#endif
+
+#ifdef ENABLE_DEFERRED_AUTH
+  if (ks->auth_username)
+    {
+      free (ks->auth_username);
+      ks->auth_username = NULL;
+    }
+#endif
+
+#ifdef ENABLE_HANDOFF
+  if (ks->handoff_key)
+    {
+      CLEAR (*ks->handoff_key);
+      free (ks->handoff_key);
+      ks->handoff_key = NULL;
+    }
+#endif
+
   if (clear)
     CLEAR (*ks);
 }
@@ -1661,6 +1811,8 @@ tls_multi_init (struct tls_options *tls_options)
   ret->key_scan[1] = &ret->session[TM_ACTIVE].key[KS_LAME_DUCK];
   ret->key_scan[2] = &ret->session[TM_LAME_DUCK].key[KS_LAME_DUCK];
 
+  ret->peer_id = TLS_PEER_ID_UNDEF;
+
   return ret;
 }
 
@@ -2079,9 +2231,53 @@ openvpn_PRF (const uint8_t *secret,
   VALGRIND_MAKE_READABLE ((void *)output, output_len);
 }
 
+/*
+ * Where should the server keep a copy of the data channel
+ * key material for --handoff?  NULL if it shouldn't.
+ */
+static struct key2 *
+handoff_key (const struct tls_session *session, struct key_state *ks)
+{
+#ifdef ENABLE_HANDOFF
+  if (session->opt->handoff)
+    {
+      if (!ks->handoff_key)
+	ALLOC_OBJ_CLEAR (ks->handoff_key, struct key2);
+      return ks->handoff_key;
+    }
+#endif
+  return NULL;
+}
+
+/*
+ * Initialize data channel encrypt/decrypt contexts
+ * from a key2 produced by generate_key_expansion.
+ */
+static void
+init_key_ctx_bi_key2 (struct key_ctx_bi *key,
+		      struct key2 *key2,
+		      const struct key_type *key_type,
+		      bool server)
+{
+  ASSERT (server == true || server == false);
+
+  init_key_ctx (&key->encrypt,
+		&key2->keys[(int)server],
+		key_type,
+		DO_ENCRYPT,
+		"Data Channel Encrypt");
+
+  init_key_ctx (&key->decrypt,
+		&key2->keys[1-(int)server],
+		key_type,
+		DO_DECRYPT,
+		"Data Channel Decrypt");
+}
+
 /* 
  * Using source entropy from local and remote hosts, mix into
- * master key.
+ * master key.  If save is not NULL, a copy of the expanded
+ * key material is left there.
  */
 static bool
 generate_key_expansion (struct key_ctx_bi *key,
@@ -2089,7 +2285,8 @@ generate_key_expansion (struct key_ctx_bi *key,
 			const struct key_source2 *key_src,
 			const struct session_id *client_sid,
 			const struct session_id *server_sid,
-			bool server)
+			bool server,
+			struct key2 *save)
 {
   uint8_t master[48];
   struct key2 key2;
@@ -2144,20 +2341,10 @@ generate_key_expansion (struct key_ctx_bi *key,
     }
 
   /* Initialize OpenSSL key contexts */
+  init_key_ctx_bi_key2 (key, &key2, key_type, server);
 
-  ASSERT (server == true || server == false);
-
-  init_key_ctx (&key->encrypt,
-		&key2.keys[(int)server],
-		key_type,
-		DO_ENCRYPT,
-		"Data Channel Encrypt");
-
-  init_key_ctx (&key->decrypt,
-		&key2.keys[1-(int)server],
-		key_type,
-		DO_DECRYPT,
-		"Data Channel Decrypt");
+  if (save)
+    *save = key2;
 
   ret = true;
 
@@ -2295,7 +2482,7 @@ read_string (struct buffer *buf, char *str, const unsigned int capacity)
  */
 
 static bool
-verify_user_pass_script (struct tls_session *session, const struct user_pass *up)
+verify_user_pass_script (struct tls_session *session, struct key_state *auth_ks, const struct user_pass *up)
 {
   struct gc_arena gc = gc_new ();
   struct buffer cmd = alloc_buf_gc (256, &gc);
@@ -2339,14 +2526,28 @@ verify_user_pass_script (struct tls_session *session, const struct user_pass *up
       /* format command line */
       buf_printf (&cmd, "%s %s", session->opt->auth_user_pass_verify_script, tmp_file);
       
-      /* call command */
-      retval = openvpn_system (BSTR (&cmd), session->opt->es, S_SCRIPT);
+#ifdef ENABLE_ASYNC_SCRIPT
+      if (auth_ks && script_async_enabled ())
+	{
+	  /* outcome is collected by verify_user_pass_script_check */
+	  script_job_start (&auth_ks->auth_job, BSTR (&cmd), session->opt->es, S_SCRIPT);
+	  if (strlen (tmp_file) > 0)
+	    auth_ks->auth_file = string_alloc (tmp_file, &auth_ks->auth_job.gc);
+	  tmp_file = "";
+	  ret = true;
+	}
+      else
+#endif
+	{
+	  /* call command */
+	  retval = openvpn_system (BSTR (&cmd), session->opt->es, S_SCRIPT);
 
-      /* test return status of command */
-      if (system_ok (retval))
-	ret = true;
-      else if (!system_executed (retval))
-	msg (D_TLS_ERRORS, "TLS Auth Error: user-pass-verify script failed to execute: %s", BSTR (&cmd));
+	  /* test return status of command */
+	  if (system_ok (retval))
+	    ret = true;
+	  else if (!system_executed (retval))
+	    msg (D_TLS_ERRORS, "TLS Auth Error: user-pass-verify script failed to execute: %s", BSTR (&cmd));
+	}
 	  
       if (!session->opt->auth_user_pass_verify_script_via_file)
 	setenv_del (session->opt->es, "password");
@@ -2365,7 +2566,7 @@ verify_user_pass_script (struct tls_session *session, const struct user_pass *up
 }
 
 static bool
-verify_user_pass_plugin (struct tls_session *session, const struct user_pass *up, const char *raw_username)
+verify_user_pass_plugin (struct tls_session *session, struct key_state *auth_ks, const struct user_pass *up, const char *raw_username)
 {
   int retval;
   bool ret = false;
@@ -2384,9 +2585,24 @@ verify_user_pass_plugin (struct tls_session *session, const struct user_pass *up
       setenv_untrusted (session);
 
       /* call command */
-      retval = plugin_call (session->opt->plugins, OPENVPN_PLUGIN_AUTH_USER_PASS_VERIFY, NULL, session->opt->es);
+#ifdef ENABLE_PLUGIN_DEFERRED
+      if (auth_ks)
+	{
+	  /* a deferred outcome is collected by verify_user_pass_deferred_check */
+	  ALLOC_OBJ_CLEAR (auth_ks->auth_plugin, struct plugin_request);
+	  retval = plugin_call_deferred (session->opt->plugins, OPENVPN_PLUGIN_AUTH_USER_PASS_VERIFY, NULL, session->opt->es,
+					 auth_ks->auth_plugin, session->opt->deferred_owner);
+	  if (retval != OPENVPN_PLUGIN_FUNC_DEFERRED)
+	    {
+	      free (auth_ks->auth_plugin);
+	      auth_ks->auth_plugin = NULL;
+	    }
+	}
+      else
+#endif
+	retval = plugin_call (session->opt->plugins, OPENVPN_PLUGIN_AUTH_USER_PASS_VERIFY, NULL, session->opt->es);
 
-      if (!retval)
+      if (retval != OPENVPN_PLUGIN_FUNC_ERROR)
 	ret = true;
 
       setenv_del (session->opt->es, "password");
@@ -2400,6 +2616,139 @@ verify_user_pass_plugin (struct tls_session *session, const struct user_pass *up
   return ret;
 }
 
+/*
+ * Act on the outcome of username/password verification.
+ */
+static void
+verify_user_pass_result (struct tls_session *session, struct key_state *auth_ks, const bool ok, const char *username)
+{
+  if (ok)
+    {
+      auth_ks->authenticated = true;
+      if (session->opt->username_as_common_name)
+	set_common_name (session, username);
+      msg (D_HANDSHAKE, "TLS: Username/Password authentication succeeded for username '%s' %s",
+	   username,
+	   session->opt->username_as_common_name ? "[CN SET]" : "");
+    }
+  else
+    {
+      msg (D_TLS_ERRORS, "TLS Auth Error: Auth Username/Password verification failed for peer");
+    }
+}
+
+/*
+ * Authentication checks which follow username/password
+ * verification, or certificate verification if there is none.
+ */
+static void
+verify_final_auth_checks (struct tls_multi *multi, struct tls_session *session, struct key_state *auth_ks)
+{
+  struct gc_arena gc = gc_new ();
+
+  /* Don't allow the CN to change once it's been locked */
+  if (auth_ks->authenticated && multi->locked_cn)
+    {
+      const char *cn = session->common_name;
+      if (cn && strcmp (cn, multi->locked_cn))
+	{
+	  msg (D_TLS_ERRORS, "TLS Auth Error: TLS object CN attempted to change from '%s' to '%s' -- tunnel disabled",
+	       multi->locked_cn,
+	       cn);
+
+	  /* change the common name back to its original value and disable the tunnel */
+	  set_common_name (session, multi->locked_cn);
+	  tls_deauthenticate (multi);
+	}
+    }
+
+  /* verify --client-config-dir based authentication */
+  if (auth_ks->authenticated && session->opt->client_config_dir_exclusive)
+    {
+      const char *cn = session->common_name;
+      const char *path = gen_path (session->opt->client_config_dir_exclusive, cn, &gc);
+      if (!cn || !strcmp (cn, CCD_DEFAULT) || !test_file (path))
+	{
+	  auth_ks->authenticated = false;
+	  msg (D_TLS_ERRORS, "TLS Auth Error: --client-config-dir authentication failed for common name '%s' file='%s'",
+	       session->common_name,
+	       path ? path : "UNDEF");
+	}
+    }
+
+  gc_free (&gc);
+}
+
+/*
+ * Is the outcome of username/password verification
+ * for auth_ks still pending?
+ */
+static inline bool
+key_state_auth_deferred (const struct key_state *auth_ks)
+{
+#ifdef ENABLE_ASYNC_SCRIPT
+  if (script_job_defined (&auth_ks->auth_job))
+    return true;
+#endif
+#ifdef ENABLE_PLUGIN_DEFERRED
+  if (auth_ks->auth_plugin && plugin_request_pending (auth_ks->auth_plugin))
+    return true;
+#endif
+  return false;
+}
+
+#ifdef ENABLE_DEFERRED_AUTH
+/*
+ * Collect the outcome of an --auth-user-pass-verify
+ * script which was run under --script-async, and of
+ * plug-in calls which were deferred, and act on it
+ * once all of them are done.
+ */
+static void
+verify_user_pass_deferred_check (struct tls_multi *multi, struct tls_session *session, struct key_state *auth_ks)
+{
+#ifdef ENABLE_ASYNC_SCRIPT
+  if (script_job_defined (&auth_ks->auth_job) && script_job_poll (&auth_ks->auth_job))
+    {
+      const int retval = auth_ks->auth_job.status;
+
+      if (!system_ok (retval))
+	{
+	  if (!system_executed (retval))
+	    msg (D_TLS_ERRORS, "TLS Auth Error: user-pass-verify script failed to execute: %s",
+		 auth_ks->auth_job.command);
+	  auth_ks->auth_deferred_ok = false;
+	}
+
+      if (auth_ks->auth_file)
+	delete_file (auth_ks->auth_file);
+
+      script_job_free (&auth_ks->auth_job);
+      auth_ks->auth_file = NULL;
+    }
+#endif
+
+#ifdef ENABLE_PLUGIN_DEFERRED
+  if (auth_ks->auth_plugin && !plugin_request_pending (auth_ks->auth_plugin))
+    {
+      if (auth_ks->auth_plugin->n_failed)
+	auth_ks->auth_deferred_ok = false;
+      free (auth_ks->auth_plugin);
+      auth_ks->auth_plugin = NULL;
+    }
+#endif
+
+  if (!key_state_auth_deferred (auth_ks))
+    {
+      verify_user_pass_result (session, auth_ks, auth_ks->auth_deferred_ok, auth_ks->auth_username);
+      verify_final_auth_checks (multi, session, auth_ks);
+
+      free (auth_ks->auth_username);
+      auth_ks->auth_username = NULL;
+    }
+}
+#endif
+
 /*
  * Handle the reading and writing of key data to and from
  * the TLS control channel (cleartext).
@@ -2478,6 +2827,23 @@ key_method_2_write (struct buffer *buf, struct tls_session *session)
 	goto error;
       purge_user_pass (&auth_user_pass, false);
     }
+  else if (session->opt->push_peer_info)
+    {
+      /* peer info must follow a (possibly empty) username/password */
+      if (!write_string (buf, "", -1))
+	goto error;
+      if (!write_string (buf, "", -1))
+	goto error;
+    }
+
+  /* write peer info, announcing the data channel features we support */
+  if (session->opt->push_peer_info)
+    {
+      char peer_info[32];
+      openvpn_snprintf (peer_info, sizeof (peer_info), "IV_PROTO=%d\n", TLS_IV_PROTO);
+      if (!write_string (buf, peer_info, -1))
+	goto error;
+    }
 
   /*
    * generate tunnel keys if server
@@ -2491,7 +2857,8 @@ key_method_2_write (struct buffer *buf, struct tls_session *session)
 				       ks->key_src,
 				       &ks->session_id_remote,
 				       &session->session_id,
-				       true))
+				       true,
+				       handoff_key (session, ks)))
 	    {
 	      msg (D_TLS_ERRORS, "TLS Error: server generate_key_expansion failed");
 	      goto error;
@@ -2638,24 +3005,21 @@ key_method_2_read (struct buffer *buf, struct tls_multi *multi, struct tls_sessi
 
       /* call plugin(s) and/or script */
       if (plugin_defined (session->opt->plugins, OPENVPN_PLUGIN_AUTH_USER_PASS_VERIFY))
-	s1 = verify_user_pass_plugin (session, up, raw_username);
+	s1 = verify_user_pass_plugin (session, ks, up, raw_username);
       if (session->opt->auth_user_pass_verify_script)
-	s2 = verify_user_pass_script (session, up);
-      
+	s2 = verify_user_pass_script (session, s1 ? ks : NULL, up);
+
       /* auth succeeded? */
-      if (s1 && s2)
+#ifdef ENABLE_DEFERRED_AUTH
+      if (key_state_auth_deferred (ks))
 	{
-	  ks->authenticated = true;
-	  if (session->opt->username_as_common_name)
-	    set_common_name (session, up->username);
-	  msg (D_HANDSHAKE, "TLS: Username/Password authentication succeeded for username '%s' %s",
-	       up->username,
-	       session->opt->username_as_common_name ? "[CN SET]" : "");
+	  /* outcome is collected by verify_user_pass_deferred_check */
+	  ks->auth_username = string_alloc (up->username, NULL);
+	  ks->auth_deferred_ok = s1 && s2;
 	}
       else
-	{
-	  msg (D_TLS_ERRORS, "TLS Auth Error: Auth Username/Password verification failed for peer");
-	}
+#endif
+	verify_user_pass_result (session, ks, s1 && s2, up->username);
 
       CLEAR (*up);
     }
@@ -2668,42 +3032,38 @@ key_method_2_read (struct buffer *buf, struct tls_multi *multi, struct tls_sessi
 	  goto error;
 	}
       ks->authenticated = true;
-    }
-
-  /* While it shouldn't really happen, don't allow the common name to be NULL */
-  if (!session->common_name)
-    set_common_name (session, "");
 
-  /* Don't allow the CN to change once it's been locked */
-  if (ks->authenticated && multi->locked_cn)
-    {
-      const char *cn = session->common_name;
-      if (cn && strcmp (cn, multi->locked_cn))
+      /* skip a username/password which we don't check, so that
+	 we can get at the peer info which may follow it */
+      if (session->opt->server && BLEN (buf) > 0)
 	{
-	  msg (D_TLS_ERRORS, "TLS Auth Error: TLS object CN attempted to change from '%s' to '%s' -- tunnel disabled",
-	       multi->locked_cn,
-	       cn);
-
-	  /* change the common name back to its original value and disable the tunnel */
-	  set_common_name (session, multi->locked_cn);
-	  tls_deauthenticate (multi);
+	  ALLOC_OBJ_CLEAR_GC (up, struct user_pass, &gc);
+	  if (read_string (buf, up->username, USER_PASS_LEN))
+	    read_string (buf, up->password, USER_PASS_LEN);
+	  CLEAR (*up);
 	}
     }
 
-  /* verify --client-config-dir based authentication */
-  if (ks->authenticated && session->opt->client_config_dir_exclusive)
+  /* get optional peer info from client */
+  if (session->opt->server)
     {
-      const char *cn = session->common_name;
-      const char *path = gen_path (session->opt->client_config_dir_exclusive, cn, &gc);
-      if (!cn || !strcmp (cn, CCD_DEFAULT) || !test_file (path))
-	{
-	  ks->authenticated = false;
-	  msg (D_TLS_ERRORS, "TLS Auth Error: --client-config-dir authentication failed for common name '%s' file='%s'",
-	       session->common_name,
-	       path ? path : "UNDEF");
-	}
+      char *peer_info;
+      const char *p;
+
+      ALLOC_ARRAY_CLEAR_GC (peer_info, char, TLS_PEER_INFO_LEN, &gc);
+      multi->iv_proto = 0;
+      if (BLEN (buf) > 0 && read_string (buf, peer_info, TLS_PEER_INFO_LEN)
+	  && (p = strstr (peer_info, "IV_PROTO=")) != NULL)
+	multi->iv_proto = atoi (p + 9);
+      dmsg (D_TLS_DEBUG, "TLS: peer info IV_PROTO=%d", multi->iv_proto);
     }
 
+  /* While it shouldn't really happen, don't allow the common name to be NULL */
+  if (!session->common_name)
+    set_common_name (session, "");
+
+  verify_final_auth_checks (multi, session, ks);
+
 #ifdef ENABLE_OCC
   /* check options consistency */
   if (!session->opt->disable_occ &&
@@ -2725,7 +3085,8 @@ key_method_2_read (struct buffer *buf, struct tls_multi *multi, struct tls_sessi
 				   ks->key_src,
 				   &session->session_id,
 				   &ks->session_id_remote,
-				   false))
+				   false,
+				   NULL))
 	{
 	  msg (D_TLS_ERRORS, "TLS Error: client generate_key_expansion failed");
 	  goto error;
@@ -3164,6 +3525,23 @@ tls_multi_process (struct tls_multi *multi,
 
   ERR_clear_error ();
 
+#ifdef ENABLE_DEFERRED_AUTH
+  /*
+   * Collect the outcome of deferred username/password
+   * verification.
+   */
+  for (i = 0; i < TM_SIZE; ++i)
+    {
+      int j;
+      for (j = 0; j < KS_SIZE; ++j)
+	{
+	  struct key_state *ks = &multi->session[i].key[j];
+	  if (ks->auth_username)
+	    verify_user_pass_deferred_check (multi, &multi->session[i], ks);
+	}
+    }
+#endif
+
   /*
    * Process each session object having state of S_INITIAL or greater,
    * and which has a defined remote IP addr.
@@ -3335,8 +3713,37 @@ tls_pre_decrypt (struct tls_multi *multi,
 	key_id = c & P_KEY_ID_MASK;
       }
 
-      if (op == P_DATA_V1)
+      if (op == P_DATA_V1 || op == P_DATA_V2)
 	{			/* data channel packet */
+	  int hdr_len = 1;
+
+	  /*
+	   * The server matched a P_DATA_V2 packet to this session
+	   * by its peer-id, perhaps from a new client address.
+	   * Such a packet is accepted from any address, provided
+	   * that it authenticates with the session's HMAC key.
+	   */
+	  if (op == P_DATA_V2)
+	    {
+	      const uint8_t *p = BPTR (buf);
+	      uint32_t peer_id;
+
+	      if (buf->len < 1 + TLS_PEER_ID_LEN || !multi->opt.server)
+		{
+		  msg (D_TLS_ERRORS, "TLS Error: unexpected P_DATA_V2 packet from %s",
+		       print_sockaddr (from, &gc));
+		  goto error;
+		}
+	      peer_id = (p[1] << 16) | (p[2] << 8) | p[3];
+	      if (peer_id != multi->peer_id)
+		{
+		  msg (D_TLS_ERRORS, "TLS Error: unknown peer-id %u in packet from %s",
+		       peer_id, print_sockaddr (from, &gc));
+		  goto error;
+		}
+	      hdr_len += TLS_PEER_ID_LEN;
+	    }
+
 	  for (i = 0; i < KEY_SCAN_SIZE; ++i)
 	    {
 	      struct key_state *ks = multi->key_scan[i];
@@ -3357,7 +3764,8 @@ tls_pre_decrypt (struct tls_multi *multi,
 	      if (DECRYPT_KEY_ENABLED (multi, ks)
 		  && key_id == ks->key_id
 		  && ks->authenticated
-		  && addr_port_match(from, &ks->remote_addr))
+		  && (addr_port_match(from, &ks->remote_addr)
+		      || (op == P_DATA_V2 && ks->key.decrypt.hmac)))
 		{
 		  /* return appropriate data channel decrypt key in opt */
 		  opt->key_ctx_bi = &ks->key;
@@ -3365,7 +3773,7 @@ tls_pre_decrypt (struct tls_multi *multi,
 		  opt->pid_persist = NULL;
 		  opt->flags &= multi->opt.crypto_flags_and;
 		  opt->flags |= multi->opt.crypto_flags_or;
-		  ASSERT (buf_advance (buf, 1));
+		  ASSERT (buf_advance (buf, hdr_len));
 		  ++ks->n_packets;
 		  ks->n_bytes += buf->len;
 		  dmsg (D_TLS_DEBUG,
@@ -3911,8 +4319,19 @@ tls_post_encrypt (struct tls_multi *multi, struct buffer *buf)
   if (buf->len > 0)
     {
       ASSERT (ks);
-      ASSERT (op = buf_prepend (buf, 1));
-      *op = (P_DATA_V1 << P_OPCODE_SHIFT) | ks->key_id;
+      if (multi->use_peer_id)
+	{
+	  ASSERT (op = buf_prepend (buf, 1 + TLS_PEER_ID_LEN));
+	  op[0] = (P_DATA_V2 << P_OPCODE_SHIFT) | ks->key_id;
+	  op[1] = (multi->peer_id >> 16) & 0xFF;
+	  op[2] = (multi->peer_id >> 8) & 0xFF;
+	  op[3] = multi->peer_id & 0xFF;
+	}
+      else
+	{
+	  ASSERT (op = buf_prepend (buf, 1));
+	  *op = (P_DATA_V1 << P_OPCODE_SHIFT) | ks->key_id;
+	}
       ++ks->n_packets;
       ks->n_bytes += buf->len;
     }
@@ -3977,6 +4396,122 @@ tls_rec_payload (struct tls_multi *multi,
   return ret;
 }
 
+#ifdef ENABLE_HANDOFF
+
+/*
+ * Serialize the active session and its primary key
+ * into buf, so that a newly exec'd server can take it
+ * over with tls_handoff_restore (--handoff).
+ *
+ * The lame duck key and any renegotiation in progress
+ * are dropped -- the client will renegotiate if needed.
+ */
+bool
+tls_handoff_save (const struct tls_multi *multi, struct buffer *buf)
+{
+  const struct tls_session *session = &multi->session[TM_ACTIVE];
+  const struct key_state *ks = &session->key[KS_PRIMARY];
+
+  if (ks->state < S_ACTIVE || !ks->authenticated
+      || !ks->handoff_key || !session->common_name)
+    return false;
+
+  return session_id_write (&session->session_id, buf)
+    && session_id_write (&ks->session_id_remote, buf)
+    && buf_write_u8 (buf, ks->key_id)
+    && buf_write_u8 (buf, session->key_id)
+    && buf_write_u32 (buf, (int) (now - ks->established))
+    && buf_write_u32 (buf, ks->n_bytes)
+    && buf_write_u32 (buf, ks->n_packets)
+    && buf_write_u8 (buf, multi->use_peer_id)
+    && buf_write_u8 (buf, multi->iv_proto)
+    && write_string (buf, session->common_name, -1)
+    && buf_write_u16 (buf, sizeof (ks->handoff_key->keys))
+    && buf_write (buf, ks->handoff_key->keys, sizeof (ks->handoff_key->keys))
+    && packet_id_save (&ks->packet_id, buf)
+    && packet_id_save (&session->tls_auth_pid, buf);
+}
+
+/*
+ * Rebuild a session saved by tls_handoff_save on a
+ * freshly initialized tls_multi.  The primary key goes
+ * straight to S_NORMAL, authenticated for remote.
+ */
+bool
+tls_handoff_restore (struct tls_multi *multi, struct buffer *buf, const struct sockaddr_in *remote)
+{
+  struct tls_session *session = &multi->session[TM_ACTIVE];
+  struct key_state *ks = &session->key[KS_PRIMARY];
+  char common_name[USER_PASS_LEN];
+  struct key2 key2;
+  int key_id, next_key_id, use_peer_id, iv_proto;
+  bool good = false;
+  uint32_t age, n_bytes = 0, n_packets = 0;
+  struct gc_arena gc = gc_new ();
+
+  CLEAR (key2);
+
+  if (!session_id_read (&session->session_id, buf)
+      || !session_id_read (&ks->session_id_remote, buf))
+    goto done;
+  if ((key_id = buf_read_u8 (buf)) < 0
+      || (next_key_id = buf_read_u8 (buf)) < 0)
+    goto done;
+  age = buf_read_u32 (buf, &good);
+  if (good)
+    n_bytes = buf_read_u32 (buf, &good);
+  if (good)
+    n_packets = buf_read_u32 (buf, &good);
+  if (!good)
+    goto done;
+  good = false;
+  if ((use_peer_id = buf_read_u8 (buf)) < 0
+      || (iv_proto = buf_read_u8 (buf)) < 0)
+    goto done;
+  if (!read_string (buf, common_name, sizeof (common_name)))
+    goto done;
+  if (buf_read_u16 (buf) != sizeof (key2.keys)
+      || !buf_read (buf, key2.keys, sizeof (key2.keys)))
+    goto done;
+  if (!packet_id_restore (&ks->packet_id, buf)
+      || !packet_id_restore (&session->tls_auth_pid, buf))
+    goto done;
+
+  key2.n = 2;
+  init_key_ctx_bi_key2 (&ks->key, &key2, &session->opt->key_type, true);
+  if (handoff_key (session, ks))
+    *ks->handoff_key = key2;
+
+  ks->key_id = key_id & P_KEY_ID_MASK;
+  session->key_id = next_key_id & P_KEY_ID_MASK;
+  ks->established = now - age;
+  ks->n_bytes = n_bytes;
+  ks->n_packets = n_packets;
+  ks->remote_addr = *remote;
+  ks->must_negotiate = 0;
+  ks->authenticated = true;
+  ks->state = S_NORMAL;
+  CLEAR (*ks->key_src);
+
+  set_common_name (session, common_name);
+  session->verified = true;
+  tls_lock_common_name (multi);
+  multi->use_peer_id = use_peer_id;
+  multi->iv_proto = iv_proto;
+
+  dmsg (D_TLS_DEBUG_MED, "TLS: handoff restore sid=%s key_id=%d",
+	session_id_print (&session->session_id, &gc),
+	ks->key_id);
+  good = true;
+
+ done:
+  CLEAR (key2);
+  gc_free (&gc);
+  return good;
+}
+
+#endif
+
 /*
  * Dump a human-readable rendition of an openvpn packet
  * into a garbage collectable string which is returned.
@@ -4013,6 +4548,14 @@ protocol_dump (struct buffer *buffer, unsigned int flags, struct gc_arena *gc)
 
   if (op == P_DATA_V1)
     goto print_data;
+  if (op == P_DATA_V2)
+    {
+      uint8_t peer_id[TLS_PEER_ID_LEN];
+      if (!buf_read (&buf, peer_id, sizeof (peer_id)))
+	goto done;
+      buf_printf (&out, " pid=%d", (peer_id[0] << 16) | (peer_id[1] << 8) | peer_id[2]);
+      goto print_data;
+    }
 
   /*
    * Session ID
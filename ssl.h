@@ -98,6 +98,12 @@
  *  P_DATA_V1 -- Data channel packet containing actual tunnel data
  *    ciphertext.
  *
+ *  P_DATA_V2 -- Like P_DATA_V1, but the opcode is followed by a
+ *    3 byte peer-id which the server assigned to the client, so
+ *    that the server can find the client's session even after the
+ *    client's address has changed.  Only sent by clients which
+ *    have been pushed a peer-id.
+ *
  *  P_CONTROL_HARD_RESET_CLIENT_V2 -- Key method 2, initial key from
  *   client, forget previous state.
  *
@@ -217,9 +223,22 @@
 #define P_CONTROL_HARD_RESET_CLIENT_V2 7     /* initial key from client, forget previous state */
 #define P_CONTROL_HARD_RESET_SERVER_V2 8     /* initial key from server, forget previous state */
 
+/* data channel packet with peer-id */
+#define P_DATA_V2                      9
+
 /* define the range of legal opcodes */
 #define P_FIRST_OPCODE                 1
-#define P_LAST_OPCODE                  8
+#define P_LAST_OPCODE                  9
+
+/* P_DATA_V2 peer-id follows the opcode, in network byte order */
+#define TLS_PEER_ID_LEN                3
+#define TLS_PEER_ID_UNDEF              0xFFFFFF
+
+/* data channel protocol version announced by clients in peer info (IV_PROTO) */
+#define TLS_IV_PROTO                   2
+
+/* max length of peer info string sent by client */
+#define TLS_PEER_INFO_LEN              256
 
 /* key negotiation states */
 #define S_ERROR          -1
@@ -367,6 +386,29 @@ struct key_state
    * If bad username/password, TLS connection will come up but 'authenticated' will be false.
    */
   bool authenticated;
+
+#ifdef ENABLE_DEFERRED_AUTH
+  /* username/password verification which has not completed yet */
+  char *auth_username;		 /* NULL unless verification is deferred */
+  bool auth_deferred_ok;	 /* false once any verifier has failed */
+#endif
+
+#ifdef ENABLE_ASYNC_SCRIPT
+  /* --auth-user-pass-verify script running under --script-async */
+  struct script_job auth_job;
+  const char *auth_file;
+#endif
+
+#ifdef ENABLE_PLUGIN_DEFERRED
+  /* auth-user-pass-verify plug-in calls which returned DEFERRED,
+     allocated separately since key_state objects are moved around */
+  struct plugin_request *auth_plugin;
+#endif
+
+#ifdef ENABLE_HANDOFF
+  /* data channel key material, kept so that --handoff can pass it on */
+  struct key2 *handoff_key;
+#endif
 };
 
 /*
@@ -415,6 +457,14 @@ struct tls_options
      passed over control channel */
   bool pass_config_info;
 
+  /* client: send peer info (IV_PROTO) to the server */
+  bool push_peer_info;
+
+#ifdef ENABLE_HANDOFF
+  /* server: keep data channel key material for --handoff */
+  bool handoff;
+#endif
+
   /* struct crypto_option flags */
   unsigned int crypto_flags_and;
   unsigned int crypto_flags_or;
@@ -442,6 +492,11 @@ struct tls_options
   struct env_set *es;
   const struct plugin_list *plugins;
 
+#ifdef ENABLE_PLUGIN_DEFERRED
+  /* passed to the plug-in notify callback, or NULL if plug-ins may not defer */
+  void *deferred_owner;
+#endif
+
   /* --gremlin bits */
   int gremlin;
 };
@@ -550,6 +605,16 @@ struct tls_multi
    */
   char *locked_cn;
 
+  /*
+   * Peer-id of this session.  The server assigns it in UDP mode,
+   * and the client sends it in P_DATA_V2 packets once it has
+   * been pushed (use_peer_id).  iv_proto is the IV_PROTO level
+   * announced by the client, or 0 if none.
+   */
+  uint32_t peer_id;
+  bool use_peer_id;
+  int iv_proto;
+
   /*
    * Our session objects.
    */
@@ -637,8 +702,26 @@ void tls_set_common_name (struct tls_multi *multi, const char *common_name);
 void tls_lock_common_name (struct tls_multi *multi);
 
 bool tls_authenticated (struct tls_multi *multi);
+#ifdef ENABLE_DEFERRED_AUTH
+bool tls_authentication_pending (const struct tls_multi *multi);
+#endif
+#ifdef ENABLE_ASYNC_SCRIPT
+bool tls_authentication_next_poll (const struct tls_multi *multi, struct timeval *tv);
+#endif
+#ifdef ENABLE_PLUGIN_DEFERRED
+void tls_set_deferred_owner (struct tls_multi *multi, void *owner);
+#endif
 void tls_deauthenticate (struct tls_multi *multi);
 
+void tls_set_peer_id (struct tls_multi *multi, const uint32_t peer_id, const bool use);
+void tls_set_crl_file (struct tls_multi *multi, const char *crl_file);
+void tls_update_remote_addr (struct tls_multi *multi, const struct sockaddr_in *addr);
+
+#ifdef ENABLE_HANDOFF
+bool tls_handoff_save (const struct tls_multi *multi, struct buffer *buf);
+bool tls_handoff_restore (struct tls_multi *multi, struct buffer *buf, const struct sockaddr_in *remote);
+#endif
+
 /*
  * inline functions
  */
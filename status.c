@@ -150,6 +150,21 @@ status_trigger (struct status_output *so)
     return false;
 }
 
+/*
+ * Change the refresh interval of an open status file.
+ */
+void
+status_set_refresh (struct status_output *so, const int refresh_freq)
+{
+  if (so && (so->flags & STATUS_OUTPUT_WRITE))
+    {
+      if (refresh_freq > 0)
+	event_timeout_init (&so->et, refresh_freq, now);
+      else
+	event_timeout_clear (&so->et);
+    }
+}
+
 bool
 status_trigger_tv (struct status_output *so, struct timeval *tv)
 {
@@ -166,6 +181,13 @@ status_reset (struct status_output *so)
     lseek (so->fd, (off_t)0, SEEK_SET);
 }
 
+void
+status_seek_end (struct status_output *so)
+{
+  if (so && so->fd >= 0)
+    lseek (so->fd, (off_t)0, SEEK_END);
+}
+
 void
 status_flush (struct status_output *so)
 {
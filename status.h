@@ -72,7 +72,9 @@ struct status_output *status_open (const char *filename,
 
 bool status_trigger_tv (struct status_output *so, struct timeval *tv);
 bool status_trigger (struct status_output *so);
+void status_set_refresh (struct status_output *so, const int refresh_freq);
 void status_reset (struct status_output *so);
+void status_seek_end (struct status_output *so);
 void status_flush (struct status_output *so);
 bool status_close (struct status_output *so);
 void status_printf (struct status_output *so, const char *format, ...)
@@ -33,6 +33,10 @@
 # include <sys/wait.h>
 #endif
 
+#ifdef HAVE_SPAWN_H
+# include <spawn.h>
+#endif
+
 #ifndef WIN32
 #ifndef WEXITSTATUS
 # define WEXITSTATUS(stat_val) ((unsigned)(stat_val) >> 8)
@@ -264,6 +268,10 @@
 #include <iphlpapi.h>
 #endif
 
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
 #ifdef HAVE_SYS_MMAN_H
 #ifdef TARGET_DARWIN
 #define _P1003_1B_VISIBLE
@@ -381,6 +389,20 @@ socket_defined (const socket_descriptor_t sd)
 #define P2MP_SERVER 0
 #endif
 
+/*
+ * Can we start scripts with posix_spawn rather than system()?
+ */
+#if defined(HAVE_POSIX_SPAWNP) && defined(HAVE_SPAWN_H) && defined(HAVE_WAITPID)
+#define ENABLE_SPAWN
+#endif
+
+/*
+ * Can we run server-side scripts without blocking?
+ */
+#if P2MP_SERVER && defined(ENABLE_SPAWN) && defined(HAVE_KILL)
+#define ENABLE_ASYNC_SCRIPT
+#endif
+
 /*
  * Do we have a plug-in capability?
  */
@@ -388,6 +410,22 @@ socket_defined (const socket_descriptor_t sd)
 #define ENABLE_PLUGIN
 #endif
 
+/*
+ * Can plug-ins return a deferred result for
+ * --auth-user-pass-verify and --client-connect?
+ */
+#if defined(ENABLE_PLUGIN) && P2MP_SERVER && !defined(WIN32)
+#define ENABLE_PLUGIN_DEFERRED
+#endif
+
+/*
+ * Can username/password verification and
+ * --client-connect complete asynchronously?
+ */
+#if defined(ENABLE_ASYNC_SCRIPT) || defined(ENABLE_PLUGIN_DEFERRED)
+#define ENABLE_DEFERRED_AUTH
+#endif
+
 /*
  * Do we have pthread capability?
  */
@@ -440,6 +478,39 @@ socket_defined (const socket_descriptor_t sd)
 #define EPOLL 0
 #endif
 
+/*
+ * Can server statistics be exported in a shared memory file?
+ */
+#if P2MP_SERVER && defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(HAVE_FTRUNCATE) && !defined(WIN32)
+#define ENABLE_MSTATS
+#endif
+
+/*
+ * Can a server re-read its options without restarting?
+ * The new options are checked by a forked child first,
+ * since option errors are fatal.
+ */
+#if P2MP_SERVER && defined(HAVE_FORK) && defined(HAVE_WAITPID) && !defined(WIN32)
+#define ENABLE_RELOAD
+#endif
+
+/*
+ * Can a UDP server hand its socket, TUN/TAP device and
+ * client sessions over to a newly exec'd copy of itself?
+ */
+#if P2MP_SERVER && defined(HAVE_FORK) && defined(HAVE_EXECVP) && defined(HAVE_SOCKETPAIR) && defined(HAVE_SENDMSG) && defined(HAVE_RECVMSG) && defined(HAVE_WAITPID) && defined(HAVE_KILL) && !defined(WIN32)
+#define ENABLE_HANDOFF
+#endif
+
+/*
+ * Is inotify available on this platform?
+ */
+#if defined(HAVE_INOTIFY_INIT) && defined(HAVE_SYS_INOTIFY_H)
+#define INOTIFY 1
+#else
+#define INOTIFY 0
+#endif
+
 /* Disable EPOLL */
 #if 0
 #undef EPOLL